@@ -0,0 +1,117 @@
+#include "Calc.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double nsPer(Clock::time_point begin, Clock::time_point end, size_t n) {
+    return std::chrono::duration<double, std::nano>(end - begin).count() / n;
+}
+
+void bench(const char* text, size_t numRows, unsigned flags = 0) {
+    auto label = std::string(text) + (flags & CALC_FAST_FP ? " [fast-fp]" : "");
+    calc_options options{nullptr, 0, flags};
+    calc_expr* e = nullptr;
+    auto begin = Clock::now();
+    if (calc_compile(text, &options, &e) != CALC_OK) {
+        std::printf("%-40s compile failed\n", label.c_str());
+        return;
+    }
+    auto compiled = Clock::now();
+
+    auto numVars = calc_num_vars(e);
+    std::vector<double> vars(numRows * numVars);
+    for (size_t i = 0; i < vars.size(); i++) {
+        vars[i] = 0.5 + (i % 97) * 0.25;
+    }
+    std::vector<double> results(numRows);
+    std::vector<unsigned char> statuses(numRows);
+
+    double sink = 0;
+    auto evalBegin = Clock::now();
+    for (size_t i = 0; i < numRows; i++) {
+        calc_eval(e, vars.data() + i * numVars, &results[i]);
+        sink += results[i];
+    }
+    auto evalEnd = Clock::now();
+
+    calc_eval_batch(e, vars.data(), numRows, results.data());
+    auto batchEnd = Clock::now();
+
+    calc_eval_batch_status(e, vars.data(), numRows, results.data(), statuses.data());
+    auto statusEnd = Clock::now();
+
+    std::printf("%-40s compile %8.0f ns  eval %7.1f ns/row  batch %7.1f ns/row  status %7.1f ns/row  (%g)\n",
+                label.c_str(), nsPer(begin, compiled, 1), nsPer(evalBegin, evalEnd, numRows),
+                nsPer(evalEnd, batchEnd, numRows), nsPer(batchEnd, statusEnd, numRows), sink);
+    calc_free(e);
+}
+
+/// The first variable dictionary-encoded with `numValues` distinct values, the others plain columns, against
+/// the same rows all decoded.
+void benchDictionary(const char* text, size_t numRows, size_t numValues) {
+    calc_expr* e = nullptr;
+    if (calc_compile(text, nullptr, &e) != CALC_OK) {
+        std::printf("%-40s compile failed\n", text);
+        return;
+    }
+    auto numVars = calc_num_vars(e);
+    std::vector<double> values(numValues);
+    for (size_t i = 0; i < numValues; i++) {
+        values[i] = 0.5 + i * 0.25;
+    }
+    std::vector<uint32_t> codes(numRows);
+    std::vector<std::vector<double>> plain(numVars, std::vector<double>(numRows));
+    for (size_t r = 0; r < numRows; r++) {
+        codes[r] = static_cast<uint32_t>((r * 7 + r / 5) % numValues);
+        plain[0][r] = values[codes[r]];
+        for (size_t v = 1; v < numVars; v++) {
+            plain[v][r] = 0.5 + ((r + v) % 97) * 0.25;
+        }
+    }
+    std::vector<const double*> columns;
+    for (auto& c : plain) {
+        columns.push_back(c.data());
+    }
+    std::vector<calc_dict_column> dicts(numVars, calc_dict_column{nullptr, 0, nullptr});
+    dicts[0] = {values.data(), numValues, codes.data()};
+    std::vector<double> results(numRows);
+
+    auto begin = Clock::now();
+    calc_eval_columns(e, columns.data(), nullptr, numRows, results.data(), nullptr);
+    auto plainEnd = Clock::now();
+    calc_eval_columns(e, columns.data(), dicts.data(), numRows, results.data(), nullptr);
+    auto dictEnd = Clock::now();
+
+    auto label = std::string(text) + " [" + std::to_string(numValues) + " values]";
+    std::printf("%-40s columns %7.1f ns/row  dictionary %7.1f ns/row\n", label.c_str(),
+                nsPer(begin, plainEnd, numRows), nsPer(plainEnd, dictEnd, numRows));
+    calc_free(e);
+}
+} // namespace
+
+int main() {
+    const size_t numRows = 1 << 20;
+    bench("1+2*3", numRows);
+    bench("x*x + 1", numRows);
+    bench("a*x^3 + b*x^2 + c*x + d", numRows);
+    bench("a*x^3 + b*x^2 + c*x + d", numRows, CALC_FAST_FP);
+    bench("x^6 - 3*x^4 + 2*x^3 - x + 7", numRows);
+    bench("x^6 - 3*x^4 + 2*x^3 - x + 7", numRows, CALC_FAST_FP);
+    bench("x^2*y + 2*x*y^2 + 3*x + y^3", numRows);
+    bench("x^2*y + 2*x*y^2 + 3*x + y^3", numRows, CALC_FAST_FP);
+    bench("sin(x)^2 + cos(x)^2", numRows);
+    // three rows in four are not ints and fail
+    bench("x % 7 + x", numRows);
+    bench("x ^ 2 % 7 + x", numRows);
+    bench("sqrt(x*x + y*y) / (1 + exp(-z))", numRows);
+    benchDictionary("exp(c) * x + sin(c)", numRows, 16);
+    benchDictionary("exp(c) * x + sin(c)", numRows, 4096);
+    benchDictionary("lg(c) ^ 2 / (1 + arctan(c))", numRows, 16);
+    benchDictionary("c * x + y", numRows, 16);
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "format.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <sstream>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double nsPer(Clock::time_point begin, Clock::time_point end, size_t n) {
+    return std::chrono::duration<double, std::nano>(end - begin).count() / n;
+}
+
+void report(const char* name, Clock::time_point begin, Clock::time_point end, size_t n, size_t bytes) {
+    double seconds = std::chrono::duration<double>(end - begin).count();
+    std::printf("%-36s %7.1f ns/value  %7.1f MB/s\n", name, nsPer(begin, end, n), bytes / seconds / 1e6);
+}
+
+/// Formats every value into a scratch buffer with `format`, returning the number of bytes produced.
+template <typename T, typename Format>
+void benchFormat(const char* name, const std::vector<T>& values, Format format) {
+    char buf[64];
+    size_t bytes = 0;
+    auto begin = Clock::now();
+    for (auto v : values) {
+        bytes += format(buf, v);
+    }
+    report(name, begin, Clock::now(), values.size(), bytes);
+}
+
+/// Writes every value to /dev/null through `write`, the way a tool prints results.
+template <typename T, typename Write>
+void benchWrite(const char* name, const std::vector<T>& values, Write write) {
+    auto begin = Clock::now();
+    size_t bytes = write(values);
+    report(name, begin, Clock::now(), values.size(), bytes);
+}
+} // namespace
+
+int main() {
+    const size_t n = 1 << 22;
+    std::mt19937_64 rng(42);
+    std::vector<double> uniform(n);
+    std::vector<double> anyBits(n);
+    std::vector<double> rounded(n);
+    std::vector<int64_t> ints(n);
+    std::uniform_real_distribution<double> dist(-1000, 1000);
+    for (size_t i = 0; i < n; i++) {
+        uniform[i] = dist(rng);
+        do {
+            uint64_t bits = rng();
+            std::memcpy(&anyBits[i], &bits, sizeof(bits));
+        } while (!(anyBits[i] - anyBits[i] == 0));
+        rounded[i] = static_cast<int64_t>(uniform[i] * 100) / 100.0;
+        ints[i] = static_cast<int64_t>(rng() >> (rng() % 64));
+    }
+
+    auto snprintf17 = [](char* buf, double v) { return static_cast<size_t>(std::snprintf(buf, 64, "%.17g", v)); };
+    auto shortest = [](char* buf, double v) { return calc_format_f(buf, v); };
+    const struct {
+        const char* name;
+        const std::vector<double>& values;
+    } sets[] = {{"uniform", uniform}, {"any bits", anyBits}, {"two decimals", rounded}};
+    for (auto& set : sets) {
+        std::printf("doubles, %s:\n", set.name);
+        benchFormat("  snprintf %.17g", set.values, snprintf17);
+        benchFormat("  calc_format_f", set.values, shortest);
+    }
+
+    std::printf("int64:\n");
+    benchFormat("  snprintf %lld", ints, [](char* buf, int64_t v) {
+        return static_cast<size_t>(std::snprintf(buf, 64, "%lld", static_cast<long long>(v)));
+    });
+    benchFormat("  calc_format_i", ints, [](char* buf, int64_t v) { return calc_format_i(buf, v); });
+
+    std::printf("printing doubles to /dev/null:\n");
+    FILE* null = std::fopen("/dev/null", "w");
+    benchWrite("  printf(\"%lf\\n\") per value", uniform, [&](const std::vector<double>& values) {
+        size_t bytes = 0;
+        for (auto v : values) {
+            bytes += std::fprintf(null, "%lf\n", v);
+        }
+        std::fflush(null);
+        return bytes;
+    });
+    benchWrite("  ostream << v << endl", uniform, [](const std::vector<double>& values) {
+        std::ostringstream os;
+        for (auto v : values) {
+            os << v << std::endl;
+        }
+        return os.str().size();
+    });
+    int fd = ::open("/dev/null", O_WRONLY);
+    static calc_output out;
+    size_t textBytes = 0;
+    char buf[CALC_FORMAT_MAX];
+    for (auto v : uniform) {
+        textBytes += calc_format_f(buf, v) + 1;
+    }
+    benchWrite("  calc_output text", uniform, [&](const std::vector<double>& values) {
+        calc_output_init(&out, fd, 0);
+        for (auto v : values) {
+            calc_output_f(&out, v);
+        }
+        calc_output_flush(&out);
+        return textBytes;
+    });
+    benchWrite("  calc_output binary", uniform, [&](const std::vector<double>& values) {
+        calc_output_init(&out, fd, 1);
+        for (auto v : values) {
+            calc_output_f(&out, v);
+        }
+        calc_output_flush(&out);
+        return values.size() * sizeof(double);
+    });
+    ::close(fd);
+    std::fclose(null);
+    return 0;
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
 #include <stdexcept>
 
 /**
@@ -12,7 +14,7 @@
  *
  * Grammar:
  *
- *  expr := term(0)
+ *  expr := term(0) [ '?' expr ':' expr ]
  *
  *  term(p) := factpr { binary_op term(q) }
  *
@@ -25,6 +27,19 @@
  *  func_call := ident '(' expr ')'
  *
  *  number := fp_literal | int_literal
+ *
+ * Binary operators from the loosest to the tightest: `||`, `&&`, `==` `!=`,
+ * `<` `<=` `>` `>=`, `+` `-`, `*` `/`, `%`, then `^`.
+ *
+ * Comparisons, `&&` and `||` give the int 1 or 0. They compare like the
+ * arithmetic operators compute: as ints if both operands are, as floats
+ * otherwise, where NaN compares unequal to everything. Anything but 0 is true.
+ * `c ? a : b` is a or b, promoted to a float if the other one is a float, so
+ * that its type does not depend on c.
+ *
+ * Nothing short-circuits: both operands of `&&` and `||` and both arms of `?:`
+ * are evaluated, as the `select` they compile to does, and an error in any of
+ * them is an error of the whole expression.
  */
 
 class AST;
@@ -34,6 +49,7 @@ class Factor;
 class UnaryOp;
 class BinaryOp;
 class FuncCall;
+class Conditional;
 class Ident;
 class Number;
 
@@ -47,6 +63,7 @@ struct ASTVisitor {
     virtual void visit(UnaryOp&) = 0;
     virtual void visit(BinaryOp&) = 0;
     virtual void visit(FuncCall&) = 0;
+    virtual void visit(Conditional&) = 0;
     virtual void visit(Ident&) = 0;
     virtual void visit(Number&) = 0;
 };
@@ -61,12 +78,15 @@ public:
         UnaryOp,
         BinaryOp,
         FuncCall,
+        Conditional,
         Number,
         Ident,
     } class_kind;
 
 private:
     const Kind kind;
+    uint32_t begin = 0; // source offsets [begin, end), both 0 for nodes that are not from the source
+    uint32_t end = 0;
 
 public:
     AST(Kind kind)
@@ -74,6 +94,19 @@ public:
 
     virtual ~AST() {}
 
+    void setSourceRange(uint32_t b, uint32_t e) {
+        begin = b;
+        end = e;
+    }
+
+    uint32_t getBegin() const {
+        return begin;
+    }
+
+    uint32_t getEnd() const {
+        return end;
+    }
+
     static bool classof(const AST* node) {
         return node->getKind() == Kind::AST;
     }
@@ -125,6 +158,10 @@ public:
         , op(op)
         , e(e) {}
 
+    ~UnaryOp() override {
+        delete e;
+    }
+
     static bool classof(const AST* node) {
         return node->getKind() == Kind::UnaryOp;
     }
@@ -151,6 +188,14 @@ public:
         DIV,
         POW,
         MOD,
+        LT,
+        LE,
+        GT,
+        GE,
+        EQ,
+        NE,
+        AND,
+        OR,
     };
 
 private:
@@ -165,6 +210,11 @@ public:
         , lhs(lhs)
         , rhs(rhs) {}
 
+    ~BinaryOp() override {
+        delete lhs;
+        delete rhs;
+    }
+
     static bool classof(const AST* node) {
         return node->getKind() == Kind::BinaryOp;
     }
@@ -196,6 +246,10 @@ public:
         , name(ident)
         , param(e) {}
 
+    ~FuncCall() override {
+        delete param;
+    }
+
     static bool classof(const AST* node) {
         return node->getKind() == Kind::FuncCall;
     }
@@ -213,6 +267,46 @@ public:
     };
 };
 
+/// `cond ? lhs : rhs`
+class Conditional : public Expr {
+    Expr* cond;
+    Expr* lhs;
+    Expr* rhs;
+
+public:
+    Conditional(Expr* cond, Expr* lhs, Expr* rhs)
+        : Expr(Kind::Conditional)
+        , cond(cond)
+        , lhs(lhs)
+        , rhs(rhs) {}
+
+    ~Conditional() override {
+        delete cond;
+        delete lhs;
+        delete rhs;
+    }
+
+    static bool classof(const AST* node) {
+        return node->getKind() == Kind::Conditional;
+    }
+
+    Expr* getCond() {
+        return cond;
+    }
+
+    Expr* getLeft() {
+        return lhs;
+    }
+
+    Expr* getRight() {
+        return rhs;
+    }
+
+    void accept(ASTVisitor& v) override {
+        v.visit(*this);
+    };
+};
+
 class Number : public Factor {
 public:
     enum Type {
@@ -222,24 +316,46 @@ public:
 
 private:
     Type t;
-    llvm::StringRef value;
+    union {
+        int64_t i;
+        double f;
+    } value;
+    llvm::StringRef text;
 
 public:
-    Number(Type t, llvm::StringRef v)
+    // the value is converted once, by the parser, the text is only kept for printing and diagnostics
+    Number(int64_t v, llvm::StringRef text)
+        : Factor(Kind::Number)
+        , t(INT)
+        , text(text) {
+        value.i = v;
+    }
+
+    Number(double v, llvm::StringRef text)
         : Factor(Kind::Number)
-        , t(t)
-        , value(v) {}
+        , t(FLOAT)
+        , text(text) {
+        value.f = v;
+    }
 
     static bool classof(const AST* node) {
         return node->getKind() == Kind::Number;
     }
 
-    Type getType() {
+    Type getType() const {
         return t;
     }
 
-    llvm::StringRef getValue() {
-        return value;
+    int64_t getInt() const {
+        return value.i;
+    }
+
+    double getFloat() const {
+        return value.f;
+    }
+
+    llvm::StringRef getText() const {
+        return text;
     }
 
     void accept(ASTVisitor& v) override {
@@ -0,0 +1,405 @@
+#include "ASTFile.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/EndianStream.h>
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+using llvm::support::endian::read32le;
+using llvm::support::endian::read64le;
+
+const char kMagic[8] = {'c', 'a', 'l', 'c', 'a', 's', 't', '\0'};
+
+// u32 fields of the header, after the magic
+enum HeaderField {
+    VERSION,
+    NUM_EXPRS,
+    EXPRS_OFFSET,
+    NUM_STRINGS,
+    STRINGS_OFFSET,
+    BLOB_OFFSET,
+    BLOB_SIZE,
+    NUM_LITERALS,
+    LITERALS_OFFSET,
+    NUM_NODES,
+    NODES_OFFSET,
+    NUM_HEADER_FIELDS,
+};
+
+constexpr size_t kHeaderSize = sizeof(kMagic) + NUM_HEADER_FIELDS * 4;
+constexpr size_t kExprSize = 12;
+constexpr size_t kStringSize = 8;
+constexpr size_t kLiteralSize = 16;
+constexpr size_t kNodeSize = 16;
+
+// node kinds, numbered independently of AST::Kind so that the format does not move with it
+enum NodeKind : uint8_t {
+    INT_NUMBER = 1,
+    FLOAT_NUMBER,
+    IDENT,
+    UNARY_OP,
+    BINARY_OP,
+    FUNC_CALL,
+    CONDITIONAL,
+};
+
+[[noreturn]] void corrupt(const char* what) {
+    throw std::runtime_error(std::string("ast file: ") + what);
+}
+} // namespace
+
+std::unique_ptr<ASTFile> ASTFile::open(llvm::StringRef path) {
+    // no null terminator, so large files are mapped rather than read
+    auto buffer = llvm::MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!buffer) {
+        throw std::runtime_error("cannot read " + path.str() + ": " + buffer.getError().message());
+    }
+    return fromBuffer(std::move(*buffer));
+}
+
+std::unique_ptr<ASTFile> ASTFile::fromBuffer(std::unique_ptr<llvm::MemoryBuffer> buffer) {
+    return std::unique_ptr<ASTFile>(new ASTFile(std::move(buffer)));
+}
+
+bool ASTFile::isASTFile(llvm::StringRef data) {
+    return data.startswith(llvm::StringRef(kMagic, sizeof(kMagic)));
+}
+
+ASTFile::ASTFile(std::unique_ptr<llvm::MemoryBuffer> buf)
+    : buffer(std::move(buf))
+    , base(buffer->getBufferStart()) {
+    uint64_t size = buffer->getBufferSize();
+    if (size < kHeaderSize || !isASTFile(buffer->getBuffer())) {
+        corrupt("not a catalog");
+    }
+    auto field = [&](HeaderField f) { return read32le(base + sizeof(kMagic) + f * 4); };
+    if (field(VERSION) != kVersion) {
+        corrupt("unsupported version");
+    }
+
+    // every table must lie within the file, sizes are checked in 64 bits so that they cannot wrap
+    auto table = [&](HeaderField offset, uint64_t count, size_t entrySize) {
+        uint64_t begin = field(offset);
+        if (begin > size || count * entrySize > size - begin) {
+            corrupt("table out of bounds");
+        }
+        return base + begin;
+    };
+    numExprs = field(NUM_EXPRS);
+    exprs = table(EXPRS_OFFSET, numExprs, kExprSize);
+    numStrings = field(NUM_STRINGS);
+    strings = table(STRINGS_OFFSET, numStrings, kStringSize);
+    uint32_t blobSize = field(BLOB_SIZE);
+    blob = table(BLOB_OFFSET, blobSize, 1);
+    numLiterals = field(NUM_LITERALS);
+    literals = table(LITERALS_OFFSET, numLiterals, kLiteralSize);
+    numNodes = field(NUM_NODES);
+    nodes = table(NODES_OFFSET, numNodes, kNodeSize);
+
+    for (uint32_t i = 0; i < numStrings; i++) {
+        uint64_t offset = read32le(strings + i * kStringSize);
+        uint64_t length = read32le(strings + i * kStringSize + 4);
+        if (offset + length > blobSize) {
+            corrupt("string out of bounds");
+        }
+    }
+    for (uint32_t i = 0; i < numLiterals; i++) {
+        if (read32le(literals + i * kLiteralSize) >= numStrings) {
+            corrupt("literal out of bounds");
+        }
+    }
+    for (uint32_t i = 0; i < numExprs; i++) {
+        auto e = exprs + i * kExprSize;
+        uint64_t first = read32le(e + 4);
+        uint64_t count = read32le(e + 8);
+        if (read32le(e) >= numStrings || first + count > numNodes) {
+            corrupt("expression out of bounds");
+        }
+    }
+}
+
+llvm::StringRef ASTFile::getString(uint32_t index) const {
+    if (index >= numStrings) {
+        corrupt("string index out of bounds");
+    }
+    auto s = strings + index * kStringSize;
+    return llvm::StringRef(blob + read32le(s), read32le(s + 4));
+}
+
+llvm::StringRef ASTFile::getName(size_t i) const {
+    return getString(read32le(exprs + i * kExprSize));
+}
+
+std::unique_ptr<AST> ASTFile::load(size_t i) const {
+    auto e = exprs + i * kExprSize;
+    auto node = nodes + read32le(e + 4) * kNodeSize;
+    auto end = node + read32le(e + 8) * kNodeSize;
+
+    // nodes without a parent yet, owned here
+    llvm::SmallVector<Expr*, 32> stack;
+    struct Cleanup {
+        llvm::SmallVector<Expr*, 32>& stack;
+        ~Cleanup() {
+            for (auto n : stack) {
+                delete n;
+            }
+        }
+    } cleanup{stack};
+    // the operands stay on the stack until their parent exists, so that nothing leaks if allocating it throws
+    auto operand = [&](size_t fromTop) {
+        if (stack.size() <= fromTop) {
+            corrupt("missing operand");
+        }
+        return stack[stack.size() - 1 - fromTop];
+    };
+
+    for (; node < end; node += kNodeSize) {
+        uint8_t op = static_cast<uint8_t>(node[1]);
+        uint32_t ref = read32le(node + 12);
+        Expr* n;
+        switch (static_cast<uint8_t>(node[0])) {
+        case INT_NUMBER:
+        case FLOAT_NUMBER: {
+            if (ref >= numLiterals) {
+                corrupt("literal index out of bounds");
+            }
+            auto literal = literals + ref * kLiteralSize;
+            auto text = getString(read32le(literal));
+            uint64_t bits = read64le(literal + 8);
+            if (node[0] == INT_NUMBER) {
+                n = new Number(static_cast<int64_t>(bits), text);
+            } else {
+                double f;
+                std::memcpy(&f, &bits, sizeof(f));
+                n = new Number(f, text);
+            }
+            break;
+        }
+        case IDENT:
+            n = new Ident(getString(ref));
+            break;
+        case UNARY_OP: {
+            if (op > UnaryOp::FACT) {
+                corrupt("unknown unary op");
+            }
+            n = new UnaryOp(static_cast<UnaryOp::Op>(op), operand(0));
+            stack.pop_back();
+            break;
+        }
+        case BINARY_OP: {
+            if (op > BinaryOp::OR) {
+                corrupt("unknown binary op");
+            }
+            n = new BinaryOp(static_cast<BinaryOp::Op>(op), operand(1), operand(0));
+            stack.pop_back();
+            stack.pop_back();
+            break;
+        }
+        case FUNC_CALL: {
+            n = new FuncCall(getString(ref), operand(0));
+            stack.pop_back();
+            break;
+        }
+        case CONDITIONAL: {
+            n = new Conditional(operand(2), operand(1), operand(0));
+            stack.resize(stack.size() - 3);
+            break;
+        }
+        default:
+            corrupt("unknown node kind");
+        }
+        n->setSourceRange(read32le(node + 4), read32le(node + 8));
+        stack.push_back(n);
+    }
+
+    if (stack.size() != 1) {
+        corrupt("expression is not a tree");
+    }
+    std::unique_ptr<AST> root(stack.back());
+    stack.clear();
+    return root;
+}
+
+void ASTFileWriter::add(llvm::StringRef name, AST* ast) {
+    Entry e;
+    e.name = intern(name);
+    e.firstNode = static_cast<uint32_t>(nodes.size());
+    addNode(ast);
+    e.numNodes = static_cast<uint32_t>(nodes.size()) - e.firstNode;
+    exprs.push_back(e);
+}
+
+void ASTFileWriter::addNode(AST* node) {
+    Node n{};
+    n.begin = node->getBegin();
+    n.end = node->getEnd();
+    switch (node->getKind()) {
+    case AST::Kind::Number: {
+        auto num = llvm::cast<Number>(node);
+        n.kind = num->getType() == Number::INT ? INT_NUMBER : FLOAT_NUMBER;
+        n.ref = internLiteral(num);
+        break;
+    }
+    case AST::Kind::Ident:
+        n.kind = IDENT;
+        n.ref = intern(llvm::cast<Ident>(node)->getName());
+        break;
+    case AST::Kind::UnaryOp: {
+        auto u = llvm::cast<UnaryOp>(node);
+        addNode(u->getExpr());
+        n.kind = UNARY_OP;
+        n.op = static_cast<uint8_t>(u->getOp());
+        break;
+    }
+    case AST::Kind::BinaryOp: {
+        auto b = llvm::cast<BinaryOp>(node);
+        addNode(b->getLeft());
+        addNode(b->getRight());
+        n.kind = BINARY_OP;
+        n.op = static_cast<uint8_t>(b->getOp());
+        break;
+    }
+    case AST::Kind::FuncCall: {
+        auto f = llvm::cast<FuncCall>(node);
+        addNode(f->getParam());
+        n.kind = FUNC_CALL;
+        n.ref = intern(f->getName());
+        break;
+    }
+    case AST::Kind::Conditional: {
+        auto c = llvm::cast<Conditional>(node);
+        addNode(c->getCond());
+        addNode(c->getLeft());
+        addNode(c->getRight());
+        n.kind = CONDITIONAL;
+        break;
+    }
+    default:
+        throw std::runtime_error("ast file: cannot write node");
+    }
+    nodes.push_back(n);
+}
+
+void ASTFileWriter::append(const ASTFileWriter& other) {
+    llvm::SmallVector<uint32_t, 0> stringMap;
+    stringMap.reserve(other.strings.size());
+    for (auto s : other.strings) {
+        stringMap.push_back(intern(s));
+    }
+    llvm::SmallVector<uint32_t, 0> literalMap;
+    literalMap.reserve(other.literals.size());
+    for (auto& l : other.literals) {
+        auto text = stringMap[l.text];
+        auto it = literalIndex.try_emplace(text, static_cast<uint32_t>(literals.size()));
+        if (it.second) {
+            literals.push_back({text, l.bits});
+        }
+        literalMap.push_back(it.first->second);
+    }
+
+    auto firstNode = static_cast<uint32_t>(nodes.size());
+    nodes.reserve(nodes.size() + other.nodes.size());
+    for (auto n : other.nodes) {
+        if (n.kind == INT_NUMBER || n.kind == FLOAT_NUMBER) {
+            n.ref = literalMap[n.ref];
+        } else if (n.kind == IDENT || n.kind == FUNC_CALL) {
+            n.ref = stringMap[n.ref];
+        }
+        nodes.push_back(n);
+    }
+    for (auto e : other.exprs) {
+        e.name = stringMap[e.name];
+        e.firstNode += firstNode;
+        exprs.push_back(e);
+    }
+}
+
+uint32_t ASTFileWriter::intern(llvm::StringRef s) {
+    auto it = stringIndex.try_emplace(s, static_cast<uint32_t>(strings.size()));
+    if (it.second) {
+        strings.push_back(it.first->getKey());
+    }
+    return it.first->getValue();
+}
+
+uint32_t ASTFileWriter::internLiteral(Number* num) {
+    // the same text always converts to the same value
+    auto text = intern(num->getText());
+    auto it = literalIndex.try_emplace(text, static_cast<uint32_t>(literals.size()));
+    if (it.second) {
+        Literal l{text, 0};
+        if (num->getType() == Number::INT) {
+            l.bits = static_cast<uint64_t>(num->getInt());
+        } else {
+            double f = num->getFloat();
+            std::memcpy(&l.bits, &f, sizeof(f));
+        }
+        literals.push_back(l);
+    }
+    return it.first->second;
+}
+
+void ASTFileWriter::write(llvm::raw_ostream& os) const {
+    uint64_t blobSize = 0;
+    for (auto s : strings) {
+        blobSize += s.size();
+    }
+    uint64_t exprsOffset = kHeaderSize;
+    uint64_t stringsOffset = exprsOffset + exprs.size() * kExprSize;
+    uint64_t blobOffset = stringsOffset + strings.size() * kStringSize;
+    uint64_t literalsOffset = blobOffset + blobSize;
+    uint64_t nodesOffset = literalsOffset + literals.size() * kLiteralSize;
+    if (nodesOffset + nodes.size() * kNodeSize > UINT32_MAX) {
+        throw std::runtime_error("ast file: catalog too large");
+    }
+
+    llvm::support::endian::Writer w(os, llvm::support::little);
+    os.write(kMagic, sizeof(kMagic));
+    uint32_t header[NUM_HEADER_FIELDS];
+    header[VERSION] = ASTFile::kVersion;
+    header[NUM_EXPRS] = static_cast<uint32_t>(exprs.size());
+    header[EXPRS_OFFSET] = static_cast<uint32_t>(exprsOffset);
+    header[NUM_STRINGS] = static_cast<uint32_t>(strings.size());
+    header[STRINGS_OFFSET] = static_cast<uint32_t>(stringsOffset);
+    header[BLOB_OFFSET] = static_cast<uint32_t>(blobOffset);
+    header[BLOB_SIZE] = static_cast<uint32_t>(blobSize);
+    header[NUM_LITERALS] = static_cast<uint32_t>(literals.size());
+    header[LITERALS_OFFSET] = static_cast<uint32_t>(literalsOffset);
+    header[NUM_NODES] = static_cast<uint32_t>(nodes.size());
+    header[NODES_OFFSET] = static_cast<uint32_t>(nodesOffset);
+    for (auto f : header) {
+        w.write<uint32_t>(f);
+    }
+
+    for (auto& e : exprs) {
+        w.write<uint32_t>(e.name);
+        w.write<uint32_t>(e.firstNode);
+        w.write<uint32_t>(e.numNodes);
+    }
+    uint32_t offset = 0;
+    for (auto s : strings) {
+        w.write<uint32_t>(offset);
+        w.write<uint32_t>(static_cast<uint32_t>(s.size()));
+        offset += static_cast<uint32_t>(s.size());
+    }
+    for (auto s : strings) {
+        os << s;
+    }
+    for (auto& l : literals) {
+        w.write<uint32_t>(l.text);
+        w.write<uint32_t>(0);
+        w.write<uint64_t>(l.bits);
+    }
+    for (auto& n : nodes) {
+        w.write<uint8_t>(n.kind);
+        w.write<uint8_t>(n.op);
+        w.write<uint16_t>(0);
+        w.write<uint32_t>(n.begin);
+        w.write<uint32_t>(n.end);
+        w.write<uint32_t>(n.ref);
+    }
+}
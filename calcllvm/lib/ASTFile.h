@@ -0,0 +1,122 @@
+#pragma once
+
+#include "AST.h"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * A binary catalog of parsed expressions, so that a process loading thousands
+ * of formulas does not lex and parse them again.
+ *
+ * All integers are little-endian and all references are offsets from the start
+ * of the file, so a file can be mapped anywhere:
+ *
+ *  header:   "calcast\0", u32 version, then the count and offset of every table
+ *  exprs:    u32 name, u32 first node, u32 node count
+ *  strings:  u32 offset into the blob, u32 size; every name and literal text once
+ *  blob:     the characters of the strings
+ *  literals: u32 text, u32 0, u64 int or double bits; every literal once
+ *  nodes:    16 bytes each, in postfix order: u8 kind, u8 op, u16 0, u32 begin,
+ *            u32 end, u32 string or literal
+ *
+ * Node kinds and ops are only ever appended (the conditional came after version
+ * 1 was written), so older catalogs stay readable without a version change.
+ *
+ * Literals are stored converted, so loading does no number parsing. load()
+ * rebuilds the nodes of one expression in a single pass, and their names and
+ * literal text point into the mapped blob, so the ASTFile must outlive them.
+ */
+class ASTFile {
+public:
+    static constexpr uint32_t kVersion = 1;
+
+    /// Maps `path`. Throws std::runtime_error if it cannot be read or is not a catalog of this version.
+    static std::unique_ptr<ASTFile> open(llvm::StringRef path);
+
+    /// Throws std::runtime_error like open().
+    static std::unique_ptr<ASTFile> fromBuffer(std::unique_ptr<llvm::MemoryBuffer> buffer);
+
+    /// Whether `data` starts like a catalog, whatever its version.
+    static bool isASTFile(llvm::StringRef data);
+
+    size_t size() const {
+        return numExprs;
+    }
+
+    llvm::StringRef getName(size_t i) const;
+
+    /// The i-th expression. Throws std::runtime_error if its nodes do not form a tree.
+    std::unique_ptr<AST> load(size_t i) const;
+
+private:
+    explicit ASTFile(std::unique_ptr<llvm::MemoryBuffer> buffer);
+
+    llvm::StringRef getString(uint32_t index) const;
+
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    const char* base;
+    uint32_t numExprs = 0;
+    const char* exprs = nullptr;
+    uint32_t numStrings = 0;
+    const char* strings = nullptr;
+    const char* blob = nullptr;
+    uint32_t numLiterals = 0;
+    const char* literals = nullptr;
+    uint32_t numNodes = 0;
+    const char* nodes = nullptr;
+};
+
+/// Collects expressions and writes them as an ASTFile.
+class ASTFileWriter {
+public:
+    /// `ast` is only read during the call.
+    void add(llvm::StringRef name, AST* ast);
+
+    /// Adds the expressions of `other` after the ones added so far, without rebuilding their trees.
+    void append(const ASTFileWriter& other);
+
+    size_t size() const {
+        return exprs.size();
+    }
+
+    void write(llvm::raw_ostream& os) const;
+
+private:
+    struct Node {
+        uint8_t kind;
+        uint8_t op;
+        uint32_t begin;
+        uint32_t end;
+        uint32_t ref;
+    };
+
+    struct Literal {
+        uint32_t text;
+        uint64_t bits;
+    };
+
+    struct Entry {
+        uint32_t name;
+        uint32_t firstNode;
+        uint32_t numNodes;
+    };
+
+    void addNode(AST* node);
+    uint32_t intern(llvm::StringRef s);
+    uint32_t internLiteral(Number* num);
+
+    llvm::StringMap<uint32_t> stringIndex;
+    std::vector<llvm::StringRef> strings; // keys of stringIndex, in index order
+    llvm::DenseMap<uint32_t, uint32_t> literalIndex; // text to literal
+    std::vector<Literal> literals;
+    std::vector<Node> nodes;
+    std::vector<Entry> exprs;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+
+#include <cmath>
+
+/**
+ * The builtin functions listed in AST.h, resolved to an enum so that evaluators
+ * do not have to compare names on every call.
+ */
+enum class Builtin : uint8_t {
+    ABS,
+    EXP,
+    LOG2,
+    LG,
+    LN,
+    SIN,
+    COS,
+    TAN,
+    COT,
+    ARCSIN,
+    ARCCOS,
+    ARCTAN,
+    ARCCOT,
+    SQRT,
+    UNKNOWN,
+};
+
+inline Builtin lookupBuiltin(llvm::StringRef name) {
+#define IF_NAME_THEN_RETURN(func_name, builtin)                                                                        \
+    if (name.equals(func_name)) {                                                                                      \
+        return (builtin);                                                                                              \
+    }
+
+    IF_NAME_THEN_RETURN("abs", Builtin::ABS);
+    IF_NAME_THEN_RETURN("exp", Builtin::EXP);
+    IF_NAME_THEN_RETURN("log2", Builtin::LOG2);
+    IF_NAME_THEN_RETURN("lg", Builtin::LG);
+    IF_NAME_THEN_RETURN("ln", Builtin::LN);
+    IF_NAME_THEN_RETURN("sin", Builtin::SIN);
+    IF_NAME_THEN_RETURN("cos", Builtin::COS);
+    IF_NAME_THEN_RETURN("tan", Builtin::TAN);
+    IF_NAME_THEN_RETURN("cot", Builtin::COT);
+    IF_NAME_THEN_RETURN("arcsin", Builtin::ARCSIN);
+    IF_NAME_THEN_RETURN("arccos", Builtin::ARCCOS);
+    IF_NAME_THEN_RETURN("arctan", Builtin::ARCTAN);
+    IF_NAME_THEN_RETURN("arccot", Builtin::ARCCOT);
+    IF_NAME_THEN_RETURN("sqrt", Builtin::SQRT);
+
+#undef IF_NAME_THEN_RETURN
+    return Builtin::UNKNOWN;
+}
+
+/// Same semantics as InterpretVisitor::visit(FuncCall&): every builtin works on
+/// and returns a float.
+inline double applyBuiltin(Builtin f, double v) {
+    switch (f) {
+    case Builtin::ABS:
+        return std::abs(v);
+    case Builtin::EXP:
+        return std::exp(v);
+    case Builtin::LOG2:
+        return std::log2(v);
+    case Builtin::LG:
+        return std::log10(v);
+    case Builtin::LN:
+        return std::log(v);
+    case Builtin::SIN:
+        return std::sin(v);
+    case Builtin::COS:
+        return std::cos(v);
+    case Builtin::TAN:
+        return std::tan(v);
+    case Builtin::COT:
+        return 1.0 / std::tan(v);
+    case Builtin::ARCSIN:
+        return std::asin(v);
+    case Builtin::ARCCOS:
+        return std::acos(v);
+    case Builtin::ARCTAN:
+        return std::atan(v);
+    case Builtin::ARCCOT:
+        return std::atan(1.0 / v);
+    case Builtin::SQRT:
+        return std::sqrt(v);
+    case Builtin::UNKNOWN:
+        break;
+    }
+    return std::nan("");
+}
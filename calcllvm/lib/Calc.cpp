@@ -0,0 +1,276 @@
+#include "Calc.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Polynomial.h"
+#include "Program.h"
+#include "VectorEvaluator.h"
+
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <new>
+#include <vector>
+
+struct calc_expr {
+    Program program;
+    /// With CALC_FAST_FP, the expression as written, which evaluates the rows that have an input bound as an int:
+    /// collecting their terms could move or cancel an int overflow.
+    Program asWritten;
+    bool rewritten = false;
+};
+
+namespace {
+/// Scratch columns of the vectorized evaluator, allocated by the first calls on each thread and reused after.
+ColumnPool& threadPool() {
+    thread_local ColumnPool pool;
+    return pool;
+}
+
+calc_status toCalcStatus(Status s) {
+    return static_cast<calc_status>(static_cast<int>(s));
+}
+
+bool anyBoundAsInt(const double* row, size_t numVars) {
+    for (size_t v = 0; v < numVars; v++) {
+        if (Program::isBoundAsInt(row[v])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Rows of a batch gathered to be evaluated by one program, see evaluateFastFp.
+struct RowGroup {
+    std::vector<size_t> rows;
+    std::vector<double> vars; // row-major
+    std::vector<double> results;
+    std::vector<uint8_t> statuses;
+
+    /// Evaluates the rows with `program` and scatters them into `results` and `statuses`, which may be null.
+    /// Returns the index of the first failing row, with its status in `first`, or the largest size_t.
+    size_t evaluate(const Program& program, double* out, uint8_t* outStatuses, Status& first) {
+        auto n = rows.size();
+        results.resize(n);
+        statuses.resize(n);
+        VectorEvaluator eval(program, threadPool());
+        eval.evaluate(vars.data(), 1, program.getNumVars(), n, results.data(), statuses.data());
+        auto firstRow = std::numeric_limits<size_t>::max();
+        for (size_t i = 0; i < n; i++) {
+            out[rows[i]] = results[i];
+            if (outStatuses != nullptr) {
+                outStatuses[rows[i]] = statuses[i];
+            }
+            if (firstRow == std::numeric_limits<size_t>::max() && statuses[i] != static_cast<uint8_t>(Status::OK)) {
+                firstRow = rows[i];
+                first = static_cast<Status>(statuses[i]);
+            }
+        }
+        return firstRow;
+    }
+};
+
+/// A batch under CALC_FAST_FP: the rows with an input bound as an int are evaluated as written, the others
+/// rewritten. `load(r, v)` is input v of row r. Where all rows go to the same program, `evaluateAll(program)`
+/// evaluates them in place; otherwise both groups are gathered and evaluated as batches of their own.
+template <typename Load, typename EvaluateAll>
+Status evaluateFastFp(const calc_expr* e, size_t numRows, Load load, EvaluateAll evaluateAll, double* results,
+                      uint8_t* statuses) {
+    thread_local RowGroup rewritten;
+    thread_local RowGroup asWritten;
+    auto numVars = e->program.getNumVars();
+    rewritten.rows.clear();
+    rewritten.vars.clear();
+    asWritten.rows.clear();
+    asWritten.vars.clear();
+    for (size_t r = 0; r < numRows; r++) {
+        auto& vars = asWritten.vars;
+        auto begin = vars.size();
+        for (size_t v = 0; v < numVars; v++) {
+            vars.push_back(load(r, v));
+        }
+        if (anyBoundAsInt(vars.data() + begin, numVars)) {
+            asWritten.rows.push_back(r);
+        } else {
+            rewritten.rows.push_back(r);
+            rewritten.vars.insert(rewritten.vars.end(), vars.begin() + begin, vars.end());
+            vars.resize(begin);
+        }
+    }
+    if (asWritten.rows.empty()) {
+        return evaluateAll(e->program);
+    }
+    if (rewritten.rows.empty()) {
+        return evaluateAll(e->asWritten);
+    }
+    Status firstRewritten = Status::OK;
+    Status firstAsWritten = Status::OK;
+    auto r = rewritten.evaluate(e->program, results, statuses, firstRewritten);
+    auto a = asWritten.evaluate(e->asWritten, results, statuses, firstAsWritten);
+    return r < a ? firstRewritten : firstAsWritten;
+}
+
+} // namespace
+
+calc_status calc_compile(const char* text, const calc_options* options, calc_expr** out) {
+    return calc_compile_diag(text, options, out, nullptr);
+}
+
+calc_status calc_compile_diag(const char* text, const calc_options* options, calc_expr** out,
+                              calc_diagnostic* diag) {
+    if (text == nullptr || out == nullptr) {
+        return CALC_ERR_INVALID_ARGUMENT;
+    }
+    *out = nullptr;
+
+    try {
+        std::vector<std::string> names;
+        if (options != nullptr && options->var_names != nullptr) {
+            for (size_t i = 0; i < options->num_vars; i++) {
+                names.emplace_back(options->var_names[i]);
+            }
+        }
+
+        Lexer lexer(text);
+        Parser parser(lexer);
+        ParseError error;
+        std::unique_ptr<AST> ast(parser.parse(error));
+        if (ast == nullptr) {
+            if (diag != nullptr) {
+                diag->offset = error.offset;
+                std::snprintf(diag->message, sizeof(diag->message), "%s", error.message.c_str());
+            }
+            return CALC_ERR_PARSE;
+        }
+
+        std::unique_ptr<calc_expr> e(new calc_expr);
+        auto s = Program::compile(ast.get(), names, e->program);
+        if (s != Status::OK) {
+            return toCalcStatus(s);
+        }
+        if (options != nullptr && (options->flags & CALC_FAST_FP) != 0) {
+            // the rewrite reorders variables, keep the slots of the expression as written
+            names.clear();
+            for (size_t i = 0; i < e->program.getNumVars(); i++) {
+                names.push_back(e->program.getVarName(i));
+            }
+            PolynomialRewriter rewriter;
+            auto rewritten = rewriter.rewrite(ast.get());
+            Program fast;
+            if (Program::compile(rewritten.get(), names, fast) == Status::OK) {
+                e->asWritten = std::move(e->program);
+                e->program = std::move(fast);
+                e->rewritten = true;
+            }
+        }
+        *out = e.release();
+        return CALC_OK;
+    } catch (std::bad_alloc&) {
+        return CALC_ERR_NO_MEMORY;
+    }
+}
+
+void calc_free(calc_expr* e) {
+    delete e;
+}
+
+size_t calc_num_vars(const calc_expr* e) {
+    return e->program.getNumVars();
+}
+
+const char* calc_var_name(const calc_expr* e, size_t i) {
+    if (i >= e->program.getNumVars()) {
+        return nullptr;
+    }
+    return e->program.getVarName(i).c_str();
+}
+
+calc_status calc_eval(const calc_expr* e, const double* vars, double* result) {
+    if (e == nullptr || result == nullptr || (vars == nullptr && e->program.getNumVars() != 0)) {
+        return CALC_ERR_INVALID_ARGUMENT;
+    }
+    auto numVars = e->program.getNumVars();
+    const auto& program = e->rewritten && anyBoundAsInt(vars, numVars) ? e->asWritten : e->program;
+    Value v;
+    auto s = program.evaluate(vars, v);
+    *result = s == Status::OK ? v.getFloat() : std::numeric_limits<double>::quiet_NaN();
+    return toCalcStatus(s);
+}
+
+calc_status calc_eval_batch(const calc_expr* e, const double* vars, size_t num_rows, double* results) {
+    return calc_eval_batch_status(e, vars, num_rows, results, nullptr);
+}
+
+calc_status calc_eval_batch_status(const calc_expr* e, const double* vars, size_t num_rows, double* results,
+                                   unsigned char* statuses) {
+    if (e == nullptr || results == nullptr || (vars == nullptr && e->program.getNumVars() != 0)) {
+        return CALC_ERR_INVALID_ARGUMENT;
+    }
+    try {
+        auto numVars = e->program.getNumVars();
+        auto evaluateAll = [&](const Program& program) {
+            VectorEvaluator eval(program, threadPool());
+            return eval.evaluate(vars, 1, numVars, num_rows, results, statuses);
+        };
+        if (!e->rewritten) {
+            return toCalcStatus(evaluateAll(e->program));
+        }
+        auto load = [&](size_t r, size_t v) { return vars[r * numVars + v]; };
+        return toCalcStatus(evaluateFastFp(e, num_rows, load, evaluateAll, results, statuses));
+    } catch (std::bad_alloc&) {
+        return CALC_ERR_NO_MEMORY;
+    }
+}
+
+calc_status calc_eval_columns(const calc_expr* e, const double* const* columns, const calc_dict_column* dicts,
+                              size_t num_rows, double* results, unsigned char* statuses) {
+    if (e == nullptr || results == nullptr) {
+        return CALC_ERR_INVALID_ARGUMENT;
+    }
+    try {
+        auto numVars = e->program.getNumVars();
+        std::vector<DictColumn> inputs(numVars);
+        for (size_t v = 0; v < numVars; v++) {
+            if (dicts != nullptr && dicts[v].values != nullptr) {
+                if (dicts[v].codes == nullptr) {
+                    return CALC_ERR_INVALID_ARGUMENT;
+                }
+                inputs[v] = {dicts[v].values, dicts[v].num_values, dicts[v].codes};
+            } else if (columns == nullptr || columns[v] == nullptr) {
+                return CALC_ERR_INVALID_ARGUMENT;
+            }
+        }
+        auto evaluateAll = [&](const Program& program) {
+            VectorEvaluator eval(program, threadPool());
+            return eval.evaluate(columns, inputs.data(), num_rows, results, statuses);
+        };
+        if (!e->rewritten) {
+            return toCalcStatus(evaluateAll(e->program));
+        }
+        auto load = [&](size_t r, size_t v) {
+            return inputs[v].values != nullptr ? inputs[v].values[inputs[v].codes[r]] : columns[v][r];
+        };
+        return toCalcStatus(evaluateFastFp(e, num_rows, load, evaluateAll, results, statuses));
+    } catch (std::bad_alloc&) {
+        return CALC_ERR_NO_MEMORY;
+    }
+}
+
+const char* calc_status_string(calc_status s) {
+    switch (s) {
+    case CALC_OK:
+        return "ok";
+    case CALC_ERR_PARSE:
+        return "parse error";
+    case CALC_ERR_UNKNOWN_VARIABLE:
+        return "unknown variable";
+    case CALC_ERR_TOO_COMPLEX:
+        return "expression too complex";
+    case CALC_ERR_DOMAIN:
+        return "domain error";
+    case CALC_ERR_INVALID_ARGUMENT:
+        return "invalid argument";
+    case CALC_ERR_NO_MEMORY:
+        return "out of memory";
+    }
+    return "unknown status";
+}
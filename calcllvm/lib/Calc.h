@@ -0,0 +1,109 @@
+#pragma once
+
+/**
+ * Embeddable C API: compile an expression once, evaluate it many times.
+ *
+ *  calc_expr* e;
+ *  const char* names[] = {"x", "y"};
+ *  calc_options opts = {names, 2};
+ *  if (calc_compile("x^2 + sin(y)", &opts, &e) == CALC_OK) {
+ *      double vars[] = {3.0, 0.5}, r;
+ *      calc_eval(e, vars, &r);
+ *      calc_free(e);
+ *  }
+ *
+ * No function in this header throws. calc_eval does not allocate; calc_eval and
+ * calc_eval_batch may be called concurrently on the same handle.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum calc_status {
+    CALC_OK = 0,
+    CALC_ERR_PARSE,
+    CALC_ERR_UNKNOWN_VARIABLE,
+    CALC_ERR_TOO_COMPLEX,
+    CALC_ERR_DOMAIN,
+    CALC_ERR_INVALID_ARGUMENT,
+    CALC_ERR_NO_MEMORY,
+} calc_status;
+
+typedef enum calc_flags {
+    /// Allow results to round differently from the expression as written, for
+    /// instance by evaluating polynomials in Horner form. Statuses do not change:
+    /// a row with an input bound as an int is evaluated as written.
+    CALC_FAST_FP = 1,
+} calc_flags;
+
+typedef struct calc_options {
+    /// Variable names in the order calc_eval expects their values. If NULL, the
+    /// variables are numbered in order of first appearance, see calc_var_name.
+    const char* const* var_names;
+    size_t num_vars;
+    /// calc_flags or'ed together, 0 to evaluate exactly as written.
+    unsigned flags;
+} calc_options;
+
+typedef struct calc_expr calc_expr;
+
+/// `options` may be NULL. On success `*out` must be released with calc_free.
+calc_status calc_compile(const char* text, const calc_options* options, calc_expr** out);
+
+/// Where and why an expression failed to parse.
+typedef struct calc_diagnostic {
+    /// Byte offset in the text of the token that could not be parsed.
+    size_t offset;
+    /// NUL-terminated, truncated to fit.
+    char message[120];
+} calc_diagnostic;
+
+/// calc_compile, which also describes a CALC_ERR_PARSE in `*diag` unless
+/// `diag` is NULL. A syntax error costs no more than a successful parse.
+calc_status calc_compile_diag(const char* text, const calc_options* options, calc_expr** out,
+                              calc_diagnostic* diag);
+
+void calc_free(calc_expr* e);
+
+size_t calc_num_vars(const calc_expr* e);
+
+const char* calc_var_name(const calc_expr* e, size_t i);
+
+/// `vars` holds calc_num_vars(e) values, integral values are bound as ints.
+calc_status calc_eval(const calc_expr* e, const double* vars, double* result);
+
+/// `vars` is row-major, `num_rows` rows of calc_num_vars(e) values each. Every
+/// row is evaluated; a failing row yields NaN and the first failure is returned.
+/// Rows are evaluated a block at a time, in scratch buffers that the first calls
+/// on a thread allocate and later ones reuse.
+calc_status calc_eval_batch(const calc_expr* e, const double* vars, size_t num_rows, double* results);
+
+/// calc_eval_batch, which also stores the calc_status of every row in
+/// `statuses`, one byte per row, to tell failed rows from NaN results.
+calc_status calc_eval_batch_status(const calc_expr* e, const double* vars, size_t num_rows, double* results,
+                                   unsigned char* statuses);
+
+/// A dictionary-encoded column: row r holds values[codes[r]], every code is
+/// below num_values.
+typedef struct calc_dict_column {
+    const double* values;
+    size_t num_values;
+    const uint32_t* codes;
+} calc_dict_column;
+
+/// calc_eval_batch_status over columns: variable v of row r is columns[v][r],
+/// or, if dicts is not NULL and dicts[v].values is set, dictionary-encoded. The
+/// parts of the expression that depend on one dictionary-encoded variable alone
+/// are evaluated once per distinct value. `statuses` may be NULL.
+calc_status calc_eval_columns(const calc_expr* e, const double* const* columns, const calc_dict_column* dicts,
+                              size_t num_rows, double* results, unsigned char* statuses);
+
+const char* calc_status_string(calc_status s);
+
+#ifdef __cplusplus
+}
+#endif
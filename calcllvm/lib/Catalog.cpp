@@ -0,0 +1,86 @@
+#include "Catalog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <tuple>
+
+namespace {
+/// Chunks are cut near multiples of this size, smaller catalogs are parsed on the calling thread.
+constexpr size_t kChunkBytes = 64 * 1024;
+
+struct Chunk {
+    llvm::StringRef text;
+    ASTFileWriter writer;
+    std::vector<CatalogError> errors; // lines counted from the start of the chunk
+    size_t numLines = 0;
+};
+
+void parseChunk(Chunk& chunk) {
+    // the lexer stops at a null, not at the end of the line, so every expression is copied out first
+    std::string source;
+    auto text = chunk.text;
+    while (!text.empty()) {
+        llvm::StringRef line;
+        std::tie(line, text) = text.split('\n');
+        chunk.numLines++;
+        llvm::StringRef id, expr;
+        std::tie(id, expr) = line.trim().split(' ');
+        if (id.empty()) {
+            continue;
+        }
+        source.assign(expr.data(), expr.size());
+        Lexer lexer(source);
+        Parser parser(lexer);
+        ParseError error;
+        std::unique_ptr<AST> ast(parser.parse(error));
+        if (ast == nullptr) {
+            chunk.errors.push_back({chunk.numLines, id.str(), std::move(error)});
+            continue;
+        }
+        chunk.writer.add(id, ast.get());
+    }
+}
+} // namespace
+
+std::vector<CatalogError> parseCatalog(llvm::StringRef text, unsigned numThreads, ASTFileWriter& out) {
+    numThreads = std::max(1u, numThreads);
+    size_t target = std::max(kChunkBytes, text.size() / (numThreads * 4) + 1);
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    while (!text.empty()) {
+        auto end = text.find('\n', std::min(target, text.size()) - 1);
+        auto size = end == llvm::StringRef::npos ? text.size() : end + 1;
+        chunks.emplace_back(new Chunk);
+        chunks.back()->text = text.take_front(size);
+        text = text.drop_front(size);
+    }
+
+    std::atomic<size_t> next{0};
+    auto work = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < chunks.size();) {
+            parseChunk(*chunks[i]);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < std::min<size_t>(numThreads, chunks.size()); i++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    std::vector<CatalogError> errors;
+    size_t linesBefore = 0;
+    for (auto& chunk : chunks) {
+        out.append(chunk->writer);
+        for (auto& e : chunk->errors) {
+            e.line += linesBefore;
+            errors.push_back(std::move(e));
+        }
+        linesBefore += chunk->numLines;
+        chunk.reset();
+    }
+    return errors;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "ASTFile.h"
+#include "Parser.h"
+
+#include <llvm/ADT/StringRef.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// A line of a text catalog that did not parse.
+struct CatalogError {
+    size_t line; // from 1
+    std::string id;
+    ParseError error;
+};
+
+/**
+ * Parses a text catalog, one `<id> <expr>` per line, on `numThreads` threads.
+ *
+ * The text is cut into chunks at line ends, a few per thread so that a chunk of
+ * long lines does not hold up the others, and the workers take them in turn.
+ * Every chunk is parsed into an ASTFileWriter of its own, which holds its nodes
+ * flattened, so nothing is shared between threads but the next chunk to take,
+ * and every tree is freed as soon as it is written. The chunks are then
+ * appended to `out` in order, so the expressions keep the order of their lines
+ * whatever the number of threads.
+ *
+ * Blank lines are skipped. A line that does not parse is returned, with the
+ * others still parsed; the errors are in line order too.
+ */
+std::vector<CatalogError> parseCatalog(llvm::StringRef text, unsigned numThreads, ASTFileWriter& out);
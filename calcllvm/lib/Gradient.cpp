@@ -0,0 +1,237 @@
+#include "Gradient.h"
+
+#include <vector>
+
+void localPartials(Program::OpCode op, Builtin func, const Value& lhs, const Value& rhs, const Value& result,
+                   double& dLhs, double& dRhs) {
+    using OpCode = Program::OpCode;
+    double a = lhs.getFloat();
+    double b = rhs.getFloat();
+    bool bothInt = lhs.isInt() && rhs.isInt();
+    dLhs = 0.0;
+    dRhs = 0.0;
+
+    switch (op) {
+    case OpCode::PUSH:
+    case OpCode::LOAD:
+    case OpCode::FACT:
+    case OpCode::LT:
+    case OpCode::LE:
+    case OpCode::GT:
+    case OpCode::GE:
+    case OpCode::EQ:
+    case OpCode::NE:
+    case OpCode::AND:
+    case OpCode::OR:
+        return;
+    case OpCode::SELECT:
+        dLhs = 1.0;
+        return;
+    case OpCode::NEG:
+        dLhs = -1.0;
+        return;
+    case OpCode::ADD:
+        dLhs = 1.0;
+        dRhs = 1.0;
+        return;
+    case OpCode::SUB:
+        dLhs = 1.0;
+        dRhs = -1.0;
+        return;
+    case OpCode::MUL:
+        dLhs = b;
+        dRhs = a;
+        return;
+    case OpCode::DIV:
+        if (!bothInt) {
+            dLhs = 1.0 / b;
+            dRhs = -a / (b * b);
+        }
+        return;
+    case OpCode::MOD:
+        dLhs = 1.0;
+        dRhs = -std::trunc(a / b);
+        return;
+    case OpCode::POW:
+        dLhs = b == 0.0 ? 0.0 : b * std::pow(a, b - 1.0);
+        if (a > 0.0) {
+            dRhs = result.getFloat() * std::log(a);
+        }
+        return;
+    case OpCode::CALL:
+        break;
+    }
+
+    double r = result.getFloat();
+    switch (func) {
+    case Builtin::ABS:
+        dLhs = a > 0.0 ? 1.0 : (a < 0.0 ? -1.0 : 0.0);
+        return;
+    case Builtin::EXP:
+        dLhs = r;
+        return;
+    case Builtin::LOG2:
+        dLhs = 1.0 / (a * std::log(2.0));
+        return;
+    case Builtin::LG:
+        dLhs = 1.0 / (a * std::log(10.0));
+        return;
+    case Builtin::LN:
+        dLhs = 1.0 / a;
+        return;
+    case Builtin::SIN:
+        dLhs = std::cos(a);
+        return;
+    case Builtin::COS:
+        dLhs = -std::sin(a);
+        return;
+    case Builtin::TAN:
+        dLhs = 1.0 + r * r;
+        return;
+    case Builtin::COT:
+        dLhs = -(1.0 + r * r);
+        return;
+    case Builtin::ARCSIN:
+        dLhs = 1.0 / std::sqrt(1.0 - a * a);
+        return;
+    case Builtin::ARCCOS:
+        dLhs = -1.0 / std::sqrt(1.0 - a * a);
+        return;
+    case Builtin::ARCTAN:
+        dLhs = 1.0 / (1.0 + a * a);
+        return;
+    case Builtin::ARCCOT:
+        dLhs = -1.0 / (1.0 + a * a);
+        return;
+    case Builtin::SQRT:
+        dLhs = 0.5 / r;
+        return;
+    case Builtin::UNKNOWN:
+        return;
+    }
+}
+
+Status evaluateGradient(const Program& p, const double* vars, llvm::ArrayRef<uint32_t> wrt, ADMode mode,
+                        Value& value, double* grad) {
+    using OpCode = Program::OpCode;
+    for (auto slot : wrt) {
+        if (slot >= p.getNumVars()) {
+            return Status::INVALID_ARGUMENT;
+        }
+    }
+    if (mode == ADMode::AUTO) {
+        mode = wrt.size() <= kMaxForwardModeVars ? ADMode::FORWARD : ADMode::REVERSE;
+    }
+
+    auto insts = p.getInsts();
+    size_t n = insts.size();
+    size_t k = wrt.size();
+
+    // one entry per instruction: its value, operands and local partials
+    std::vector<Value> values(n);
+    std::vector<int> lhs(n, -1), rhs(n, -1);
+    std::vector<double> dLhs(n), dRhs(n);
+    std::vector<double> tangents(mode == ADMode::FORWARD ? n * k : 0, 0.0);
+
+    int stack[Program::kMaxStackDepth];
+    int sp = 0;
+    for (size_t i = 0; i < n; i++) {
+        const auto& inst = insts[i];
+        Status s = Status::OK;
+        switch (inst.op) {
+        case OpCode::PUSH:
+            values[i] = inst.imm;
+            break;
+        case OpCode::LOAD:
+            // always a float, an integral input bound as an int would make x / 2 piecewise constant
+            values[i] = Value(vars[inst.index]);
+            if (mode == ADMode::FORWARD) {
+                for (size_t j = 0; j < k; j++) {
+                    tangents[i * k + j] = wrt[j] == inst.index ? 1.0 : 0.0;
+                }
+            }
+            break;
+        case OpCode::NEG:
+        case OpCode::FACT:
+        case OpCode::CALL:
+            lhs[i] = stack[--sp];
+            values[i] = values[lhs[i]];
+            s = Program::applyUnary(inst.op, inst.func, values[i]);
+            break;
+        case OpCode::SELECT: {
+            // only the arm taken has an edge to the result, the condition is piecewise constant
+            int b = stack[--sp];
+            int a = stack[--sp];
+            int c = stack[--sp];
+            values[i] = values[c];
+            Program::applySelect(values[i], values[a], values[b]);
+            lhs[i] = Program::isTrue(values[c]) ? a : b;
+            break;
+        }
+        default:
+            rhs[i] = stack[--sp];
+            lhs[i] = stack[--sp];
+            values[i] = values[lhs[i]];
+            s = Program::applyBinary(inst.op, values[i], values[rhs[i]]);
+            break;
+        }
+        if (s != Status::OK) {
+            return s;
+        }
+        stack[sp++] = static_cast<int>(i);
+
+        if (lhs[i] >= 0) {
+            localPartials(inst.op, inst.func, values[lhs[i]], rhs[i] >= 0 ? values[rhs[i]] : Value(0.0), values[i],
+                          dLhs[i], dRhs[i]);
+        }
+
+        if (mode == ADMode::FORWARD && lhs[i] >= 0) {
+            for (size_t j = 0; j < k; j++) {
+                double t = dLhs[i] * tangents[lhs[i] * k + j];
+                if (rhs[i] >= 0) {
+                    t += dRhs[i] * tangents[rhs[i] * k + j];
+                }
+                tangents[i * k + j] = t;
+            }
+        }
+    }
+
+    if (sp != 1 || n == 0) {
+        return Status::INVALID_ARGUMENT;
+    }
+    value = values[n - 1];
+
+    if (mode == ADMode::FORWARD) {
+        for (size_t j = 0; j < k; j++) {
+            grad[j] = tangents[(n - 1) * k + j];
+        }
+        return Status::OK;
+    }
+
+    std::vector<double> adjoints(n, 0.0);
+    adjoints[n - 1] = 1.0;
+    for (size_t j = 0; j < k; j++) {
+        grad[j] = 0.0;
+    }
+    for (size_t i = n; i-- > 0;) {
+        double adj = adjoints[i];
+        if (adj == 0.0) {
+            continue;
+        }
+        if (insts[i].op == OpCode::LOAD) {
+            for (size_t j = 0; j < k; j++) {
+                if (wrt[j] == insts[i].index) {
+                    grad[j] += adj;
+                }
+            }
+            continue;
+        }
+        if (lhs[i] >= 0) {
+            adjoints[lhs[i]] += dLhs[i] * adj;
+        }
+        if (rhs[i] >= 0) {
+            adjoints[rhs[i]] += dRhs[i] * adj;
+        }
+    }
+    return Status::OK;
+}
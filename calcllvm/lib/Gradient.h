@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Program.h"
+
+/**
+ * Automatic differentiation: the value of an expression together with its
+ * partial derivatives with respect to some of its variables, in one evaluation.
+ *
+ * FORWARD carries one tangent per requested variable through every node and is
+ * the cheaper choice for a few variables. REVERSE records the local partials of
+ * every node on a tape and sweeps it backwards once, so its cost does not grow
+ * with the number of variables. AUTO picks between the two.
+ *
+ * Derivatives are those of the real-valued function: an int operation that is
+ * piecewise constant (int `/`, `!`, comparisons, `&&`, `||`) has a zero
+ * derivative, `%` follows a % b = a - b * trunc(a / b), d(a^b)/db only counts
+ * for a > 0, and `c ? a : b` has the derivative of the arm it takes.
+ *
+ * Unlike Program::evaluate, every variable is bound as a float, integral inputs
+ * included, the way `calcc --grad` reads them: d(x / 2)/dx is 0.5 at x = 3 as
+ * it is at x = 3.5. Only literals take int operations, so `%` and `!` of a
+ * variable fail.
+ */
+enum class ADMode {
+    FORWARD,
+    REVERSE,
+    AUTO,
+};
+
+/// Above this many variables AUTO switches from forward to reverse mode.
+constexpr size_t kMaxForwardModeVars = 4;
+
+/// Local partial derivatives of one operation. `lhs` and `rhs` are the operands (rhs is unused by unary ops, and
+/// lhs is the arm taken by SELECT) and `result` the value the operation produced.
+void localPartials(Program::OpCode op, Builtin func, const Value& lhs, const Value& rhs, const Value& result,
+                   double& dLhs, double& dRhs);
+
+/// Evaluates `p` with its variables bound as floats and writes d(result)/d(vars[wrt[i]]) to grad[i].
+Status evaluateGradient(const Program& p, const double* vars, llvm::ArrayRef<uint32_t> wrt, ADMode mode,
+                        Value& value, double* grad);
@@ -0,0 +1,189 @@
+#include "IncrementalEvaluator.h"
+
+#include <algorithm>
+
+namespace {
+class NodeBuilder : public ASTVisitor {
+    std::vector<IncrementalEvaluator::Node>& nodes;
+    std::vector<std::string>& vars;
+
+public:
+    int last = -1; // index of the node for the subtree visited last
+
+    NodeBuilder(std::vector<IncrementalEvaluator::Node>& nodes, std::vector<std::string>& vars)
+        : nodes(nodes)
+        , vars(vars) {}
+
+    void visit(UnaryOp& e) override {
+        e.getExpr()->accept(*this);
+        if (e.getOp() == UnaryOp::POS) {
+            return;
+        }
+        int operand = last;
+        auto& n = add(IncrementalEvaluator::Node::UNARY);
+        n.op = Program::toOpCode(e.getOp());
+        n.lhs = operand;
+        last = static_cast<int>(nodes.size()) - 1;
+    }
+
+    void visit(BinaryOp& e) override {
+        e.getLeft()->accept(*this);
+        int lhs = last;
+        e.getRight()->accept(*this);
+        int rhs = last;
+        auto& n = add(IncrementalEvaluator::Node::BINARY);
+        n.op = Program::toOpCode(e.getOp());
+        n.lhs = lhs;
+        n.rhs = rhs;
+        last = static_cast<int>(nodes.size()) - 1;
+    }
+
+    void visit(Conditional& e) override {
+        e.getCond()->accept(*this);
+        int cond = last;
+        e.getLeft()->accept(*this);
+        int lhs = last;
+        e.getRight()->accept(*this);
+        int rhs = last;
+        auto& n = add(IncrementalEvaluator::Node::SELECT);
+        n.op = Program::OpCode::SELECT;
+        n.cond = cond;
+        n.lhs = lhs;
+        n.rhs = rhs;
+        last = static_cast<int>(nodes.size()) - 1;
+    }
+
+    void visit(FuncCall& e) override {
+        e.getParam()->accept(*this);
+        int param = last;
+        auto& n = add(IncrementalEvaluator::Node::UNARY);
+        n.op = Program::OpCode::CALL;
+        n.func = lookupBuiltin(e.getName());
+        n.lhs = param;
+        last = static_cast<int>(nodes.size()) - 1;
+    }
+
+    void visit(Ident& e) override {
+        auto it = std::find(vars.begin(), vars.end(), e.getName());
+        if (it == vars.end()) {
+            it = vars.insert(vars.end(), e.getName().str());
+        }
+        auto& n = add(IncrementalEvaluator::Node::LOAD);
+        n.var = static_cast<uint32_t>(it - vars.begin());
+        last = static_cast<int>(nodes.size()) - 1;
+    }
+
+    void visit(Number& e) override {
+        auto& n = add(IncrementalEvaluator::Node::CONST);
+        n.valid = true;
+        n.cached = e.getType() == Number::INT ? Value(e.getInt()) : Value(e.getFloat());
+        last = static_cast<int>(nodes.size()) - 1;
+    }
+
+private:
+    IncrementalEvaluator::Node& add(IncrementalEvaluator::Node::Kind kind) {
+        nodes.push_back(IncrementalEvaluator::Node{
+            kind, Program::OpCode::PUSH, Builtin::UNKNOWN, 0, -1, -1, -1, {}, false, Status::OK, Value()});
+        return nodes.back();
+    }
+};
+} // namespace
+
+IncrementalEvaluator::IncrementalEvaluator(AST* ast) {
+    NodeBuilder builder(nodes, vars);
+    ast->accept(builder);
+
+    // children precede their parents, so one forward pass computes every dependency set
+    for (auto& n : nodes) {
+        n.deps.resize(vars.size());
+        if (n.kind == Node::LOAD) {
+            n.deps.set(n.var);
+        }
+        if (n.lhs >= 0) {
+            n.deps |= nodes[n.lhs].deps;
+        }
+        if (n.rhs >= 0) {
+            n.deps |= nodes[n.rhs].deps;
+        }
+        if (n.cond >= 0) {
+            n.deps |= nodes[n.cond].deps;
+        }
+    }
+
+    bindings.resize(vars.size());
+    bound.resize(vars.size());
+    changed.resize(vars.size());
+}
+
+bool IncrementalEvaluator::setBinding(llvm::StringRef name, Value v) {
+    auto it = std::find(vars.begin(), vars.end(), name);
+    if (it == vars.end()) {
+        return false;
+    }
+    auto i = it - vars.begin();
+    auto& old = bindings[i];
+    bool same = bound.test(i) && old.isInt() == v.isInt() &&
+                (v.isInt() ? old.getInt() == v.getInt() : old.getFloat() == v.getFloat());
+    if (!same) {
+        old = v;
+        bound.set(i);
+        changed.set(i);
+    }
+    return true;
+}
+
+Status IncrementalEvaluator::evaluate(Value& out) {
+    auto s = evaluateNode(static_cast<int>(nodes.size()) - 1);
+    changed.reset();
+    out = nodes.back().cached;
+    return s;
+}
+
+Status IncrementalEvaluator::evaluateNode(int i) {
+    auto& n = nodes[i];
+    if (n.valid && !n.deps.anyCommon(changed)) {
+        numReused += 1;
+        return n.status;
+    }
+    numRecomputed += 1;
+    n.valid = true;
+
+    switch (n.kind) {
+    case Node::CONST:
+        return n.status;
+    case Node::LOAD:
+        n.status = bound.test(n.var) ? Status::OK : Status::UNKNOWN_VARIABLE;
+        n.cached = bindings[n.var];
+        return n.status;
+    case Node::UNARY:
+        n.status = evaluateNode(n.lhs);
+        n.cached = nodes[n.lhs].cached;
+        if (n.status == Status::OK) {
+            n.status = Program::applyUnary(n.op, n.func, n.cached);
+        }
+        return n.status;
+    case Node::BINARY: {
+        auto ls = evaluateNode(n.lhs);
+        auto rs = evaluateNode(n.rhs);
+        n.status = ls != Status::OK ? ls : rs;
+        n.cached = nodes[n.lhs].cached;
+        if (n.status == Status::OK) {
+            n.status = Program::applyBinary(n.op, n.cached, nodes[n.rhs].cached);
+        }
+        return n.status;
+    }
+    case Node::SELECT: {
+        // both arms, like Program: an error in the one not taken still counts
+        auto cs = evaluateNode(n.cond);
+        auto ls = evaluateNode(n.lhs);
+        auto rs = evaluateNode(n.rhs);
+        n.status = cs != Status::OK ? cs : (ls != Status::OK ? ls : rs);
+        n.cached = nodes[n.cond].cached;
+        if (n.status == Status::OK) {
+            Program::applySelect(n.cached, nodes[n.lhs].cached, nodes[n.rhs].cached);
+        }
+        return n.status;
+    }
+    }
+    return Status::INVALID_ARGUMENT;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "AST.h"
+#include "Program.h"
+
+#include <llvm/ADT/BitVector.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * Evaluates an expression repeatedly while its bindings change a few at a time.
+ *
+ * Every node caches its last result together with the set of variables its
+ * subtree depends on. After setBinding() only the nodes that depend on a changed
+ * variable, i.e. the paths from the changed Idents up to the root, are
+ * recomputed; every clean subtree is reused as a whole.
+ */
+class IncrementalEvaluator {
+public:
+    explicit IncrementalEvaluator(AST* ast);
+
+    /// Returns false if `name` does not occur in the expression.
+    bool setBinding(llvm::StringRef name, Value v);
+
+    /// Fails with UNKNOWN_VARIABLE while a variable the result depends on is unbound.
+    Status evaluate(Value& out);
+
+    llvm::ArrayRef<std::string> getVarNames() const {
+        return vars;
+    }
+
+    /// Nodes evaluated since the last resetCounters().
+    size_t getNumRecomputed() const {
+        return numRecomputed;
+    }
+
+    /// Subtrees whose cached result was used as is since the last resetCounters().
+    size_t getNumReused() const {
+        return numReused;
+    }
+
+    void resetCounters() {
+        numRecomputed = 0;
+        numReused = 0;
+    }
+
+    struct Node {
+        enum Kind : uint8_t {
+            CONST,
+            LOAD,
+            UNARY,
+            BINARY,
+            SELECT, // cond ? lhs : rhs
+        } kind;
+        Program::OpCode op;
+        Builtin func;
+        uint32_t var;
+        int lhs;
+        int rhs;
+        int cond;
+        llvm::BitVector deps;
+
+        bool valid;
+        Status status;
+        Value cached;
+    };
+
+private:
+    Status evaluateNode(int i);
+
+    std::vector<Node> nodes; // post-order, the root is last
+    std::vector<std::string> vars;
+    std::vector<Value> bindings;
+    llvm::BitVector bound;
+    llvm::BitVector changed;
+
+    size_t numRecomputed = 0;
+    size_t numReused = 0;
+};
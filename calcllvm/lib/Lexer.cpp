@@ -38,7 +38,7 @@ Token Lexer::next() {
     }
 
     if (*bufferCurr == '\0') {
-        return Token(TokenKind::EOI);
+        return Token(TokenKind::EOI, llvm::StringRef{}, getOffset());
     }
 
     // is a number: FP_LITERAL or INT_LITERAL
@@ -57,6 +57,26 @@ Token Lexer::next() {
         return formToken(p, TokenKind::IDENT);
     }
 
+    // two-character operators first, so that "!=" is not a factorial
+    switch (*bufferCurr) {
+#define CASE2(c1, c2, kind)                                                                                            \
+    case (c1):                                                                                                         \
+        if (bufferCurr[1] == (c2)) {                                                                                   \
+            return formToken(bufferCurr + 2, (kind));                                                                  \
+        }                                                                                                              \
+        break;
+
+        CASE2('<', '=', TokenKind::OP_LE);
+        CASE2('>', '=', TokenKind::OP_GE);
+        CASE2('=', '=', TokenKind::OP_EQ);
+        CASE2('!', '=', TokenKind::OP_NE);
+        CASE2('&', '&', TokenKind::OP_AND);
+        CASE2('|', '|', TokenKind::OP_OR);
+#undef CASE2
+    default:
+        break;
+    }
+
     switch (*bufferCurr) {
 #define CASE(c, kind)                                                                                                  \
     case (c):                                                                                                          \
@@ -69,10 +89,14 @@ Token Lexer::next() {
         CASE('^', TokenKind::OP_POW);
         CASE('%', TokenKind::OP_MOD);
         CASE('!', TokenKind::OP_FACT);
+        CASE('<', TokenKind::OP_LT);
+        CASE('>', TokenKind::OP_GT);
+        CASE('?', TokenKind::QUESTION);
+        CASE(':', TokenKind::COLON);
         CASE('(', TokenKind::L_PARAN);
         CASE(')', TokenKind::R_PARAN);
 #undef CASE
     default:
-        return Token(TokenKind::UNKNOWN);
+        return Token(TokenKind::UNKNOWN, llvm::StringRef{}, getOffset());
     }
 }
@@ -4,6 +4,9 @@
  * FP_LITERAL: [0-9]+(.[0-9]*)?
  * OP_PLUS, OP_MINUS, OP_DIV, OP_MUL: '+', '-', '*', '/'
  * OP_POW, OP_MOD, OP_FACT: '^', '%', '!'
+ * OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE: '<', '<=', '>', '>=', '==', '!='
+ * OP_AND, OP_OR: '&&', '||'
+ * QUESTION, COLON: '?', ':'
  * L_PARAN, R_PARAN: '(', ')'
  * IDENT: [a-zA-Z_][a-zA-Z_0-9]*
  */
@@ -25,6 +28,16 @@ enum class TokenKind : uint8_t {
     OP_POW,
     OP_MOD,
     OP_FACT,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_AND,
+    OP_OR,
+    QUESTION,
+    COLON,
     L_PARAN,
     R_PARAN,
     IDENT,
@@ -33,13 +46,19 @@ enum class TokenKind : uint8_t {
 struct Token {
     TokenKind kind;
     llvm::StringRef text;
+    uint32_t offset; // of the first character in the source
 
-    Token(TokenKind kind, llvm::StringRef text)
+    Token(TokenKind kind, llvm::StringRef text, uint32_t offset = 0)
         : kind(kind)
-        , text(text){};
+        , text(text)
+        , offset(offset){};
     Token(TokenKind kind)
         : Token(kind, llvm::StringRef{}) {}
 
+    uint32_t getEndOffset() const {
+        return offset + static_cast<uint32_t>(text.size());
+    }
+
     bool operator==(const Token& other) const {
         return kind == other.kind && text.equals(other.text);
     }
@@ -71,9 +90,14 @@ public:
     Token next();
 
 private:
+    uint32_t getOffset() const {
+        return static_cast<uint32_t>(bufferCurr - bufferBase);
+    }
+
     Token formToken(const char* end, TokenKind kind) {
         llvm::StringRef text(bufferCurr, end - bufferCurr);
+        auto offset = getOffset();
         bufferCurr = end;
-        return Token(kind, text);
+        return Token(kind, text, offset);
     }
 };
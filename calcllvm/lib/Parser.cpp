@@ -1,25 +1,81 @@
 #include "Parser.h"
 
-inline void Parser::error() const {
-    throw std::runtime_error("parser error");
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+
+namespace {
+/// Digits of an INT_LITERAL. False if the value does not fit in an int64.
+bool parseIntLiteral(llvm::StringRef text, int64_t& out) {
+    uint64_t v = 0;
+    for (char c : text) {
+        if (__builtin_mul_overflow(v, 10u, &v) || __builtin_add_overflow(v, static_cast<unsigned>(c - '0'), &v)) {
+            return false;
+        }
+    }
+    if (v > static_cast<uint64_t>(INT64_MAX)) {
+        return false;
+    }
+    out = static_cast<int64_t>(v);
+    return true;
 }
 
-inline void Parser::advance() {
-    token = lexer.next();
+/**
+ * Digits of an FP_LITERAL, correctly rounded. False if it overflows to infinity.
+ *
+ * Literals with at most 19 significant digits and 22 fractional ones, nearly all of them, are exact as an integer
+ * m and a power of ten, and m / 10^k is then rounded once by the division (Clinger's fast path). The rest go
+ * through APFloat.
+ */
+bool parseFloatLiteral(llvm::StringRef text, double& out) {
+    static const double kPow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    uint64_t m = 0;
+    int significant = 0;
+    int fraction = -1; // digits after the point, once it is seen
+    for (char c : text) {
+        if (c == '.') {
+            fraction = 0;
+            continue;
+        }
+        if (m != 0 || c != '0') {
+            if (++significant > 19) {
+                break;
+            }
+        }
+        m = m * 10 + static_cast<unsigned>(c - '0');
+        if (fraction >= 0) {
+            fraction++;
+        }
+    }
+    if (significant <= 19 && m <= (uint64_t(1) << 53) && fraction <= 22) {
+        out = static_cast<double>(m) / kPow10[fraction < 0 ? 0 : fraction];
+        return true;
+    }
+    return !text.getAsDouble(out) && !std::isinf(out);
 }
+} // namespace
 
-inline void Parser::consume(TokenKind kind) {
-    if (!expect(kind)) {
-        error();
+Expr* Parser::error(std::string message) {
+    // only the first error counts, the ones after it follow from it
+    if (failure != nullptr && failure->message.empty()) {
+        failure->offset = token.offset;
+        failure->message = std::move(message);
     }
-    advance();
+    return nullptr;
 }
 
-inline bool Parser::expect(TokenKind kind) const {
+inline void Parser::advance() {
+    prevEnd = token.getEndOffset();
+    token = lexer.next();
+}
+
+inline bool Parser::consume(TokenKind kind, const char* spelling) {
     if (!token.is(kind)) {
-        error();
+        error(std::string("expected ") + spelling);
         return false;
     }
+    advance();
     return true;
 }
 
@@ -36,7 +92,24 @@ bool Parser::isBuiltinFuncName(llvm::StringRef ident) const {
 
 Expr* Parser::parseExpr() {
     auto expr = parseTerm(0);
-    return expr;
+    if (expr == nullptr || !token.is(TokenKind::QUESTION)) {
+        return expr;
+    }
+    // right associative: a ? b : c ? d : e is a ? b : (c ? d : e)
+    std::unique_ptr<Expr> cond(expr);
+    advance();
+    std::unique_ptr<Expr> lhs(parseExpr());
+    if (lhs == nullptr || !consume(TokenKind::COLON, "':'")) {
+        return nullptr;
+    }
+    auto rhs = parseExpr();
+    if (rhs == nullptr) {
+        return nullptr;
+    }
+    auto begin = cond->getBegin();
+    auto ret = new Conditional(cond.release(), lhs.release(), rhs);
+    ret->setSourceRange(begin, prevEnd);
+    return ret;
 }
 
 bool isPostfixOp(Token token) {
@@ -45,21 +118,34 @@ bool isPostfixOp(Token token) {
 
 bool isBinaryOp(Token token) {
     return token.isOneOf(TokenKind::OP_PLUS, TokenKind::OP_MINUS, TokenKind::OP_MUL, TokenKind::OP_DIV,
-                         TokenKind::OP_POW, TokenKind::OP_MOD);
+                         TokenKind::OP_POW, TokenKind::OP_MOD, TokenKind::OP_LT, TokenKind::OP_LE, TokenKind::OP_GT,
+                         TokenKind::OP_GE, TokenKind::OP_EQ, TokenKind::OP_NE, TokenKind::OP_AND, TokenKind::OP_OR);
 }
 
 int getPrecedence(Token token, bool binary = true) {
     if (binary) {
         switch (token.kind) {
         case TokenKind::OP_POW:
-            return 4;
+            return 8;
         case TokenKind::OP_MOD:
-            return 2;
+            return 6;
         case TokenKind::OP_MUL:
         case TokenKind::OP_DIV:
-            return 1;
+            return 5;
         case TokenKind::OP_PLUS:
         case TokenKind::OP_MINUS:
+            return 4;
+        case TokenKind::OP_LT:
+        case TokenKind::OP_LE:
+        case TokenKind::OP_GT:
+        case TokenKind::OP_GE:
+            return 3;
+        case TokenKind::OP_EQ:
+        case TokenKind::OP_NE:
+            return 2;
+        case TokenKind::OP_AND:
+            return 1;
+        case TokenKind::OP_OR:
             return 0;
         default:
             return -1;
@@ -68,9 +154,9 @@ int getPrecedence(Token token, bool binary = true) {
         switch (token.kind) {
         case TokenKind::OP_PLUS:
         case TokenKind::OP_MINUS:
-            return 5;
+            return 9;
         case TokenKind::OP_FACT:
-            return 3;
+            return 7;
         default:
             return -1;
         }
@@ -82,8 +168,12 @@ bool isRightAssociative(Token token) {
 }
 
 Expr* Parser::parseTerm(int precedence) {
-    Expr* ret = parseFactor();
+    std::unique_ptr<Expr> ret(parseFactor());
+    if (ret == nullptr) {
+        return nullptr;
+    }
     while ((isBinaryOp(token) || isPostfixOp(token)) && getPrecedence(token, isBinaryOp(token)) >= precedence) {
+        auto begin = ret->getBegin();
         if (isBinaryOp(token)) {
             BinaryOp::Op op_kind{};
             switch (token.kind) {
@@ -97,20 +187,32 @@ Expr* Parser::parseTerm(int precedence) {
                 CASE(TokenKind::OP_DIV, BinaryOp::DIV);
                 CASE(TokenKind::OP_POW, BinaryOp::POW);
                 CASE(TokenKind::OP_MOD, BinaryOp::MOD);
+                CASE(TokenKind::OP_LT, BinaryOp::LT);
+                CASE(TokenKind::OP_LE, BinaryOp::LE);
+                CASE(TokenKind::OP_GT, BinaryOp::GT);
+                CASE(TokenKind::OP_GE, BinaryOp::GE);
+                CASE(TokenKind::OP_EQ, BinaryOp::EQ);
+                CASE(TokenKind::OP_NE, BinaryOp::NE);
+                CASE(TokenKind::OP_AND, BinaryOp::AND);
+                CASE(TokenKind::OP_OR, BinaryOp::OR);
 #undef CASE
             default:
-                throw std::runtime_error("parser error");
+                return error("expected an operator");
             }
             int q = isRightAssociative(token) ? getPrecedence(token) : 1 + getPrecedence(token);
             advance();
             auto rhs = parseTerm(q);
-            ret = new BinaryOp(op_kind, ret, rhs);
+            if (rhs == nullptr) {
+                return nullptr;
+            }
+            ret.reset(new BinaryOp(op_kind, ret.release(), rhs));
         } else {
-            consume(TokenKind::OP_FACT);
-            ret = new UnaryOp(UnaryOp::FACT, ret);
+            advance();
+            ret.reset(new UnaryOp(UnaryOp::FACT, ret.release()));
         }
+        ret->setSourceRange(begin, prevEnd);
     }
-    return ret;
+    return ret.release();
 }
 
 Expr* Parser::parseFactor() {
@@ -118,14 +220,24 @@ Expr* Parser::parseFactor() {
         auto t = token;
         advance();
         auto e = parseTerm(getPrecedence(t, /*binary=*/false));
-        return new UnaryOp(t.is(TokenKind::OP_PLUS) ? UnaryOp::POS : UnaryOp::NEG, e);
+        if (e == nullptr) {
+            return nullptr;
+        }
+        auto ret = new UnaryOp(t.is(TokenKind::OP_PLUS) ? UnaryOp::POS : UnaryOp::NEG, e);
+        ret->setSourceRange(t.offset, prevEnd);
+        return ret;
     }
 
     if (token.is(TokenKind::L_PARAN)) {
+        auto begin = token.offset;
         advance();
-        auto e = parseExpr();
-        consume(TokenKind::R_PARAN);
-        return e;
+        std::unique_ptr<Expr> e(parseExpr());
+        if (e == nullptr || !consume(TokenKind::R_PARAN, "')'")) {
+            return nullptr;
+        }
+        // the parentheses belong to the span, so that the span of an enclosing node stays contiguous
+        e->setSourceRange(begin, prevEnd);
+        return e.release();
     }
 
     if (token.is(TokenKind::IDENT)) {
@@ -134,7 +246,9 @@ Expr* Parser::parseFactor() {
         } else {
             auto t = token;
             advance();
-            return new Ident(t.text);
+            auto ret = new Ident(t.text);
+            ret->setSourceRange(t.offset, t.getEndOffset());
+            return ret;
         }
     }
 
@@ -142,31 +256,46 @@ Expr* Parser::parseFactor() {
         return parseNumber();
     }
 
-    error();
-    return nullptr;
+    if (token.is(TokenKind::UNKNOWN)) {
+        return error("unexpected character");
+    }
+    return error(token.is(TokenKind::EOI) ? "unexpected end of input" : "expected an operand");
 }
 
 Expr* Parser::parseFuncCall() {
     auto func_name = token.text;
-    consume(TokenKind::IDENT);
-    consume(TokenKind::L_PARAN);
-    auto e = parseExpr();
-    consume(TokenKind::R_PARAN);
-    return new FuncCall(func_name, e);
+    auto begin = token.offset;
+    advance();
+    if (!consume(TokenKind::L_PARAN, "'(' after a function name")) {
+        return nullptr;
+    }
+    std::unique_ptr<Expr> e(parseExpr());
+    if (e == nullptr || !consume(TokenKind::R_PARAN, "')'")) {
+        return nullptr;
+    }
+    auto ret = new FuncCall(func_name, e.release());
+    ret->setSourceRange(begin, prevEnd);
+    return ret;
 }
 
 Expr* Parser::parseNumber() {
     Expr* ret{};
+    auto t = token;
     if (token.is(TokenKind::FP_LITERAL)) {
-        ret = new Number(Number::FLOAT, token.text);
-        advance();
-    } else if (token.is(TokenKind::INT_LITERAL)) {
-        ret = new Number(Number::INT, token.text);
-        advance();
+        double v;
+        if (!parseFloatLiteral(token.text, v)) {
+            return error("float literal out of range: " + token.text.str());
+        }
+        ret = new Number(v, token.text);
     } else {
-        error();
-        ret = nullptr;
+        int64_t v;
+        if (!parseIntLiteral(token.text, v)) {
+            return error("integer literal out of range: " + token.text.str());
+        }
+        ret = new Number(v, token.text);
     }
+    advance();
+    ret->setSourceRange(t.offset, t.getEndOffset());
     return ret;
 }
 
@@ -177,7 +306,22 @@ Parser::Parser(Lexer& lexer)
 }
 
 AST* Parser::parse() {
-    auto e = parseExpr();
-    expect(TokenKind::EOI);
-    return e;
+    ParseError err;
+    auto ast = parse(err);
+    if (ast == nullptr) {
+        throw std::runtime_error(err.message);
+    }
+    return ast;
+}
+
+AST* Parser::parse(ParseError& err) {
+    err = ParseError();
+    failure = &err;
+    std::unique_ptr<Expr> e(parseExpr());
+    if (e != nullptr && !token.is(TokenKind::EOI)) {
+        error(token.is(TokenKind::UNKNOWN) ? "unexpected character" : "expected an operator");
+        e.reset();
+    }
+    failure = nullptr;
+    return e.release();
 }
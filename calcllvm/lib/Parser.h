@@ -3,14 +3,28 @@
 #include "AST.h"
 #include "Lexer.h"
 
+#include <string>
+
+/// Why parsing stopped, and where: the offset in the source of the token that could not be parsed.
+struct ParseError {
+    uint32_t offset = 0;
+    std::string message;
+};
+
+/**
+ * A recursive descent parser. Syntax errors do not unwind: the first one is
+ * recorded, every parse function then returns null up to parse(), and the
+ * subtrees built so far are freed on the way.
+ */
 class Parser {
     Lexer& lexer;
     Token token; // the peaked token
+    uint32_t prevEnd = 0; // end offset of the token before it
+    ParseError* failure = nullptr; // where parse(ParseError&) reports the first error
 
-    void error() const;
+    Expr* error(std::string message);
     void advance();
-    void consume(TokenKind kind);
-    bool expect(TokenKind kind) const;
+    bool consume(TokenKind kind, const char* spelling);
     bool isBuiltinFuncName(llvm::StringRef) const;
 
     Expr* parseExpr();
@@ -21,5 +35,11 @@ class Parser {
 
 public:
     Parser(Lexer& lexer);
+
+    /// Throws std::runtime_error with the message of the ParseError on a syntax error.
     AST* parse();
+
+    /// Null on a syntax error, described in `error`. Does not throw but for a failed allocation, so that dirty
+    /// input costs no more than clean input.
+    AST* parse(ParseError& error);
 };
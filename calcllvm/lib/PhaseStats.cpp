@@ -0,0 +1,169 @@
+#include "PhaseStats.h"
+
+#include <llvm/Support/Compiler.h>
+#include <llvm/Support/Format.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <sys/resource.h>
+
+namespace {
+std::atomic<uint64_t> numAllocations{0};
+std::atomic<uint64_t> numAllocatedBytes{0};
+
+class NodeCounter : public ASTVisitor {
+public:
+    size_t count = 0;
+
+    void visit(UnaryOp& e) override {
+        count++;
+        e.getExpr()->accept(*this);
+    }
+
+    void visit(BinaryOp& e) override {
+        count++;
+        e.getLeft()->accept(*this);
+        e.getRight()->accept(*this);
+    }
+
+    void visit(Conditional& e) override {
+        count++;
+        e.getCond()->accept(*this);
+        e.getLeft()->accept(*this);
+        e.getRight()->accept(*this);
+    }
+
+    void visit(FuncCall& e) override {
+        count++;
+        e.getParam()->accept(*this);
+    }
+
+    void visit(Ident&) override {
+        count++;
+    }
+
+    void visit(Number&) override {
+        count++;
+    }
+};
+
+void printJSONString(llvm::raw_ostream& os, llvm::StringRef s) {
+    os << '"';
+    os.write_escaped(s);
+    os << '"';
+}
+} // namespace
+
+void* operator new(size_t size) {
+    numAllocations.fetch_add(1, std::memory_order_relaxed);
+    numAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// not inlined into the delete expressions of this file, where GCC would see a free of memory from new
+LLVM_ATTRIBUTE_NOINLINE void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+// the sized form C++14 calls for complete types, replaced along with the unsized one
+LLVM_ATTRIBUTE_NOINLINE void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+PhaseStats::PhaseStats(llvm::StringRef tool, bool enabled)
+    : tool(tool.str())
+    , enabled(enabled)
+    , group(tool, "Phase timing") {}
+
+PhaseStats::~PhaseStats() {
+    // a TimerGroup prints its triggered timers to stderr when they are destroyed
+    group.clear();
+}
+
+PhaseStats::Scope PhaseStats::phase(llvm::StringRef name) {
+    if (!enabled) {
+        return Scope(nullptr);
+    }
+    for (auto& timer : timers) {
+        if (timer->getName() == name) {
+            return Scope(timer.get());
+        }
+    }
+    timers.push_back(std::make_unique<llvm::Timer>(name, name, group));
+    return Scope(timers.back().get());
+}
+
+void PhaseStats::setCounter(llvm::StringRef name, llvm::StringRef desc, uint64_t value) {
+    for (auto& c : counters) {
+        if (c.name == name) {
+            c.value = value;
+            return;
+        }
+    }
+    counters.push_back(Counter{name.str(), desc.str(), value});
+}
+
+void PhaseStats::print(llvm::raw_ostream& os, Format format, bool phases, bool withCounters) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    setCounter("peak-rss-kb", "Peak resident set size in KiB", usage.ru_maxrss);
+    setCounter("allocations", "Number of operator new calls", numAllocations.load(std::memory_order_relaxed));
+    setCounter("allocated-bytes", "Bytes requested from operator new",
+               numAllocatedBytes.load(std::memory_order_relaxed));
+
+    if (format == Format::TEXT) {
+        if (phases) {
+            group.print(os);
+        }
+        if (withCounters) {
+            os << "===" << std::string(73, '-') << "===\n"
+               << "                          ... Statistics Collected ...\n"
+               << "===" << std::string(73, '-') << "===\n\n";
+            for (auto& c : counters) {
+                os << llvm::format("%12llu %-16s - ", static_cast<unsigned long long>(c.value), c.name.c_str())
+                   << c.desc << "\n";
+            }
+            os << "\n";
+        }
+        return;
+    }
+
+    os << "{\"tool\": ";
+    printJSONString(os, tool);
+    if (phases) {
+        os << ", \"phases\": [";
+        const char* delim = "";
+        for (auto& timer : timers) {
+            auto time = timer->getTotalTime();
+            os << delim << "{\"name\": ";
+            printJSONString(os, timer->getName());
+            os << llvm::format(", \"wall\": %.9f, \"user\": %.9f, \"sys\": %.9f}", time.getWallTime(),
+                               time.getUserTime(), time.getSystemTime());
+            delim = ", ";
+        }
+        os << "]";
+    }
+    if (withCounters) {
+        os << ", \"counters\": {";
+        const char* delim = "";
+        for (auto& c : counters) {
+            os << delim;
+            printJSONString(os, c.name);
+            os << ": " << c.value;
+            delim = ", ";
+        }
+        os << "}";
+    }
+    os << "}\n";
+}
+
+size_t PhaseStats::countNodes(AST* ast) {
+    NodeCounter counter;
+    ast->accept(counter);
+    return counter.count;
+}
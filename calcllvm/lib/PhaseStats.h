@@ -0,0 +1,80 @@
+#pragma once
+
+#include "AST.h"
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Timer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Wall time per phase and a few counters of one tool invocation, behind the
+ * `--time-phases` and `--stats` options of calcc and calci.
+ *
+ * Phases are timed with llvm::Timer, in the order they first run. Besides the
+ * counters a tool adds, the report includes peak RSS and the number and size
+ * of allocations. They are counted by the replacement operator new that comes
+ * with this library, so only binaries that link it pay for the counting.
+ *
+ * Reports go to a raw_ostream, as an LLVM-style table or as one JSON object.
+ */
+class PhaseStats {
+public:
+    enum class Format {
+        TEXT,
+        JSON,
+    };
+
+    /// Stops the timer of its phase when it goes out of scope.
+    class Scope {
+        llvm::Timer* timer;
+
+    public:
+        explicit Scope(llvm::Timer* timer)
+            : timer(timer) {
+            if (timer != nullptr) {
+                timer->startTimer();
+            }
+        }
+        Scope(Scope&& other)
+            : timer(other.timer) {
+            other.timer = nullptr;
+        }
+        ~Scope() {
+            if (timer != nullptr) {
+                timer->stopTimer();
+            }
+        }
+    };
+
+    /// `enabled` false makes every phase() a no-op, so call sites need not check the options.
+    PhaseStats(llvm::StringRef tool, bool enabled);
+    ~PhaseStats();
+
+    Scope phase(llvm::StringRef name);
+
+    void setCounter(llvm::StringRef name, llvm::StringRef desc, uint64_t value);
+
+    /// Adds peak RSS and allocation counters and prints the phase times, the counters, or both.
+    void print(llvm::raw_ostream& os, Format format, bool phases, bool counters);
+
+    static size_t countNodes(AST* ast);
+
+private:
+    struct Counter {
+        std::string name;
+        std::string desc;
+        uint64_t value;
+    };
+
+    std::string tool;
+    bool enabled;
+    llvm::TimerGroup group;
+    std::vector<std::unique_ptr<llvm::Timer>> timers;
+    std::vector<Counter> counters;
+};
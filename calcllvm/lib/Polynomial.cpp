@@ -0,0 +1,360 @@
+#include "Polynomial.h"
+
+#include "Program.h"
+#include "Specializer.h"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Casting.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace {
+/// A coefficient times powers of variables, sorted by variable.
+struct Monomial {
+    Value coef;
+    llvm::SmallVector<std::pair<unsigned, unsigned>, 4> powers;
+};
+
+using Polynomial = std::vector<Monomial>;
+
+bool isInt(const Value& v, int64_t i) {
+    return v.isInt() && v.getInt() == i;
+}
+
+/// A coefficient that keeps the polynomial it ends up in as written, see Rewriter::isFinite. Any term it is
+/// collected with stays NaN.
+Value poisoned() {
+    return Value(std::numeric_limits<double>::quiet_NaN());
+}
+
+/// a op b folded like Program evaluates it, poisoned if it fails there: an int overflow is kept as written.
+Value fold(Program::OpCode op, Value a, const Value& b) {
+    return Program::applyBinary(op, a, b) == Status::OK ? a : poisoned();
+}
+
+Value negated(Value v) {
+    return Program::applyUnary(Program::OpCode::NEG, Builtin::UNKNOWN, v) == Status::OK ? v : poisoned();
+}
+
+/// Whether `node` can be an int where every variable is a float. Coefficients of such a subtree are int
+/// arithmetic that collecting and reordering terms would move, and with it where an int overflow happens.
+bool mayBeInt(AST* node) {
+    if (auto n = llvm::dyn_cast<Number>(node)) {
+        return n->getType() == Number::INT;
+    }
+    if (llvm::isa<Ident>(node) || llvm::isa<FuncCall>(node)) {
+        return false;
+    }
+    if (auto u = llvm::dyn_cast<UnaryOp>(node)) {
+        return u->getOp() == UnaryOp::FACT || mayBeInt(u->getExpr());
+    }
+    if (auto c = llvm::dyn_cast<Conditional>(node)) {
+        // arms of different types make a float
+        return mayBeInt(c->getLeft()) && mayBeInt(c->getRight());
+    }
+    auto b = llvm::cast<BinaryOp>(node);
+    switch (b->getOp()) {
+    case BinaryOp::PLUS:
+    case BinaryOp::MINUS:
+    case BinaryOp::MUL:
+    case BinaryOp::DIV:
+    case BinaryOp::POW:
+        return mayBeInt(b->getLeft()) && mayBeInt(b->getRight());
+    default:
+        // comparisons, && and || are 0 or 1, % only works on ints
+        return true;
+    }
+}
+
+class Rewriter {
+    llvm::StringSaver& saver;
+
+    // the variables of the polynomials: identifiers, and the subtrees that are not polynomials, rewritten
+    std::vector<llvm::StringRef> names; // empty for a subtree
+    std::vector<Expr*> subtrees;        // null for an identifier
+    llvm::StringMap<unsigned> identIndex;
+    llvm::DenseMap<AST*, Expr*> rewritten; // subtree variables by the node they were rewritten from
+
+public:
+    explicit Rewriter(llvm::StringSaver& saver)
+        : saver(saver) {}
+
+    Expr* rewrite(AST* node) {
+        int cost = 0;
+        auto p = toPolynomial(node, cost);
+        return finish(p, node, cost);
+    }
+
+private:
+    /// The Horner form of `p` if it is cheaper than `node`, which computes it in `cost` operations, else `node`
+    /// as written.
+    Expr* finish(const Polynomial& p, AST* node, int cost) {
+        int hornerCost = 0;
+        if (isFinite(p) && (horner(p, false, hornerCost), hornerCost < cost)) {
+            return horner(p, true, hornerCost);
+        }
+        return rebuild(node);
+    }
+
+    /// The polynomial `node` computes, adding the operations it takes as written to `cost`.
+    Polynomial toPolynomial(AST* node, int& cost) {
+        if (auto n = llvm::dyn_cast<Number>(node)) {
+            return {Monomial{n->getType() == Number::INT ? Value(n->getInt()) : Value(n->getFloat()), {}}};
+        }
+        if (auto id = llvm::dyn_cast<Ident>(node)) {
+            auto it = identIndex.try_emplace(id->getName(), static_cast<unsigned>(names.size()));
+            if (it.second) {
+                names.push_back(id->getName());
+                subtrees.push_back(nullptr);
+            }
+            return {Monomial{Value(int64_t(1)), {{it.first->getValue(), 1}}}};
+        }
+        if (auto u = llvm::dyn_cast<UnaryOp>(node)) {
+            if (u->getOp() == UnaryOp::POS) {
+                return toPolynomial(u->getExpr(), cost);
+            }
+            if (u->getOp() == UnaryOp::NEG) {
+                auto p = toPolynomial(u->getExpr(), cost);
+                for (auto& m : p) {
+                    m.coef = negated(m.coef);
+                }
+                cost++;
+                return p;
+            }
+        }
+        if (auto b = llvm::dyn_cast<BinaryOp>(node)) {
+            auto op = b->getOp();
+            if (op == BinaryOp::PLUS || op == BinaryOp::MINUS) {
+                auto p = toPolynomial(b->getLeft(), cost);
+                auto q = toPolynomial(b->getRight(), cost);
+                for (auto& m : q) {
+                    add(p, op == BinaryOp::PLUS ? m : Monomial{negated(m.coef), m.powers});
+                }
+                cost++;
+                return p;
+            }
+            if (op == BinaryOp::MUL) {
+                int lhsCost = 0;
+                int rhsCost = 0;
+                auto p = toPolynomial(b->getLeft(), lhsCost);
+                auto q = toPolynomial(b->getRight(), rhsCost);
+                // distributing a term over a sum copies its variables, which a subtree cannot be
+                if ((p.size() == 1 && (q.size() == 1 || onlyIdents(p[0]))) || (q.size() == 1 && onlyIdents(q[0]))) {
+                    cost += lhsCost + rhsCost + 1;
+                    return multiply(p, q);
+                }
+                return subtree(node, new BinaryOp(op, finish(p, b->getLeft(), lhsCost),
+                                                  finish(q, b->getRight(), rhsCost)));
+            }
+            auto exponent = llvm::dyn_cast<Number>(b->getRight());
+            if (op == BinaryOp::POW && exponent != nullptr && exponent->getType() == Number::INT &&
+                exponent->getInt() >= 1 && exponent->getInt() <= PolynomialRewriter::kMaxDegree) {
+                auto k = static_cast<unsigned>(exponent->getInt());
+                int baseCost = 0;
+                auto p = toPolynomial(b->getLeft(), baseCost);
+                // only a product of identifiers, a coefficient other than an int 1 would change how ^ computes
+                if (p.size() == 1 && isInt(p[0].coef, 1) && onlyIdents(p[0]) &&
+                    degree(p[0]) * k <= PolynomialRewriter::kMaxDegree) {
+                    for (auto& power : p[0].powers) {
+                        power.second *= k;
+                    }
+                    cost += baseCost + PolynomialRewriter::kPowCost;
+                    return p;
+                }
+                return subtree(node, new BinaryOp(op, finish(p, b->getLeft(), baseCost), rebuild(exponent)));
+            }
+        }
+        return subtree(node, rewriteChildren(node));
+    }
+
+    /// A variable standing for `rewrittenNode`, the rewritten `node`. One that can be an int keeps the polynomial
+    /// around it as written.
+    Polynomial subtree(AST* node, Expr* rewrittenNode) {
+        auto index = static_cast<unsigned>(names.size());
+        names.push_back({});
+        subtrees.push_back(rewrittenNode);
+        rewritten[node] = rewrittenNode;
+        return {Monomial{mayBeInt(node) ? poisoned() : Value(int64_t(1)), {{index, 1}}}};
+    }
+
+    /// A node that is not part of a polynomial, with its children rewritten as polynomials of their own.
+    Expr* rewriteChildren(AST* node) {
+        if (auto u = llvm::dyn_cast<UnaryOp>(node)) {
+            return new UnaryOp(u->getOp(), rewrite(u->getExpr()));
+        }
+        if (auto b = llvm::dyn_cast<BinaryOp>(node)) {
+            return new BinaryOp(b->getOp(), rewrite(b->getLeft()), rewrite(b->getRight()));
+        }
+        if (auto c = llvm::dyn_cast<Conditional>(node)) {
+            return new Conditional(rewrite(c->getCond()), rewrite(c->getLeft()), rewrite(c->getRight()));
+        }
+        if (auto f = llvm::dyn_cast<FuncCall>(node)) {
+            return new FuncCall(f->getName(), rewrite(f->getParam()));
+        }
+        return rebuild(node);
+    }
+
+    /// `node` as written, with the subtrees that are not polynomials rewritten.
+    Expr* rebuild(AST* node) {
+        auto it = rewritten.find(node);
+        if (it != rewritten.end()) {
+            return it->second;
+        }
+        if (auto n = llvm::dyn_cast<Number>(node)) {
+            return n->getType() == Number::INT ? new Number(n->getInt(), n->getText())
+                                               : new Number(n->getFloat(), n->getText());
+        }
+        if (auto id = llvm::dyn_cast<Ident>(node)) {
+            return new Ident(id->getName());
+        }
+        if (auto u = llvm::dyn_cast<UnaryOp>(node)) {
+            return new UnaryOp(u->getOp(), rebuild(u->getExpr()));
+        }
+        auto b = llvm::cast<BinaryOp>(node);
+        return new BinaryOp(b->getOp(), rebuild(b->getLeft()), rebuild(b->getRight()));
+    }
+
+    bool onlyIdents(const Monomial& m) const {
+        for (auto& power : m.powers) {
+            if (subtrees[power.first] != nullptr) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static unsigned degree(const Monomial& m) {
+        unsigned d = 0;
+        for (auto& power : m.powers) {
+            d += power.second;
+        }
+        return d;
+    }
+
+    /// Literal coefficients that could not be written back, such as an overflow to infinity, or that could not be
+    /// folded, keep the original.
+    static bool isFinite(const Polynomial& p) {
+        for (auto& m : p) {
+            if (!m.coef.isInt() && !std::isfinite(m.coef.getFloat())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// p += m, collecting like terms.
+    static void add(Polynomial& p, const Monomial& m) {
+        for (auto& n : p) {
+            if (n.powers == m.powers) {
+                n.coef = fold(Program::OpCode::ADD, n.coef, m.coef);
+                return;
+            }
+        }
+        p.push_back(m);
+    }
+
+    static Polynomial multiply(const Polynomial& p, const Polynomial& q) {
+        Polynomial product;
+        for (auto& a : p) {
+            for (auto& b : q) {
+                Monomial m{fold(Program::OpCode::MUL, a.coef, b.coef), a.powers};
+                for (auto& power : b.powers) {
+                    auto it = std::lower_bound(m.powers.begin(), m.powers.end(), std::make_pair(power.first, 0u));
+                    if (it != m.powers.end() && it->first == power.first) {
+                        it->second += power.second;
+                    } else {
+                        m.powers.insert(it, power);
+                    }
+                }
+                add(product, m);
+            }
+        }
+        return product;
+    }
+
+    /// The Horner form of `p`, in the variable of highest degree with the coefficients in the others. Adds its
+    /// operations to `cost`, and only builds it if `build` is set.
+    Expr* horner(const Polynomial& p, bool build, int& cost) {
+        if (p.size() == 1 && p[0].powers.empty()) {
+            return build ? Specializer::literal(p[0].coef, saver) : nullptr;
+        }
+
+        // highest degree first, then the variable in most terms, then the one seen first
+        std::map<unsigned, std::pair<unsigned, unsigned>> stats;
+        for (auto& m : p) {
+            for (auto& power : m.powers) {
+                auto& s = stats[power.first];
+                s.first = std::max(s.first, power.second);
+                s.second++;
+            }
+        }
+        auto v = stats.begin()->first;
+        for (auto& s : stats) {
+            if (s.second > stats[v]) {
+                v = s.first;
+            }
+        }
+
+        std::map<unsigned, Polynomial> byDegree;
+        for (auto& m : p) {
+            Monomial rest{m.coef, {}};
+            unsigned d = 0;
+            for (auto& power : m.powers) {
+                if (power.first == v) {
+                    d = power.second;
+                } else {
+                    rest.powers.push_back(power);
+                }
+            }
+            byDegree[d].push_back(rest);
+        }
+
+        auto var = [&]() -> Expr* {
+            if (!build) {
+                return nullptr;
+            }
+            return subtrees[v] != nullptr ? subtrees[v] : new Ident(names[v]);
+        };
+        auto binary = [&](BinaryOp::Op op, Expr* lhs, Expr* rhs) -> Expr* {
+            cost++;
+            return build ? new BinaryOp(op, lhs, rhs) : nullptr;
+        };
+
+        unsigned n = byDegree.rbegin()->first;
+        auto& lead = byDegree[n];
+        Expr* acc;
+        if (lead.size() == 1 && lead[0].powers.empty() && isInt(lead[0].coef, 1)) {
+            acc = var();
+        } else if (lead.size() == 1 && lead[0].powers.empty() && isInt(lead[0].coef, -1)) {
+            cost++;
+            acc = build ? new UnaryOp(UnaryOp::NEG, var()) : nullptr;
+        } else {
+            auto coef = horner(lead, build, cost);
+            acc = binary(BinaryOp::MUL, coef, var());
+        }
+        for (unsigned d = n; d-- > 0;) {
+            auto it = byDegree.find(d);
+            if (it != byDegree.end()) {
+                auto coef = horner(it->second, build, cost);
+                acc = binary(BinaryOp::PLUS, acc, coef);
+            }
+            if (d > 0) {
+                acc = binary(BinaryOp::MUL, acc, var());
+            }
+        }
+        return acc;
+    }
+};
+} // namespace
+
+std::unique_ptr<AST> PolynomialRewriter::rewrite(AST* ast) {
+    Rewriter rewriter(saver);
+    return std::unique_ptr<AST>(rewriter.rewrite(ast));
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "AST.h"
+
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/StringSaver.h>
+
+#include <memory>
+
+/**
+ * Rewrites the polynomials of an expression into Horner form.
+ *
+ * A polynomial is a subtree built from literals, variables, `+`, `-`, `*`,
+ * negation and `^` to an int literal from 1 to kMaxDegree. Any other subtree,
+ * say `sin(y)` or `x / 2`, is rewritten on its own and stands for one more
+ * variable of the polynomial around it, used once and only to the first power,
+ * since a tree cannot share it. Products of sums are not expanded.
+ *
+ * Several variables are handled recursively: the polynomial is written in
+ * Horner form in the variable of highest degree, with the coefficient of every
+ * power a polynomial in the others, so `a*x^3 + b*x^2 + c*x + d` becomes
+ * `((a*x + b)*x + c)*x + d`, three multiplications and three additions instead
+ * of two calls to pow. Like terms are collected and literal coefficients folded.
+ * A polynomial is only rewritten if that takes fewer operations, counting a `^`
+ * as kPowCost of them.
+ *
+ * This changes rounding: the powers are products and the sums are reordered,
+ * and where ints and floats mix, an int product may become a float one. Only
+ * use it where the caller asked for fast floating point, see calc_options and
+ * calcc --fast-fp.
+ *
+ * Errors are kept where every variable is a float: no subtree is dropped, a
+ * term whose coefficient cancels to 0 stays as a product by 0, and literal
+ * coefficients are folded the way Program evaluates them. A polynomial is kept
+ * as written if folding one fails, say on an int overflow, or if it has a
+ * subtree that can be an int, such as a comparison. Terms of a variable bound as
+ * an int are still collected and reordered, which moves or cancels its int
+ * overflows, so calc_compile evaluates rows with an int input as written.
+ */
+class PolynomialRewriter {
+public:
+    static constexpr int kMaxDegree = 64;
+    static constexpr int kPowCost = 8;
+
+    /// A copy of `ast` with its polynomials rewritten. Names and literal text point into `ast`'s source or into
+    /// this rewriter, which must both outlive the copy.
+    std::unique_ptr<AST> rewrite(AST* ast);
+
+private:
+    llvm::BumpPtrAllocator allocator;
+    llvm::StringSaver saver{allocator};
+};
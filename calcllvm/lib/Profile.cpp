@@ -0,0 +1,148 @@
+#include "Profile.h"
+
+#include <llvm/Support/Casting.h>
+#include <llvm/Support/Format.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+// shares of the root's total time from which a node's own time is highlighted
+constexpr double kHot = 0.20;
+constexpr double kWarm = 0.05;
+
+std::vector<AST*> children(AST* node) {
+    if (auto e = llvm::dyn_cast<UnaryOp>(node)) {
+        return {e->getExpr()};
+    }
+    if (auto e = llvm::dyn_cast<BinaryOp>(node)) {
+        return {e->getLeft(), e->getRight()};
+    }
+    if (auto e = llvm::dyn_cast<Conditional>(node)) {
+        return {e->getCond(), e->getLeft(), e->getRight()};
+    }
+    if (auto e = llvm::dyn_cast<FuncCall>(node)) {
+        return {e->getParam()};
+    }
+    return {};
+}
+
+llvm::StringRef spanOf(llvm::StringRef source, const AST* node) {
+    return source.slice(node->getBegin(), node->getEnd());
+}
+
+/// A flame graph frame: the span with whitespace squeezed, shortened, and its offset to keep equal texts apart.
+std::string frameOf(llvm::StringRef source, const AST* node) {
+    std::string text;
+    for (char c : spanOf(source, node)) {
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            continue;
+        }
+        text.push_back(c == ';' ? ',' : c);
+    }
+    if (text.size() > 40) {
+        text = text.substr(0, 37) + "...";
+    }
+    if (text.empty()) {
+        text = "?";
+    }
+    return text + " @" + std::to_string(node->getBegin());
+}
+
+void preorder(AST* node, std::vector<AST*>& out) {
+    out.push_back(node);
+    for (auto child : children(node)) {
+        preorder(child, out);
+    }
+}
+
+void collapse(const Profile& profile, llvm::raw_ostream& os, llvm::StringRef source, AST* node, std::string& stack) {
+    auto size = stack.size();
+    if (!stack.empty()) {
+        stack += ';';
+    }
+    stack += frameOf(source, node);
+    auto e = profile.get(node);
+    if (e.selfNs > 0) {
+        os << stack << ' ' << e.selfNs << '\n';
+    }
+    for (auto child : children(node)) {
+        collapse(profile, os, source, child, stack);
+    }
+    stack.resize(size);
+}
+
+double percent(uint64_t part, uint64_t whole) {
+    return whole == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(whole);
+}
+} // namespace
+
+Profile::Entry Profile::get(const AST* node) const {
+    auto it = nodes.find(node);
+    return it != nodes.end() ? it->second : Entry{};
+}
+
+void Profile::printAnnotated(llvm::raw_ostream& os, llvm::StringRef source, AST* root, bool color) const {
+    uint64_t total = get(root).totalNs;
+    std::vector<AST*> all;
+    preorder(root, all);
+
+    // the innermost node covering each character; children come after their parent in preorder
+    std::vector<const AST*> owner(source.size(), nullptr);
+    for (auto node : all) {
+        for (auto i = node->getBegin(); i < node->getEnd() && i < source.size(); i++) {
+            owner[i] = node;
+        }
+    }
+    auto heatAt = [&](size_t i) {
+        return owner[i] == nullptr ? 0.0 : percent(get(owner[i]).selfNs, total) / 100.0;
+    };
+
+    if (color) {
+        for (size_t i = 0; i < source.size(); i++) {
+            double heat = heatAt(i);
+            if (heat >= kHot) {
+                os.changeColor(llvm::raw_ostream::RED, /*Bold=*/true);
+            } else if (heat >= kWarm) {
+                os.changeColor(llvm::raw_ostream::YELLOW);
+            }
+            os << source[i];
+            os.resetColor();
+        }
+        os << "\n";
+    } else {
+        os << source << "\n";
+        std::string marks;
+        for (size_t i = 0; i < source.size(); i++) {
+            double heat = heatAt(i);
+            marks.push_back(heat >= kHot ? '#' : (heat >= kWarm ? '+' : ' '));
+        }
+        os << llvm::StringRef(marks).rtrim() << "\n";
+    }
+
+    std::stable_sort(all.begin(), all.end(),
+                     [&](const AST* a, const AST* b) { return get(a).selfNs > get(b).selfNs; });
+    os << "\n   self%  total%      count  span\n";
+    for (auto node : all) {
+        auto e = get(node);
+        os << llvm::format("  %5.1f%%  %5.1f%%  %9llu  ", percent(e.selfNs, total), percent(e.totalNs, total),
+                           static_cast<unsigned long long>(e.count))
+           << spanOf(source, node) << "\n";
+    }
+
+    if (!builtins.empty()) {
+        os << "\n   self%      count     ns/call  builtin\n";
+        for (auto& it : builtins) {
+            auto& e = it.second;
+            os << llvm::format("  %5.1f%%  %9llu  %10.1f  ", percent(e.selfNs, total),
+                               static_cast<unsigned long long>(e.count),
+                               e.count == 0 ? 0.0 : static_cast<double>(e.selfNs) / e.count)
+               << it.first << "\n";
+        }
+    }
+}
+
+void Profile::printCollapsedStacks(llvm::raw_ostream& os, llvm::StringRef source, AST* root) const {
+    std::string stack;
+    collapse(*this, os, source, root, stack);
+}
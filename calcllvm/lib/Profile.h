@@ -0,0 +1,59 @@
+#pragma once
+
+#include "AST.h"
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Evaluation counts and time per AST node and per builtin, filled in by an
+ * instrumented evaluator (ProfilingInterpretVisitor for calci).
+ *
+ * Total time of a node includes its children, self time does not. Reports map
+ * nodes back to the expression text with the source ranges the parser records:
+ *
+ *  - printAnnotated() shows the text with every character shaded by the self
+ *    time of the innermost node covering it, followed by a table of nodes and
+ *    one of builtins;
+ *  - printCollapsedStacks() writes one `frame;frame;frame self_ns` line per
+ *    node, the input format of flamegraph.pl and speedscope.
+ */
+class Profile {
+public:
+    struct Entry {
+        uint64_t count = 0;
+        uint64_t totalNs = 0;
+        uint64_t selfNs = 0;
+    };
+
+    void record(const AST* node, uint64_t totalNs, uint64_t selfNs) {
+        auto& e = nodes[node];
+        e.count++;
+        e.totalNs += totalNs;
+        e.selfNs += selfNs;
+    }
+
+    void recordBuiltin(llvm::StringRef name, uint64_t ns) {
+        auto& e = builtins[name.str()];
+        e.count++;
+        e.totalNs += ns;
+        e.selfNs += ns;
+    }
+
+    /// The entry of `node`, all zero if it never ran.
+    Entry get(const AST* node) const;
+
+    /// `color` highlights hot spans with terminal colors, otherwise they are marked on a line below the text.
+    void printAnnotated(llvm::raw_ostream& os, llvm::StringRef source, AST* root, bool color) const;
+
+    void printCollapsedStacks(llvm::raw_ostream& os, llvm::StringRef source, AST* root) const;
+
+private:
+    std::unordered_map<const AST*, Entry> nodes;
+    std::map<std::string, Entry> builtins;
+};
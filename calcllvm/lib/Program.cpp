@@ -0,0 +1,137 @@
+#include "Program.h"
+
+#include <algorithm>
+#include <type_traits>
+
+namespace {
+class ProgramBuilder : public ASTVisitor {
+    std::vector<Program::Inst>& insts;
+    std::vector<std::string>& vars;
+    bool fixedVars;
+    int depth = 0;
+
+public:
+    Status status = Status::OK;
+
+    ProgramBuilder(std::vector<Program::Inst>& insts, std::vector<std::string>& vars)
+        : insts(insts)
+        , vars(vars)
+        , fixedVars(!vars.empty()) {}
+
+    void visit(UnaryOp& e) override {
+        e.getExpr()->accept(*this);
+        if (e.getOp() != UnaryOp::POS) {
+            emit(Program::toOpCode(e.getOp()), 0);
+        }
+    }
+
+    void visit(BinaryOp& e) override {
+        e.getLeft()->accept(*this);
+        e.getRight()->accept(*this);
+        emit(Program::toOpCode(e.getOp()), -1);
+    }
+
+    void visit(Conditional& e) override {
+        e.getCond()->accept(*this);
+        e.getLeft()->accept(*this);
+        e.getRight()->accept(*this);
+        emit(Program::OpCode::SELECT, -2);
+    }
+
+    void visit(FuncCall& e) override {
+        e.getParam()->accept(*this);
+        auto func = lookupBuiltin(e.getName());
+        if (func == Builtin::UNKNOWN) {
+            fail(Status::PARSE_ERROR);
+            return;
+        }
+        emit(Program::OpCode::CALL, 0).func = func;
+    }
+
+    void visit(Ident& e) override {
+        auto it = std::find(vars.begin(), vars.end(), e.getName());
+        if (it == vars.end()) {
+            if (fixedVars) {
+                fail(Status::UNKNOWN_VARIABLE);
+                return;
+            }
+            it = vars.insert(vars.end(), e.getName().str());
+        }
+        emit(Program::OpCode::LOAD, 1).index = static_cast<uint32_t>(it - vars.begin());
+    }
+
+    void visit(Number& e) override {
+        emit(Program::OpCode::PUSH, 1).imm = e.getType() == Number::INT ? Value(e.getInt()) : Value(e.getFloat());
+    }
+
+private:
+    Program::Inst& emit(Program::OpCode op, int stackEffect) {
+        depth += stackEffect;
+        if (depth > Program::kMaxStackDepth) {
+            fail(Status::TOO_COMPLEX);
+        }
+        insts.push_back(Program::Inst{op, Builtin::UNKNOWN, 0, Value()});
+        return insts.back();
+    }
+
+    void fail(Status s) {
+        if (status == Status::OK) {
+            status = s;
+        }
+    }
+};
+
+static_assert(std::is_trivially_copyable<Value>::value, "Program::evaluate keeps Values in raw storage");
+} // namespace
+
+Status Program::compile(AST* ast, llvm::ArrayRef<std::string> names, Program& out) {
+    out.insts.clear();
+    out.vars.assign(names.begin(), names.end());
+    ProgramBuilder builder(out.insts, out.vars);
+    ast->accept(builder);
+    return builder.status;
+}
+
+Status Program::evaluate(const double* vars, Value& out) const {
+    return evaluate(insts, vars, out);
+}
+
+Status Program::evaluate(llvm::ArrayRef<Inst> insts, const double* vars, Value& out) {
+    // Value is trivially copyable; leave the stack uninitialized rather than constructing kMaxStackDepth NaNs per call
+    std::aligned_storage<sizeof(Value), alignof(Value)>::type storage[kMaxStackDepth];
+    auto stack = reinterpret_cast<Value*>(storage);
+    int sp = 0;
+    for (const auto& inst : insts) {
+        Status s = Status::OK;
+        switch (inst.op) {
+        case OpCode::PUSH:
+            stack[sp++] = inst.imm;
+            break;
+        case OpCode::LOAD:
+            stack[sp++] = bindVariable(vars[inst.index]);
+            break;
+        case OpCode::NEG:
+        case OpCode::FACT:
+        case OpCode::CALL:
+            s = applyUnary(inst.op, inst.func, stack[sp - 1]);
+            break;
+        case OpCode::SELECT:
+            sp -= 2;
+            applySelect(stack[sp - 1], stack[sp], stack[sp + 1]);
+            break;
+        default:
+            sp -= 1;
+            s = applyBinary(inst.op, stack[sp - 1], stack[sp]);
+            break;
+        }
+        if (s != Status::OK) {
+            return s;
+        }
+    }
+
+    if (sp != 1) {
+        return Status::INVALID_ARGUMENT;
+    }
+    out = stack[0];
+    return Status::OK;
+}
@@ -0,0 +1,328 @@
+#pragma once
+
+#include "AST.h"
+#include "Builtins.h"
+#include "Value.h"
+
+#include <llvm/ADT/ArrayRef.h>
+
+#include <string>
+#include <vector>
+
+enum class Status : int {
+    OK = 0,
+    PARSE_ERROR,
+    UNKNOWN_VARIABLE,
+    TOO_COMPLEX,
+    DOMAIN_ERROR,
+    INVALID_ARGUMENT,
+};
+
+/**
+ * A flat, postfix encoding of an expression, evaluated on a fixed-size value
+ * stack. Once compiled, a Program is immutable: evaluate() neither allocates nor
+ * throws, so one Program can be evaluated from many threads at the same time.
+ *
+ * Variables are read from a `const double*` indexed by slot. Following calci,
+ * which reads "3" as an int and "3.0" as a float, an integral input is bound as
+ * an int and anything else as a float.
+ */
+class Program {
+public:
+    enum class OpCode : uint8_t {
+        PUSH, // push imm
+        LOAD, // push vars[index]
+        NEG,
+        FACT,
+        CALL, // apply func to the top of the stack
+        ADD,
+        SUB,
+        MUL,
+        DIV,
+        POW,
+        MOD,
+        LT,
+        LE,
+        GT,
+        GE,
+        EQ,
+        NE,
+        AND,
+        OR,
+        SELECT, // pop b, a, c and push c ? a : b
+    };
+
+    struct Inst {
+        OpCode op;
+        Builtin func;
+        uint32_t index;
+        Value imm;
+    };
+
+    static constexpr int kMaxStackDepth = 64;
+
+    /// Compiles `ast`. If `names` is not empty it fixes the variable slots and any other
+    /// identifier is an error, otherwise slots are assigned in order of first appearance.
+    static Status compile(AST* ast, llvm::ArrayRef<std::string> names, Program& out);
+
+    static bool isBoundAsInt(double v);
+    static Value bindVariable(double v);
+
+    static OpCode toOpCode(UnaryOp::Op op);
+    static OpCode toOpCode(BinaryOp::Op op);
+
+    /// NEG, FACT or CALL on `v` in place. Reports a DOMAIN_ERROR where the Value operators would
+    /// throw or the int operation is undefined, an int result that does not fit in an int64 included.
+    static Status applyUnary(OpCode op, Builtin func, Value& v);
+
+    /// A binary opcode on `lhs` in place, checked like applyUnary.
+    static Status applyBinary(OpCode op, Value& lhs, const Value& rhs);
+
+    /// `cond ? lhs : rhs` in `cond`, with the semantics described in AST.h.
+    static void applySelect(Value& cond, const Value& lhs, const Value& rhs);
+
+    /// n! in `out` for n >= 0, false if it does not fit in an int64: past 20!, without computing it.
+    static bool factorialInt(int64_t n, int64_t& out);
+
+    /// b^e in `out` for e >= 1, false if it does not fit in an int64.
+    static bool powInt(int64_t b, int64_t e, int64_t& out);
+
+    static bool isTrue(const Value& v) {
+        return v.isInt() ? v.getInt() != 0 : v.getFloat() != 0.0;
+    }
+
+    /// The comparison opcode `op` on a and b.
+    template <typename T>
+    static bool compare(OpCode op, T a, T b);
+
+    Status evaluate(const double* vars, Value& out) const;
+
+    /// Evaluates instructions of a Program, or a subtree of them.
+    static Status evaluate(llvm::ArrayRef<Inst> insts, const double* vars, Value& out);
+
+    size_t getNumVars() const {
+        return vars.size();
+    }
+
+    const std::string& getVarName(size_t i) const {
+        return vars[i];
+    }
+
+    llvm::ArrayRef<Inst> getInsts() const {
+        return insts;
+    }
+
+private:
+    std::vector<Inst> insts;
+    std::vector<std::string> vars;
+};
+
+inline bool Program::isBoundAsInt(double v) {
+    return v == std::trunc(v) && v >= -9.2233720368547758e18 && v < 9.2233720368547758e18;
+}
+
+inline Value Program::bindVariable(double v) {
+    return isBoundAsInt(v) ? Value(static_cast<int64_t>(v)) : Value(v);
+}
+
+inline Program::OpCode Program::toOpCode(UnaryOp::Op op) {
+    // POS has no opcode of its own, the builder emits nothing for it
+    return op == UnaryOp::FACT ? OpCode::FACT : OpCode::NEG;
+}
+
+inline Program::OpCode Program::toOpCode(BinaryOp::Op op) {
+    switch (op) {
+    case BinaryOp::PLUS:
+        return OpCode::ADD;
+    case BinaryOp::MINUS:
+        return OpCode::SUB;
+    case BinaryOp::MUL:
+        return OpCode::MUL;
+    case BinaryOp::DIV:
+        return OpCode::DIV;
+    case BinaryOp::POW:
+        return OpCode::POW;
+    case BinaryOp::MOD:
+        return OpCode::MOD;
+    case BinaryOp::LT:
+        return OpCode::LT;
+    case BinaryOp::LE:
+        return OpCode::LE;
+    case BinaryOp::GT:
+        return OpCode::GT;
+    case BinaryOp::GE:
+        return OpCode::GE;
+    case BinaryOp::EQ:
+        return OpCode::EQ;
+    case BinaryOp::NE:
+        return OpCode::NE;
+    case BinaryOp::AND:
+        return OpCode::AND;
+    case BinaryOp::OR:
+        return OpCode::OR;
+    }
+    return OpCode::ADD;
+}
+
+template <typename T>
+inline bool Program::compare(OpCode op, T a, T b) {
+    switch (op) {
+    case OpCode::LT:
+        return a < b;
+    case OpCode::LE:
+        return a <= b;
+    case OpCode::GT:
+        return a > b;
+    case OpCode::GE:
+        return a >= b;
+    case OpCode::EQ:
+        return a == b;
+    default:
+        return a != b;
+    }
+}
+
+inline Status Program::applyUnary(OpCode op, Builtin func, Value& v) {
+    switch (op) {
+    case OpCode::NEG:
+        if (v.isInt() && v.getInt() == std::numeric_limits<int64_t>::min()) {
+            return Status::DOMAIN_ERROR;
+        }
+        v = negate(v);
+        return Status::OK;
+    case OpCode::FACT: {
+        int64_t result;
+        if (!v.isInt() || v.getInt() < 0 || !factorialInt(v.getInt(), result)) {
+            return Status::DOMAIN_ERROR;
+        }
+        v = Value(result);
+        return Status::OK;
+    }
+    case OpCode::CALL:
+        v = Value(applyBuiltin(func, v.getFloat()));
+        return Status::OK;
+    default:
+        return Status::INVALID_ARGUMENT;
+    }
+}
+
+inline Status Program::applyBinary(OpCode op, Value& lhs, const Value& rhs) {
+    bool bothInt = lhs.isInt() && rhs.isInt();
+    auto isIntDivByZeroOrOverflow = [&]() {
+        return rhs.getInt() == 0 || (lhs.getInt() == std::numeric_limits<int64_t>::min() && rhs.getInt() == -1);
+    };
+
+    int64_t result;
+
+    switch (op) {
+    case OpCode::ADD:
+        if (bothInt) {
+            if (__builtin_add_overflow(lhs.getInt(), rhs.getInt(), &result)) {
+                return Status::DOMAIN_ERROR;
+            }
+            lhs = Value(result);
+            return Status::OK;
+        }
+        lhs = lhs + rhs;
+        return Status::OK;
+    case OpCode::SUB:
+        if (bothInt) {
+            if (__builtin_sub_overflow(lhs.getInt(), rhs.getInt(), &result)) {
+                return Status::DOMAIN_ERROR;
+            }
+            lhs = Value(result);
+            return Status::OK;
+        }
+        lhs = lhs - rhs;
+        return Status::OK;
+    case OpCode::MUL:
+        if (bothInt) {
+            if (__builtin_mul_overflow(lhs.getInt(), rhs.getInt(), &result)) {
+                return Status::DOMAIN_ERROR;
+            }
+            lhs = Value(result);
+            return Status::OK;
+        }
+        lhs = lhs * rhs;
+        return Status::OK;
+    case OpCode::DIV:
+        if (bothInt && isIntDivByZeroOrOverflow()) {
+            return Status::DOMAIN_ERROR;
+        }
+        lhs = lhs / rhs;
+        return Status::OK;
+    case OpCode::MOD:
+        if (!bothInt || isIntDivByZeroOrOverflow()) {
+            return Status::DOMAIN_ERROR;
+        }
+        lhs = lhs % rhs;
+        return Status::OK;
+    case OpCode::POW:
+        if (bothInt) {
+            if (rhs.getInt() < 0 || (lhs.getInt() == 0 && rhs.getInt() == 0)) {
+                return Status::DOMAIN_ERROR;
+            }
+            if (rhs.getInt() == 0) {
+                lhs = Value(static_cast<int64_t>(1));
+                return Status::OK;
+            }
+            if (!powInt(lhs.getInt(), rhs.getInt(), result)) {
+                return Status::DOMAIN_ERROR;
+            }
+            lhs = Value(result);
+            return Status::OK;
+        }
+        lhs = lhs ^ rhs;
+        return Status::OK;
+    case OpCode::AND:
+        lhs = Value(static_cast<int64_t>(isTrue(lhs) && isTrue(rhs)));
+        return Status::OK;
+    case OpCode::OR:
+        lhs = Value(static_cast<int64_t>(isTrue(lhs) || isTrue(rhs)));
+        return Status::OK;
+    case OpCode::LT:
+    case OpCode::LE:
+    case OpCode::GT:
+    case OpCode::GE:
+    case OpCode::EQ:
+    case OpCode::NE:
+        lhs = Value(static_cast<int64_t>(bothInt ? compare(op, lhs.getInt(), rhs.getInt())
+                                                 : compare(op, lhs.getFloat(), rhs.getFloat())));
+        return Status::OK;
+    default:
+        return Status::INVALID_ARGUMENT;
+    }
+}
+
+inline void Program::applySelect(Value& cond, const Value& lhs, const Value& rhs) {
+    const Value& v = isTrue(cond) ? lhs : rhs;
+    cond = lhs.isInt() == rhs.isInt() ? v : Value(v.getFloat());
+}
+
+inline bool Program::factorialInt(int64_t n, int64_t& out) {
+    if (n > 20) {
+        return false;
+    }
+    out = 1;
+    for (int64_t j = 2; j <= n; j++) {
+        out *= j;
+    }
+    return true;
+}
+
+inline bool Program::powInt(int64_t b, int64_t e, int64_t& out) {
+    // by squaring, the base only squared while a higher bit of e is left to use it
+    out = 1;
+    for (;;) {
+        if ((e & 1) != 0 && __builtin_mul_overflow(out, b, &out)) {
+            return false;
+        }
+        e >>= 1;
+        if (e == 0) {
+            return true;
+        }
+        if (__builtin_mul_overflow(b, b, &b)) {
+            return false;
+        }
+    }
+}
@@ -0,0 +1,274 @@
+#include "RangeAnalysis.h"
+#include "Builtins.h"
+
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+
+namespace {
+constexpr double kMaxExactInt = 9007199254740992.0; // 2^53
+const double kPi = std::acos(-1.0);
+
+Range::Kind combine(Range::Kind a, Range::Kind b) {
+    if (a == Range::INT && b == Range::INT) {
+        return Range::INT;
+    }
+    if (a == Range::FLOAT || b == Range::FLOAT) {
+        return Range::FLOAT;
+    }
+    return Range::ANY;
+}
+
+/// The smallest range of `kind` holding all of `candidates`, or the unbounded one if a candidate is NaN or an int
+/// bound is not exact.
+Range hull(Range::Kind kind, std::initializer_list<double> candidates) {
+    double lo = std::numeric_limits<double>::infinity();
+    double hi = -lo;
+    for (double c : candidates) {
+        if (std::isnan(c)) {
+            return Range::top(kind);
+        }
+        lo = std::min(lo, c);
+        hi = std::max(hi, c);
+    }
+    if (kind != Range::FLOAT && (lo < -kMaxExactInt || hi > kMaxExactInt)) {
+        return Range::top(kind);
+    }
+    return Range{kind, lo, hi};
+}
+
+double maxAbs(const Range& r) {
+    return std::max(std::abs(r.lo), std::abs(r.hi));
+}
+} // namespace
+
+class RangeVisitor : public ASTVisitor {
+    RangeAnalysis& analysis;
+
+public:
+    Range result = Range::top(Range::ANY);
+
+    explicit RangeVisitor(RangeAnalysis& analysis)
+        : analysis(analysis) {}
+
+    Range analyze(AST* e) {
+        e->accept(*this);
+        analysis.ranges[e] = result;
+        return result;
+    }
+
+    void visit(UnaryOp& e) override {
+        Range r = analyze(e.getExpr());
+        switch (e.getOp()) {
+        case UnaryOp::POS:
+            result = r;
+            break;
+        case UnaryOp::NEG:
+            result = hull(r.kind, {-r.hi, -r.lo});
+            break;
+        case UnaryOp::FACT:
+            // only defined on non-negative ints, and 20! is the last one that fits in an int64
+            if (r.lo >= 0 && r.hi <= 20) {
+                result = hull(Range::INT, {factorial(r.lo), factorial(r.hi)});
+            } else {
+                result = Range{Range::INT, 1, std::numeric_limits<double>::infinity()};
+            }
+            break;
+        }
+    }
+
+    void visit(BinaryOp& e) override {
+        Range a = analyze(e.getLeft());
+        Range b = analyze(e.getRight());
+        auto kind = combine(a.kind, b.kind);
+
+        switch (e.getOp()) {
+        case BinaryOp::PLUS:
+            result = hull(kind, {a.lo + b.lo, a.hi + b.hi});
+            break;
+        case BinaryOp::MINUS:
+            result = hull(kind, {a.lo - b.hi, a.hi - b.lo});
+            break;
+        case BinaryOp::MUL:
+            result = hull(kind, {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi});
+            break;
+        case BinaryOp::DIV:
+            if (!b.contains(0)) {
+                // monotonic in each operand when the divisor keeps its sign, and truncation keeps the order
+                result = hull(kind, {a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi});
+                if (kind == Range::INT) {
+                    result = hull(kind, {std::trunc(result.lo), std::trunc(result.hi)});
+                } else if (kind == Range::ANY) {
+                    result = hull(kind, {result.lo, result.hi, std::trunc(result.lo), std::trunc(result.hi)});
+                }
+            } else if (kind == Range::INT) {
+                // b == 0 fails, any other divisor gives |a / b| <= |a|
+                result = hull(kind, {-maxAbs(a), maxAbs(a)});
+            } else {
+                result = Range::top(kind);
+            }
+            break;
+        case BinaryOp::MOD: {
+            // the remainder takes the sign of the dividend, |a % b| <= min(|a|, |b| - 1)
+            double m = std::max(maxAbs(b) - 1, 0.0);
+            result = hull(Range::INT, {std::max(-m, std::min(a.lo, 0.0)), std::min(m, std::max(a.hi, 0.0))});
+            break;
+        }
+        case BinaryOp::POW:
+            result = pow(kind, a, b);
+            break;
+        case BinaryOp::LT:
+        case BinaryOp::LE:
+        case BinaryOp::GT:
+        case BinaryOp::GE:
+        case BinaryOp::EQ:
+        case BinaryOp::NE:
+        case BinaryOp::AND:
+        case BinaryOp::OR:
+            result = Range{Range::INT, 0, 1};
+            break;
+        }
+    }
+
+    void visit(Conditional& e) override {
+        Range c = analyze(e.getCond());
+        Range a = analyze(e.getLeft());
+        Range b = analyze(e.getRight());
+        // the arm that is never taken still decides the type
+        auto kind = combine(a.kind, b.kind);
+        if (!c.contains(0)) {
+            result = hull(kind, {a.lo, a.hi});
+        } else if (c.lo == 0 && c.hi == 0) {
+            result = hull(kind, {b.lo, b.hi});
+        } else {
+            result = hull(kind, {a.lo, a.hi, b.lo, b.hi});
+        }
+    }
+
+    void visit(FuncCall& e) override {
+        Range r = analyze(e.getParam());
+        auto func = lookupBuiltin(e.getName());
+        switch (func) {
+        case Builtin::ABS:
+            result =
+                hull(Range::FLOAT, {r.contains(0) ? 0.0 : std::min(std::abs(r.lo), std::abs(r.hi)), maxAbs(r)});
+            break;
+        case Builtin::EXP:
+        case Builtin::ARCTAN:
+            result = monotonic(func, r.lo, r.hi);
+            break;
+        case Builtin::LOG2:
+        case Builtin::LG:
+        case Builtin::LN:
+            result = monotonic(func, std::max(r.lo, 0.0), r.hi);
+            break;
+        case Builtin::SQRT:
+            result = monotonic(func, std::max(r.lo, 0.0), std::max(r.hi, 0.0));
+            break;
+        case Builtin::ARCSIN:
+            result = monotonic(func, std::max(r.lo, -1.0), std::min(r.hi, 1.0));
+            break;
+        case Builtin::ARCCOS:
+            // decreasing
+            result = hull(Range::FLOAT,
+                          {applyBuiltin(func, std::min(r.hi, 1.0)), applyBuiltin(func, std::max(r.lo, -1.0))});
+            break;
+        case Builtin::SIN:
+        case Builtin::COS:
+            result = Range{Range::FLOAT, -1, 1};
+            break;
+        case Builtin::ARCCOT:
+            result = Range{Range::FLOAT, -kPi / 2, kPi / 2};
+            break;
+        case Builtin::TAN:
+        case Builtin::COT:
+        case Builtin::UNKNOWN:
+            result = Range::top(Range::FLOAT);
+            break;
+        }
+    }
+
+    void visit(Ident& e) override {
+        auto it = analysis.declared.find(e.getName().str());
+        result = it != analysis.declared.end() ? it->second : Range::top(analysis.undeclaredKind);
+    }
+
+    void visit(Number& e) override {
+        if (e.getType() == Number::INT) {
+            result = hull(Range::INT, {double(e.getInt())});
+        } else {
+            result = Range::point(Range::FLOAT, e.getFloat());
+        }
+    }
+
+private:
+    static double factorial(double n) {
+        double r = 1;
+        for (int i = 2; i <= n; i++) {
+            r *= i;
+        }
+        return r;
+    }
+
+    static Range monotonic(Builtin func, double lo, double hi) {
+        if (lo > hi) {
+            // the whole input range is outside the domain, only NaN comes out
+            return Range::top(Range::FLOAT);
+        }
+        return hull(Range::FLOAT, {applyBuiltin(func, lo), applyBuiltin(func, hi)});
+    }
+
+    static Range pow(Range::Kind kind, const Range& a, const Range& b) {
+        if (kind != Range::INT) {
+            if (a.lo == a.hi && b.lo == b.hi) {
+                return hull(kind, {std::pow(a.lo, b.lo)});
+            }
+            return Range::top(kind);
+        }
+        // a negative exponent fails, so only b >= 0 counts
+        double eLo = std::max(b.lo, 0.0);
+        double eHi = b.hi;
+        if (eLo > eHi || !std::isfinite(eHi)) {
+            return Range::top(kind);
+        }
+        double m = maxAbs(a);
+        double bound = std::pow(std::max(m, 1.0), eHi);
+        if (a.lo >= 1) {
+            return hull(kind, {std::pow(a.lo, eLo), std::pow(a.hi, eHi)});
+        }
+        if (a.lo >= 0) {
+            return hull(kind, {0.0, bound});
+        }
+        return hull(kind, {-bound, bound});
+    }
+};
+
+RangeAnalysis::RangeAnalysis(Declared declared, Range::Kind undeclaredKind)
+    : declared(std::move(declared))
+    , undeclaredKind(undeclaredKind) {}
+
+Range RangeAnalysis::analyze(AST* ast) {
+    return RangeVisitor(*this).analyze(ast);
+}
+
+Range RangeAnalysis::getRange(const AST* node) const {
+    auto it = ranges.find(node);
+    return it != ranges.end() ? it->second : Range::top(Range::ANY);
+}
+
+bool RangeAnalysis::parseRange(llvm::StringRef text, Range& out) {
+    auto bounds = text.split("..");
+    if (bounds.second.empty()) {
+        return false;
+    }
+    int64_t lo, hi;
+    if (!bounds.first.contains('.') && !bounds.second.contains('.') && !bounds.first.getAsInteger(10, lo) &&
+        !bounds.second.getAsInteger(10, hi)) {
+        out = Range{Range::INT, double(lo), double(hi)};
+    } else if (!bounds.first.getAsDouble(out.lo) && !bounds.second.getAsDouble(out.hi)) {
+        out.kind = Range::FLOAT;
+    } else {
+        return false;
+    }
+    return out.lo <= out.hi;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "AST.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+/// The values a subexpression can take when it evaluates without an error, and what is known of their type.
+struct Range {
+    enum Kind {
+        INT,
+        FLOAT,
+        ANY, // int or float, decided by the inputs at run time
+    };
+
+    Kind kind;
+    double lo;
+    double hi;
+
+    static Range top(Kind kind) {
+        return Range{kind, -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity()};
+    }
+
+    static Range point(Kind kind, double v) {
+        return Range{kind, v, v};
+    }
+
+    bool contains(double v) const {
+        return lo <= v && v <= hi;
+    }
+
+    bool isBounded() const {
+        return std::isfinite(lo) && std::isfinite(hi);
+    }
+
+    /// Every value, and every quotient or remainder of two such ints, fits in an int32.
+    bool fitsInt32() const {
+        return lo > std::numeric_limits<int32_t>::min() && hi <= std::numeric_limits<int32_t>::max();
+    }
+};
+
+/**
+ * Interval analysis over the AST, with the value semantics of Program.
+ *
+ * Every node gets the range of values it can produce when it does not fail, given
+ * the declared ranges of the variables. Code generators use it to prove facts the
+ * inputs alone do not show, such as a divisor that is never zero or an exponent
+ * that is never negative, and drop the checks or pick narrower types accordingly.
+ *
+ * Bounds are kept as doubles. An int range that reaches beyond 2^53 could wrap or
+ * lose precision, so it is widened to the full range.
+ */
+class RangeAnalysis {
+public:
+    using Declared = std::map<std::string, Range>;
+
+    /// Variables without a declared range are unbounded, of kind `undeclaredKind`.
+    explicit RangeAnalysis(Declared declared = {}, Range::Kind undeclaredKind = Range::ANY);
+
+    /// Analyzes `ast` and every subtree of it.
+    Range analyze(AST* ast);
+
+    /// The range of a node analyzed before, or the unbounded range of kind ANY.
+    Range getRange(const AST* node) const;
+
+    /// Parses a declared range `lo..hi`. Like calci input, bounds written as ints ("0..10") declare an int
+    /// variable and anything else ("0.0..1") a float one. Returns false if `text` is not a range.
+    static bool parseRange(llvm::StringRef text, Range& out);
+
+private:
+    Declared declared;
+    Range::Kind undeclaredKind;
+    std::unordered_map<const AST*, Range> ranges;
+
+    friend class RangeVisitor;
+};
@@ -0,0 +1,230 @@
+#include "Specializer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+class PartialEvaluator : public ASTVisitor {
+    const Specializer::Bindings& bindings;
+    llvm::StringSaver& saver;
+
+public:
+    // the folded value of the subtree visited last, or its residual if it could not be folded
+    bool isConst = false;
+    Value constant;
+    Expr* residual = nullptr;
+
+    PartialEvaluator(const Specializer::Bindings& bindings, llvm::StringSaver& saver)
+        : bindings(bindings)
+        , saver(saver) {}
+
+    Expr* specialize(AST* e) {
+        e->accept(*this);
+        return take();
+    }
+
+    void visit(UnaryOp& e) override {
+        e.getExpr()->accept(*this);
+        if (e.getOp() == UnaryOp::POS) {
+            return;
+        }
+        Value v = constant;
+        if (isConst && fold(Program::applyUnary(Program::toOpCode(e.getOp()), Builtin::UNKNOWN, v), v)) {
+            return;
+        }
+        setResidual(located(new UnaryOp(e.getOp(), take()), e));
+    }
+
+    void visit(BinaryOp& e) override {
+        e.getLeft()->accept(*this);
+        bool lhsConst = isConst;
+        Value lhs = constant;
+        Expr* lhsResidual = residual;
+
+        e.getRight()->accept(*this);
+        if (lhsConst && isConst) {
+            Value v = lhs;
+            if (fold(Program::applyBinary(Program::toOpCode(e.getOp()), v, constant), v)) {
+                return;
+            }
+        }
+        // x*1, 1*x, x/1 and x^1 are exactly x under Value semantics, whatever the type of x. A float 1.0 is
+        // not: it would turn an int x into a float.
+        auto op = e.getOp();
+        if (!isConst && lhsConst && isIntOne(lhs) && op == BinaryOp::MUL) {
+            return;
+        }
+        if (!lhsConst && isConst && isIntOne(constant) &&
+            (op == BinaryOp::MUL || op == BinaryOp::DIV || op == BinaryOp::POW)) {
+            return setResidual(lhsResidual);
+        }
+
+        Expr* rhsResidual = take();
+        setResidual(located(new BinaryOp(op, lhsConst ? materialize(lhs) : lhsResidual, rhsResidual), e));
+    }
+
+    void visit(Conditional& e) override {
+        e.getCond()->accept(*this);
+        bool condConst = isConst;
+        Value cond = constant;
+        Expr* condResidual = residual;
+
+        e.getLeft()->accept(*this);
+        bool lhsConst = isConst;
+        Value lhs = constant;
+        Expr* lhsResidual = residual;
+
+        e.getRight()->accept(*this);
+        // a constant condition does not drop the other arm, which is evaluated too and could still fail
+        if (condConst && lhsConst && isConst) {
+            Program::applySelect(cond, lhs, constant);
+            return setConst(cond);
+        }
+
+        Expr* rhsResidual = take();
+        setResidual(located(new Conditional(condConst ? materialize(cond) : condResidual,
+                                            lhsConst ? materialize(lhs) : lhsResidual, rhsResidual),
+                            e));
+    }
+
+    void visit(FuncCall& e) override {
+        e.getParam()->accept(*this);
+        auto func = lookupBuiltin(e.getName());
+        Value v = constant;
+        if (isConst && func != Builtin::UNKNOWN && fold(Program::applyUnary(Program::OpCode::CALL, func, v), v)) {
+            return;
+        }
+        setResidual(located(new FuncCall(e.getName(), take()), e));
+    }
+
+    void visit(Ident& e) override {
+        auto it = bindings.find(e.getName().str());
+        if (it != bindings.end()) {
+            setConst(it->second);
+        } else {
+            setResidual(located(new Ident(e.getName()), e));
+        }
+    }
+
+    void visit(Number& e) override {
+        setConst(e.getType() == Number::INT ? Value(e.getInt()) : Value(e.getFloat()));
+    }
+
+private:
+    void setConst(Value v) {
+        isConst = true;
+        constant = v;
+        residual = nullptr;
+    }
+
+    void setResidual(Expr* e) {
+        isConst = false;
+        residual = e;
+    }
+
+    /// Keeps the folded value only if the operation succeeded and the result can be written as a literal.
+    bool fold(Status s, Value v) {
+        if (s != Status::OK || !(v.isInt() || std::isfinite(v.getFloat()))) {
+            return false;
+        }
+        setConst(v);
+        return true;
+    }
+
+    /// `n` with the source range of the node it stands for, so that code generated from the residual still maps
+    /// back to the source.
+    static Expr* located(Expr* n, const AST& from) {
+        n->setSourceRange(from.getBegin(), from.getEnd());
+        return n;
+    }
+
+    static bool isIntOne(const Value& v) {
+        return v.isInt() && v.getInt() == 1;
+    }
+
+    /// Takes the subtree visited last as a node, creating a literal for a folded value.
+    Expr* take() {
+        return isConst ? materialize(constant) : residual;
+    }
+
+    Expr* materialize(Value v) {
+        return Specializer::literal(v, saver);
+    }
+};
+
+void appendKey(std::string& key, const std::string& name, const Value& v) {
+    char buf[32];
+    if (v.isInt()) {
+        std::snprintf(buf, sizeof(buf), "=i%lld;", static_cast<long long>(v.getInt()));
+    } else {
+        double f = v.getFloat();
+        uint64_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        std::snprintf(buf, sizeof(buf), "=f%llx;", static_cast<unsigned long long>(bits));
+    }
+    key += name;
+    key += buf;
+}
+} // namespace
+
+Number* Specializer::literal(const Value& v, llvm::StringSaver& saver) {
+    char buf[32];
+    if (v.isInt()) {
+        std::snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(v.getInt()));
+        return new Number(v.getInt(), saver.save(buf));
+    }
+    std::snprintf(buf, sizeof(buf), "%.17g", v.getFloat());
+    if (!std::strpbrk(buf, ".e")) {
+        std::strcat(buf, ".0");
+    }
+    return new Number(v.getFloat(), saver.save(buf));
+}
+
+Specializer::Specializer(AST* ast)
+    : ast(ast)
+    , saver(allocator) {
+    Program p;
+    Program::compile(ast, {}, p);
+    for (size_t i = 0; i < p.getNumVars(); i++) {
+        vars.push_back(p.getVarName(i));
+    }
+}
+
+std::unique_ptr<AST> Specializer::specialize(const Bindings& bindings) {
+    PartialEvaluator pe(bindings, saver);
+    return std::unique_ptr<AST>(pe.specialize(ast));
+}
+
+const Specializer::Kernel* Specializer::getKernel(const Bindings& bindings, Status& status) {
+    // bindings are ordered by name; ones the expression does not use do not split the cache
+    std::string key;
+    for (const auto& b : bindings) {
+        if (std::find(vars.begin(), vars.end(), b.first) != vars.end()) {
+            appendKey(key, b.first, b.second);
+        }
+    }
+
+    auto& kernel = kernels[key];
+    if (kernel) {
+        status = Status::OK;
+        return kernel.get();
+    }
+
+    std::vector<std::string> freeVars;
+    for (const auto& name : vars) {
+        if (bindings.find(name) == bindings.end()) {
+            freeVars.push_back(name);
+        }
+    }
+
+    std::unique_ptr<Kernel> k(new Kernel);
+    k->residual = specialize(bindings);
+    status = Program::compile(k->residual.get(), freeVars, k->program);
+    if (status != Status::OK) {
+        kernels.erase(key);
+        return nullptr;
+    }
+    kernel = std::move(k);
+    return kernel.get();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "AST.h"
+#include "Program.h"
+
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/StringSaver.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+/**
+ * Partial evaluation of an expression on a subset of its variables.
+ *
+ * specialize() substitutes the bound variables and folds every subtree that no
+ * longer depends on a free variable, with the same semantics Program uses. A
+ * subtree whose folding would fail (say `1 % 0`) is left in the residual so the
+ * error still surfaces when it is evaluated. The residual is an ordinary AST, so
+ * it can be handed to ToIRVisitor or the interpreters as is.
+ *
+ * getKernel() compiles the residual and caches it by binding set, so per-row work
+ * only covers what depends on the free variables.
+ */
+class Specializer {
+public:
+    using Bindings = std::map<std::string, Value>;
+
+    struct Kernel {
+        std::unique_ptr<AST> residual;
+        Program program;
+    };
+
+    /// Does not take ownership of `ast`, which must outlive the Specializer.
+    explicit Specializer(AST* ast);
+
+    /// The residual expression. Its nodes keep the source ranges of the ones they come from, folded literals
+    /// have none. Literal text of folded nodes is owned by this Specializer.
+    std::unique_ptr<AST> specialize(const Bindings& bindings);
+
+    /// The compiled residual for `bindings`. Its variable slots are the free variables of the
+    /// original expression in order of first appearance, whatever values are bound.
+    const Kernel* getKernel(const Bindings& bindings, Status& status);
+
+    size_t getNumCachedKernels() const {
+        return kernels.size();
+    }
+
+    /// A literal node for `v` that parses back to the same value, its text saved in `saver`.
+    static Number* literal(const Value& v, llvm::StringSaver& saver);
+
+private:
+    AST* ast;
+    std::vector<std::string> vars;
+
+    llvm::BumpPtrAllocator allocator;
+    llvm::StringSaver saver;
+
+    std::map<std::string, std::unique_ptr<Kernel>> kernels;
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+inline int64_t pow_(int64_t b, int64_t e) {
+    if (e == 1)
+        return b;
+
+    if ((e % 2) == 0) {
+        auto r = pow_(b, e / 2);
+        return r * r;
+    } else {
+        auto r = pow_(b, e / 2);
+        return r * r * b;
+    }
+}
+
+inline int64_t pow(int64_t b, int64_t e) {
+    if (b == 0 && e == 0)
+        throw std::runtime_error("0^0 is undefined");
+
+    if (e < 0)
+        throw std::runtime_error("exponent < 0 for int value is not allowed");
+
+    if (e == 0)
+        return 1;
+
+    return pow_(b, e);
+}
+
+class Value {
+    union {
+        int64_t v_i;
+        double v_f;
+    };
+    bool isInt_;
+
+    void error() const {
+        throw std::runtime_error("value getting error");
+    }
+
+    double promoteToFloat() const {
+        if (!isInt_)
+            return v_f;
+        return static_cast<double>(v_i);
+    }
+
+public:
+    Value(int64_t v)
+        : v_i(v)
+        , isInt_(true) {}
+    Value(double v)
+        : v_f(v)
+        , isInt_(false) {}
+
+    Value()
+        : Value(std::numeric_limits<double>::quiet_NaN()) {}
+
+    bool isInt() const {
+        return isInt_;
+    }
+
+    int64_t getInt() const {
+        if (!isInt_) {
+            error();
+        }
+        return v_i;
+    }
+
+    double getFloat() const {
+        if (isInt_)
+            return promoteToFloat();
+
+        return v_f;
+    }
+
+    Value operator+(const Value& rhs) const {
+        if (isInt() && rhs.isInt()) {
+            return getInt() + rhs.getInt();
+        }
+        return getFloat() + rhs.getFloat();
+    }
+
+    Value operator-(const Value& rhs) const {
+        if (isInt() && rhs.isInt()) {
+            return getInt() - rhs.getInt();
+        }
+        return getFloat() - rhs.getFloat();
+    }
+
+    Value operator*(const Value& rhs) const {
+        if (isInt() && rhs.isInt()) {
+            return getInt() * rhs.getInt();
+        }
+        return getFloat() * rhs.getFloat();
+    }
+
+    Value operator/(const Value& rhs) const {
+        if (isInt() && rhs.isInt()) {
+            return getInt() / rhs.getInt();
+        }
+        return getFloat() / rhs.getFloat();
+    }
+
+    Value operator^(const Value& rhs) const {
+        if (isInt() && rhs.isInt()) {
+            return pow(getInt(), rhs.getInt());
+        }
+        return std::pow(getFloat(), rhs.getFloat());
+    }
+
+    Value operator%(const Value& rhs) const {
+        if (isInt() && rhs.isInt()) {
+            return getInt() % rhs.getInt();
+        }
+        throw std::runtime_error("mod for float value is not allowed");
+    }
+};
+
+inline Value negate(Value v) {
+    if (v.isInt()) {
+        return Value(-v.getInt());
+    } else {
+        return Value(-v.getFloat());
+    }
+}
+
+inline Value factorial(Value v) {
+    int64_t i = v.getInt();
+    if (i < 0) {
+        throw std::runtime_error("factorial value error");
+    }
+    if (i == 0) {
+        return Value(static_cast<int64_t>(1LL));
+    }
+    int64_t acc = 1;
+    for (int64_t j = 1; j <= i; j++) {
+        acc *= j;
+    }
+    return Value(acc);
+}
@@ -0,0 +1,880 @@
+#include "VectorEvaluator.h"
+
+#include <llvm/ADT/SmallVector.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <vector>
+
+namespace {
+using OpCode = Program::OpCode;
+
+/// A stack slot: one value per row of the block, in a pooled buffer.
+struct Column {
+    enum Kind : uint8_t {
+        FLOAT,
+        INT,
+        MIXED,
+    } kind;
+    void* data;
+
+    double* f() const {
+        return static_cast<double*>(data);
+    }
+
+    /// The values of an INT column, the bits of an int or a double per row of a MIXED one.
+    int64_t* i() const {
+        return static_cast<int64_t*>(data);
+    }
+
+    /// Which rows of a MIXED column hold an int.
+    uint8_t* isInt() const {
+        return static_cast<uint8_t*>(data) + VectorEvaluator::kBlockRows * sizeof(double);
+    }
+};
+
+/// The status of every row of a block. A row keeps its first failure, where Program::evaluate would have stopped;
+/// later instructions still run on it, with 0 in place of the value that failed.
+struct RowStatus {
+    uint8_t s[VectorEvaluator::kBlockRows];
+
+    void fail(size_t r, Status status) {
+        if (s[r] == 0) {
+            s[r] = static_cast<uint8_t>(status);
+        }
+    }
+
+    bool ok(size_t r) const {
+        return s[r] == 0;
+    }
+};
+
+double fromBits(int64_t bits) {
+    double v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+int64_t toBits(double v) {
+    int64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+/// A row of a mixed column promoted to float.
+double floatOf(int64_t bits, uint8_t isInt) {
+    return isInt ? static_cast<double>(bits) : fromBits(bits);
+}
+
+template <typename F>
+void map(double* __restrict x, size_t n, F f) {
+    for (size_t r = 0; r < n; r++) {
+        x[r] = f(x[r]);
+    }
+}
+
+template <typename T, typename F>
+void map2(T* __restrict a, const T* __restrict b, size_t n, F f) {
+    for (size_t r = 0; r < n; r++) {
+        a[r] = f(a[r], b[r]);
+    }
+}
+
+/// x[i] = f(x[i]), reusing the result of the row before when the argument repeats bit for bit, as it does in
+/// runs of a low-cardinality column. Only worth it for functions that cost more than the comparison.
+template <typename F>
+void mapMemoized(double* x, size_t n, F f) {
+    if (n == 0) {
+        return;
+    }
+    auto lastArg = toBits(x[0]);
+    auto lastResult = f(x[0]);
+    x[0] = lastResult;
+    for (size_t r = 1; r < n; r++) {
+        auto arg = toBits(x[r]);
+        if (arg != lastArg) {
+            lastArg = arg;
+            lastResult = f(x[r]);
+        }
+        x[r] = lastResult;
+    }
+}
+
+void applyBuiltin(Builtin func, double* x, size_t n) {
+    switch (func) {
+#define CASE(builtin)                                                                                                  \
+    case Builtin::builtin:                                                                                             \
+        return map(x, n, [](double v) { return applyBuiltin(Builtin::builtin, v); });
+#define MEMOIZED_CASE(builtin)                                                                                         \
+    case Builtin::builtin:                                                                                             \
+        return mapMemoized(x, n, [](double v) { return applyBuiltin(Builtin::builtin, v); });
+
+        CASE(ABS);
+        MEMOIZED_CASE(EXP);
+        MEMOIZED_CASE(LOG2);
+        MEMOIZED_CASE(LG);
+        MEMOIZED_CASE(LN);
+        MEMOIZED_CASE(SIN);
+        MEMOIZED_CASE(COS);
+        MEMOIZED_CASE(TAN);
+        MEMOIZED_CASE(COT);
+        MEMOIZED_CASE(ARCSIN);
+        MEMOIZED_CASE(ARCCOS);
+        MEMOIZED_CASE(ARCTAN);
+        MEMOIZED_CASE(ARCCOT);
+        CASE(SQRT);
+        CASE(UNKNOWN);
+#undef MEMOIZED_CASE
+#undef CASE
+    }
+}
+
+// int arithmetic checked like Program::applyBinary: the result in `out`, and whether it overflowed
+const auto addOverflow = [](int64_t a, int64_t b, int64_t* out) { return __builtin_add_overflow(a, b, out); };
+const auto subOverflow = [](int64_t a, int64_t b, int64_t* out) { return __builtin_sub_overflow(a, b, out); };
+const auto mulOverflow = [](int64_t a, int64_t b, int64_t* out) { return __builtin_mul_overflow(a, b, out); };
+
+bool isCondition(OpCode op) {
+    return op >= OpCode::LT && op <= OpCode::OR;
+}
+
+template <typename T, typename F>
+void compareRows(int64_t* out, const T* a, const T* b, size_t n, F f) {
+    for (size_t r = 0; r < n; r++) {
+        out[r] = f(a[r], b[r]);
+    }
+}
+
+/// A comparison, && or || of a and b as 0 or 1 in out, which may be a.
+template <typename T>
+void condition(OpCode op, int64_t* out, const T* a, const T* b, size_t n) {
+    switch (op) {
+    case OpCode::LT:
+        return compareRows(out, a, b, n, [](T x, T y) { return x < y; });
+    case OpCode::LE:
+        return compareRows(out, a, b, n, [](T x, T y) { return x <= y; });
+    case OpCode::GT:
+        return compareRows(out, a, b, n, [](T x, T y) { return x > y; });
+    case OpCode::GE:
+        return compareRows(out, a, b, n, [](T x, T y) { return x >= y; });
+    case OpCode::EQ:
+        return compareRows(out, a, b, n, [](T x, T y) { return x == y; });
+    case OpCode::NE:
+        return compareRows(out, a, b, n, [](T x, T y) { return x != y; });
+    // & and | rather than && and ||, which would be branches
+    case OpCode::AND:
+        return compareRows(out, a, b, n, [](T x, T y) { return (x != 0) & (y != 0); });
+    case OpCode::OR:
+        return compareRows(out, a, b, n, [](T x, T y) { return (x != 0) | (y != 0); });
+    default:
+        return;
+    }
+}
+
+template <typename T>
+void blend(T* __restrict a, const T* __restrict b, const uint8_t* __restrict takeA, size_t n) {
+    for (size_t r = 0; r < n; r++) {
+        a[r] = takeA[r] ? a[r] : b[r];
+    }
+}
+
+/// a op b on int rows, flagging in `overflow` the rows whose result does not fit. Returns whether any does not.
+template <typename IntOp>
+bool checkedArithmetic(int64_t* __restrict a, const int64_t* __restrict b, uint8_t* __restrict overflow, size_t n,
+                       IntOp intOp) {
+    uint8_t any = 0;
+    for (size_t r = 0; r < n; r++) {
+        overflow[r] = intOp(a[r], b[r], &a[r]);
+        any |= overflow[r];
+    }
+    return any != 0;
+}
+
+/// a op b on mixed rows: int if both are, float otherwise, both computed and one kept, without branches. Int rows
+/// that overflow are flagged as in checkedArithmetic.
+template <typename IntOp, typename FloatOp>
+bool mixedArithmetic(int64_t* __restrict a, uint8_t* __restrict aIsInt, const int64_t* __restrict b,
+                     const uint8_t* __restrict bIsInt, uint8_t* __restrict overflow, size_t n, IntOp intOp,
+                     FloatOp floatOp) {
+    uint8_t any = 0;
+    for (size_t r = 0; r < n; r++) {
+        uint8_t both = aIsInt[r] & bIsInt[r];
+        int64_t i;
+        overflow[r] = intOp(a[r], b[r], &i) & both;
+        any |= overflow[r];
+        int64_t f = toBits(floatOp(floatOf(a[r], aIsInt[r]), floatOf(b[r], bIsInt[r])));
+        a[r] = both ? i : f;
+        aIsInt[r] = both;
+    }
+    return any != 0;
+}
+
+} // namespace
+
+/// A subexpression of one dictionary-encoded variable, evaluated for every entry of the dictionary.
+struct VectorEvaluator::Gathered {
+    const uint32_t* codes;
+    std::vector<int64_t> bits;     // per entry, an int or the bits of a double, 0 where it failed
+    std::vector<uint8_t> isInt;    // per entry
+    std::vector<uint8_t> statuses; // per entry
+    Column::Kind kind;             // of the entries that did not fail
+    bool anyFailed;
+};
+
+namespace {
+class BlockEvaluator {
+    ColumnPool& pool;
+    size_t n;
+    RowStatus& status;
+
+public:
+    BlockEvaluator(ColumnPool& pool, size_t n, RowStatus& status)
+        : pool(pool)
+        , n(n)
+        , status(status) {}
+
+    Column push(const Value& imm) {
+        Column c{imm.isInt() ? Column::INT : Column::FLOAT, pool.acquire()};
+        if (imm.isInt()) {
+            std::fill(c.i(), c.i() + n, imm.getInt());
+        } else {
+            std::fill(c.f(), c.f() + n, imm.getFloat());
+        }
+        return c;
+    }
+
+    /// Binds the inputs like Program::bindVariable, into a float or an int column if the rows agree.
+    Column load(const double* src, size_t stride) {
+        size_t ints = 0;
+        for (size_t r = 0; r < n; r++) {
+            ints += Program::isBoundAsInt(src[r * stride]);
+        }
+        Column c{ints == 0 ? Column::FLOAT : (ints == n ? Column::INT : Column::MIXED), pool.acquire()};
+        if (c.kind == Column::FLOAT) {
+            for (size_t r = 0; r < n; r++) {
+                c.f()[r] = src[r * stride];
+            }
+        } else if (c.kind == Column::INT) {
+            for (size_t r = 0; r < n; r++) {
+                c.i()[r] = static_cast<int64_t>(src[r * stride]);
+            }
+        } else {
+            for (size_t r = 0; r < n; r++) {
+                double v = src[r * stride];
+                c.isInt()[r] = Program::isBoundAsInt(v);
+                c.i()[r] = c.isInt()[r] ? static_cast<int64_t>(v) : toBits(v);
+            }
+        }
+        return c;
+    }
+
+    /// Every row takes the entry of its code, and fails where the entry did.
+    Column gather(const VectorEvaluator::Gathered& g, size_t begin) {
+        auto codes = g.codes + begin;
+        auto bits = g.bits.data();
+        Column c{g.kind, pool.acquire()};
+        if (c.kind == Column::FLOAT) {
+            for (size_t r = 0; r < n; r++) {
+                c.f()[r] = fromBits(bits[codes[r]]);
+            }
+        } else {
+            for (size_t r = 0; r < n; r++) {
+                c.i()[r] = bits[codes[r]];
+            }
+        }
+        if (c.kind == Column::MIXED) {
+            for (size_t r = 0; r < n; r++) {
+                c.isInt()[r] = g.isInt[codes[r]];
+            }
+            c = narrow(c);
+        }
+        if (g.anyFailed) {
+            for (size_t r = 0; r < n; r++) {
+                if (g.statuses[codes[r]] != 0) {
+                    status.fail(r, static_cast<Status>(g.statuses[codes[r]]));
+                }
+            }
+        }
+        return c;
+    }
+
+    void unary(OpCode op, Builtin func, Column& c) {
+        switch (op) {
+        case OpCode::NEG:
+            if (c.kind == Column::FLOAT) {
+                map(c.f(), n, [](double v) { return -v; });
+            } else if (c.kind == Column::INT) {
+                auto x = c.i();
+                for (size_t r = 0; r < n; r++) {
+                    // -INT64_MIN is the one negation that does not fit
+                    if (x[r] == std::numeric_limits<int64_t>::min()) {
+                        status.fail(r, Status::DOMAIN_ERROR);
+                        x[r] = 0;
+                    } else {
+                        x[r] = -x[r];
+                    }
+                }
+            } else {
+                auto x = c.i();
+                auto isInt = c.isInt();
+                for (size_t r = 0; r < n; r++) {
+                    // flipping the sign bit negates a double
+                    if (isInt[r] && x[r] == std::numeric_limits<int64_t>::min()) {
+                        status.fail(r, Status::DOMAIN_ERROR);
+                        x[r] = 0;
+                    } else {
+                        x[r] = isInt[r] ? -x[r] : (x[r] ^ std::numeric_limits<int64_t>::min());
+                    }
+                }
+            }
+            return;
+        case OpCode::FACT:
+            if (c.kind == Column::FLOAT) {
+                failAll(Status::DOMAIN_ERROR);
+            } else if (c.kind == Column::INT) {
+                auto x = c.i();
+                for (size_t r = 0; r < n; r++) {
+                    if (!status.ok(r) || x[r] < 0 || !Program::factorialInt(x[r], x[r])) {
+                        status.fail(r, Status::DOMAIN_ERROR);
+                        x[r] = 0;
+                    }
+                }
+            } else {
+                unaryRows(op, func, c);
+            }
+            return;
+        case OpCode::CALL:
+            c = convert(c, Column::FLOAT);
+            applyBuiltin(func, c.f(), n);
+            return;
+        default:
+            failAll(Status::INVALID_ARGUMENT);
+            return;
+        }
+    }
+
+    /// lhs = lhs op rhs, rhs goes back to the pool.
+    void binary(OpCode op, Column& lhs, Column rhs) {
+        if (op == OpCode::MOD && (lhs.kind == Column::FLOAT || rhs.kind == Column::FLOAT)) {
+            failAll(Status::DOMAIN_ERROR);
+        } else if (isCondition(op) && (lhs.kind == Column::FLOAT || rhs.kind == Column::FLOAT)) {
+            // compared as floats if either row is one, the 0 or 1 goes to a new int column
+            lhs = convert(lhs, Column::FLOAT);
+            rhs = convert(rhs, Column::FLOAT);
+            Column out{Column::INT, pool.acquire()};
+            condition(op, out.i(), lhs.f(), rhs.f(), n);
+            pool.release(lhs.data);
+            lhs = out;
+        } else if (lhs.kind == Column::FLOAT && rhs.kind == Column::FLOAT) {
+            binaryFloat(op, lhs.f(), rhs.f());
+        } else if (lhs.kind == Column::INT && rhs.kind == Column::INT) {
+            binaryInt(op, lhs.i(), rhs.i());
+        } else if (lhs.kind == Column::FLOAT || rhs.kind == Column::FLOAT) {
+            // any operation with a float is a float operation, whatever the other row holds
+            lhs = convert(lhs, Column::FLOAT);
+            rhs = convert(rhs, Column::FLOAT);
+            binaryFloat(op, lhs.f(), rhs.f());
+        } else {
+            lhs = convert(lhs, Column::MIXED);
+            rhs = convert(rhs, Column::MIXED);
+            binaryMixed(op, lhs, rhs);
+            lhs = narrow(lhs);
+        }
+        pool.release(rhs.data);
+    }
+
+    /// cond = cond ? lhs : rhs with Program::applySelect semantics, lhs and rhs go back to the pool.
+    void select(Column& cond, Column lhs, Column rhs) {
+        uint8_t takeLhs[VectorEvaluator::kBlockRows];
+        if (cond.kind == Column::FLOAT) {
+            for (size_t r = 0; r < n; r++) {
+                takeLhs[r] = cond.f()[r] != 0.0;
+            }
+        } else if (cond.kind == Column::INT) {
+            for (size_t r = 0; r < n; r++) {
+                takeLhs[r] = cond.i()[r] != 0;
+            }
+        } else {
+            for (size_t r = 0; r < n; r++) {
+                takeLhs[r] = floatOf(cond.i()[r], cond.isInt()[r]) != 0.0;
+            }
+        }
+        pool.release(cond.data);
+
+        if (lhs.kind == Column::INT && rhs.kind == Column::INT) {
+            blend(lhs.i(), rhs.i(), takeLhs, n);
+        } else if (lhs.kind == Column::FLOAT || rhs.kind == Column::FLOAT) {
+            // every row has a float arm, so every row is a float
+            lhs = convert(lhs, Column::FLOAT);
+            rhs = convert(rhs, Column::FLOAT);
+            blend(lhs.f(), rhs.f(), takeLhs, n);
+        } else {
+            lhs = convert(lhs, Column::MIXED);
+            rhs = convert(rhs, Column::MIXED);
+            auto a = lhs.i();
+            auto aIsInt = lhs.isInt();
+            auto b = rhs.i();
+            auto bIsInt = rhs.isInt();
+            for (size_t r = 0; r < n; r++) {
+                uint8_t both = aIsInt[r] & bIsInt[r];
+                int64_t v = takeLhs[r] ? a[r] : b[r];
+                uint8_t vIsInt = takeLhs[r] ? aIsInt[r] : bIsInt[r];
+                a[r] = both ? v : toBits(floatOf(v, vIsInt));
+                aIsInt[r] = both;
+            }
+            lhs = narrow(lhs);
+        }
+        pool.release(rhs.data);
+        cond = lhs;
+    }
+
+    /// The result of every row, NaN where it failed. Takes `c` back to the pool.
+    void store(Column c, double* results) {
+        auto f = convert(c, Column::FLOAT);
+        for (size_t r = 0; r < n; r++) {
+            results[r] = status.ok(r) ? f.f()[r] : std::numeric_limits<double>::quiet_NaN();
+        }
+        pool.release(f.data);
+    }
+
+    void failAll(Status s) {
+        for (size_t r = 0; r < n; r++) {
+            status.fail(r, s);
+        }
+    }
+
+    /// Fails the int rows flagged in `overflow`, which hold 0 from then on.
+    void failRows(int64_t* values, const uint8_t* overflow) {
+        for (size_t r = 0; r < n; r++) {
+            if (overflow[r]) {
+                status.fail(r, Status::DOMAIN_ERROR);
+                values[r] = 0;
+            }
+        }
+    }
+
+private:
+    /// The column in another representation. Ints become mixed in place, every other change, between doubles and
+    /// int64 bits, goes to a buffer of its own.
+    Column convert(Column c, Column::Kind kind) {
+        if (c.kind == kind) {
+            return c;
+        }
+        if (c.kind == Column::INT && kind == Column::MIXED) {
+            std::fill(c.isInt(), c.isInt() + n, 1);
+            c.kind = Column::MIXED;
+            return c;
+        }
+        Column out{kind, pool.acquire()};
+        if (c.kind == Column::INT) {
+            std::copy(c.i(), c.i() + n, out.f());
+        } else if (c.kind == Column::MIXED) {
+            for (size_t r = 0; r < n; r++) {
+                out.f()[r] = floatOf(c.i()[r], c.isInt()[r]);
+            }
+        } else {
+            for (size_t r = 0; r < n; r++) {
+                out.i()[r] = toBits(c.f()[r]);
+            }
+            std::fill(out.isInt(), out.isInt() + n, 0);
+        }
+        pool.release(c.data);
+        return out;
+    }
+
+    /// A mixed column whose rows turned out to be all ints or all floats goes back to the plain kernels.
+    Column narrow(Column c) {
+        size_t ints = 0;
+        for (size_t r = 0; r < n; r++) {
+            ints += c.isInt()[r];
+        }
+        if (ints == n) {
+            c.kind = Column::INT;
+            return c;
+        }
+        return ints == 0 ? convert(c, Column::FLOAT) : c;
+    }
+
+    Value get(const Column& c, size_t r) const {
+        return c.isInt()[r] ? Value(c.i()[r]) : Value(fromBits(c.i()[r]));
+    }
+
+    void set(Column& c, size_t r, const Value& v) {
+        c.isInt()[r] = v.isInt();
+        c.i()[r] = v.isInt() ? v.getInt() : toBits(v.getFloat());
+    }
+
+    /// The operations on mixed columns that need checks, one row at a time through Program.
+    void unaryRows(OpCode op, Builtin func, Column& c) {
+        for (size_t r = 0; r < n; r++) {
+            auto v = get(c, r);
+            auto s = status.ok(r) ? Program::applyUnary(op, func, v) : Status::OK;
+            set(c, r, status.ok(r) && s == Status::OK ? v : Value(static_cast<int64_t>(0)));
+            if (s != Status::OK) {
+                status.fail(r, s);
+            }
+        }
+        c = narrow(c);
+    }
+
+    void binaryMixed(OpCode op, Column& lhs, const Column& rhs) {
+        switch (op) {
+        case OpCode::ADD:
+        case OpCode::SUB:
+        case OpCode::MUL: {
+            uint8_t overflow[VectorEvaluator::kBlockRows];
+            bool any;
+            if (op == OpCode::ADD) {
+                any = mixedArithmetic(lhs.i(), lhs.isInt(), rhs.i(), rhs.isInt(), overflow, n, addOverflow,
+                                      [](double x, double y) { return x + y; });
+            } else if (op == OpCode::SUB) {
+                any = mixedArithmetic(lhs.i(), lhs.isInt(), rhs.i(), rhs.isInt(), overflow, n, subOverflow,
+                                      [](double x, double y) { return x - y; });
+            } else {
+                any = mixedArithmetic(lhs.i(), lhs.isInt(), rhs.i(), rhs.isInt(), overflow, n, mulOverflow,
+                                      [](double x, double y) { return x * y; });
+            }
+            if (any) {
+                failRows(lhs.i(), overflow);
+            }
+            return;
+        }
+        default:
+            for (size_t r = 0; r < n; r++) {
+                auto v = get(lhs, r);
+                auto s = status.ok(r) ? Program::applyBinary(op, v, get(rhs, r)) : Status::OK;
+                set(lhs, r, status.ok(r) && s == Status::OK ? v : Value(static_cast<int64_t>(0)));
+                if (s != Status::OK) {
+                    status.fail(r, s);
+                }
+            }
+            return;
+        }
+    }
+
+    void binaryFloat(OpCode op, double* a, const double* b) {
+        switch (op) {
+        case OpCode::ADD:
+            return map2(a, b, n, [](double x, double y) { return x + y; });
+        case OpCode::SUB:
+            return map2(a, b, n, [](double x, double y) { return x - y; });
+        case OpCode::MUL:
+            return map2(a, b, n, [](double x, double y) { return x * y; });
+        case OpCode::DIV:
+            return map2(a, b, n, [](double x, double y) { return x / y; });
+        case OpCode::POW:
+            return map2(a, b, n, [](double x, double y) { return std::pow(x, y); });
+        default:
+            return failAll(Status::INVALID_ARGUMENT);
+        }
+    }
+
+    void binaryInt(OpCode op, int64_t* a, const int64_t* b) {
+        switch (op) {
+        case OpCode::ADD:
+        case OpCode::SUB:
+        case OpCode::MUL: {
+            uint8_t overflow[VectorEvaluator::kBlockRows];
+            bool any;
+            if (op == OpCode::ADD) {
+                any = checkedArithmetic(a, b, overflow, n, addOverflow);
+            } else if (op == OpCode::SUB) {
+                any = checkedArithmetic(a, b, overflow, n, subOverflow);
+            } else {
+                any = checkedArithmetic(a, b, overflow, n, mulOverflow);
+            }
+            if (any) {
+                failRows(a, overflow);
+            }
+            return;
+        }
+        case OpCode::DIV:
+        case OpCode::MOD:
+            for (size_t r = 0; r < n; r++) {
+                if (b[r] == 0 || (a[r] == std::numeric_limits<int64_t>::min() && b[r] == -1)) {
+                    status.fail(r, Status::DOMAIN_ERROR);
+                    a[r] = 0;
+                } else {
+                    a[r] = op == OpCode::DIV ? a[r] / b[r] : a[r] % b[r];
+                }
+            }
+            return;
+        case OpCode::POW:
+            for (size_t r = 0; r < n; r++) {
+                if (!status.ok(r) || b[r] < 0 || (a[r] == 0 && b[r] == 0) ||
+                    (b[r] != 0 && !Program::powInt(a[r], b[r], a[r]))) {
+                    status.fail(r, Status::DOMAIN_ERROR);
+                    a[r] = 0;
+                } else if (b[r] == 0) {
+                    a[r] = 1;
+                }
+            }
+            return;
+        case OpCode::LT:
+        case OpCode::LE:
+        case OpCode::GT:
+        case OpCode::GE:
+        case OpCode::EQ:
+        case OpCode::NE:
+        case OpCode::AND:
+        case OpCode::OR:
+            return condition(op, a, a, b, n);
+        default:
+            return failAll(Status::INVALID_ARGUMENT);
+        }
+    }
+};
+} // namespace
+
+ColumnPool::~ColumnPool() {
+    for (auto buffer : all) {
+        ::operator delete(buffer);
+    }
+}
+
+void* ColumnPool::acquire() {
+    if (!free.empty()) {
+        auto buffer = free.back();
+        free.pop_back();
+        return buffer;
+    }
+    // reserve first, so that neither a failed allocation leaks nor release() ever allocates
+    all.reserve(all.size() + 1);
+    free.reserve(all.size() + 1);
+    auto buffer = ::operator new(kBufferSize);
+    all.push_back(buffer);
+    return buffer;
+}
+
+void ColumnPool::release(void* buffer) {
+    free.push_back(buffer);
+}
+
+// std::min takes it by reference, which needs a definition before C++17
+constexpr size_t VectorEvaluator::kBlockRows;
+
+Status VectorEvaluator::evaluate(const double* vars, size_t varStride, size_t rowStride, size_t numRows,
+                                 double* results, uint8_t* statuses) {
+    llvm::SmallVector<const double*, 16> starts(program.getNumVars());
+    auto first = Status::OK;
+    for (size_t begin = 0; begin < numRows; begin += kBlockRows) {
+        auto n = std::min(kBlockRows, numRows - begin);
+        for (size_t v = 0; v < starts.size(); v++) {
+            starts[v] = vars + v * varStride + begin * rowStride;
+        }
+        auto s = evaluateBlock(program.getInsts(), starts.data(), rowStride, nullptr, begin, n, results + begin,
+                               statuses != nullptr ? statuses + begin : nullptr);
+        if (first == Status::OK) {
+            first = s;
+        }
+    }
+    return first;
+}
+
+Status VectorEvaluator::evaluate(const double* const* columns, size_t numRows, double* results) {
+    llvm::SmallVector<const double*, 16> starts(program.getNumVars());
+    auto first = Status::OK;
+    for (size_t begin = 0; begin < numRows; begin += kBlockRows) {
+        auto n = std::min(kBlockRows, numRows - begin);
+        for (size_t v = 0; v < starts.size(); v++) {
+            starts[v] = columns[v] + begin;
+        }
+        auto s = evaluateBlock(program.getInsts(), starts.data(), 1, nullptr, begin, n, results + begin, nullptr);
+        if (first == Status::OK) {
+            first = s;
+        }
+    }
+    return first;
+}
+
+namespace {
+/// Operands an instruction pops.
+size_t arity(OpCode op) {
+    switch (op) {
+    case OpCode::PUSH:
+    case OpCode::LOAD:
+        return 0;
+    case OpCode::NEG:
+    case OpCode::FACT:
+    case OpCode::CALL:
+        return 1;
+    case OpCode::SELECT:
+        return 3;
+    default:
+        return 2;
+    }
+}
+} // namespace
+
+Status VectorEvaluator::evaluate(const double* const* columns, const DictColumn* dicts, size_t numRows,
+                                 double* results, uint8_t* statuses) {
+    auto insts = program.getInsts();
+    auto numVars = program.getNumVars();
+
+    // a dictionary with more entries than rows costs more to evaluate than its rows
+    std::vector<std::vector<double>> decoded(numVars);
+    llvm::SmallVector<const double*, 16> plain(numVars);
+    for (size_t v = 0; v < numVars; v++) {
+        auto& d = dicts[v];
+        if (d.values == nullptr) {
+            plain[v] = columns[v];
+        } else if (d.numValues > numRows) {
+            decoded[v].resize(numRows);
+            for (size_t r = 0; r < numRows; r++) {
+                decoded[v][r] = d.values[d.codes[r]];
+            }
+            plain[v] = decoded[v].data();
+        }
+    }
+
+    // the first instruction of every subtree, and the one dictionary-encoded variable it depends on if any
+    const int kConst = -1;
+    const int kMany = -2;
+    std::vector<size_t> first(insts.size());
+    std::vector<int> var(insts.size());
+    std::vector<size_t> parent(insts.size(), insts.size());
+    llvm::SmallVector<size_t, Program::kMaxStackDepth> roots;
+    for (size_t i = 0; i < insts.size(); i++) {
+        first[i] = i;
+        var[i] = insts[i].op != OpCode::LOAD ? kConst : (plain[insts[i].index] ? kMany : insts[i].index);
+        for (size_t k = arity(insts[i].op); k > 0 && !roots.empty(); k--) {
+            auto child = roots.pop_back_val();
+            parent[child] = i;
+            first[i] = first[child];
+            if (var[i] == kConst || var[child] == kMany) {
+                var[i] = var[child];
+            } else if (var[child] != kConst && var[child] != var[i]) {
+                var[i] = kMany;
+            }
+        }
+        roots.push_back(i);
+    }
+
+    // the largest of these subtrees become LOADs of their values gathered from the dictionary
+    std::vector<size_t> gatheredRoot(insts.size(), insts.size());
+    for (size_t i = 0; i < insts.size(); i++) {
+        if (var[i] >= 0 && (parent[i] == insts.size() || var[parent[i]] != var[i])) {
+            gatheredRoot[first[i]] = i;
+        }
+    }
+    std::vector<Program::Inst> rewritten;
+    std::vector<Gathered> gathered;
+    for (size_t i = 0; i < insts.size(); i++) {
+        auto root = gatheredRoot[i];
+        if (root == insts.size()) {
+            rewritten.push_back(insts[i]);
+            continue;
+        }
+        auto& d = dicts[var[root]];
+        std::vector<Program::Inst> subtree(insts.begin() + i, insts.begin() + root + 1);
+        for (auto& inst : subtree) {
+            if (inst.op == OpCode::LOAD) {
+                inst.index = 0;
+            }
+        }
+        Gathered g;
+        g.codes = d.codes;
+        g.bits.resize(d.numValues);
+        g.isInt.resize(d.numValues);
+        g.statuses.resize(d.numValues);
+        g.anyFailed = false;
+        size_t ints = 0;
+        size_t ok = 0;
+        for (size_t e = 0; e < d.numValues; e++) {
+            Value v;
+            auto s = Program::evaluate(subtree, &d.values[e], v);
+            g.statuses[e] = static_cast<uint8_t>(s);
+            if (s != Status::OK) {
+                g.anyFailed = true;
+                g.isInt[e] = 1;
+                g.bits[e] = 0;
+                continue;
+            }
+            ok++;
+            ints += v.isInt();
+            g.isInt[e] = v.isInt();
+            g.bits[e] = v.isInt() ? v.getInt() : toBits(v.getFloat());
+        }
+        g.kind = ints == ok ? Column::INT : (ints == 0 ? Column::FLOAT : Column::MIXED);
+        gathered.push_back(std::move(g));
+        rewritten.push_back({OpCode::LOAD, Builtin::UNKNOWN, static_cast<uint32_t>(numVars + gathered.size() - 1),
+                             Value()});
+        i = root;
+    }
+
+    llvm::SmallVector<const double*, 16> starts(numVars);
+    auto firstStatus = Status::OK;
+    for (size_t begin = 0; begin < numRows; begin += kBlockRows) {
+        auto n = std::min(kBlockRows, numRows - begin);
+        for (size_t v = 0; v < numVars; v++) {
+            starts[v] = plain[v] ? plain[v] + begin : nullptr;
+        }
+        auto s = evaluateBlock(rewritten, starts.data(), 1, gathered.data(), begin, n, results + begin,
+                               statuses != nullptr ? statuses + begin : nullptr);
+        if (firstStatus == Status::OK) {
+            firstStatus = s;
+        }
+    }
+    return firstStatus;
+}
+
+Status VectorEvaluator::evaluateBlock(llvm::ArrayRef<Program::Inst> insts, const double* const* vars,
+                                      size_t rowStride, const Gathered* gathered, size_t begin, size_t n,
+                                      double* results, uint8_t* statuses) {
+    RowStatus status;
+    std::fill(status.s, status.s + n, 0);
+    BlockEvaluator block(pool, n, status);
+
+    auto numVars = program.getNumVars();
+    Column stack[Program::kMaxStackDepth];
+    int sp = 0;
+    for (const auto& inst : insts) {
+        switch (inst.op) {
+        case OpCode::PUSH:
+            stack[sp++] = block.push(inst.imm);
+            break;
+        case OpCode::LOAD:
+            stack[sp++] = inst.index < numVars ? block.load(vars[inst.index], rowStride)
+                                               : block.gather(gathered[inst.index - numVars], begin);
+            break;
+        case OpCode::NEG:
+        case OpCode::FACT:
+        case OpCode::CALL:
+            block.unary(inst.op, inst.func, stack[sp - 1]);
+            break;
+        case OpCode::SELECT:
+            sp -= 2;
+            block.select(stack[sp - 1], stack[sp], stack[sp + 1]);
+            break;
+        default:
+            sp -= 1;
+            block.binary(inst.op, stack[sp - 1], stack[sp]);
+            break;
+        }
+    }
+
+    if (sp != 1) {
+        block.failAll(Status::INVALID_ARGUMENT);
+    }
+    if (sp > 0) {
+        block.store(stack[--sp], results);
+    } else {
+        std::fill(results, results + n, std::numeric_limits<double>::quiet_NaN());
+    }
+    for (int i = 0; i < sp; i++) {
+        pool.release(stack[i].data);
+    }
+
+    if (statuses != nullptr) {
+        std::copy(status.s, status.s + n, statuses);
+    }
+    for (size_t r = 0; r < n; r++) {
+        if (!status.ok(r)) {
+            return static_cast<Status>(status.s[r]);
+        }
+    }
+    return Status::OK;
+}
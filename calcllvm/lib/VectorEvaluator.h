@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Program.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Scratch columns for VectorEvaluator, kept between calls so that evaluating a
+ * block allocates nothing once the pool has grown to the deepest stack seen. A
+ * pool must not be used by two evaluations at the same time.
+ */
+class ColumnPool {
+public:
+    static constexpr size_t kRows = 1024;
+
+    /// Bytes in every buffer: the widest column, 8 bytes and an int flag per row.
+    static constexpr size_t kBufferSize = kRows * (sizeof(double) + 1);
+
+    ColumnPool() = default;
+    ColumnPool(const ColumnPool&) = delete;
+    ColumnPool& operator=(const ColumnPool&) = delete;
+    ~ColumnPool();
+
+    void* acquire();
+    void release(void* buffer);
+
+    /// Buffers allocated so far.
+    size_t size() const {
+        return all.size();
+    }
+
+private:
+    std::vector<void*> all;
+    std::vector<void*> free;
+};
+
+/// An input column as its distinct values and a code per row: row r holds values[codes[r]].
+struct DictColumn {
+    const double* values = nullptr;
+    size_t numValues = 0;
+    const uint32_t* codes = nullptr;
+};
+
+/**
+ * Evaluates a Program over many rows, one instruction over a block of rows at a
+ * time, so that dispatch is paid once per block instead of once per row.
+ *
+ * Every stack slot is a column of kBlockRows values in a pooled buffer. As in
+ * Program::evaluate, integral inputs are bound as ints, so a column is all
+ * floats, all ints, or mixed: the bits of an int or a double per row and a flag
+ * telling which. The kernels work on plain arrays the compiler can vectorize;
+ * on mixed columns + - * and negation compute both the int and the float result
+ * and pick one per row, the other operations fall back to
+ * Program::applyUnary/applyBinary row by row. `?:` has both arms as columns
+ * already and blends them by the condition. Results and statuses are exactly
+ * those of Program::evaluate on every row.
+ */
+class VectorEvaluator {
+public:
+    static constexpr size_t kBlockRows = ColumnPool::kRows;
+
+    VectorEvaluator(const Program& program, ColumnPool& pool)
+        : program(program)
+        , pool(pool) {}
+
+    /// Variable v of row r is `vars[v * varStride + r * rowStride]`, which covers row-major (1, numVars) and
+    /// column-major (numRows, 1) inputs. A failing row yields NaN, and the status of the first failing row is
+    /// returned. If `statuses` is not null, the Status of every row is stored in it as well.
+    Status evaluate(const double* vars, size_t varStride, size_t rowStride, size_t numRows, double* results,
+                    uint8_t* statuses = nullptr);
+
+    /// Variable v of row r is `columns[v][r]`, for columns that are not evenly spaced.
+    Status evaluate(const double* const* columns, size_t numRows, double* results);
+
+    /// Variable v of row r is `columns[v][r]`, or dictionary-encoded if `dicts[v].values` is set. The largest
+    /// subexpressions of a single dictionary-encoded variable, such as `exp(c) * 2` in `exp(c) * 2 + x`, are
+    /// evaluated once per entry of its dictionary and gathered into the rows by their codes. A dictionary with
+    /// more entries than there are rows is decoded instead. Codes must be below numValues.
+    Status evaluate(const double* const* columns, const DictColumn* dicts, size_t numRows, double* results,
+                    uint8_t* statuses = nullptr);
+
+    /// A subexpression of a dictionary-encoded variable, evaluated for every entry of the dictionary.
+    struct Gathered;
+
+private:
+    /// Variable v of row r of the block is `vars[v][r * rowStride]`. LOADs past the variables of the program
+    /// read `gathered`, from row `begin` of its codes.
+    Status evaluateBlock(llvm::ArrayRef<Program::Inst> insts, const double* const* vars, size_t rowStride,
+                         const Gathered* gathered, size_t begin, size_t n, double* results, uint8_t* statuses);
+
+    const Program& program;
+    ColumnPool& pool;
+};
@@ -0,0 +1,268 @@
+#include "aggregate.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LANES CALC_AGGREGATE_LANES
+
+static int parse_hist(struct calc_aggregate* a, const char* spec) {
+    char* end;
+    a->lo = strtod(spec, &end);
+    if (end == spec || *end != ':') {
+        return -1;
+    }
+    spec = end + 1;
+    a->hi = strtod(spec, &end);
+    if (end == spec || *end != ':') {
+        return -1;
+    }
+    spec = end + 1;
+    unsigned long bins = strtoul(spec, &end, 10);
+    if (end == spec || *end != '\0' || bins == 0 || bins > (1ul << 24)) {
+        return -1;
+    }
+    if (!isfinite(a->lo) || !isfinite(a->hi) || !(a->lo < a->hi)) {
+        return -1;
+    }
+    a->bins = (uint32_t)bins;
+    a->counts = calloc(bins, sizeof(uint64_t));
+    return a->counts != NULL ? 0 : -1;
+}
+
+int calc_aggregate_init(struct calc_aggregate* a, const char* spec, int exact) {
+    memset(a, 0, sizeof(*a));
+    a->exact = exact;
+    if (strcmp(spec, "sum") == 0) {
+        a->kind = CALC_AGGREGATE_SUM;
+    } else if (strcmp(spec, "mean") == 0) {
+        a->kind = CALC_AGGREGATE_MEAN;
+    } else if (strcmp(spec, "min") == 0) {
+        a->kind = CALC_AGGREGATE_MIN;
+    } else if (strcmp(spec, "max") == 0) {
+        a->kind = CALC_AGGREGATE_MAX;
+    } else if (strncmp(spec, "hist:", 5) == 0) {
+        a->kind = CALC_AGGREGATE_HIST;
+        return parse_hist(a, spec + 5);
+    } else {
+        return -1;
+    }
+    for (int l = 0; l < LANES; l++) {
+        a->lanes[l] = a->kind == CALC_AGGREGATE_MIN ? INFINITY : a->kind == CALC_AGGREGATE_MAX ? -INFINITY : 0.0;
+    }
+    return 0;
+}
+
+void calc_aggregate_free(struct calc_aggregate* a) {
+    free(a->counts);
+    a->counts = NULL;
+}
+
+/*
+ * The lane loops start at lane `lane` and run up to lane 0 one row at a time,
+ * then LANES rows at a time, which the compiler turns into vector operations on
+ * a copy of the lanes held in registers.
+ */
+
+static void add_sum(double* lanes, unsigned lane, const double* v, int64_t n) {
+    double acc[LANES];
+    memcpy(acc, lanes, sizeof(acc));
+    int64_t i = 0;
+    for (; i < n && lane != 0; i++, lane = (lane + 1) % LANES) {
+        acc[lane] += v[i];
+    }
+    for (; i + LANES <= n; i += LANES) {
+        for (int l = 0; l < LANES; l++) {
+            acc[l] += v[i + l];
+        }
+    }
+    for (int l = 0; i < n; i++, l++) {
+        acc[l] += v[i];
+    }
+    memcpy(lanes, acc, sizeof(acc));
+}
+
+/* `x < m ? x : m` keeps m when x is NaN, and is what minpd computes. */
+static uint64_t add_min(double* lanes, unsigned lane, const double* v, int64_t n) {
+    double acc[LANES];
+    memcpy(acc, lanes, sizeof(acc));
+    uint64_t nans = 0;
+    int64_t i = 0;
+    for (; i < n && lane != 0; i++, lane = (lane + 1) % LANES) {
+        acc[lane] = v[i] < acc[lane] ? v[i] : acc[lane];
+        nans += v[i] != v[i];
+    }
+    for (; i + LANES <= n; i += LANES) {
+        for (int l = 0; l < LANES; l++) {
+            acc[l] = v[i + l] < acc[l] ? v[i + l] : acc[l];
+            nans += v[i + l] != v[i + l];
+        }
+    }
+    for (int l = 0; i < n; i++, l++) {
+        acc[l] = v[i] < acc[l] ? v[i] : acc[l];
+        nans += v[i] != v[i];
+    }
+    memcpy(lanes, acc, sizeof(acc));
+    return nans;
+}
+
+static uint64_t add_max(double* lanes, unsigned lane, const double* v, int64_t n) {
+    double acc[LANES];
+    memcpy(acc, lanes, sizeof(acc));
+    uint64_t nans = 0;
+    int64_t i = 0;
+    for (; i < n && lane != 0; i++, lane = (lane + 1) % LANES) {
+        acc[lane] = v[i] > acc[lane] ? v[i] : acc[lane];
+        nans += v[i] != v[i];
+    }
+    for (; i + LANES <= n; i += LANES) {
+        for (int l = 0; l < LANES; l++) {
+            acc[l] = v[i + l] > acc[l] ? v[i + l] : acc[l];
+            nans += v[i + l] != v[i + l];
+        }
+    }
+    for (int l = 0; i < n; i++, l++) {
+        acc[l] = v[i] > acc[l] ? v[i] : acc[l];
+        nans += v[i] != v[i];
+    }
+    memcpy(lanes, acc, sizeof(acc));
+    return nans;
+}
+
+/* Adds x to the partials, which stay non-overlapping and in increasing magnitude. */
+static void add_exact(struct calc_aggregate* a, double x) {
+    if (!isfinite(x)) {
+        a->special += x;
+        return;
+    }
+    size_t k = 0;
+    for (size_t j = 0; j < a->num_partials; j++) {
+        double y = a->partials[j];
+        if (fabs(x) < fabs(y)) {
+            double t = x;
+            x = y;
+            y = t;
+        }
+        double hi = x + y;
+        double lo = y - (hi - x);
+        if (lo != 0.0) {
+            a->partials[k++] = lo;
+        }
+        x = hi;
+    }
+    if (!isfinite(x)) {
+        a->special += x;
+        a->num_partials = 0;
+        return;
+    }
+    a->partials[k++] = x;
+    a->num_partials = k;
+}
+
+/* The partials rounded once, ties to even, as in Python's math.fsum. */
+static double exact_sum(const struct calc_aggregate* a) {
+    if (a->special != 0.0) {
+        return a->special;
+    }
+    size_t n = a->num_partials;
+    if (n == 0) {
+        return 0.0;
+    }
+    double hi = a->partials[--n];
+    double lo = 0.0;
+    while (n > 0) {
+        double x = hi;
+        double y = a->partials[--n];
+        hi = x + y;
+        lo = y - (hi - x);
+        if (lo != 0.0) {
+            break;
+        }
+    }
+    if (n > 0 && ((lo < 0.0 && a->partials[n - 1] < 0.0) || (lo > 0.0 && a->partials[n - 1] > 0.0))) {
+        double y = lo * 2.0;
+        double x = hi + y;
+        if (y == x - hi) {
+            hi = x;
+        }
+    }
+    return hi;
+}
+
+static void add_hist(struct calc_aggregate* a, const double* v, int64_t n) {
+    double scale = a->bins / (a->hi - a->lo);
+    for (int64_t i = 0; i < n; i++) {
+        if (v[i] >= a->lo && v[i] < a->hi) {
+            uint32_t bin = (uint32_t)((v[i] - a->lo) * scale);
+            a->counts[bin < a->bins ? bin : a->bins - 1]++;
+        }
+    }
+}
+
+void calc_aggregate_add(struct calc_aggregate* a, const double* values, int64_t n) {
+    unsigned lane = (unsigned)(a->rows % LANES);
+    switch (a->kind) {
+    case CALC_AGGREGATE_SUM:
+    case CALC_AGGREGATE_MEAN:
+        if (a->exact) {
+            for (int64_t i = 0; i < n; i++) {
+                add_exact(a, values[i]);
+            }
+        } else {
+            add_sum(a->lanes, lane, values, n);
+        }
+        break;
+    case CALC_AGGREGATE_MIN:
+        a->valid += (uint64_t)n - add_min(a->lanes, lane, values, n);
+        break;
+    case CALC_AGGREGATE_MAX:
+        a->valid += (uint64_t)n - add_max(a->lanes, lane, values, n);
+        break;
+    case CALC_AGGREGATE_HIST:
+        add_hist(a, values, n);
+        break;
+    }
+    a->rows += (uint64_t)n;
+}
+
+size_t calc_aggregate_size(const struct calc_aggregate* a) {
+    return a->kind == CALC_AGGREGATE_HIST ? a->bins : 1;
+}
+
+/* Combines the lanes pairwise, always in the same order. */
+static double combine(const struct calc_aggregate* a) {
+    double acc[LANES];
+    memcpy(acc, a->lanes, sizeof(acc));
+    for (int width = LANES / 2; width > 0; width /= 2) {
+        for (int l = 0; l < width; l++) {
+            if (a->kind == CALC_AGGREGATE_MIN) {
+                acc[l] = acc[l + width] < acc[l] ? acc[l + width] : acc[l];
+            } else if (a->kind == CALC_AGGREGATE_MAX) {
+                acc[l] = acc[l + width] > acc[l] ? acc[l + width] : acc[l];
+            } else {
+                acc[l] += acc[l + width];
+            }
+        }
+    }
+    return acc[0];
+}
+
+void calc_aggregate_result(const struct calc_aggregate* a, double* out) {
+    switch (a->kind) {
+    case CALC_AGGREGATE_SUM:
+        out[0] = a->exact ? exact_sum(a) : combine(a);
+        break;
+    case CALC_AGGREGATE_MEAN:
+        out[0] = (a->exact ? exact_sum(a) : combine(a)) / (double)a->rows;
+        break;
+    case CALC_AGGREGATE_MIN:
+    case CALC_AGGREGATE_MAX:
+        out[0] = a->valid > 0 ? combine(a) : NAN;
+        break;
+    case CALC_AGGREGATE_HIST:
+        for (uint32_t b = 0; b < a->bins; b++) {
+            out[b] = (double)a->counts[b];
+        }
+        break;
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * Reductions over the results of a batch evaluation, for the streaming runtime
+ * and calci, so that only the aggregate leaves the evaluation loop:
+ *
+ *  sum, mean        NaN as soon as one row is NaN
+ *  min, max         NaN rows are skipped, NaN if every row is
+ *  hist:LO:HI:BINS  BINS counts of the rows in [LO, HI), split evenly
+ *
+ * Values are added a chunk at a time. Sums, minima and maxima are kept in
+ * CALC_AGGREGATE_LANES partial accumulators which the compiler can keep in
+ * vector registers; row i of the input always goes to lane i % LANES and the
+ * lanes are combined in a fixed order, so the result depends on the values and
+ * their order only, not on how they were split into chunks.
+ *
+ * In exact mode sum and mean do not round until the end: the running sum is a
+ * list of non-overlapping partials (Shewchuk's algorithm, as in Python's fsum),
+ * so the result is the correctly rounded sum of the rows, the same for any order
+ * of the rows, any split of them and any lane count. It costs a few times more
+ * per row. An intermediate overflow gives an infinity.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CALC_AGGREGATE_LANES 8
+
+/* Enough for any sum of doubles, partials do not overlap and each holds 53 of the 2098 bits of the range. */
+#define CALC_AGGREGATE_MAX_PARTIALS 48
+
+enum calc_aggregate_kind {
+    CALC_AGGREGATE_SUM,
+    CALC_AGGREGATE_MEAN,
+    CALC_AGGREGATE_MIN,
+    CALC_AGGREGATE_MAX,
+    CALC_AGGREGATE_HIST,
+};
+
+struct calc_aggregate {
+    enum calc_aggregate_kind kind;
+    int exact;
+    uint64_t rows;
+    uint64_t valid; /* rows that are not NaN, for min and max */
+    double lanes[CALC_AGGREGATE_LANES];
+
+    double special; /* exact mode: the sum of the infinities and NaNs */
+    double partials[CALC_AGGREGATE_MAX_PARTIALS];
+    size_t num_partials;
+
+    double lo;
+    double hi;
+    uint32_t bins;
+    uint64_t* counts;
+};
+
+/* Parse `spec` (see above) into a. Returns 0, or -1 if it is invalid or out of memory. */
+int calc_aggregate_init(struct calc_aggregate* a, const char* spec, int exact);
+void calc_aggregate_free(struct calc_aggregate* a);
+
+void calc_aggregate_add(struct calc_aggregate* a, const double* values, int64_t n);
+
+/* The number of values calc_aggregate_result writes: 1, or the number of bins. */
+size_t calc_aggregate_size(const struct calc_aggregate* a);
+void calc_aggregate_result(const struct calc_aggregate* a, double* out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,431 @@
+/*
+ * Float formatting follows Grisu2 (Loitsch, "Printing Floating-Point Numbers
+ * Quickly and Accurately with Integers", PLDI 2010): the boundaries of the
+ * interval that rounds to the value are scaled by a cached power of ten into a
+ * 64-bit fixed point range where the digits can be generated with integer
+ * arithmetic, and generation stops as soon as the digits are inside the interval.
+ */
+
+#include "format.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char digit_pairs[201] = "00010203040506070809"
+                                     "10111213141516171819"
+                                     "20212223242526272829"
+                                     "30313233343536373839"
+                                     "40414243444546474849"
+                                     "50515253545556575859"
+                                     "60616263646566676869"
+                                     "70717273747576777879"
+                                     "80818283848586878889"
+                                     "90919293949596979899";
+
+size_t calc_format_i(char* dst, int64_t v) {
+    char* p = dst;
+    uint64_t u = (uint64_t)v;
+    if (v < 0) {
+        *p++ = '-';
+        u = 0 - u;
+    }
+    char tmp[20];
+    char* end = tmp + sizeof(tmp);
+    char* q = end;
+    while (u >= 100) {
+        unsigned r = (unsigned)(u % 100);
+        u /= 100;
+        q -= 2;
+        memcpy(q, digit_pairs + 2 * r, 2);
+    }
+    if (u >= 10) {
+        q -= 2;
+        memcpy(q, digit_pairs + 2 * u, 2);
+    } else {
+        *--q = (char)('0' + u);
+    }
+    memcpy(p, q, (size_t)(end - q));
+    return (size_t)(p - dst) + (size_t)(end - q);
+}
+
+/* f * 2^e */
+struct diy_fp {
+    uint64_t f;
+    int e;
+};
+
+static struct diy_fp diy_fp_sub(struct diy_fp x, struct diy_fp y) {
+    struct diy_fp r = {x.f - y.f, x.e};
+    return r;
+}
+
+/* The upper 64 bits of the product, rounded. */
+static struct diy_fp diy_fp_mul(struct diy_fp x, struct diy_fp y) {
+    unsigned __int128 p = (unsigned __int128)x.f * y.f;
+    p += (unsigned __int128)1 << 63;
+    struct diy_fp r = {(uint64_t)(p >> 64), x.e + y.e + 64};
+    return r;
+}
+
+static struct diy_fp diy_fp_normalize(struct diy_fp x) {
+    int shift = __builtin_clzll(x.f);
+    struct diy_fp r = {x.f << shift, x.e - shift};
+    return r;
+}
+
+/*
+ * v and the boundaries of the interval rounding to it, m_minus < v < m_plus,
+ * all normalized to the exponent of m_plus. v must be finite and positive.
+ */
+static void compute_boundaries(double value, struct diy_fp* m_minus, struct diy_fp* v, struct diy_fp* m_plus) {
+    const uint64_t hidden_bit = (uint64_t)1 << 52;
+    const int bias = 1023 + 52;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t fraction = bits & (hidden_bit - 1);
+    int exponent = (int)(bits >> 52);
+
+    struct diy_fp w;
+    if (exponent == 0) {
+        w.f = fraction;
+        w.e = 1 - bias;
+    } else {
+        w.f = fraction + hidden_bit;
+        w.e = exponent - bias;
+    }
+
+    /* the gap below a power of two is half the one above it */
+    int lower_is_closer = fraction == 0 && exponent > 1;
+    struct diy_fp plus = {2 * w.f + 1, w.e - 1};
+    struct diy_fp minus = {2 * w.f - 1, w.e - 1};
+    if (lower_is_closer) {
+        minus.f = 4 * w.f - 1;
+        minus.e = w.e - 2;
+    }
+
+    *m_plus = diy_fp_normalize(plus);
+    m_minus->f = minus.f << (minus.e - m_plus->e);
+    m_minus->e = m_plus->e;
+    *v = diy_fp_normalize(w);
+}
+
+struct cached_power {
+    uint64_t f;
+    int e;
+    int k;
+};
+
+/* 10^k ~= f * 2^e with f normalized, for k = -300, -292, ..., 324 */
+static const struct cached_power cached_powers[] = {
+    {0xAB70FE17C79AC6CA, -1060, -300},
+    {0xFF77B1FCBEBCDC4F, -1034, -292},
+    {0xBE5691EF416BD60C, -1007, -284},
+    {0x8DD01FAD907FFC3C, -980, -276},
+    {0xD3515C2831559A83, -954, -268},
+    {0x9D71AC8FADA6C9B5, -927, -260},
+    {0xEA9C227723EE8BCB, -901, -252},
+    {0xAECC49914078536D, -874, -244},
+    {0x823C12795DB6CE57, -847, -236},
+    {0xC21094364DFB5637, -821, -228},
+    {0x9096EA6F3848984F, -794, -220},
+    {0xD77485CB25823AC7, -768, -212},
+    {0xA086CFCD97BF97F4, -741, -204},
+    {0xEF340A98172AACE5, -715, -196},
+    {0xB23867FB2A35B28E, -688, -188},
+    {0x84C8D4DFD2C63F3B, -661, -180},
+    {0xC5DD44271AD3CDBA, -635, -172},
+    {0x936B9FCEBB25C996, -608, -164},
+    {0xDBAC6C247D62A584, -582, -156},
+    {0xA3AB66580D5FDAF6, -555, -148},
+    {0xF3E2F893DEC3F126, -529, -140},
+    {0xB5B5ADA8AAFF80B8, -502, -132},
+    {0x87625F056C7C4A8B, -475, -124},
+    {0xC9BCFF6034C13053, -449, -116},
+    {0x964E858C91BA2655, -422, -108},
+    {0xDFF9772470297EBD, -396, -100},
+    {0xA6DFBD9FB8E5B88F, -369, -92},
+    {0xF8A95FCF88747D94, -343, -84},
+    {0xB94470938FA89BCF, -316, -76},
+    {0x8A08F0F8BF0F156B, -289, -68},
+    {0xCDB02555653131B6, -263, -60},
+    {0x993FE2C6D07B7FAC, -236, -52},
+    {0xE45C10C42A2B3B06, -210, -44},
+    {0xAA242499697392D3, -183, -36},
+    {0xFD87B5F28300CA0E, -157, -28},
+    {0xBCE5086492111AEB, -130, -20},
+    {0x8CBCCC096F5088CC, -103, -12},
+    {0xD1B71758E219652C, -77, -4},
+    {0x9C40000000000000, -50, 4},
+    {0xE8D4A51000000000, -24, 12},
+    {0xAD78EBC5AC620000, 3, 20},
+    {0x813F3978F8940984, 30, 28},
+    {0xC097CE7BC90715B3, 56, 36},
+    {0x8F7E32CE7BEA5C70, 83, 44},
+    {0xD5D238A4ABE98068, 109, 52},
+    {0x9F4F2726179A2245, 136, 60},
+    {0xED63A231D4C4FB27, 162, 68},
+    {0xB0DE65388CC8ADA8, 189, 76},
+    {0x83C7088E1AAB65DB, 216, 84},
+    {0xC45D1DF942711D9A, 242, 92},
+    {0x924D692CA61BE758, 269, 100},
+    {0xDA01EE641A708DEA, 295, 108},
+    {0xA26DA3999AEF774A, 322, 116},
+    {0xF209787BB47D6B85, 348, 124},
+    {0xB454E4A179DD1877, 375, 132},
+    {0x865B86925B9BC5C2, 402, 140},
+    {0xC83553C5C8965D3D, 428, 148},
+    {0x952AB45CFA97A0B3, 455, 156},
+    {0xDE469FBD99A05FE3, 481, 164},
+    {0xA59BC234DB398C25, 508, 172},
+    {0xF6C69A72A3989F5C, 534, 180},
+    {0xB7DCBF5354E9BECE, 561, 188},
+    {0x88FCF317F22241E2, 588, 196},
+    {0xCC20CE9BD35C78A5, 614, 204},
+    {0x98165AF37B2153DF, 641, 212},
+    {0xE2A0B5DC971F303A, 667, 220},
+    {0xA8D9D1535CE3B396, 694, 228},
+    {0xFB9B7CD9A4A7443C, 720, 236},
+    {0xBB764C4CA7A44410, 747, 244},
+    {0x8BAB8EEFB6409C1A, 774, 252},
+    {0xD01FEF10A657842C, 800, 260},
+    {0x9B10A4E5E9913129, 827, 268},
+    {0xE7109BFBA19C0C9D, 853, 276},
+    {0xAC2820D9623BF429, 880, 284},
+    {0x80444B5E7AA7CF85, 907, 292},
+    {0xBF21E44003ACDD2D, 933, 300},
+    {0x8E679C2F5E44FF8F, 960, 308},
+    {0xD433179D9C8CB841, 986, 316},
+    {0x9E19DB92B4E31BA9, 1013, 324},
+};
+
+#define CACHED_POWERS_MIN_K (-300)
+#define CACHED_POWERS_STEP 8
+
+/* The range the scaled boundaries have to land in, so that the digits before the point fit in 32 bits. */
+#define ALPHA (-60)
+#define GAMMA (-32)
+
+/* A cached power c with ALPHA <= e + c.e + 64 <= GAMMA. */
+static struct cached_power cached_power_for(int e) {
+    /* ceil((ALPHA - e - 1) * log10(2)), 78913 / 2^18 ~= log10(2) */
+    int f = ALPHA - e - 1;
+    int k = (f * 78913) / (1 << 18) + (f > 0);
+    int index = (-CACHED_POWERS_MIN_K + k + (CACHED_POWERS_STEP - 1)) / CACHED_POWERS_STEP;
+    return cached_powers[index];
+}
+
+/* The number of decimal digits of n, and 10^(digits - 1) in pow10. */
+static int largest_pow10(uint32_t n, uint32_t* pow10) {
+    static const uint32_t powers[] = {1,      10,      100,      1000,      10000,
+                                      100000, 1000000, 10000000, 100000000, 1000000000};
+    int digits = 1;
+    while (digits < 10 && n >= powers[digits]) {
+        digits++;
+    }
+    *pow10 = powers[digits - 1];
+    return digits;
+}
+
+/* Move the last digit towards w while the digits stay within the interval. */
+static void round_weed(char* buffer, int length, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k) {
+    while (rest < dist && delta - rest >= ten_k && (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+        buffer[length - 1]--;
+        rest += ten_k;
+    }
+}
+
+/* Digits of a value in (m_minus, m_plus) closest to w, all scaled. value = digits * 10^exponent. */
+static int generate_digits(char* buffer, int* exponent, struct diy_fp m_minus, struct diy_fp w, struct diy_fp m_plus) {
+    uint64_t delta = diy_fp_sub(m_plus, m_minus).f;
+    uint64_t dist = diy_fp_sub(m_plus, w).f;
+
+    /* split m_plus at the point of `one` into 32 bits of integral part and the fraction */
+    const int shift = -m_plus.e;
+    const uint64_t one = (uint64_t)1 << shift;
+    uint32_t p1 = (uint32_t)(m_plus.f >> shift);
+    uint64_t p2 = m_plus.f & (one - 1);
+
+    int length = 0;
+    uint32_t pow10;
+    int n = largest_pow10(p1, &pow10);
+    while (n > 0) {
+        uint32_t d = p1 / pow10;
+        p1 %= pow10;
+        buffer[length++] = (char)('0' + d);
+        n--;
+        uint64_t rest = ((uint64_t)p1 << shift) + p2;
+        if (rest <= delta) {
+            *exponent += n;
+            round_weed(buffer, length, dist, delta, rest, (uint64_t)pow10 << shift);
+            return length;
+        }
+        pow10 /= 10;
+    }
+
+    int m = 0;
+    for (;;) {
+        p2 *= 10;
+        buffer[length++] = (char)('0' + (p2 >> shift));
+        p2 &= one - 1;
+        m++;
+        delta *= 10;
+        dist *= 10;
+        if (p2 <= delta) {
+            break;
+        }
+    }
+    *exponent -= m;
+    round_weed(buffer, length, dist, delta, p2, one);
+    return length;
+}
+
+/* Shortest digits of a finite, positive value: value = digits * 10^exponent. */
+static int grisu2(char* buffer, int* exponent, double value) {
+    struct diy_fp m_minus, v, m_plus;
+    compute_boundaries(value, &m_minus, &v, &m_plus);
+
+    struct cached_power cached = cached_power_for(m_plus.e);
+    struct diy_fp c = {cached.f, cached.e};
+    struct diy_fp w = diy_fp_mul(v, c);
+    struct diy_fp w_minus = diy_fp_mul(m_minus, c);
+    struct diy_fp w_plus = diy_fp_mul(m_plus, c);
+
+    /* the products are off by at most one ulp, keep clear of the boundaries */
+    w_minus.f++;
+    w_plus.f--;
+
+    *exponent = -cached.k;
+    return generate_digits(buffer, exponent, w_minus, w, w_plus);
+}
+
+static char* append_exponent(char* p, int e) {
+    *p++ = 'e';
+    if (e < 0) {
+        *p++ = '-';
+        e = -e;
+    } else {
+        *p++ = '+';
+    }
+    if (e >= 100) {
+        *p++ = (char)('0' + e / 100);
+        e %= 100;
+    }
+    memcpy(p, digit_pairs + 2 * e, 2);
+    return p + 2;
+}
+
+/* Lay out the digits, at the start of p, as fixed or scientific notation. */
+static char* format_digits(char* p, int length, int exponent) {
+    /* the value is 0.digits * 10^point */
+    int point = length + exponent;
+
+    if (length <= point && point <= 17) {
+        /* digits[000].0 */
+        memset(p + length, '0', (size_t)(point - length));
+        p[point] = '.';
+        p[point + 1] = '0';
+        return p + point + 2;
+    }
+    if (0 < point && point <= 17) {
+        /* dig.its */
+        memmove(p + point + 1, p + point, (size_t)(length - point));
+        p[point] = '.';
+        return p + length + 1;
+    }
+    if (-4 < point && point <= 0) {
+        /* 0.[000]digits */
+        memmove(p + 2 - point, p, (size_t)length);
+        p[0] = '0';
+        p[1] = '.';
+        memset(p + 2, '0', (size_t)-point);
+        return p + 2 - point + length;
+    }
+    if (length == 1) {
+        /* de+xx */
+        return append_exponent(p + 1, point - 1);
+    }
+    /* d.igitse+xx */
+    memmove(p + 2, p + 1, (size_t)(length - 1));
+    p[1] = '.';
+    return append_exponent(p + length + 1, point - 1);
+}
+
+size_t calc_format_f(char* dst, double v) {
+    char* p = dst;
+    if (v != v) {
+        memcpy(p, "nan", 3);
+        return 3;
+    }
+    if (signbit(v)) {
+        *p++ = '-';
+        v = -v;
+    }
+    if (v == __builtin_inf()) {
+        memcpy(p, "inf", 3);
+        return (size_t)(p - dst) + 3;
+    }
+    if (v == 0) {
+        memcpy(p, "0.0", 3);
+        return (size_t)(p - dst) + 3;
+    }
+    int exponent;
+    int length = grisu2(p, &exponent, v);
+    return (size_t)(format_digits(p, length, exponent) - dst);
+}
+
+void calc_output_init(struct calc_output* out, int fd, int binary) {
+    out->fd = fd;
+    out->binary = binary;
+    out->failed = 0;
+    out->size = 0;
+}
+
+static void write_out(struct calc_output* out) {
+    if (out->fd == 1) {
+        fflush(stdout);
+    }
+    size_t done = 0;
+    while (done < out->size && !out->failed) {
+        ssize_t r = write(out->fd, out->data + done, out->size - done);
+        if (r < 0 && errno != EINTR) {
+            out->failed = 1;
+        } else if (r > 0) {
+            done += (size_t)r;
+        }
+    }
+    out->size = 0;
+}
+
+void calc_output_i(struct calc_output* out, int64_t v) {
+    if (sizeof(out->data) - out->size < CALC_FORMAT_MAX) {
+        write_out(out);
+    }
+    if (out->binary) {
+        memcpy(out->data + out->size, &v, sizeof(v));
+        out->size += sizeof(v);
+        return;
+    }
+    out->size += calc_format_i(out->data + out->size, v);
+    out->data[out->size++] = '\n';
+}
+
+void calc_output_f(struct calc_output* out, double v) {
+    if (sizeof(out->data) - out->size < CALC_FORMAT_MAX) {
+        write_out(out);
+    }
+    if (out->binary) {
+        memcpy(out->data + out->size, &v, sizeof(v));
+        out->size += sizeof(v);
+        return;
+    }
+    out->size += calc_format_f(out->data + out->size, v);
+    out->data[out->size++] = '\n';
+}
+
+int calc_output_flush(struct calc_output* out) {
+    write_out(out);
+    return out->failed ? -1 : 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Number formatting and buffered output, shared by the runtime of compiled
+ * expressions and by calci.
+ *
+ * Floats are printed with the fewest digits that read back to the same double
+ * (Grisu2: the result always round-trips, and is the shortest in all but about
+ * one case in a thousand, where it has one digit more). Fixed notation is used
+ * for decimal exponents in [-4, 17), scientific notation otherwise, and a ".0"
+ * is kept on integral values so that floats stay apart from ints:
+ *
+ *   0.1 -> 0.1    3.0 -> 3.0    1e-7 -> 1e-07    2^70 -> 1.1805916207174113e+21
+ *
+ * calc_output collects values in a 64 KiB buffer and writes it out with one
+ * write() per buffer instead of one printf() per value. Text output is one value
+ * per line, binary output the raw 8 bytes of every int64 or double in native
+ * byte order.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Enough for any value formatted below, with its sign. */
+#define CALC_FORMAT_MAX 32
+
+#define CALC_OUTPUT_BUFFER_SIZE (1 << 16)
+
+/* Write the decimal text of v to dst, not terminated. Return its length. */
+size_t calc_format_i(char* dst, int64_t v);
+size_t calc_format_f(char* dst, double v);
+
+struct calc_output {
+    int fd;
+    int binary;
+    int failed;
+    size_t size;
+    char data[CALC_OUTPUT_BUFFER_SIZE];
+};
+
+void calc_output_init(struct calc_output* out, int fd, int binary);
+void calc_output_i(struct calc_output* out, int64_t v);
+void calc_output_f(struct calc_output* out, double v);
+
+/*
+ * Write out what is buffered. Flushes stdio's stdout first when writing to fd 1,
+ * so that prompts printed with printf() come out before the values. Returns 0,
+ * or -1 if any write so far has failed.
+ */
+int calc_output_flush(struct calc_output* out);
+
+#ifdef __cplusplus
+}
+#endif
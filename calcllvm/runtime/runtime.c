@@ -1,7 +1,9 @@
+#include "format.h"
 #include "math.h"
 #include "stdint.h"
-
-extern int printf(const char*, ...);
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
 
 int64_t _powi(int64_t b, int64_t e) {
     if (e == 1)
@@ -23,18 +25,57 @@ int64_t powi(int64_t b, int64_t e) {
     if (e < 0)
         return -1;
 
-    if (b == 0)
+    if (e == 0)
         return 1;
 
     return _powi(b, e);
 }
 
+// Results are buffered and written out at exit. CALC_OUTPUT=binary writes them as raw 8 byte values, the
+// prompts for variables then go to stderr to keep stdout clean.
+static struct calc_output output;
+static int output_ready = 0;
+
+static void flush_output(void) {
+    if (calc_output_flush(&output) != 0) {
+        fprintf(stderr, "write failed\n");
+    }
+}
+
+static struct calc_output* get_output(void) {
+    if (!output_ready) {
+        const char* mode = getenv("CALC_OUTPUT");
+        calc_output_init(&output, 1, mode != NULL && strcmp(mode, "binary") == 0);
+        atexit(flush_output);
+        output_ready = 1;
+    }
+    return &output;
+}
+
 void print_i(int64_t v) {
-    printf("%lld\n", v);
+    calc_output_i(get_output(), v);
 }
 
 void print_f(double v) {
-    printf("%lf\n", v);
+    calc_output_f(get_output(), v);
+}
+
+static void prompt(const char* name) {
+    fprintf(get_output()->binary ? stderr : stdout, "Input value %s: ", name);
+}
+
+double read_f(const char* name) {
+    double v = 0.0;
+    prompt(name);
+    scanf("%lf", &v);
+    return v;
+}
+
+int64_t read_i(const char* name) {
+    long long v = 0;
+    prompt(name);
+    scanf("%lld", &v);
+    return v;
 }
 
 struct Value {
@@ -0,0 +1,596 @@
+/*
+ * Runtime of executables built with `calcc --stream`: evaluates the expression
+ * over every row of a columnar input, a block of rows at a time.
+ *
+ *  a.out [--text] [--aggregate=SPEC [--exact]] [--set=NAME=VALUE ...] [-o OUTPUT] [INPUT]
+ *
+ * INPUT and OUTPUT default to stdin and stdout. The format, little-endian, with
+ * every section starting at a multiple of 8 bytes so that columns can be used
+ * where they are:
+ *
+ *  header := "CALCCOL1" u32:num_columns u32:0
+ *            num_columns * (u32:length name), zero-padded to a multiple of 8
+ *  block  := u64:num_rows, then num_rows doubles for each column in turn
+ *  end    := u64:0, or the end of the input
+ *
+ * Columns are matched to variables by name, other columns are skipped. A
+ * variable given with --set needs no column, it has that value on every row;
+ * kernels built with `calcc --scalar` only read it once per block. Output is the
+ * same format with one column, "result", and one block per input block, or one
+ * value per line with --text.
+ *
+ * With --aggregate only the reduction of the results is written, as a single
+ * block or with --text one value per line; SPEC and --exact are described in
+ * aggregate.h. The kernel then runs on chunks of a block small enough for their
+ * results to stay in the L1 cache, and each chunk is reduced as soon as it is
+ * computed, so the results never go to memory.
+ *
+ * Reading, evaluating and writing overlap: a reader thread fills one of two
+ * input buffers while the kernel runs on the other, and a writer thread drains
+ * one of two output buffers while the kernel fills the other. A regular file is
+ * mmap'd instead of read, its blocks are handed to the kernel in place.
+ */
+
+#include "aggregate.h"
+#include "format.h"
+#include "stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NUM_BUFFERS 2
+
+/* Rows evaluated at a time when aggregating, 4 KB of results. */
+#define CHUNK_ROWS 512
+
+static const char magic[8] = {'C', 'A', 'L', 'C', 'C', 'O', 'L', '1'};
+
+struct in_buffer {
+    int full;
+    int last; /* the end of the input, holds no rows */
+    int64_t rows;
+    const double** columns; /* num_columns pointers, into data or into the mapping */
+    double* data;
+    size_t capacity; /* of data, in doubles */
+};
+
+struct out_buffer {
+    int full;
+    int last;
+    int64_t rows;
+    double* data;
+    size_t capacity;
+};
+
+struct stream {
+    int in_fd;
+    int out_fd;
+    int text;
+
+    const unsigned char* map; /* the whole input if it could be mapped */
+    size_t map_size;
+    size_t map_offset;
+
+    uint32_t num_columns;
+    int num_vars;
+    int* var_columns; /* the input column of every variable */
+    char* var_set;    /* whether a variable was given with --set, then it has no column but var_values[v] */
+    double* var_values;
+    double** broadcast; /* var_values[v] repeated broadcast_rows times, for every variable set */
+    size_t broadcast_rows;
+    calc_kernel_fn kernel;
+    struct calc_aggregate* aggregate; /* or NULL, then every result is written */
+
+    struct in_buffer in[NUM_BUFFERS];
+    struct out_buffer out[NUM_BUFFERS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    const char* error; /* the first failure, stops every thread */
+};
+
+static void fail(struct stream* s, const char* error) {
+    pthread_mutex_lock(&s->lock);
+    if (s->error == NULL) {
+        s->error = error;
+    }
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* Returns the number of bytes read, less than n only at the end of the input, or -1. */
+static ssize_t read_fully(int fd, void* buf, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t r = read(fd, (char*)buf + done, n - done);
+        if (r == 0) {
+            break;
+        }
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += (size_t)r;
+    }
+    return (ssize_t)done;
+}
+
+static int write_fully(int fd, const void* buf, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t r = write(fd, (const char*)buf + done, n - done);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+/* Reads n bytes of the input, from the mapping or the file. Returns 0, or -1 at the end or on a short read. */
+static int input(struct stream* s, void* buf, size_t n) {
+    if (s->map != NULL) {
+        if (s->map_size - s->map_offset < n) {
+            return -1;
+        }
+        memcpy(buf, s->map + s->map_offset, n);
+        s->map_offset += n;
+        return 0;
+    }
+    return read_fully(s->in_fd, buf, n) == (ssize_t)n ? 0 : -1;
+}
+
+static const char* read_header(struct stream* s, const char* const* names) {
+    char head[16];
+    if (input(s, head, sizeof(head)) != 0 || memcmp(head, magic, sizeof(magic)) != 0) {
+        return "input is not in the columnar format";
+    }
+    memcpy(&s->num_columns, head + 8, sizeof(uint32_t));
+
+    for (int v = 0; v < s->num_vars; v++) {
+        s->var_columns[v] = -1;
+    }
+    size_t size = 0;
+    char name[256];
+    for (uint32_t c = 0; c < s->num_columns; c++) {
+        uint32_t length;
+        if (input(s, &length, sizeof(length)) != 0 || length >= sizeof(name) || input(s, name, length) != 0) {
+            return "truncated or invalid column names";
+        }
+        name[length] = '\0';
+        size += sizeof(length) + length;
+        for (int v = 0; v < s->num_vars; v++) {
+            if (s->var_columns[v] < 0 && !s->var_set[v] && strcmp(names[v], name) == 0) {
+                s->var_columns[v] = (int)c;
+            }
+        }
+    }
+    char pad[8];
+    if (size % 8 != 0 && input(s, pad, 8 - size % 8) != 0) {
+        return "truncated header";
+    }
+
+    for (int v = 0; v < s->num_vars; v++) {
+        if (s->var_columns[v] < 0 && !s->var_set[v]) {
+            fprintf(stderr, "input has no column %s\n", names[v]);
+            return "missing column";
+        }
+    }
+    return NULL;
+}
+
+/* Fills b with the next block, or marks it last. Called without the lock, b belongs to the reader. */
+static const char* read_block(struct stream* s, struct in_buffer* b) {
+    uint64_t rows;
+    if (input(s, &rows, sizeof(rows)) != 0 || rows == 0) {
+        b->last = 1;
+        b->rows = 0;
+        return NULL;
+    }
+    if (rows > (SIZE_MAX / sizeof(double)) / (s->num_columns + 1)) {
+        return "block too large";
+    }
+    size_t bytes = rows * s->num_columns * sizeof(double);
+
+    if (s->map != NULL) {
+        if (s->map_size - s->map_offset < bytes) {
+            return "truncated block";
+        }
+        for (uint32_t c = 0; c < s->num_columns; c++) {
+            b->columns[c] = (const double*)(s->map + s->map_offset) + c * rows;
+        }
+        s->map_offset += bytes;
+        /* let the kernel find the next block in memory as well */
+        if (s->map_offset < s->map_size) {
+            uintptr_t page = (uintptr_t)(s->map + s->map_offset) & ~(uintptr_t)4095;
+            size_t ahead = s->map_size - s->map_offset < bytes ? s->map_size - s->map_offset : bytes;
+            madvise((void*)page, ahead, MADV_WILLNEED);
+        }
+    } else {
+        size_t n = rows * s->num_columns;
+        if (b->capacity < n) {
+            free(b->data);
+            b->data = malloc(n * sizeof(double));
+            b->capacity = b->data != NULL ? n : 0;
+            if (b->data == NULL) {
+                return "out of memory";
+            }
+        }
+        if (read_fully(s->in_fd, b->data, bytes) != (ssize_t)bytes) {
+            return "truncated block";
+        }
+        for (uint32_t c = 0; c < s->num_columns; c++) {
+            b->columns[c] = b->data + c * rows;
+        }
+    }
+    b->rows = (int64_t)rows;
+    return NULL;
+}
+
+static void* reader(void* arg) {
+    struct stream* s = arg;
+    for (unsigned k = 0;; k++) {
+        struct in_buffer* b = &s->in[k % NUM_BUFFERS];
+        pthread_mutex_lock(&s->lock);
+        while (b->full && s->error == NULL) {
+            pthread_cond_wait(&s->changed, &s->lock);
+        }
+        int stop = s->error != NULL;
+        pthread_mutex_unlock(&s->lock);
+        if (stop) {
+            return NULL;
+        }
+
+        const char* error = read_block(s, b);
+        if (error != NULL) {
+            fail(s, error);
+            return NULL;
+        }
+
+        pthread_mutex_lock(&s->lock);
+        b->full = 1;
+        pthread_cond_broadcast(&s->changed);
+        pthread_mutex_unlock(&s->lock);
+        if (b->last) {
+            return NULL;
+        }
+    }
+}
+
+static const char* write_block(struct stream* s, struct calc_output* text, const struct out_buffer* b) {
+    if (text != NULL) {
+        for (int64_t i = 0; i < b->rows; i++) {
+            calc_output_f(text, b->data[i]);
+        }
+        return text->failed ? "write failed" : NULL;
+    }
+    uint64_t rows = (uint64_t)b->rows;
+    if (write_fully(s->out_fd, &rows, sizeof(rows)) != 0 ||
+        write_fully(s->out_fd, b->data, rows * sizeof(double)) != 0) {
+        return "write failed";
+    }
+    return NULL;
+}
+
+/* The header of a single column named "result": 4 + 6 bytes of name, padded to 16. */
+static int write_header(int fd) {
+    char head[32] = {0};
+    memcpy(head, magic, sizeof(magic));
+    uint32_t one = 1;
+    uint32_t length = 6;
+    memcpy(head + 8, &one, sizeof(one));
+    memcpy(head + 16, &length, sizeof(length));
+    memcpy(head + 20, "result", 6);
+    return write_fully(fd, head, sizeof(head));
+}
+
+static void* writer(void* arg) {
+    struct stream* s = arg;
+    struct calc_output* text = NULL;
+    if (s->text) {
+        text = malloc(sizeof(struct calc_output));
+        if (text == NULL) {
+            fail(s, "out of memory");
+            return NULL;
+        }
+        calc_output_init(text, s->out_fd, 0);
+    } else if (write_header(s->out_fd) != 0) {
+        fail(s, "write failed");
+        return NULL;
+    }
+
+    for (unsigned k = 0;; k++) {
+        struct out_buffer* b = &s->out[k % NUM_BUFFERS];
+        pthread_mutex_lock(&s->lock);
+        while (!b->full && s->error == NULL) {
+            pthread_cond_wait(&s->changed, &s->lock);
+        }
+        int stop = s->error != NULL;
+        pthread_mutex_unlock(&s->lock);
+        if (stop) {
+            break;
+        }
+
+        if (b->last) {
+            uint64_t end = 0;
+            if (text == NULL && write_fully(s->out_fd, &end, sizeof(end)) != 0) {
+                fail(s, "write failed");
+            }
+            break;
+        }
+        const char* error = write_block(s, text, b);
+        if (error != NULL) {
+            fail(s, error);
+            break;
+        }
+
+        pthread_mutex_lock(&s->lock);
+        b->full = 0;
+        pthread_cond_broadcast(&s->changed);
+        pthread_mutex_unlock(&s->lock);
+    }
+    if (text != NULL) {
+        if (calc_output_flush(text) != 0) {
+            fail(s, "write failed");
+        }
+        free(text);
+    }
+    return NULL;
+}
+
+/* Grows the columns of the variables given with --set to at least `rows` rows. */
+static const char* broadcast(struct stream* s, size_t rows) {
+    if (rows <= s->broadcast_rows) {
+        return NULL;
+    }
+    for (int v = 0; v < s->num_vars; v++) {
+        if (s->var_set[v]) {
+            free(s->broadcast[v]);
+            s->broadcast[v] = malloc(rows * sizeof(double));
+            if (s->broadcast[v] == NULL) {
+                s->broadcast_rows = 0;
+                return "out of memory";
+            }
+            for (size_t i = 0; i < rows; i++) {
+                s->broadcast[v][i] = s->var_values[v];
+            }
+        }
+    }
+    s->broadcast_rows = rows;
+    return NULL;
+}
+
+/* Evaluates and reduces b a chunk at a time, through the results in `chunk`. */
+static void aggregate_block(struct stream* s, const double** columns, double* chunk, const struct in_buffer* b) {
+    for (int64_t start = 0; start < b->rows; start += CHUNK_ROWS) {
+        int64_t n = b->rows - start < CHUNK_ROWS ? b->rows - start : CHUNK_ROWS;
+        for (int v = 0; v < s->num_vars; v++) {
+            columns[v] = s->var_set[v] ? s->broadcast[v] : b->columns[s->var_columns[v]] + start;
+        }
+        s->kernel(columns, chunk, n);
+        calc_aggregate_add(s->aggregate, chunk, n);
+    }
+}
+
+/* The kernel runs on the calling thread, between the reader and the writer. */
+static void compute(struct stream* s) {
+    const double** columns = malloc((s->num_vars + 1) * sizeof(double*));
+    double* chunk = malloc(CHUNK_ROWS * sizeof(double));
+    if (columns == NULL || chunk == NULL || (s->aggregate != NULL && broadcast(s, CHUNK_ROWS) != NULL)) {
+        fail(s, "out of memory");
+        free(columns);
+        free(chunk);
+        return;
+    }
+    for (unsigned k = 0;; k++) {
+        struct in_buffer* in = &s->in[k % NUM_BUFFERS];
+        struct out_buffer* out = &s->out[k % NUM_BUFFERS];
+        pthread_mutex_lock(&s->lock);
+        while ((!in->full || (s->aggregate == NULL && out->full)) && s->error == NULL) {
+            pthread_cond_wait(&s->changed, &s->lock);
+        }
+        int stop = s->error != NULL;
+        pthread_mutex_unlock(&s->lock);
+        if (stop) {
+            break;
+        }
+
+        if (s->aggregate != NULL) {
+            /* the reader refills `in` as soon as it is released */
+            int last = in->last;
+            aggregate_block(s, columns, chunk, in);
+            pthread_mutex_lock(&s->lock);
+            in->full = 0;
+            pthread_cond_broadcast(&s->changed);
+            pthread_mutex_unlock(&s->lock);
+            if (last) {
+                break;
+            }
+            continue;
+        }
+
+        if (!in->last) {
+            if (out->capacity < (size_t)in->rows) {
+                free(out->data);
+                out->data = malloc(in->rows * sizeof(double));
+                out->capacity = out->data != NULL ? (size_t)in->rows : 0;
+                if (out->data == NULL) {
+                    fail(s, "out of memory");
+                    break;
+                }
+            }
+            if (broadcast(s, (size_t)in->rows) != NULL) {
+                fail(s, "out of memory");
+                break;
+            }
+            for (int v = 0; v < s->num_vars; v++) {
+                columns[v] = s->var_set[v] ? s->broadcast[v] : in->columns[s->var_columns[v]];
+            }
+            s->kernel(columns, out->data, in->rows);
+        }
+
+        pthread_mutex_lock(&s->lock);
+        out->rows = in->rows;
+        out->last = in->last;
+        out->full = 1;
+        in->full = 0;
+        pthread_cond_broadcast(&s->changed);
+        pthread_mutex_unlock(&s->lock);
+        if (out->last) {
+            break;
+        }
+    }
+    free(columns);
+    free(chunk);
+}
+
+static const char* write_aggregate(struct stream* s) {
+    size_t n = calc_aggregate_size(s->aggregate);
+    double* values = malloc(n * sizeof(double));
+    if (values == NULL) {
+        return "out of memory";
+    }
+    calc_aggregate_result(s->aggregate, values);
+    int failed;
+    if (s->text) {
+        struct calc_output text;
+        calc_output_init(&text, s->out_fd, 0);
+        for (size_t i = 0; i < n; i++) {
+            calc_output_f(&text, values[i]);
+        }
+        failed = calc_output_flush(&text) != 0;
+    } else {
+        uint64_t rows = n;
+        uint64_t end = 0;
+        failed = write_header(s->out_fd) != 0 || write_fully(s->out_fd, &rows, sizeof(rows)) != 0 ||
+                 write_fully(s->out_fd, values, n * sizeof(double)) != 0 ||
+                 write_fully(s->out_fd, &end, sizeof(end)) != 0;
+    }
+    free(values);
+    return failed ? "write failed" : NULL;
+}
+
+int calc_stream(int argc, char** argv, int num_vars, const char* const* names, calc_kernel_fn kernel) {
+    const char* input_path = "-";
+    const char* output_path = "-";
+    const char* aggregate = NULL;
+    int exact = 0;
+    struct stream s;
+    memset(&s, 0, sizeof(s));
+    s.var_set = calloc(num_vars + 1, 1);
+    s.var_values = calloc(num_vars + 1, sizeof(double));
+    s.broadcast = calloc(num_vars + 1, sizeof(double*));
+    if (s.var_set == NULL || s.var_values == NULL || s.broadcast == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--text") == 0) {
+            s.text = 1;
+        } else if (strncmp(argv[i], "--aggregate=", 12) == 0) {
+            aggregate = argv[i] + 12;
+        } else if (strcmp(argv[i], "--exact") == 0) {
+            exact = 1;
+        } else if (strncmp(argv[i], "--set=", 6) == 0) {
+            const char* name = argv[i] + 6;
+            const char* value = strchr(name, '=');
+            char* end = NULL;
+            double d = value != NULL ? strtod(value + 1, &end) : 0;
+            int v = 0;
+            while (value != NULL && v < num_vars &&
+                   (strncmp(names[v], name, (size_t)(value - name)) != 0 || names[v][value - name] != '\0')) {
+                v++;
+            }
+            if (value == NULL || end == value + 1 || *end != '\0' || v == num_vars) {
+                fprintf(stderr, "invalid %s, expected --set=NAME=VALUE for a variable of the expression\n", argv[i]);
+                return 1;
+            }
+            s.var_set[v] = 1;
+            s.var_values[v] = d;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strcmp(input_path, "-") == 0) {
+            input_path = argv[i];
+        } else {
+            fprintf(stderr,
+                    "Usage:\n\t%s [--text] [--aggregate=SPEC [--exact]] [--set=NAME=VALUE ...] [-o OUTPUT] [INPUT]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    struct calc_aggregate reduction;
+    if (aggregate != NULL) {
+        if (calc_aggregate_init(&reduction, aggregate, exact) != 0) {
+            fprintf(stderr, "invalid aggregate %s, expected sum, mean, min, max or hist:LO:HI:BINS\n", aggregate);
+            return 1;
+        }
+        s.aggregate = &reduction;
+    }
+
+    s.in_fd = strcmp(input_path, "-") == 0 ? 0 : open(input_path, O_RDONLY);
+    s.out_fd = strcmp(output_path, "-") == 0 ? 1 : open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (s.in_fd < 0 || s.out_fd < 0) {
+        perror(s.in_fd < 0 ? input_path : output_path);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(s.in_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, s.in_fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            s.map = map;
+            s.map_size = (size_t)st.st_size;
+        }
+    }
+
+    s.num_vars = num_vars;
+    s.kernel = kernel;
+    s.var_columns = malloc((num_vars + 1) * sizeof(int));
+    const char* error = s.var_columns == NULL ? "out of memory" : read_header(&s, names);
+    if (error != NULL) {
+        fprintf(stderr, "%s: %s\n", input_path, error);
+        return 1;
+    }
+    for (int i = 0; i < NUM_BUFFERS; i++) {
+        s.in[i].columns = malloc((s.num_columns + 1) * sizeof(double*));
+        if (s.in[i].columns == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    }
+
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.changed, NULL);
+    pthread_t reader_thread, writer_thread;
+    if (pthread_create(&reader_thread, NULL, reader, &s) != 0 ||
+        (s.aggregate == NULL && pthread_create(&writer_thread, NULL, writer, &s) != 0)) {
+        fprintf(stderr, "cannot start threads\n");
+        return 1;
+    }
+    compute(&s);
+    pthread_join(reader_thread, NULL);
+    if (s.aggregate == NULL) {
+        pthread_join(writer_thread, NULL);
+    } else if (s.error == NULL) {
+        s.error = write_aggregate(&s);
+    }
+
+    if (s.error != NULL) {
+        fprintf(stderr, "%s: %s\n", input_path, s.error);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+/*
+ * Entry point of the streaming runtime, see stream.c: executables built with
+ * `calcc --stream` call it from main with their compiled kernel, calci with one
+ * that runs the vector interpreter.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Evaluates n rows, variable v of row i is columns[v][i]. */
+typedef void (*calc_kernel_fn)(const double* const* columns, double* out, int64_t n);
+
+/* Parses the stream options in argv[1..argc), runs kernel over the input and returns the exit status. */
+int calc_stream(int argc, char** argv, int num_vars, const char* const* names, calc_kernel_fn kernel);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,8 +1,14 @@
 #include "AST.h"
+#include "Gradient.h"
 #include "Lexer.h"
 #include "Parser.h"
+#include "PhaseStats.h"
+#include "Polynomial.h"
+#include "RangeAnalysis.h"
+#include "Specializer.h"
 #include "ToIRVisitor.h"
 
+#include <llvm/ADT/Statistic.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/InitLLVM.h>
 #include <llvm/Support/raw_ostream.h>
@@ -11,22 +17,52 @@ namespace cl = llvm::cl;
 
 static cl::opt<std::string> input("input", cl::desc("expr"), cl::Positional, cl::Required);
 static cl::opt<std::string> output("o", cl::desc("Specify output filename"), cl::value_desc("filename"), cl::Optional);
+static cl::list<std::string> bindings("bind", cl::desc("Fold a variable to a constant before code generation"),
+                                      cl::value_desc("name=value"), cl::ZeroOrMore);
+static cl::list<std::string> grad("grad", cl::desc("Also print the partial derivatives with respect to these variables"),
+                                  cl::value_desc("var,..."), cl::CommaSeparated);
+static cl::opt<ADMode> adMode("ad-mode", cl::desc("Automatic differentiation mode for --grad"),
+                              cl::values(clEnumValN(ADMode::FORWARD, "forward", "One tangent per variable"),
+                                         clEnumValN(ADMode::REVERSE, "reverse", "One backward sweep over the tape"),
+                                         clEnumValN(ADMode::AUTO, "auto", "Forward for few variables, else reverse")),
+                              cl::init(ADMode::AUTO));
+static cl::list<std::string> declaredRanges("range", cl::desc("Promise that a variable stays within lo..hi, ints if "
+                                                              "both bounds are written as ints"),
+                                            cl::value_desc("name=lo..hi"), cl::ZeroOrMore);
+static cl::opt<bool> stream("stream", cl::desc("Evaluate over the rows of a columnar input, see runtime/stream.c"));
+static cl::list<std::string> scalars("scalar", cl::desc("With --stream, a variable that is the same on every row: "
+                                                       "what only depends on such variables is computed once per "
+                                                       "call instead of once per row"),
+                                     cl::value_desc("name"), cl::ZeroOrMore);
+static cl::opt<bool> fastFP("fast-fp", cl::desc("Allow results to round differently from the expression as written: "
+                                                "evaluate polynomials in Horner form with fused multiply-adds"));
+static cl::opt<bool> timePhases("time-phases", cl::desc("Print the wall time of every phase to stderr"));
+static cl::opt<PhaseStats::Format> statsFormat("stats-format", cl::desc("Format of --time-phases and --stats"),
+                                               cl::values(clEnumValN(PhaseStats::Format::TEXT, "text", "Tables"),
+                                                          clEnumValN(PhaseStats::Format::JSON, "json", "One object")),
+                                               cl::init(PhaseStats::Format::TEXT));
 
 class Compiler {
     llvm::LLVMContext& ctx;
+    RangeAnalysis::Declared declared;
+    PhaseStats& phaseStats;
 
 public:
-    Compiler(llvm::LLVMContext& ctx)
-        : ctx(ctx) {}
+    Compiler(llvm::LLVMContext& ctx, RangeAnalysis::Declared declared, PhaseStats& phaseStats)
+        : ctx(ctx)
+        , declared(std::move(declared))
+        , phaseStats(phaseStats) {}
 
     std::shared_ptr<llvm::Module> compile(AST* ast) {
         auto mod = doCompile(ast);
+        auto timer = phaseStats.phase("print IR");
         mod->print(llvm::outs(), nullptr);
         return mod;
     }
 
     std::shared_ptr<llvm::Module> compile(AST* ast, const std::string& filename) {
         auto mod = doCompile(ast);
+        auto timer = phaseStats.phase("print IR");
         std::error_code ec;
         llvm::raw_fd_ostream f(filename, ec);
         mod->print(f, nullptr);
@@ -37,7 +73,27 @@ private:
     std::shared_ptr<llvm::Module> doCompile(AST* ast) {
         auto mod = std::make_shared<llvm::Module>("expr", ctx);
         ToIRVisitor toIR(mod);
-        toIR.create_main_function(ast);
+        // calcc reads undeclared variables as floats
+        RangeAnalysis ranges(declared, Range::FLOAT);
+        {
+            auto timer = phaseStats.phase("range analysis");
+            ranges.analyze(ast);
+        }
+        toIR.setRanges(&ranges);
+        if (!grad.empty()) {
+            toIR.enableGradient(grad, adMode);
+        }
+        if (stream) {
+            toIR.enableStreaming();
+            toIR.setScalars(scalars);
+        }
+        if (fastFP) {
+            toIR.enableFastFP();
+        }
+        {
+            auto timer = phaseStats.phase("codegen");
+            toIR.create_main_function(ast);
+        }
         return mod;
     }
 };
@@ -45,18 +101,85 @@ private:
 int main(int argc, char* argv[]) {
     llvm::InitLLVM initLLVM(argc, argv);
     cl::ParseCommandLineOptions(argc, argv, "A calculator based on LLVM.");
+    if (stream && !grad.empty()) {
+        llvm::errs() << "--grad is not supported with --stream\n";
+        return -1;
+    }
 
     llvm::LLVMContext ctx{};
+    // -stats is LLVM's own option, calcc adds its counters to what it enables
+    bool stats = llvm::AreStatisticsEnabled();
+    PhaseStats phaseStats("calcc", timePhases || stats);
+
+    if (timePhases) {
+        // the parser pulls tokens on demand, so lexing alone is timed on a pass of its own
+        auto timer = phaseStats.phase("lex");
+        Lexer lexer(input);
+        while (!lexer.next().is(TokenKind::EOI)) {
+        }
+    }
 
     Lexer lexer(input);
     Parser parser(lexer);
-    AST* expr = parser.parse();
-    Compiler compiler(ctx);
+    AST* expr;
+    {
+        auto timer = phaseStats.phase("parse");
+        expr = parser.parse();
+    }
+
+    std::unique_ptr<AST> residual;
+    Specializer specializer(expr);
+    if (!bindings.empty()) {
+        Specializer::Bindings b;
+        for (llvm::StringRef binding : bindings) {
+            auto nameAndValue = binding.split('=');
+            int64_t i;
+            double f;
+            // like calci input: "3" binds an int, "3.0" a float
+            if (!nameAndValue.second.contains('.') && !nameAndValue.second.getAsInteger(10, i)) {
+                b[nameAndValue.first.str()] = Value(i);
+            } else if (!nameAndValue.second.getAsDouble(f)) {
+                b[nameAndValue.first.str()] = Value(f);
+            } else {
+                llvm::errs() << "invalid binding: " << binding << "\n";
+                return -1;
+            }
+        }
+        auto timer = phaseStats.phase("specialize");
+        residual = specializer.specialize(b);
+        expr = residual.get();
+    }
+
+    PolynomialRewriter polynomials;
+    std::unique_ptr<AST> horner;
+    if (fastFP) {
+        auto timer = phaseStats.phase("polynomials");
+        horner = polynomials.rewrite(expr);
+        expr = horner.get();
+    }
+
+    RangeAnalysis::Declared declared;
+    for (llvm::StringRef range : declaredRanges) {
+        auto nameAndRange = range.split('=');
+        if (!RangeAnalysis::parseRange(nameAndRange.second, declared[nameAndRange.first.str()])) {
+            llvm::errs() << "invalid range: " << range << "\n";
+            return -1;
+        }
+    }
+
+    Compiler compiler(ctx, std::move(declared), phaseStats);
+    std::shared_ptr<llvm::Module> mod;
     if (output.empty()) {
-        compiler.compile(expr);
+        mod = compiler.compile(expr);
     }
     else {
-        compiler.compile(expr, output);
+        mod = compiler.compile(expr, output);
+    }
+
+    if (timePhases || stats) {
+        phaseStats.setCounter("ast-nodes", "Number of AST nodes", PhaseStats::countNodes(expr));
+        phaseStats.setCounter("ir-instructions", "Number of IR instructions", mod->getInstructionCount());
+        phaseStats.print(llvm::errs(), statsFormat, timePhases, stats);
     }
     return 0;
 }
@@ -2,164 +2,38 @@
 
 #include "AST.h"
 #include "Lexer.h"
+#include "Profile.h"
+#include "Program.h"
+#include "Value.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <limits>
+#include <stdexcept>
 #include <unordered_map>
 
-int64_t pow_(int64_t b, int64_t e) {
-    if (e == 1)
-        return b;
-
-    if ((e % 2) == 0) {
-        auto r = pow_(b, e / 2);
-        return r * r;
-    } else {
-        auto r = pow_(b, e / 2);
-        return r * r * b;
-    }
-}
-
-int64_t pow(int64_t b, int64_t e) {
-    if (b == 0 && e == 0)
-        throw std::runtime_error("0^0 is undefined");
-
-    if (e < 0)
-        throw std::runtime_error("exponent < 0 for int value is not allowed");
-
-    if (b == 0)
-        return 1;
-
-    return pow_(b, e);
-}
-
-class Value {
-    union {
-        int64_t v_i;
-        double v_f;
-    };
-    bool isInt_;
-
-    void error() const {
-        throw std::runtime_error("value getting error");
-    }
-
-    double promoteToFloat() const {
-        if (!isInt_)
-            return v_f;
-        return static_cast<double>(v_i);
-    }
-
-public:
-    Value(int64_t v)
-        : v_i(v)
-        , isInt_(true) {}
-    Value(double v)
-        : v_f(v)
-        , isInt_(false) {}
-
-    Value()
-        : Value(std::numeric_limits<double>::quiet_NaN()) {}
-
-    bool isInt() const {
-        return isInt_;
-    }
-
-    int64_t getInt() const {
-        if (!isInt_) {
-            error();
-        }
-        return v_i;
-    }
-
-    double getFloat() const {
-        if (isInt_)
-            return promoteToFloat();
-
-        return v_f;
-    }
-
-    Value operator+(const Value& rhs) const {
-        if (isInt() && rhs.isInt()) {
-            return getInt() + rhs.getInt();
-        }
-        return getFloat() + rhs.getFloat();
-    }
-
-    Value operator-(const Value& rhs) const {
-        if (isInt() && rhs.isInt()) {
-            return getInt() - rhs.getInt();
-        }
-        return getFloat() - rhs.getFloat();
-    }
-
-    Value operator*(const Value& rhs) const {
-        if (isInt() && rhs.isInt()) {
-            return getInt() * rhs.getInt();
-        }
-        return getFloat() * rhs.getFloat();
-    }
-
-    Value operator/(const Value& rhs) const {
-        if (isInt() && rhs.isInt()) {
-            return getInt() / rhs.getInt();
-        }
-        return getFloat() / rhs.getFloat();
-    }
-
-    Value operator^(const Value& rhs) const {
-        if (isInt() && rhs.isInt()) {
-            return pow(getInt(), rhs.getInt());
-        }
-        return std::pow(getFloat(), rhs.getFloat());
-    }
-
-    Value operator%(const Value& rhs) const {
-        if (isInt() && rhs.isInt()) {
-            return getInt() % rhs.getInt();
-        }
-        throw std::runtime_error("mod for float value is not allowed");
-    }
-};
-
-Value negate(Value v) {
-    if (v.isInt()) {
-        return Value(-v.getInt());
-    } else {
-        return Value(-v.getFloat());
-    }
-}
-
-Value factorial(Value v) {
-    int64_t i = v.getInt();
-    if (i < 0) {
-        throw std::runtime_error("factorial value error");
-    }
-    if (i == 0) {
-        return Value(static_cast<int64_t>(1LL));
-    }
-    int64_t acc = 1;
-    for (int64_t j = 1; j <= i; j++) {
-        acc *= j;
-    }
-    return Value(acc);
-}
-
 class InterpretVisitor : public ASTVisitor {
     std::unordered_map<std::string, Value> env;
+    FILE* prompts = stdout;
 
 public:
     InterpretVisitor()
         : eval_result(std::numeric_limits<double>::quiet_NaN()) {}
 
+    /// Where the prompts for variable values go, stdout by default.
+    void setPrompts(FILE* f) {
+        prompts = f;
+    }
+
     void visit(Ident& e) override {
         auto ident = e.getName().str();
         auto it = env.find(ident);
         if (it == env.end()) {
             std::array<char, 256> buffer{};
             std::fill(buffer.begin(), buffer.end(), 0);
-            printf("Input value %s: ", ident.c_str());
+            fprintf(prompts, "Input value %s: ", ident.c_str());
             scanf("%256s", buffer.data());
             auto it = std::find(buffer.begin(), buffer.end(), '.');
             Value v;
@@ -181,10 +55,8 @@ public:
     void visit(UnaryOp& e) override {
         e.getExpr()->accept(*this);
         // result is the eval_result for UnaryOp::POS;
-        if (e.getOp() == UnaryOp::NEG) {
-            eval_result = negate(eval_result);
-        } else if (e.getOp() == UnaryOp::FACT) {
-            eval_result = factorial(eval_result);
+        if (e.getOp() != UnaryOp::POS) {
+            check(Program::applyUnary(Program::toOpCode(e.getOp()), Builtin::UNKNOWN, eval_result));
         }
     }
 
@@ -194,30 +66,25 @@ public:
         e.getRight()->accept(*this);
         auto rhs = eval_result;
 
-        switch (e.getOp()) {
-#define CASE(p, op)                                                                                                    \
-    case (p):                                                                                                          \
-        eval_result = (lhs op rhs);                                                                                    \
-        break
-            CASE(BinaryOp::PLUS, +);
-            CASE(BinaryOp::MINUS, -);
-            CASE(BinaryOp::MUL, *);
-            CASE(BinaryOp::DIV, /);
-            CASE(BinaryOp::POW, ^);
-            CASE(BinaryOp::MOD, %);
-#undef CASE
-        }
+        check(Program::applyBinary(Program::toOpCode(e.getOp()), lhs, rhs));
+        eval_result = lhs;
+    }
+
+    void visit(Conditional& e) override {
+        e.getCond()->accept(*this);
+        auto cond = eval_result;
+        e.getLeft()->accept(*this);
+        auto lhs = eval_result;
+        e.getRight()->accept(*this);
+        Program::applySelect(cond, lhs, eval_result);
+        eval_result = cond;
     }
 
     void visit(Number& e) override {
         if (e.getType() == Number::INT) {
-            int64_t v;
-            e.getValue().getAsInteger(10, v);
-            eval_result = Value(v);
+            eval_result = Value(e.getInt());
         } else if (e.getType() == Number::FLOAT) {
-            double v;
-            e.getValue().getAsDouble(v);
-            eval_result = Value(v);
+            eval_result = Value(e.getFloat());
         }
     }
 
@@ -249,4 +116,72 @@ public:
     }
 
     Value eval_result;
+
+private:
+    /// Operators are evaluated like Program does, an int overflow is an error rather than undefined behavior.
+    static void check(Status s) {
+        if (s != Status::OK) {
+            throw std::runtime_error("domain error");
+        }
+    }
+};
+
+/// InterpretVisitor that records the count and time of every node it evaluates in a Profile. Identifiers are
+/// counted but not timed, their first evaluation waits for input on stdin.
+class ProfilingInterpretVisitor : public InterpretVisitor {
+    Profile& profile;
+    uint64_t pausedNs = 0; // time spent in identifiers so far
+    uint64_t childNs = 0;  // total time of the children of the node being evaluated
+
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    /// Evaluates `e` with InterpretVisitor and returns its self time.
+    template <typename Node>
+    uint64_t timed(Node& e) {
+        auto outerChildNs = childNs;
+        auto pausedAtStart = pausedNs;
+        childNs = 0;
+        auto start = now();
+        InterpretVisitor::visit(e);
+        uint64_t total = now() - start - (pausedNs - pausedAtStart);
+        uint64_t self = total - std::min(total, childNs);
+        profile.record(&e, total, self);
+        childNs = outerChildNs + total;
+        return self;
+    }
+
+public:
+    explicit ProfilingInterpretVisitor(Profile& profile)
+        : profile(profile) {}
+
+    void visit(Ident& e) override {
+        auto start = now();
+        InterpretVisitor::visit(e);
+        pausedNs += now() - start;
+        profile.record(&e, 0, 0);
+    }
+
+    void visit(UnaryOp& e) override {
+        timed(e);
+    }
+
+    void visit(BinaryOp& e) override {
+        timed(e);
+    }
+
+    void visit(Conditional& e) override {
+        timed(e);
+    }
+
+    void visit(Number& e) override {
+        timed(e);
+    }
+
+    void visit(FuncCall& e) override {
+        profile.recordBuiltin(e.getName(), timed(e));
+    }
 };
@@ -1,26 +1,184 @@
+#include "Calc.h"
 #include "InterpretVisitor.h"
 #include "Lexer.h"
 #include "Parser.h"
+#include "PhaseStats.h"
+#include "Program.h"
+#include "VectorEvaluator.h"
+#include "format.h"
+#include "stream.h"
+
+#include <llvm/ADT/StringRef.h>
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
 
 #include <iostream>
+#include <memory>
+#include <vector>
+
+namespace {
+
+// calc_stream takes a plain function, so the program it runs is a global
+const Program* streamProgram;
+
+void interpretKernel(const double* const* columns, double* out, int64_t n) {
+    static ColumnPool pool;
+    VectorEvaluator(*streamProgram, pool).evaluate(columns, static_cast<size_t>(n), out);
+}
+
+/// Evaluates `input` over every row of a columnar input, like an executable built with `calcc --stream`.
+/// `argv` holds the options of calc_stream, argv[0] included.
+int stream(const char* input, std::vector<char*>& argv) {
+    Lexer lexer(input);
+    Parser parser(lexer);
+    ParseError error;
+    std::unique_ptr<AST> ast(parser.parse(error));
+    if (ast == nullptr) {
+        std::cerr << "offset " << error.offset << ": " << error.message << std::endl;
+        return -1;
+    }
+    Program program;
+    auto status = Program::compile(ast.get(), {}, program);
+    if (status != Status::OK) {
+        std::cerr << calc_status_string(static_cast<calc_status>(status)) << std::endl;
+        return -1;
+    }
+    std::vector<const char*> names;
+    for (size_t v = 0; v < program.getNumVars(); v++) {
+        names.push_back(program.getVarName(v).c_str());
+    }
+    streamProgram = &program;
+    return calc_stream(static_cast<int>(argv.size()), argv.data(), static_cast<int>(names.size()), names.data(),
+                       interpretKernel);
+}
+
+} // namespace
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage:\n\t" << argv[0] << " <expr>" << std::endl;
+    // no llvm::cl here, it would cost startup time on every run
+    bool binary = false;
+    bool timePhases = false;
+    bool stats = false;
+    auto format = PhaseStats::Format::TEXT;
+    bool profile = false;
+    unsigned profileRuns = 1000;
+    llvm::StringRef profileStacks;
+    const char* input = nullptr;
+    for (int i = 1; i < argc; i++) {
+        llvm::StringRef arg(argv[i]);
+        if (arg == "--stream" && i + 1 < argc) {
+            // the rest are options of the streaming runtime
+            std::vector<char*> streamArgs{argv[0]};
+            streamArgs.insert(streamArgs.end(), argv + i + 2, argv + argc);
+            try {
+                return stream(argv[i + 1], streamArgs);
+            } catch (std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return -1;
+            }
+        } else if (arg == "--binary") {
+            binary = true;
+        } else if (arg == "--time-phases") {
+            timePhases = true;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--stats-format=json") {
+            format = PhaseStats::Format::JSON;
+        } else if (arg == "--stats-format=text") {
+            format = PhaseStats::Format::TEXT;
+        } else if (arg == "--profile") {
+            profile = true;
+        } else if (arg.consume_front("--profile-runs=")) {
+            profile = true;
+            if (arg.getAsInteger(10, profileRuns) || profileRuns == 0) {
+                input = nullptr;
+                break;
+            }
+        } else if (arg.consume_front("--profile-stacks=")) {
+            profile = true;
+            profileStacks = arg;
+        } else if (input == nullptr) {
+            input = argv[i];
+        } else {
+            input = nullptr;
+            break;
+        }
+    }
+    if (input == nullptr) {
+        std::cerr << "Usage:\n\t" << argv[0]
+                  << " [--binary] [--time-phases] [--stats] [--stats-format=text|json]"
+                     " [--profile] [--profile-runs=N] [--profile-stacks=FILE] <expr>\n\t"
+                  << argv[0]
+                  << " --stream <expr> [--text] [--aggregate=SPEC [--exact]] [--set=NAME=VALUE ...] [-o OUTPUT] [INPUT]"
+                  << std::endl;
         return -1;
     }
 
+    PhaseStats phaseStats("calci", timePhases || stats);
     try {
-        Lexer lexer(argv[1]);
+        if (timePhases) {
+            // the parser pulls tokens on demand, so lexing alone is timed on a pass of its own
+            auto timer = phaseStats.phase("lex");
+            Lexer lexer(input);
+            while (!lexer.next().is(TokenKind::EOI)) {
+            }
+        }
+
+        Lexer lexer(input);
         Parser parser(lexer);
-        auto ast = parser.parse();
-        InterpretVisitor eval;
-        ast->accept(eval);
+        std::unique_ptr<AST> ast;
+        {
+            auto timer = phaseStats.phase("parse");
+            ast.reset(parser.parse());
+        }
+        Profile prof;
+        std::unique_ptr<InterpretVisitor> evalPtr(profile ? new ProfilingInterpretVisitor(prof)
+                                                          : new InterpretVisitor());
+        auto& eval = *evalPtr;
+        if (binary) {
+            eval.setPrompts(stderr);
+        }
+        {
+            auto timer = phaseStats.phase("evaluate");
+            // variables are read on the first run only, later runs see them in the environment
+            for (unsigned i = 0; i < (profile ? profileRuns : 1); i++) {
+                ast->accept(eval);
+            }
+        }
 
-        if (eval.eval_result.isInt()) {
-            std::cout << eval.eval_result.getInt() << std::endl;
-        } else {
-            std::cout << eval.eval_result.getFloat() << std::endl;
+        {
+            auto timer = phaseStats.phase("print");
+            // static, the buffer is too large for the stack
+            static calc_output out;
+            calc_output_init(&out, 1, binary);
+            if (eval.eval_result.isInt()) {
+                calc_output_i(&out, eval.eval_result.getInt());
+            } else {
+                calc_output_f(&out, eval.eval_result.getFloat());
+            }
+            if (calc_output_flush(&out) != 0) {
+                std::cerr << "write failed" << std::endl;
+                return -1;
+            }
+        }
+
+        if (profile) {
+            prof.printAnnotated(llvm::errs(), input, ast.get(), llvm::errs().has_colors());
+            if (!profileStacks.empty()) {
+                std::error_code ec;
+                llvm::raw_fd_ostream os(profileStacks, ec, llvm::sys::fs::OF_None);
+                if (ec) {
+                    std::cerr << profileStacks.str() << ": " << ec.message() << std::endl;
+                    return -1;
+                }
+                prof.printCollapsedStacks(os, input, ast.get());
+            }
+        }
+
+        if (timePhases || stats) {
+            phaseStats.setCounter("ast-nodes", "Number of AST nodes", PhaseStats::countNodes(ast.get()));
+            phaseStats.print(llvm::errs(), format, timePhases, stats);
         }
         return 0;
     } catch (std::exception& e) {
@@ -0,0 +1,451 @@
+#include "Calc.h"
+#include "Catalog.h"
+#include "TieredEngine.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace cl = llvm::cl;
+
+static cl::opt<std::string> socketPath("socket", cl::desc("Unix domain socket to listen on"),
+                                       cl::value_desc("path"), cl::init("/tmp/calcd.sock"));
+static cl::opt<uint64_t> jitThreshold("jit-threshold",
+                                      cl::desc("Compile an expression to native code once it has evaluated this "
+                                               "many rows, 0 keeps every expression on the interpreter"),
+                                      cl::value_desc("rows"), cl::init(10000));
+static cl::opt<unsigned> jitThreads("jit-threads", cl::desc("Threads compiling expressions to native code"),
+                                    cl::init(std::max(1u, std::thread::hardware_concurrency())));
+static cl::opt<TieredEngine::Perf> perf(
+    "perf", cl::desc("Tell perf about native code"), cl::init(TieredEngine::Perf::NONE),
+    cl::values(clEnumValN(TieredEngine::Perf::NONE, "none", "Nothing"),
+               clEnumValN(TieredEngine::Perf::MAP, "map", "Name every kernel in /tmp/perf-<pid>.map"),
+               clEnumValN(TieredEngine::Perf::JITDUMP, "jitdump",
+                          "Also write jit-<pid>.dump, with line tables, for perf inject --jit")));
+static cl::opt<std::string> catalog("catalog",
+                                    cl::desc("Expressions to compile to native code before serving, one "
+                                             "`<id> <expr>` per line"),
+                                    cl::value_desc("filename"));
+static cl::opt<std::string> writeCatalog("write-catalog",
+                                         cl::desc("Convert the text --catalog to a binary one that loads without "
+                                                  "parsing, and exit"),
+                                         cl::value_desc("filename"));
+static cl::opt<unsigned> parseThreads("parse-threads", cl::desc("Threads parsing a text --catalog"),
+                                      cl::init(std::max(1u, std::thread::hardware_concurrency())));
+
+/// Rows of one batch request, and bytes of one request line. A client that sends a longer line is disconnected,
+/// there is no telling where its next request starts.
+static constexpr size_t kMaxBatchRows = 1 << 20;
+static constexpr size_t kMaxLineBytes = 64 << 20;
+
+static std::string describe(const CatalogError& e) {
+    return "line " + std::to_string(e.line) + ": " + e.id + ": " + e.error.message;
+}
+
+/**
+ * Line protocol, one request per line, one response line per request:
+ *
+ *  compile <id> <expr>           -> ok <num_vars> <var names...>
+ *  eval <id> <v0> <v1> ...       -> ok <result>
+ *  batch <id> <rows> <values...> -> ok <result0> <result1> ...   (values are row-major, up to kMaxBatchRows rows)
+ *  free <id>                     -> ok
+ *  stats                         -> ok tier_ups=<n> ineligible=<n> failed=<n> compile_us=<total> max_compile_us=<n>
+ *  stats <id>                    -> ok tier=<tier> evals=<rows> compile_us=<n>
+ *
+ * Failures answer `error <message>`. Requests are answered in order, so a
+ * client may pipeline as many of them as it likes before reading. Expressions
+ * start on the interpreter and move to native code once they are hot, see
+ * TieredEngine; the answers are the same either way.
+ */
+class Server {
+    TieredEngine engine;
+    // declared after the engine so that they are destroyed before it
+    std::unordered_map<std::string, std::shared_ptr<TieredEngine::Expression>> exprs;
+
+    // reused between requests so that eval does not allocate in the steady state
+    std::vector<double> vars;
+    std::vector<double> results;
+
+public:
+    Server(uint64_t jitThreshold, unsigned jitThreads, TieredEngine::Perf perf)
+        : engine(jitThreshold, jitThreads, perf) {}
+
+    /// Compiles every `<id> <expr>` line of a catalog like a compile request and waits until the JIT is done with
+    /// them all. The lines are parsed on `threads` threads into a binary catalog first, see parseCatalog. A line
+    /// that does not parse or compile is described in `errors` and the others are still loaded. Returns the
+    /// number of expressions loaded.
+    size_t loadCatalog(llvm::StringRef text, unsigned threads, std::vector<std::string>& errors) {
+        ASTFileWriter writer;
+        for (auto& e : parseCatalog(text, threads, writer)) {
+            errors.push_back(describe(e));
+        }
+        llvm::SmallString<0> data;
+        llvm::raw_svector_ostream os(data);
+        writer.write(os);
+        return loadCatalog(ASTFile::fromBuffer(llvm::MemoryBuffer::getMemBufferCopy(data, "catalog")), errors);
+    }
+
+    /// Same for a binary catalog, see ASTFile.
+    size_t loadCatalog(const std::shared_ptr<const ASTFile>& file, std::vector<std::string>& errors) {
+        size_t loaded = 0;
+        for (size_t i = 0; i < file->size(); i++) {
+            std::shared_ptr<TieredEngine::Expression> e;
+            auto s = engine.compile(file, i, {}, e);
+            if (s != Status::OK) {
+                errors.push_back(file->getName(i).str() + ": " + statusString(s));
+                continue;
+            }
+            engine.tierUpNow(*e);
+            exprs[file->getName(i).str()] = std::move(e);
+            loaded++;
+        }
+        engine.drain();
+        return loaded;
+    }
+
+    TieredEngine::Stats getStats() const {
+        return engine.getStats();
+    }
+
+    void handle(llvm::StringRef line, std::string& out) {
+        llvm::StringRef cmd;
+        std::tie(cmd, line) = line.trim().split(' ');
+        llvm::StringRef id;
+        std::tie(id, line) = line.ltrim().split(' ');
+        line = line.trim();
+
+        if (cmd == "compile") {
+            compile(id, line, out);
+        } else if (cmd == "eval" || cmd == "batch") {
+            auto it = exprs.find(id.str());
+            if (it == exprs.end()) {
+                return error("unknown expression", out);
+            }
+            if (cmd == "eval") {
+                eval(it->second.get(), line, out);
+            } else {
+                batch(it->second.get(), line, out);
+            }
+        } else if (cmd == "free") {
+            exprs.erase(id.str());
+            out += "ok\n";
+        } else if (cmd == "stats") {
+            stats(id, out);
+        } else {
+            error("unknown command", out);
+        }
+    }
+
+private:
+    void compile(llvm::StringRef id, llvm::StringRef text, std::string& out) {
+        if (id.empty()) {
+            return error("missing id", out);
+        }
+        std::shared_ptr<TieredEngine::Expression> e;
+        auto s = engine.compile(text.str(), {}, e, id);
+        if (s != Status::OK) {
+            return error(statusString(s), out);
+        }
+        auto& program = e->getProgram();
+        exprs[id.str()] = std::move(e);
+
+        out += "ok ";
+        out += std::to_string(program.getNumVars());
+        for (size_t i = 0; i < program.getNumVars(); i++) {
+            out += ' ';
+            out += program.getVarName(i);
+        }
+        out += '\n';
+    }
+
+    void eval(TieredEngine::Expression* e, llvm::StringRef args, std::string& out) {
+        if (!parseNumbers(args, vars) || vars.size() != e->getProgram().getNumVars()) {
+            return error("expected one value per variable", out);
+        }
+        double r;
+        auto s = engine.evaluate(*e, vars.data(), r);
+        if (s != Status::OK) {
+            return error(statusString(s), out);
+        }
+        out += "ok ";
+        appendNumber(r, out);
+        out += '\n';
+    }
+
+    void batch(TieredEngine::Expression* e, llvm::StringRef args, std::string& out) {
+        llvm::StringRef rowsText;
+        std::tie(rowsText, args) = args.split(' ');
+        size_t rows;
+        size_t numVars = e->getProgram().getNumVars();
+        // checked by division, rows * numVars could overflow
+        if (rowsText.getAsInteger(10, rows) || rows > kMaxBatchRows || !parseNumbers(args, vars) ||
+            (numVars == 0 ? !vars.empty() : vars.size() % numVars != 0 || vars.size() / numVars != rows)) {
+            return error("expected <rows> followed by rows * num_vars values", out);
+        }
+        // failing rows are reported as nan, the batch as a whole still succeeds
+        try {
+            results.resize(rows);
+            engine.evaluateBatch(*e, vars.data(), rows, results.data());
+        } catch (std::bad_alloc&) {
+            return error("out of memory", out);
+        }
+        out += "ok";
+        for (auto r : results) {
+            out += ' ';
+            appendNumber(r, out);
+        }
+        out += '\n';
+    }
+
+    void stats(llvm::StringRef id, std::string& out) {
+        if (id.empty()) {
+            auto stats = engine.getStats();
+            out += "ok tier_ups=" + std::to_string(stats.tierUps);
+            out += " ineligible=" + std::to_string(stats.ineligible);
+            out += " failed=" + std::to_string(stats.failed);
+            out += " compile_us=" + std::to_string(stats.compileNanos / 1000);
+            out += " max_compile_us=" + std::to_string(stats.maxCompileNanos / 1000) + "\n";
+            return;
+        }
+        auto it = exprs.find(id.str());
+        if (it == exprs.end()) {
+            return error("unknown expression", out);
+        }
+        static const char* const tierNames[] = {"interpreted", "queued", "native", "ineligible", "failed"};
+        auto& e = *it->second;
+        out += "ok tier=";
+        out += tierNames[static_cast<int>(e.getTier())];
+        out += " evals=" + std::to_string(e.getEvaluations());
+        out += " compile_us=" + std::to_string(e.getCompileNanos() / 1000) + "\n";
+    }
+
+    static const char* statusString(Status s) {
+        // Status and calc_status share their values, see Calc.cpp
+        return calc_status_string(static_cast<calc_status>(s));
+    }
+
+    static bool parseNumbers(llvm::StringRef text, std::vector<double>& values) {
+        values.clear();
+        while (!(text = text.ltrim()).empty()) {
+            llvm::StringRef tok;
+            std::tie(tok, text) = text.split(' ');
+            double v;
+            if (tok.getAsDouble(v)) {
+                return false;
+            }
+            values.push_back(v);
+        }
+        return true;
+    }
+
+    static void appendNumber(double v, std::string& out) {
+        char buf[32];
+        int n = std::snprintf(buf, sizeof(buf), "%.17g", v);
+        out.append(buf, n);
+    }
+
+    static void error(const char* msg, std::string& out) {
+        out += "error ";
+        out += msg;
+        out += '\n';
+    }
+};
+
+/// Parses the `<id> <expr>` lines of a text catalog and writes them as an ASTFile. Every line that does not parse
+/// is described in `errors`, and then nothing is written.
+static bool convertCatalog(llvm::StringRef text, const std::string& path, std::vector<std::string>& errors) {
+    ASTFileWriter writer;
+    for (auto& e : parseCatalog(text, parseThreads, writer)) {
+        errors.push_back(describe(e));
+    }
+    if (!errors.empty()) {
+        return false;
+    }
+    std::error_code ec;
+    llvm::raw_fd_ostream os(path, ec);
+    if (!ec) {
+        writer.write(os);
+        os.close();
+        ec = os.error();
+    }
+    if (ec) {
+        errors.push_back("cannot write " + path + ": " + ec.message());
+        return false;
+    }
+    return true;
+}
+
+struct Connection {
+    int fd;
+    std::string in;
+    std::string out;
+};
+
+static bool flush(Connection& c) {
+    size_t done = 0;
+    while (done < c.out.size()) {
+        auto n = ::write(c.fd, c.out.data() + done, c.out.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        done += n;
+    }
+    c.out.erase(0, done);
+    return true;
+}
+
+/// Reads what is available and answers every complete line. Returns false once the peer is gone.
+static bool serve(Server& server, Connection& c) {
+    char buf[64 * 1024];
+    auto n = ::read(c.fd, buf, sizeof(buf));
+    if (n <= 0) {
+        return n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    c.in.append(buf, n);
+
+    size_t begin = 0;
+    for (auto end = c.in.find('\n'); end != std::string::npos; end = c.in.find('\n', begin)) {
+        server.handle(llvm::StringRef(c.in).slice(begin, end), c.out);
+        begin = end + 1;
+    }
+    c.in.erase(0, begin);
+    if (c.in.size() > kMaxLineBytes) {
+        c.out += "error line too long\n";
+        flush(c);
+        return false;
+    }
+    return flush(c);
+}
+
+int main(int argc, char* argv[]) {
+    llvm::InitLLVM initLLVM(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "A calculator evaluation server.");
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if (!writeCatalog.empty()) {
+        auto buffer = llvm::MemoryBuffer::getFile(catalog);
+        std::vector<std::string> errors;
+        if (!buffer) {
+            errors.push_back(buffer.getError().message());
+        } else if (!convertCatalog((*buffer)->getBuffer(), writeCatalog, errors)) {
+            std::fprintf(stderr, "%s: cannot convert\n", catalog.c_str());
+        }
+        for (auto& err : errors) {
+            std::fprintf(stderr, "%s: %s\n", catalog.c_str(), err.c_str());
+        }
+        return errors.empty() ? 0 : -1;
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        std::fprintf(stderr, "socket path too long: %s\n", socketPath.c_str());
+        return -1;
+    }
+    std::strcpy(addr.sun_path, socketPath.c_str());
+    ::unlink(socketPath.c_str());
+
+    int listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        ::listen(listenFd, SOMAXCONN) < 0) {
+        std::perror("calcd");
+        return -1;
+    }
+
+    Server server(jitThreshold, jitThreads, perf);
+    if (!catalog.empty()) {
+        auto begin = std::chrono::steady_clock::now();
+        auto buffer = llvm::MemoryBuffer::getFile(catalog, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+        if (!buffer) {
+            std::fprintf(stderr, "cannot read %s: %s\n", catalog.c_str(), buffer.getError().message().c_str());
+            return -1;
+        }
+        // expressions that fail are reported and skipped, only a catalog that cannot be read at all stops here
+        std::vector<std::string> errors;
+        size_t loaded = 0;
+        try {
+            if (ASTFile::isASTFile((*buffer)->getBuffer())) {
+                loaded = server.loadCatalog(ASTFile::fromBuffer(std::move(*buffer)), errors);
+            } else {
+                loaded = server.loadCatalog((*buffer)->getBuffer(), parseThreads, errors);
+            }
+        } catch (std::runtime_error& e) {
+            std::fprintf(stderr, "%s: %s\n", catalog.c_str(), e.what());
+            return -1;
+        }
+        for (auto& err : errors) {
+            std::fprintf(stderr, "%s: %s\n", catalog.c_str(), err.c_str());
+        }
+        auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        std::fprintf(stderr, "calcd: %zu expressions from %s, %zu failed, %llu native, ready in %.1f ms\n", loaded,
+                     catalog.c_str(), errors.size(), static_cast<unsigned long long>(server.getStats().tierUps), ms);
+    }
+    std::vector<Connection> conns;
+    std::vector<pollfd> fds;
+    while (true) {
+        fds.clear();
+        fds.push_back(pollfd{listenFd, POLLIN, 0});
+        for (auto& c : conns) {
+            fds.push_back(pollfd{c.fd, static_cast<short>(c.out.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+        }
+        if (::poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::perror("calcd");
+            return -1;
+        }
+
+        // walk backwards so that closed connections can be removed in place
+        for (size_t i = conns.size(); i > 0; i--) {
+            auto& c = conns[i - 1];
+            auto revents = fds[i].revents;
+            bool alive = true;
+            if (revents & POLLOUT) {
+                alive = flush(c);
+            }
+            if (alive && (revents & (POLLIN | POLLHUP | POLLERR))) {
+                alive = serve(server, c);
+            }
+            if (!alive) {
+                ::close(c.fd);
+                conns.erase(conns.begin() + (i - 1));
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = ::accept(listenFd, nullptr, nullptr);
+            if (fd >= 0) {
+                ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+                conns.push_back(Connection{fd, {}, {}});
+            }
+        }
+    }
+}
@@ -0,0 +1,570 @@
+#pragma once
+
+#include "AST.h"
+#include "ASTFile.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Program.h"
+#include "Specializer.h"
+#include "ToIRVisitor.h"
+#include "VectorEvaluator.h"
+
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Object/SymbolSize.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+/**
+ * Tiered evaluation for long-running processes: every expression starts on the
+ * interpreter (Program and VectorEvaluator) and counts the rows it evaluates.
+ * Once it crosses the threshold it is queued for a pool of background threads.
+ * A worker generates a batch kernel with ToIRVisitor, optimizes it at O2 and
+ * emits an object file, all in an LLVMContext and a TargetMachine of its own,
+ * and hands the object to an ORC JIT to link. The kernel is published with an
+ * atomic store, so callers switch to native code on their next call and never
+ * wait for a compilation. Kernel names are fixed when an expression is
+ * compiled for the interpreter, so the code does not depend on which worker
+ * picks it up or when.
+ *
+ * The kernel reads every variable as a float, which is what Program does with
+ * non-integral inputs. Rows with an integral input are bound as ints by the
+ * interpreter and can take int operations, so they stay on Program::evaluate.
+ * Expressions that can fail on float rows are not compiled at all: only those
+ * whose residual after constant folding is made of float operations (+ - * /
+ * ^ and builtins) tier up, which are the ones where the kernel and the
+ * interpreter agree bit for bit. `%` and `!`, which always fail on floats,
+ * and constant subexpressions whose folding fails keep an expression on the
+ * interpreter.
+ *
+ * Kernels are named `calc:<label>#<n>` after the label an expression was
+ * compiled with, so that profiles tell expressions apart. With Perf::MAP every
+ * kernel is appended to /tmp/perf-<pid>.map as it is linked, which `perf
+ * report` reads to name samples in JIT'd code. Perf::JITDUMP also compiles
+ * kernels with a line table, the label as file name and the source offset of
+ * every operation as column, and registers LLVM's perf listener, which writes
+ * code and line table to a jit-<pid>.dump under .debug/jit in $JITDUMPDIR or
+ * the working directory, for `perf record -k 1` and `perf inject --jit`. A map
+ * entry is not removed when its expression is freed, so a later kernel may
+ * reuse its addresses under another name.
+ */
+class TieredEngine {
+public:
+    /// The kernel generated by ToIRVisitor::create_batch_kernel.
+    using Kernel = void (*)(const double* vars, int64_t stride, double* out, int64_t n);
+
+    enum class Tier {
+        INTERPRETED,
+        QUEUED,
+        NATIVE,
+        INELIGIBLE, // can fail on float rows, see above
+        FAILED,     // the JIT rejected it
+    };
+
+    /// What the JIT tells perf about the kernels it links, see above.
+    enum class Perf {
+        NONE,
+        MAP,
+        JITDUMP, // and MAP
+    };
+
+    struct Stats {
+        uint64_t tierUps = 0;
+        uint64_t ineligible = 0;
+        uint64_t failed = 0;
+        uint64_t compileNanos = 0; // summed over workers, tier-ups and failures alike
+        uint64_t maxCompileNanos = 0;
+    };
+
+    /// One compiled expression. It must not outlive the engine that created it.
+    class Expression : public std::enable_shared_from_this<Expression> {
+    public:
+        ~Expression() {
+            if (tracker) {
+                llvm::consumeError(tracker->remove());
+            }
+        }
+
+        const Program& getProgram() const {
+            return program;
+        }
+
+        Tier getTier() const {
+            return tier.load(std::memory_order_acquire);
+        }
+
+        /// Rows evaluated on the interpreter, counting stops once the expression is queued.
+        uint64_t getEvaluations() const {
+            return evaluations.load(std::memory_order_relaxed);
+        }
+
+        /// Wall time of its compilation, 0 until it is done.
+        uint64_t getCompileNanos() const {
+            return compileNanos.load(std::memory_order_relaxed);
+        }
+
+    private:
+        friend class TieredEngine;
+
+        // the AST refers to one or the other
+        std::string text;
+        std::shared_ptr<const ASTFile> file;
+        std::unique_ptr<AST> ast;
+        Program program;
+
+        std::atomic<uint64_t> evaluations{0};
+        std::atomic<Tier> tier{Tier::INTERPRETED};
+        std::atomic<Kernel> kernel{nullptr};
+        std::atomic<uint64_t> compileNanos{0};
+        std::string label;
+        std::string kernelName;
+        llvm::orc::ResourceTrackerSP tracker; // owns the kernel's code
+    };
+
+    /// Expressions are compiled once they have evaluated `threshold` rows, by `threads` workers. A threshold of
+    /// 0, or a host the JIT does not support, keeps every expression on the interpreter.
+    explicit TieredEngine(uint64_t threshold, unsigned threads = 1, Perf perf = Perf::NONE)
+        : threshold(threshold)
+        , perf(perf) {
+        if (threshold == 0 || threads == 0) {
+            return;
+        }
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+
+        auto jtmb = llvm::orc::JITTargetMachineBuilder::detectHost();
+        if (!jtmb) {
+            llvm::consumeError(jtmb.takeError());
+            return;
+        }
+        jtmb->setCodeGenOptLevel(llvm::CodeGenOpt::Default);
+        // a TargetMachine is not thread-safe, every worker optimizes and emits code with its own
+        for (unsigned i = 0; i < threads; i++) {
+            auto tm = jtmb->createTargetMachine();
+            if (!tm) {
+                llvm::consumeError(tm.takeError());
+                return;
+            }
+            targetMachines.push_back(std::move(*tm));
+        }
+        llvm::orc::LLJITBuilder builder;
+        builder.setJITTargetMachineBuilder(*jtmb);
+        if (perf == Perf::JITDUMP) {
+            // the listener is a process-wide singleton, null if LLVM was built without perf support
+            auto listener = llvm::JITEventListener::createPerfJITEventListener();
+            builder.setObjectLinkingLayerCreator([listener](llvm::orc::ExecutionSession& es, const llvm::Triple&) {
+                auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+                    es, [] { return std::make_unique<llvm::SectionMemoryManager>(); });
+                if (listener != nullptr) {
+                    layer->registerJITEventListener(*listener);
+                }
+                return std::unique_ptr<llvm::orc::ObjectLayer>(std::move(layer));
+            });
+        }
+        if (perf != Perf::NONE) {
+            perfMap = std::fopen(("/tmp/perf-" + std::to_string(::getpid()) + ".map").c_str(), "a");
+        }
+        auto j = builder.create();
+        if (!j) {
+            llvm::consumeError(j.takeError());
+            return;
+        }
+        jit = std::move(*j);
+
+        // kernels call into the math library of this process
+        auto generator =
+            llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(jit->getDataLayout().getGlobalPrefix());
+        if (!generator) {
+            llvm::consumeError(generator.takeError());
+            jit.reset();
+            return;
+        }
+        jit->getMainJITDylib().addGenerator(std::move(*generator));
+        for (auto& tm : targetMachines) {
+            auto target = tm.get();
+            workers.emplace_back([this, target] { run(*target); });
+        }
+    }
+
+    TieredEngine(const TieredEngine&) = delete;
+    TieredEngine& operator=(const TieredEngine&) = delete;
+
+    ~TieredEngine() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (perfMap != nullptr) {
+            std::fclose(perfMap);
+        }
+    }
+
+    /// Parses and compiles `text` for the interpreter, see Program::compile. `label`, such as the id a client
+    /// gave the expression, names its kernel.
+    Status compile(const std::string& text, llvm::ArrayRef<std::string> names, std::shared_ptr<Expression>& out,
+                   llvm::StringRef label = {}) {
+        auto e = std::make_shared<Expression>();
+        e->text = text;
+        Lexer lexer(e->text);
+        Parser parser(lexer);
+        ParseError error;
+        e->ast.reset(parser.parse(error));
+        if (e->ast == nullptr) {
+            return Status::PARSE_ERROR;
+        }
+        return finish(std::move(e), names, out, label);
+    }
+
+    /// Compiles expression `index` of a binary catalog, without parsing, labelled with its name. The expression
+    /// keeps `file` alive.
+    Status compile(const std::shared_ptr<const ASTFile>& file, size_t index, llvm::ArrayRef<std::string> names,
+                   std::shared_ptr<Expression>& out) {
+        auto e = std::make_shared<Expression>();
+        e->file = file;
+        try {
+            e->ast = file->load(index);
+        } catch (std::runtime_error&) {
+            return Status::PARSE_ERROR;
+        }
+        return finish(std::move(e), names, out, file->getName(index));
+    }
+
+    /// Same result and status as Program::evaluate.
+    Status evaluate(Expression& e, const double* vars, double& result) {
+        auto kernel = e.kernel.load(std::memory_order_acquire);
+        if (kernel != nullptr && !anyBoundAsInt(vars, e.program.getNumVars())) {
+            kernel(vars, 0, &result, 1);
+            return Status::OK;
+        }
+        count(e, 1);
+        Value v;
+        auto s = e.program.evaluate(vars, v);
+        result = s == Status::OK ? v.getFloat() : std::numeric_limits<double>::quiet_NaN();
+        return s;
+    }
+
+    /// Row-major like calc_eval_batch, same results and status as VectorEvaluator.
+    Status evaluateBatch(Expression& e, const double* vars, size_t numRows, double* results) {
+        size_t numVars = e.program.getNumVars();
+        auto kernel = e.kernel.load(std::memory_order_acquire);
+        if (kernel == nullptr) {
+            count(e, numRows);
+            thread_local ColumnPool pool;
+            VectorEvaluator eval(e.program, pool);
+            return eval.evaluate(vars, 1, numVars, numRows, results);
+        }
+
+        kernel(vars, static_cast<int64_t>(numVars), results, static_cast<int64_t>(numRows));
+        // the rows the interpreter would bind an int in
+        auto status = Status::OK;
+        for (size_t r = 0; r < numRows; r++) {
+            auto row = vars + r * numVars;
+            if (!anyBoundAsInt(row, numVars)) {
+                continue;
+            }
+            Value v;
+            auto s = e.program.evaluate(row, v);
+            results[r] = s == Status::OK ? v.getFloat() : std::numeric_limits<double>::quiet_NaN();
+            if (status == Status::OK) {
+                status = s;
+            }
+        }
+        return status;
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    /// Queues `e` for native code whatever its count, to warm up expressions known to be hot.
+    void tierUpNow(Expression& e) {
+        if (jit) {
+            enqueue(e);
+        }
+    }
+
+    /// Blocks until the compile queue is empty and every worker is idle.
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return queue.empty() && compiling == 0; });
+    }
+
+private:
+    Status finish(std::shared_ptr<Expression> e, llvm::ArrayRef<std::string> names, std::shared_ptr<Expression>& out,
+                  llvm::StringRef label) {
+        auto s = Program::compile(e->ast.get(), names, e->program);
+        if (s != Status::OK) {
+            return s;
+        }
+        // numbered, a label may be reused while the kernel of the expression it named is still linked
+        auto n = std::to_string(nextKernel.fetch_add(1, std::memory_order_relaxed));
+        e->label = label.str();
+        e->kernelName = label.empty() ? "calc_kernel_" + n : "calc:" + e->label + "#" + n;
+        out = std::move(e);
+        return Status::OK;
+    }
+
+    static bool anyBoundAsInt(const double* vars, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            if (Program::isBoundAsInt(vars[i])) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void count(Expression& e, uint64_t rows) {
+        if (!jit || e.tier.load(std::memory_order_relaxed) != Tier::INTERPRETED) {
+            return;
+        }
+        if (e.evaluations.fetch_add(rows, std::memory_order_relaxed) + rows >= threshold) {
+            enqueue(e);
+        }
+    }
+
+    void enqueue(Expression& e) {
+        auto expected = Tier::INTERPRETED;
+        if (!e.tier.compare_exchange_strong(expected, Tier::QUEUED)) {
+            return; // queued by another caller
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(e.shared_from_this());
+        }
+        wakeup.notify_one();
+    }
+
+    void run(llvm::TargetMachine& tm) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wakeup.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            auto e = std::move(queue.front());
+            queue.pop_front();
+            compiling++;
+            lock.unlock();
+
+            auto begin = std::chrono::steady_clock::now();
+            auto tier = tierUp(*e, tm);
+            auto nanos = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin)
+                    .count());
+            e->compileNanos.store(nanos, std::memory_order_relaxed);
+            e->tier.store(tier, std::memory_order_release);
+            // the last reference may be this one, drop it before taking the lock
+            e.reset();
+
+            lock.lock();
+            compiling--;
+            if (tier == Tier::NATIVE) {
+                stats.tierUps++;
+            } else if (tier == Tier::INELIGIBLE) {
+                stats.ineligible++;
+            } else {
+                stats.failed++;
+            }
+            if (tier != Tier::INELIGIBLE) {
+                stats.compileNanos += nanos;
+                stats.maxCompileNanos = std::max(stats.maxCompileNanos, nanos);
+            }
+            if (queue.empty() && compiling == 0) {
+                idle.notify_all();
+            }
+        }
+    }
+
+    Tier tierUp(Expression& e, llvm::TargetMachine& tm) {
+        Specializer specializer(e.ast.get());
+        auto residual = specializer.specialize({});
+        if (!FloatOnly::check(residual.get())) {
+            return Tier::INELIGIBLE;
+        }
+
+        llvm::LLVMContext ctx;
+        auto mod = std::make_unique<llvm::Module>("calc", ctx);
+        mod->setDataLayout(jit->getDataLayout());
+        mod->setTargetTriple(jit->getTargetTriple().str());
+        auto& name = e.kernelName;
+        {
+            // ToIRVisitor shares ownership of its module, it only needs this one while it runs
+            ToIRVisitor toIR(std::shared_ptr<llvm::Module>(mod.get(), [](llvm::Module*) {}));
+            if (perf == Perf::JITDUMP) {
+                toIR.enableDebugInfo(e.label.empty() ? name : e.label);
+            }
+            try {
+                toIR.create_batch_kernel(residual.get(), name);
+            } catch (std::runtime_error&) {
+                return Tier::FAILED;
+            }
+            // kernels index variables by first appearance, as Program does, check rather than assume
+            auto kernelVars = toIR.getVariables();
+            if (kernelVars.size() != e.program.getNumVars()) {
+                return Tier::FAILED;
+            }
+            for (size_t i = 0; i < kernelVars.size(); i++) {
+                if (kernelVars[i] != e.program.getVarName(i)) {
+                    return Tier::FAILED;
+                }
+            }
+        }
+        optimize(*mod, tm);
+        auto obj = llvm::orc::SimpleCompiler(tm)(*mod);
+        if (!obj) {
+            llvm::consumeError(obj.takeError());
+            return Tier::FAILED;
+        }
+
+        uint64_t size = perfMap != nullptr ? symbolSize(**obj, name) : 0;
+        auto tracker = jit->getMainJITDylib().createResourceTracker();
+        if (auto err = jit->addObjectFile(tracker, std::move(*obj))) {
+            llvm::consumeError(std::move(err));
+            return Tier::FAILED;
+        }
+        auto sym = jit->lookup(name);
+        if (!sym) {
+            llvm::consumeError(sym.takeError());
+            llvm::consumeError(tracker->remove());
+            return Tier::FAILED;
+        }
+        if (perfMap != nullptr) {
+            std::lock_guard<std::mutex> lock(perfMapMutex);
+            std::fprintf(perfMap, "%llx %llx %s\n", static_cast<unsigned long long>(sym->getAddress()),
+                         static_cast<unsigned long long>(size), name.c_str());
+            std::fflush(perfMap);
+        }
+        e.tracker = std::move(tracker);
+        e.kernel.store(reinterpret_cast<Kernel>(sym->getAddress()), std::memory_order_release);
+        return Tier::NATIVE;
+    }
+
+    /// Bytes of code of function `name` in an object file, 0 if it cannot be told.
+    static uint64_t symbolSize(const llvm::MemoryBuffer& obj, const std::string& name) {
+        auto file = llvm::object::ObjectFile::createObjectFile(obj.getMemBufferRef());
+        if (!file) {
+            llvm::consumeError(file.takeError());
+            return 0;
+        }
+        for (auto& s : llvm::object::computeSymbolSizes(**file)) {
+            auto symName = s.first.getName();
+            if (!symName) {
+                llvm::consumeError(symName.takeError());
+            } else if (*symName == name) {
+                return s.second;
+            }
+        }
+        return 0;
+    }
+
+    static void optimize(llvm::Module& mod, llvm::TargetMachine& tm) {
+        llvm::LoopAnalysisManager lam;
+        llvm::FunctionAnalysisManager fam;
+        llvm::CGSCCAnalysisManager cgam;
+        llvm::ModuleAnalysisManager mam;
+        llvm::PassBuilder pb(&tm);
+        pb.registerModuleAnalyses(mam);
+        pb.registerCGSCCAnalyses(cgam);
+        pb.registerFunctionAnalyses(fam);
+        pb.registerLoopAnalyses(lam);
+        pb.crossRegisterProxies(lam, fam, cgam, mam);
+        pb.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2).run(mod, mam);
+    }
+
+    /// Whether every operation of an expression is a float one once its variables are floats, the literals
+    /// left over from constant folding aside.
+    class FloatOnly : public ASTVisitor {
+        bool isInt = false;
+        bool ok = true;
+
+    public:
+        static bool check(AST* ast) {
+            FloatOnly v;
+            ast->accept(v);
+            return v.ok;
+        }
+
+        void visit(UnaryOp& e) override {
+            e.getExpr()->accept(*this);
+            ok = ok && !isInt && e.getOp() != UnaryOp::FACT;
+        }
+
+        void visit(BinaryOp& e) override {
+            e.getLeft()->accept(*this);
+            bool lhsInt = isInt;
+            e.getRight()->accept(*this);
+            // comparisons, && and || give an int 0 or 1 whatever their operands are
+            if (e.getOp() >= BinaryOp::LT) {
+                isInt = true;
+                return;
+            }
+            ok = ok && !(lhsInt && isInt) && e.getOp() != BinaryOp::MOD;
+            isInt = false;
+        }
+
+        void visit(Conditional& e) override {
+            e.getCond()->accept(*this);
+            e.getLeft()->accept(*this);
+            bool lhsInt = isInt;
+            e.getRight()->accept(*this);
+            isInt = lhsInt && isInt;
+        }
+
+        void visit(FuncCall& e) override {
+            e.getParam()->accept(*this);
+            // abs keeps an int an int in the generated code
+            ok = ok && !(isInt && e.getName().equals("abs"));
+            isInt = false;
+        }
+
+        void visit(Ident&) override {
+            isInt = false;
+        }
+
+        void visit(Number& e) override {
+            isInt = e.getType() == Number::INT;
+        }
+    };
+
+    const uint64_t threshold;
+    const Perf perf;
+    FILE* perfMap = nullptr; // /tmp/perf-<pid>.map, shared by the workers
+    std::mutex perfMapMutex;
+    std::vector<std::unique_ptr<llvm::TargetMachine>> targetMachines; // one per worker
+    std::unique_ptr<llvm::orc::LLJIT> jit;
+    std::atomic<uint64_t> nextKernel{0};
+    mutable std::mutex mutex;
+    std::condition_variable wakeup;
+    std::condition_variable idle;
+    std::deque<std::shared_ptr<Expression>> queue;
+    bool stopping = false;
+    size_t compiling = 0; // workers busy with an expression
+    Stats stats;
+
+    std::vector<std::thread> workers;
+};
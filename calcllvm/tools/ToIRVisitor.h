@@ -1,12 +1,19 @@
 #pragma once
 
 #include "AST.h"
+#include "Gradient.h"
 #include "Lexer.h"
+#include "RangeAnalysis.h"
 
+#include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Support/Casting.h"
 
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 class ToIRVisitor : public ASTVisitor {
@@ -31,6 +38,48 @@ class ToIRVisitor : public ASTVisitor {
     std::shared_ptr<llvm::GlobalVariable> globalNumValues;
     std::shared_ptr<llvm::GlobalVariable> globalNames;
 
+    std::unordered_map<std::string, llvm::Value*> varValues; // name to the value read in the prelude
+
+    // Every emitted operation in evaluation order, the input to gradient generation.
+    struct TapeEntry {
+        Program::OpCode op;
+        Builtin func;
+        int lhs;
+        int rhs;
+        llvm::Value* value;
+        ResultType type;
+        std::string var;             // for LOAD
+        llvm::Value* cond = nullptr; // for SELECT, the i1 choosing lhs
+    };
+    std::vector<TapeEntry> tape;
+    int resultEntry = -1;
+
+    std::vector<std::string> gradWrt;
+    ADMode gradMode = ADMode::AUTO;
+    bool gradEnabled = false;
+
+    const RangeAnalysis* ranges = nullptr;
+
+    // kernels loop over rows: a stream kernel reads row `rowIndex` of `streamColumns`, a batch kernel reads
+    // `rowStride` values per row from `rowVars`
+    bool streaming = false;
+    llvm::Value* streamColumns = nullptr;
+    llvm::Value* rowVars = nullptr;
+    llvm::Value* rowStride = nullptr;
+    llvm::Value* rowIndex = nullptr;
+
+    // variables that are the same on every row of a kernel call, and the subtrees depending on nothing else, which
+    // are computed in the prologue of the row loop, see setScalars
+    std::unordered_set<std::string> scalars;
+    std::unordered_set<AST*> invariant;
+    llvm::BasicBlock* kernelPrologue = nullptr;
+    bool inPrologue = false;
+
+    // line tables of a batch kernel, see enableDebugInfo
+    std::unique_ptr<llvm::DIBuilder> diBuilder;
+    llvm::DIFile* diFile = nullptr;
+    llvm::DISubprogram* diScope = nullptr;
+
 public:
     ToIRVisitor(const std::shared_ptr<llvm::Module>& mod)
         : mod(mod)
@@ -41,7 +90,57 @@ public:
         f64 = llvm::Type::getDoubleTy(ctx);
     }
 
+    /// Makes main print the partial derivatives with respect to `wrt`, one per line, after the value.
+    void enableGradient(llvm::ArrayRef<std::string> wrt, ADMode mode) {
+        gradWrt.assign(wrt.begin(), wrt.end());
+        gradMode = mode;
+        gradEnabled = true;
+    }
+
+    /// Ranges of the expression given to create_main_function. Variables with an int range are read as ints,
+    /// and int `/`, `%` and `^` drop to narrower or unchecked code where the ranges prove it safe.
+    void setRanges(const RangeAnalysis* analysis) {
+        ranges = analysis;
+    }
+
+    /// Makes create_main_function generate a kernel evaluating the expression over a block of rows, and a main
+    /// that hands it to the streaming runtime (runtime/stream.c) instead of reading variables from stdin.
+    void enableStreaming() {
+        streaming = true;
+    }
+
+    /// Variables that are the same on every row of a kernel call, such as parameters fixed for a whole batch.
+    /// Kernels read them once, from the first row, and compute every subexpression that depends on nothing else,
+    /// like `exp(k)` in `exp(k) * x`, once before the row loop rather than leave it to LLVM to hoist.
+    void setScalars(llvm::ArrayRef<std::string> names) {
+        scalars.clear();
+        scalars.insert(names.begin(), names.end());
+    }
+
+    /// Lets LLVM contract a float multiplication and the addition of its result into one fused multiply-add,
+    /// which rounds once instead of twice, on targets that have one.
+    void enableFastFP() {
+        llvm::FastMathFlags fmf;
+        fmf.setAllowContract();
+        irBuilder.setFastMathFlags(fmf);
+    }
+
+    /// Gives the batch kernel generated next a line table, so that profilers and debuggers map its code back to
+    /// the expression: an operation is at line 1 of `file`, at the column its node starts in the source.
+    void enableDebugInfo(llvm::StringRef file) {
+        diBuilder.reset(new llvm::DIBuilder(*mod));
+        diFile = diBuilder->createFile(file, ".");
+        diBuilder->createCompileUnit(llvm::dwarf::DW_LANG_C, diFile, "calcllvm", /*isOptimized=*/true, "", 0, "",
+                                     llvm::DICompileUnit::LineTablesOnly);
+        mod->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+    }
+
     void create_main_function(AST* expr) {
+        if (streaming) {
+            create_stream_functions(expr);
+            return;
+        }
+
         auto& ctx = mod->getContext();
         auto i32 = llvm::Type::getInt32Ty(ctx);
         auto i8 = llvm::Type::getInt8Ty(ctx);
@@ -59,9 +158,16 @@ public:
         mainFuncBody = llvm::BasicBlock::Create(ctx, "body", mainFunc);
         irBuilder.SetInsertPoint(mainFuncBody);
 
+        expr->accept(*this);
 
+        irBuilder.SetInsertPoint(mainFuncPrelude);
+        irBuilder.CreateBr(mainFuncBody);
+        irBuilder.SetInsertPoint(mainFuncBody);
 
-        expr->accept(*this);
+        std::vector<llvm::Value*> partials;
+        if (gradEnabled) {
+            partials = emitGradient();
+        }
 
         // print the value
         llvm::Type* inputType;
@@ -74,12 +180,97 @@ public:
             funcName = "print_i";
         }
         callExternal(funcName, llvm::Type::getVoidTy(ctx), {inputType}, {result});
+        for (auto partial : partials) {
+            callExternal("print_f", llvm::Type::getVoidTy(ctx), {f64}, {partial});
+        }
 
         irBuilder.CreateRet(llvm::ConstantInt::get(i32, 0, true));
     }
 
+    /**
+     * void calc_kernel(const double* const* columns, double* out, int64_t n), see emitRowLoop(). main passes it
+     * to calc_stream() along with the variable names, which the runtime matches against the columns of the input.
+     */
+    void create_stream_functions(AST* expr) {
+        auto& ctx = mod->getContext();
+        auto i32 = llvm::Type::getInt32Ty(ctx);
+        auto i8Ptr = llvm::Type::getInt8PtrTy(ctx);
+        auto f64Ptr = f64->getPointerTo();
+
+        auto kernelType =
+            llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), {f64Ptr->getPointerTo(), f64Ptr, i64}, false);
+        auto kernel = llvm::Function::Create(kernelType, llvm::GlobalValue::InternalLinkage, "calc_kernel", mod.get());
+        kernel->addParamAttr(1, llvm::Attribute::NoAlias);
+        streamColumns = kernel->getArg(0);
+        emitRowLoop(kernel, expr, kernel->getArg(1), kernel->getArg(2));
+
+        // the variable names in column order of the kernel
+        std::vector<llvm::Constant*> names(env.size());
+        for (auto& it : env) {
+            names[it.second] = irBuilder.CreateGlobalStringPtr(it.first, "name." + it.first, 0, mod.get());
+        }
+        auto namesType = llvm::ArrayType::get(i8Ptr, names.size());
+        auto namesArray = new llvm::GlobalVariable(*mod, namesType, /*isConstant=*/true,
+                                                   llvm::GlobalValue::PrivateLinkage,
+                                                   llvm::ConstantArray::get(namesType, names), "names");
+
+        auto mainFuncType = llvm::FunctionType::get(i32, {i32, i8Ptr->getPointerTo()}, /*isVarArg=*/false);
+        auto mainFunc = llvm::Function::Create(mainFuncType, llvm::GlobalValue::ExternalLinkage, "main", mod.get());
+        irBuilder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", mainFunc));
+        auto namesPtr = irBuilder.CreateConstInBoundsGEP2_32(namesType, namesArray, 0, 0);
+        auto ret = callExternal(
+            "calc_stream", i32, {i32, i8Ptr->getPointerTo(), i32, i8Ptr->getPointerTo(), kernel->getType()},
+            {mainFunc->getArg(0), mainFunc->getArg(1), llvm::ConstantInt::get(i32, names.size()), namesPtr, kernel});
+        irBuilder.CreateRet(ret);
+    }
+
+    /**
+     * void <name>(const double* vars, int64_t stride, double* out, int64_t n), see emitRowLoop(). Variable v of
+     * row i is `vars[i * stride + v]`, numbered as getVariables() lists them. Calls nothing but the math library,
+     * so it can be handed to a JIT as is.
+     */
+    void create_batch_kernel(AST* expr, const std::string& name) {
+        auto& ctx = mod->getContext();
+        auto f64Ptr = f64->getPointerTo();
+
+        auto kernelType = llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), {f64Ptr, i64, f64Ptr, i64}, false);
+        auto kernel = llvm::Function::Create(kernelType, llvm::GlobalValue::ExternalLinkage, name, mod.get());
+        kernel->addParamAttr(2, llvm::Attribute::NoAlias);
+        if (diBuilder) {
+            auto type = diBuilder->createSubroutineType(diBuilder->getOrCreateTypeArray({}));
+            diScope = diBuilder->createFunction(diFile, name, name, diFile, 1, type, 1, llvm::DINode::FlagZero,
+                                                llvm::DISubprogram::SPFlagDefinition |
+                                                    llvm::DISubprogram::SPFlagOptimized);
+            kernel->setSubprogram(diScope);
+            irBuilder.SetCurrentDebugLocation(llvm::DILocation::get(ctx, 1, 1, diScope));
+        }
+        rowVars = kernel->getArg(0);
+        rowStride = kernel->getArg(1);
+        emitRowLoop(kernel, expr, kernel->getArg(2), kernel->getArg(3));
+        if (diBuilder) {
+            diBuilder->finalizeSubprogram(diScope);
+            diBuilder->finalize();
+            diScope = nullptr;
+            irBuilder.SetCurrentDebugLocation(llvm::DebugLoc());
+        }
+    }
+
+    /// The variables of the last generated function, in the order it reads them.
+    std::vector<std::string> getVariables() const {
+        std::vector<std::string> names(env.size());
+        for (auto& it : env) {
+            names[it.second] = it.first;
+        }
+        return names;
+    }
+
     void visit(UnaryOp& e) override {
+        if (hoist(e)) {
+            return;
+        }
         e.getExpr()->accept(*this);
+        int operand = resultEntry;
+        locate(e);
 
         if (e.getOp() == UnaryOp::POS) {
             // do nothing
@@ -89,6 +280,7 @@ public:
             } else {
                 result = irBuilder.CreateNeg(result);
             }
+            record(Program::OpCode::NEG, Builtin::UNKNOWN, operand, -1);
         } else if (e.getOp() == UnaryOp::FACT) {
             if (result_type == ResultType::FLOAT) {
                 throw std::runtime_error("ToIR: factorial of float is not defined");
@@ -101,12 +293,18 @@ public:
     }
 
     void visit(BinaryOp& e) override {
+        if (hoist(e)) {
+            return;
+        }
         e.getLeft()->accept(*this);
         llvm::Value* lhs = result;
         auto lhsType = result_type;
+        int lhsEntry = resultEntry;
         e.getRight()->accept(*this);
         llvm::Value* rhs = result;
         auto rhsType = result_type;
+        int rhsEntry = resultEntry;
+        locate(e);
 
         // prompt to f64, only i64 to f64 is allowed
         if (lhsType != rhsType) {
@@ -123,6 +321,28 @@ public:
 
         auto op = e.getOp();
 
+        // comparisons, && and || give an int 0 or 1, as in Program::applyBinary
+        if (op >= BinaryOp::LT) {
+            result = irBuilder.CreateZExt(emitCondition(op, lhs, rhs), i64);
+            result_type = ResultType::INT;
+            record(Program::toOpCode(op), Builtin::UNKNOWN, lhsEntry, rhsEntry);
+            return;
+        }
+
+        // an int32 division is several times faster than an int64 one, and gives the same result when both
+        // operands fit
+        if ((op == BinaryOp::DIV || op == BinaryOp::MOD) && lhsType == ResultType::INT && ranges != nullptr &&
+            ranges->getRange(e.getLeft()).fitsInt32() && ranges->getRange(e.getRight()).fitsInt32()) {
+            auto i32 = irBuilder.getInt32Ty();
+            lhs = irBuilder.CreateTrunc(lhs, i32);
+            rhs = irBuilder.CreateTrunc(rhs, i32);
+            result = op == BinaryOp::DIV ? irBuilder.CreateSDiv(lhs, rhs) : irBuilder.CreateSRem(lhs, rhs);
+            result = irBuilder.CreateSExt(result, i64);
+            result_type = ResultType::INT;
+            record(Program::toOpCode(op), Builtin::UNKNOWN, lhsEntry, rhsEntry);
+            return;
+        }
+
 #define IF_OP_THEN(bop, float_func, int_func)                                                                          \
     if (op == (bop)) {                                                                                                 \
         if (lhsType == ResultType::FLOAT) {                                                                            \
@@ -132,6 +352,7 @@ public:
             result = irBuilder.int_func(lhs, rhs);                                                                     \
             result_type = ResultType::INT;                                                                             \
         }                                                                                                              \
+        record(Program::toOpCode(op), Builtin::UNKNOWN, lhsEntry, rhsEntry);                                           \
         return;                                                                                                        \
     }
 
@@ -145,29 +366,72 @@ public:
                 throw std::runtime_error("mod only works on integer");
             } else {
                 result = irBuilder.CreateSRem(lhs, rhs);
+                record(Program::OpCode::MOD, Builtin::UNKNOWN, lhsEntry, rhsEntry);
             }
         }
 
         if (op == BinaryOp::POW) {
             if (lhsType == ResultType::INT && rhsType == ResultType::INT) {
-                result = callExternal("powi", i64, {i64, i64}, {lhs, rhs});
+                // powi rejects negative exponents and 0^0, neither can happen for an exponent >= 1
+                bool unchecked = ranges != nullptr && ranges->getRange(e.getRight()).lo >= 1;
+                result = callExternal(unchecked ? "_powi" : "powi", i64, {i64, i64}, {lhs, rhs}, /*readNone=*/true);
                 result_type = ResultType::INT;
             } else {
-                result = callExternal("pow", f64, {f64, f64}, {lhs, rhs});
+                result = callIntrinsic(llvm::Intrinsic::pow, {lhs, rhs});
                 result_type = ResultType::FLOAT;
             }
+            record(Program::OpCode::POW, Builtin::UNKNOWN, lhsEntry, rhsEntry);
+        }
+    }
+
+    /// Both arms are evaluated and the result picked with a select, no branch: the arms are cheap next to a
+    /// mispredicted one, and Program evaluates both anyway.
+    void visit(Conditional& e) override {
+        if (hoist(e)) {
+            return;
+        }
+        e.getCond()->accept(*this);
+        auto cond = isTrue(result);
+        e.getLeft()->accept(*this);
+        llvm::Value* lhs = result;
+        auto lhsType = result_type;
+        int lhsEntry = resultEntry;
+        e.getRight()->accept(*this);
+        llvm::Value* rhs = result;
+        int rhsEntry = resultEntry;
+        locate(e);
+
+        if (lhsType != result_type) {
+            if (lhsType == ResultType::INT) {
+                lhs = irBuilder.CreateSIToFP(lhs, f64);
+            } else {
+                rhs = irBuilder.CreateSIToFP(rhs, f64);
+            }
+            lhsType = ResultType::FLOAT;
         }
+        result = irBuilder.CreateSelect(cond, lhs, rhs);
+        result_type = lhsType;
+        record(Program::OpCode::SELECT, Builtin::UNKNOWN, lhsEntry, rhsEntry);
+        tape.back().cond = cond;
     }
 
     void visit(FuncCall& e) override {
+        if (hoist(e)) {
+            return;
+        }
         e.getParam()->accept(*this);
+        int operand = resultEntry;
+        locate(e);
 
         auto name = e.getName();
+        auto func = lookupBuiltin(name);
 
         // only abs supports int input
         if (result_type == ResultType::INT) {
             if (name.equals("abs")) {
-                result = callExternal("llabs", i64, {i64}, {result});
+                // like Value, abs of the smallest int wraps to itself instead of being poison
+                result = callIntrinsic(llvm::Intrinsic::abs, {result, irBuilder.getFalse()});
+                record(Program::OpCode::CALL, func, operand, -1);
                 return;
             } else {
                 result = irBuilder.CreateSIToFP(result, f64);
@@ -175,36 +439,48 @@ public:
             }
         }
 
+        static std::unordered_map<std::string, llvm::Intrinsic::ID> calcc_func_to_intrinsic{
+            {"abs", llvm::Intrinsic::fabs},   //
+            {"exp", llvm::Intrinsic::exp},    //
+            {"log2", llvm::Intrinsic::log2},  //
+            {"lg", llvm::Intrinsic::log10},   //
+            {"ln", llvm::Intrinsic::log},     //
+            {"sin", llvm::Intrinsic::sin},    //
+            {"cos", llvm::Intrinsic::cos},    //
+            {"sqrt", llvm::Intrinsic::sqrt},  //
+        };
+        // LLVM has no intrinsics for these
         static std::unordered_map<std::string, std::string> calcc_func_to_math_func{
-            {"abs", "fabs"},    //
-            {"exp", "exp"},     //
-            {"log2", "log2"},   //
-            {"lg", "log10"},    //
-            {"ln", "log"},      //
-            {"sin", "sin"},     //
-            {"cos", "cos"},     //
             {"tan", "tan"},     //
             {"arcsin", "asin"}, //
             {"arccos", "acos"}, //
             {"arctan", "atan"}, //
-            {"sqrt", "sqrt"},   //
         };
+        auto intrinsic = calcc_func_to_intrinsic.find(name.str());
+        if (intrinsic != calcc_func_to_intrinsic.end()) {
+            result = callIntrinsic(intrinsic->second, {result});
+            record(Program::OpCode::CALL, func, operand, -1);
+            return;
+        }
         auto it = calcc_func_to_math_func.find(name.str());
         if (it != calcc_func_to_math_func.end()) {
-            result = callExternal(it->second, f64, {f64}, {result});
+            result = callExternal(it->second, f64, {f64}, {result}, /*readNone=*/true);
+            record(Program::OpCode::CALL, func, operand, -1);
             return;
         }
 
         auto one = llvm::ConstantFP::get(f64, 1.0);
         if (name.equals("cot")) {
-            result = callExternal("tan", f64, {f64}, {result});
+            result = callExternal("tan", f64, {f64}, {result}, /*readNone=*/true);
             result = irBuilder.CreateFDiv(one, result);
+            record(Program::OpCode::CALL, func, operand, -1);
             return;
         }
 
         if (name.equals("arccot")) {
             result = irBuilder.CreateFDiv(one, result);
-            result = callExternal("atan", f64, {f64}, {result});
+            result = callExternal("atan", f64, {f64}, {result}, /*readNone=*/true);
+            record(Program::OpCode::CALL, func, operand, -1);
             return;
         }
 
@@ -216,33 +492,142 @@ public:
         auto it = env.find(name);
         if (it == env.end()) {
             int index = env.size();
-            prependReads(name, index);
+            prependReads(name, index, ranges != nullptr && ranges->getRange(&e).kind == Range::INT);
             env[name] = static_cast<int>(index);
         }
+        // without a declared int range variables are read as floats, their type is only known at run time
+        result = varValues[name];
+        result_type = result->getType() == i64 ? ResultType::INT : ResultType::FLOAT;
+        record(Program::OpCode::LOAD, Builtin::UNKNOWN, -1, -1);
+        tape.back().var = name;
     }
 
     void visit(Number& e) override {
         if (e.getType() == Number::INT) {
-            int64_t v;
-            e.getValue().getAsInteger(10, v);
-            result = llvm::ConstantInt::get(i64, v);
+            result = llvm::ConstantInt::get(i64, e.getInt());
             result_type = ResultType::INT;
         } else if (e.getType() == Number::FLOAT) {
-            double v;
-            e.getValue().getAsDouble(v);
-            result = llvm::ConstantFP::get(f64, v);
+            result = llvm::ConstantFP::get(f64, e.getFloat());
             result_type = ResultType::FLOAT;
         }
+        record(Program::OpCode::PUSH, Builtin::UNKNOWN, -1, -1);
     }
 
 private:
+    /**
+     * The body of a kernel over n rows, with the same prelude/body split as main but inside the row loop:
+     *
+     *  entry:    n > 0 ? prologue : exit
+     *  prologue: load the scalars, compute what depends on them alone; only if there are scalars
+     *  loop:     i = phi; load the variables of row i
+     *  body:     out[i] = expr; ++i < n ? loop : exit
+     *
+     * The prologue comes after the test so that nothing is evaluated for an empty block.
+     */
+    void emitRowLoop(llvm::Function* kernel, AST* expr, llvm::Value* out, llvm::Value* n) {
+        auto& ctx = mod->getContext();
+        auto entry = llvm::BasicBlock::Create(ctx, "entry", kernel);
+        kernelPrologue = scalars.empty() ? nullptr : llvm::BasicBlock::Create(ctx, "prologue", kernel);
+        mainFuncPrelude = llvm::BasicBlock::Create(ctx, "loop", kernel);
+        mainFuncBody = llvm::BasicBlock::Create(ctx, "body", kernel);
+        auto exit = llvm::BasicBlock::Create(ctx, "exit", kernel);
+        auto preheader = kernelPrologue != nullptr ? kernelPrologue : entry;
+        invariant.clear();
+        if (kernelPrologue != nullptr) {
+            findInvariants(expr);
+        }
+
+        irBuilder.SetInsertPoint(entry);
+        irBuilder.CreateCondBr(irBuilder.CreateICmpSGT(n, llvm::ConstantInt::get(i64, 0)),
+                               kernelPrologue != nullptr ? kernelPrologue : mainFuncPrelude, exit);
+        irBuilder.SetInsertPoint(mainFuncPrelude);
+        auto phi = irBuilder.CreatePHI(i64, 2, "i");
+        phi->addIncoming(llvm::ConstantInt::get(i64, 0), preheader);
+        rowIndex = phi;
+
+        irBuilder.SetInsertPoint(mainFuncBody);
+        expr->accept(*this);
+        if (result_type == ResultType::INT) {
+            result = irBuilder.CreateSIToFP(result, f64);
+        }
+        irBuilder.CreateStore(result, irBuilder.CreateInBoundsGEP(f64, out, phi));
+        auto next = irBuilder.CreateAdd(phi, llvm::ConstantInt::get(i64, 1), "next");
+        phi->addIncoming(next, irBuilder.GetInsertBlock());
+        irBuilder.CreateCondBr(irBuilder.CreateICmpSLT(next, n), mainFuncPrelude, exit);
+
+        irBuilder.SetInsertPoint(mainFuncPrelude);
+        irBuilder.CreateBr(mainFuncBody);
+        if (kernelPrologue != nullptr) {
+            irBuilder.SetInsertPoint(kernelPrologue);
+            irBuilder.CreateBr(mainFuncPrelude);
+            kernelPrologue = nullptr;
+        }
+        irBuilder.SetInsertPoint(exit);
+        irBuilder.CreateRetVoid();
+    }
+
+    /// Adds the subtrees of `e` that depend on scalars and literals alone to `invariant`, and tells if `e` does.
+    bool findInvariants(AST* e) {
+        bool inv = false;
+        if (auto id = llvm::dyn_cast<Ident>(e)) {
+            inv = scalars.count(id->getName().str()) != 0;
+        } else if (llvm::isa<Number>(e)) {
+            inv = true;
+        } else if (auto u = llvm::dyn_cast<UnaryOp>(e)) {
+            inv = findInvariants(u->getExpr());
+        } else if (auto b = llvm::dyn_cast<BinaryOp>(e)) {
+            bool lhs = findInvariants(b->getLeft());
+            inv = findInvariants(b->getRight()) && lhs;
+        } else if (auto c = llvm::dyn_cast<Conditional>(e)) {
+            bool cond = findInvariants(c->getCond());
+            bool lhs = findInvariants(c->getLeft());
+            inv = findInvariants(c->getRight()) && cond && lhs;
+        } else if (auto f = llvm::dyn_cast<FuncCall>(e)) {
+            inv = findInvariants(f->getParam());
+        }
+        if (inv) {
+            invariant.insert(e);
+        }
+        return inv;
+    }
+
+    /// Emits an operation whose operands only depend on scalars in the prologue instead of the row loop. The
+    /// largest such subtree is moved as a whole, its operands along with it.
+    bool hoist(AST& e) {
+        if (kernelPrologue == nullptr || inPrologue || invariant.count(&e) == 0) {
+            return false;
+        }
+        auto insertPoint = irBuilder.saveIP();
+        irBuilder.SetInsertPoint(kernelPrologue);
+        inPrologue = true;
+        e.accept(*this);
+        inPrologue = false;
+        irBuilder.restoreIP(insertPoint);
+        return true;
+    }
+
+    /// Attributes the instructions emitted next to `e`, if there is a line table and `e` comes from the source.
+    void locate(AST& e) {
+        if (diScope != nullptr && e.getEnd() != 0) {
+            irBuilder.SetCurrentDebugLocation(llvm::DILocation::get(mod->getContext(), 1, e.getBegin() + 1, diScope));
+        }
+    }
+
+    /// Calls a function of the runtime or the C library. `readNone` declares it a pure function of its
+    /// arguments, so that the optimizer may fold, merge and hoist calls: true of powi and of the math library,
+    /// whose errno is never read.
     llvm::Value* callExternal(const std::string& funcName, llvm::Type* retType, llvm::ArrayRef<llvm::Type*> inType,
-                              llvm::ArrayRef<llvm::Value*> input) {
+                              llvm::ArrayRef<llvm::Value*> input, bool readNone = false) {
         auto funcType = llvm::FunctionType::get(retType, inType, false);
         auto it = functions.find(funcName);
         llvm::Function* func;
         if (it == functions.end()) {
             func = llvm::Function::Create(funcType, llvm::GlobalValue::ExternalLinkage, funcName, mod.get());
+            if (readNone) {
+                func->setDoesNotAccessMemory();
+                func->setDoesNotThrow();
+                func->setWillReturn();
+            }
             functions[funcName] = func;
         } else {
             func = it->second;
@@ -251,9 +636,308 @@ private:
         return irBuilder.CreateCall(funcType, func, input);
     }
 
-    void prependReads(const std::string& name, int index) {
-        irBuilder.SetInsertPoint(mainFuncPrelude);
+    /// Calls an LLVM intrinsic overloaded on the type of its first argument. Codegen lowers the float ones to
+    /// the math library or to an instruction, the optimizer knows what they compute.
+    llvm::Value* callIntrinsic(llvm::Intrinsic::ID id, llvm::ArrayRef<llvm::Value*> input) {
+        return irBuilder.CreateIntrinsic(id, {input[0]->getType()}, input);
+    }
 
-        irBuilder.SetInsertPoint(mainFuncBody);
+    void prependReads(const std::string& name, int index, bool isInt) {
+        auto insertPoint = irBuilder.saveIP();
+        // a scalar is read once, from the first row
+        bool scalar = kernelPrologue != nullptr && scalars.count(name) != 0;
+        irBuilder.SetInsertPoint(scalar ? kernelPrologue : mainFuncPrelude);
+        if (streaming || rowVars != nullptr) {
+            auto row = scalar ? llvm::ConstantInt::get(i64, 0) : rowIndex;
+            llvm::Value* p;
+            if (streaming) {
+                auto f64Ptr = f64->getPointerTo();
+                auto column =
+                    irBuilder.CreateLoad(f64Ptr, irBuilder.CreateConstInBoundsGEP1_64(f64Ptr, streamColumns, index));
+                p = irBuilder.CreateInBoundsGEP(f64, column, row);
+            } else {
+                auto offset =
+                    irBuilder.CreateAdd(irBuilder.CreateMul(row, rowStride), llvm::ConstantInt::get(i64, index));
+                p = irBuilder.CreateInBoundsGEP(f64, rowVars, offset);
+            }
+            llvm::Value* v = irBuilder.CreateLoad(f64, p, name);
+            varValues[name] = isInt ? irBuilder.CreateFPToSI(v, i64) : v;
+            irBuilder.restoreIP(insertPoint);
+            return;
+        }
+        auto nameStr = irBuilder.CreateGlobalStringPtr(name, "name." + name);
+        if (isInt) {
+            varValues[name] = callExternal("read_i", i64, {nameStr->getType()}, {nameStr});
+        } else {
+            varValues[name] = callExternal("read_f", f64, {nameStr->getType()}, {nameStr});
+        }
+        irBuilder.restoreIP(insertPoint);
+    }
+
+    /// Whether v is nonzero, NaN included.
+    llvm::Value* isTrue(llvm::Value* v) {
+        if (v->getType() == f64) {
+            return irBuilder.CreateFCmpUNE(v, llvm::ConstantFP::get(f64, 0.0));
+        }
+        return irBuilder.CreateICmpNE(v, llvm::ConstantInt::get(i64, 0));
+    }
+
+    /// The i1 of a comparison, && or || on operands already promoted to the same type.
+    llvm::Value* emitCondition(BinaryOp::Op op, llvm::Value* lhs, llvm::Value* rhs) {
+        bool isFloat = lhs->getType() == f64;
+        switch (op) {
+        case BinaryOp::LT:
+            return isFloat ? irBuilder.CreateFCmpOLT(lhs, rhs) : irBuilder.CreateICmpSLT(lhs, rhs);
+        case BinaryOp::LE:
+            return isFloat ? irBuilder.CreateFCmpOLE(lhs, rhs) : irBuilder.CreateICmpSLE(lhs, rhs);
+        case BinaryOp::GT:
+            return isFloat ? irBuilder.CreateFCmpOGT(lhs, rhs) : irBuilder.CreateICmpSGT(lhs, rhs);
+        case BinaryOp::GE:
+            return isFloat ? irBuilder.CreateFCmpOGE(lhs, rhs) : irBuilder.CreateICmpSGE(lhs, rhs);
+        case BinaryOp::EQ:
+            return isFloat ? irBuilder.CreateFCmpOEQ(lhs, rhs) : irBuilder.CreateICmpEQ(lhs, rhs);
+        case BinaryOp::NE:
+            return isFloat ? irBuilder.CreateFCmpUNE(lhs, rhs) : irBuilder.CreateICmpNE(lhs, rhs);
+        case BinaryOp::AND:
+            return irBuilder.CreateAnd(isTrue(lhs), isTrue(rhs));
+        case BinaryOp::OR:
+            return irBuilder.CreateOr(isTrue(lhs), isTrue(rhs));
+        default:
+            throw std::runtime_error("ToIR: not a condition");
+        }
+    }
+
+    void record(Program::OpCode op, Builtin func, int lhs, int rhs) {
+        tape.push_back(TapeEntry{op, func, lhs, rhs, result, result_type, {}, nullptr});
+        resultEntry = static_cast<int>(tape.size()) - 1;
+    }
+
+    llvm::Value* toF64(const TapeEntry& e) {
+        return e.type == ResultType::FLOAT ? e.value : irBuilder.CreateSIToFP(e.value, f64);
+    }
+
+    /// acc + d * t, where a null acc, d or t stands for 0.0
+    llvm::Value* mulAdd(llvm::Value* acc, llvm::Value* d, llvm::Value* t) {
+        if (d == nullptr || t == nullptr) {
+            return acc;
+        }
+        auto p = irBuilder.CreateFMul(d, t);
+        return acc == nullptr ? p : irBuilder.CreateFAdd(acc, p);
+    }
+
+    /// `cond ? a : b` where a null a or b stands for 0.0.
+    llvm::Value* selectOrZero(llvm::Value* cond, llvm::Value* a, llvm::Value* b) {
+        if (a == nullptr && b == nullptr) {
+            return nullptr;
+        }
+        auto zero = llvm::ConstantFP::get(f64, 0.0);
+        return irBuilder.CreateSelect(cond, a == nullptr ? zero : a, b == nullptr ? zero : b);
+    }
+
+    /// IR for localPartials() in Gradient.h; a null partial stands for 0.0. SELECT has none, emitGradient()
+    /// selects the derivative of the arm taken so that the other one cannot turn it into a NaN.
+    void emitLocalPartials(const TapeEntry& e, llvm::Value*& dLhs, llvm::Value*& dRhs) {
+        auto c = [&](double v) { return llvm::ConstantFP::get(f64, v); };
+        auto zero = c(0.0);
+        auto one = c(1.0);
+        dLhs = nullptr;
+        dRhs = nullptr;
+        if (e.lhs < 0) {
+            return;
+        }
+        auto& l = tape[e.lhs];
+        auto a = toF64(l);
+        llvm::Value* b = nullptr;
+        bool bothInt = false;
+        if (e.rhs >= 0) {
+            b = toF64(tape[e.rhs]);
+            bothInt = l.type == ResultType::INT && tape[e.rhs].type == ResultType::INT;
+        }
+        auto r = toF64(e);
+
+        switch (e.op) {
+        case Program::OpCode::NEG:
+            dLhs = c(-1.0);
+            return;
+        case Program::OpCode::ADD:
+            dLhs = one;
+            dRhs = one;
+            return;
+        case Program::OpCode::SUB:
+            dLhs = one;
+            dRhs = c(-1.0);
+            return;
+        case Program::OpCode::MUL:
+            dLhs = b;
+            dRhs = a;
+            return;
+        case Program::OpCode::DIV:
+            if (!bothInt) {
+                dLhs = irBuilder.CreateFDiv(one, b);
+                dRhs = irBuilder.CreateFNeg(irBuilder.CreateFDiv(a, irBuilder.CreateFMul(b, b)));
+            }
+            return;
+        case Program::OpCode::MOD:
+            dLhs = one;
+            dRhs = irBuilder.CreateFNeg(irBuilder.CreateSIToFP(irBuilder.CreateSDiv(l.value, tape[e.rhs].value), f64));
+            return;
+        case Program::OpCode::POW: {
+            auto dl = irBuilder.CreateFMul(b, callIntrinsic(llvm::Intrinsic::pow, {a, irBuilder.CreateFSub(b, one)}));
+            dLhs = irBuilder.CreateSelect(irBuilder.CreateFCmpOEQ(b, zero), zero, dl);
+            auto dr = irBuilder.CreateFMul(r, callIntrinsic(llvm::Intrinsic::log, {a}));
+            dRhs = irBuilder.CreateSelect(irBuilder.CreateFCmpOGT(a, zero), dr, zero);
+            return;
+        }
+        case Program::OpCode::CALL:
+            break;
+        default:
+            return;
+        }
+
+        switch (e.func) {
+        case Builtin::ABS:
+            dLhs = irBuilder.CreateSelect(irBuilder.CreateFCmpOGT(a, zero), one,
+                                          irBuilder.CreateSelect(irBuilder.CreateFCmpOLT(a, zero), c(-1.0), zero));
+            return;
+        case Builtin::EXP:
+            dLhs = r;
+            return;
+        case Builtin::LOG2:
+            dLhs = irBuilder.CreateFDiv(one, irBuilder.CreateFMul(a, c(std::log(2.0))));
+            return;
+        case Builtin::LG:
+            dLhs = irBuilder.CreateFDiv(one, irBuilder.CreateFMul(a, c(std::log(10.0))));
+            return;
+        case Builtin::LN:
+            dLhs = irBuilder.CreateFDiv(one, a);
+            return;
+        case Builtin::SIN:
+            dLhs = callIntrinsic(llvm::Intrinsic::cos, {a});
+            return;
+        case Builtin::COS:
+            dLhs = irBuilder.CreateFNeg(callIntrinsic(llvm::Intrinsic::sin, {a}));
+            return;
+        case Builtin::TAN:
+            dLhs = irBuilder.CreateFAdd(one, irBuilder.CreateFMul(r, r));
+            return;
+        case Builtin::COT:
+            dLhs = irBuilder.CreateFNeg(irBuilder.CreateFAdd(one, irBuilder.CreateFMul(r, r)));
+            return;
+        case Builtin::ARCSIN:
+        case Builtin::ARCCOS: {
+            auto d = irBuilder.CreateFDiv(
+                one, callIntrinsic(llvm::Intrinsic::sqrt, {irBuilder.CreateFSub(one, irBuilder.CreateFMul(a, a))}));
+            dLhs = e.func == Builtin::ARCSIN ? d : irBuilder.CreateFNeg(d);
+            return;
+        }
+        case Builtin::ARCTAN:
+        case Builtin::ARCCOT: {
+            auto d = irBuilder.CreateFDiv(one, irBuilder.CreateFAdd(one, irBuilder.CreateFMul(a, a)));
+            dLhs = e.func == Builtin::ARCTAN ? d : irBuilder.CreateFNeg(d);
+            return;
+        }
+        case Builtin::SQRT:
+            dLhs = irBuilder.CreateFDiv(c(0.5), r);
+            return;
+        case Builtin::UNKNOWN:
+            return;
+        }
+    }
+
+    /// Partial derivatives of the result with respect to gradWrt, walking the tape forwards (one tangent per
+    /// variable) or backwards (one adjoint per entry).
+    std::vector<llvm::Value*> emitGradient() {
+        auto mode = gradMode;
+        if (mode == ADMode::AUTO) {
+            mode = gradWrt.size() <= kMaxForwardModeVars ? ADMode::FORWARD : ADMode::REVERSE;
+        }
+        auto one = llvm::ConstantFP::get(f64, 1.0);
+        size_t n = tape.size();
+        size_t k = gradWrt.size();
+        std::vector<llvm::Value*> grad(k, nullptr);
+        std::vector<llvm::Value*> dLhs(n), dRhs(n);
+        for (size_t i = 0; i < n; i++) {
+            emitLocalPartials(tape[i], dLhs[i], dRhs[i]);
+        }
+
+        if (mode == ADMode::FORWARD) {
+            std::vector<llvm::Value*> tangents(n * k, nullptr);
+            for (size_t i = 0; i < n; i++) {
+                auto& e = tape[i];
+                for (size_t j = 0; j < k; j++) {
+                    if (e.op == Program::OpCode::LOAD) {
+                        tangents[i * k + j] = e.var == gradWrt[j] ? one : nullptr;
+                        continue;
+                    }
+                    if (e.op == Program::OpCode::SELECT) {
+                        tangents[i * k + j] = selectOrZero(e.cond, tangents[e.lhs * k + j], tangents[e.rhs * k + j]);
+                        continue;
+                    }
+                    llvm::Value* t = nullptr;
+                    if (e.lhs >= 0) {
+                        t = mulAdd(t, dLhs[i], tangents[e.lhs * k + j]);
+                    }
+                    if (e.rhs >= 0) {
+                        t = mulAdd(t, dRhs[i], tangents[e.rhs * k + j]);
+                    }
+                    tangents[i * k + j] = t;
+                }
+            }
+            for (size_t j = 0; j < k; j++) {
+                grad[j] = tangents[resultEntry * k + j];
+            }
+        } else {
+            std::vector<llvm::Value*> adjoints(n, nullptr);
+            // below an arm of a select an adjoint can be 0 at run time, and such an entry is skipped like
+            // evaluateGradient() skips it, so that an infinite partial of the arm not taken does not make a NaN
+            std::vector<bool> gated(n, false);
+            adjoints[resultEntry] = one;
+            for (size_t i = n; i-- > 0;) {
+                auto& e = tape[i];
+                if (adjoints[i] == nullptr) {
+                    continue;
+                }
+                if (gated[i] || e.op == Program::OpCode::SELECT) {
+                    for (int operand : {e.lhs, e.rhs}) {
+                        if (operand >= 0) {
+                            gated[operand] = true;
+                        }
+                    }
+                }
+                if (e.op == Program::OpCode::LOAD) {
+                    for (size_t j = 0; j < k; j++) {
+                        if (e.var == gradWrt[j]) {
+                            grad[j] = mulAdd(grad[j], one, adjoints[i]);
+                        }
+                    }
+                    continue;
+                }
+                if (e.op == Program::OpCode::SELECT) {
+                    adjoints[e.lhs] = mulAdd(adjoints[e.lhs], one, selectOrZero(e.cond, adjoints[i], nullptr));
+                    adjoints[e.rhs] = mulAdd(adjoints[e.rhs], one, selectOrZero(e.cond, nullptr, adjoints[i]));
+                    continue;
+                }
+                auto adj = adjoints[i];
+                if (gated[i]) {
+                    auto zero = llvm::ConstantFP::get(f64, 0.0);
+                    auto skip = irBuilder.CreateFCmpOEQ(adj, zero);
+                    dLhs[i] = dLhs[i] == nullptr ? nullptr : irBuilder.CreateSelect(skip, zero, dLhs[i]);
+                    dRhs[i] = dRhs[i] == nullptr ? nullptr : irBuilder.CreateSelect(skip, zero, dRhs[i]);
+                }
+                if (e.lhs >= 0) {
+                    adjoints[e.lhs] = mulAdd(adjoints[e.lhs], dLhs[i], adj);
+                }
+                if (e.rhs >= 0) {
+                    adjoints[e.rhs] = mulAdd(adjoints[e.rhs], dRhs[i], adj);
+                }
+            }
+        }
+
+        for (auto& g : grad) {
+            if (g == nullptr) {
+                g = llvm::ConstantFP::get(f64, 0.0);
+            }
+        }
+        return grad;
     }
 };
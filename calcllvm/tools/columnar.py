@@ -0,0 +1,96 @@
+"""Converts between CSV and the columnar format read and written by `calcc --stream` executables.
+
+    columnar.py pack input.csv output.col [--block-rows N]
+    columnar.py unpack input.col [output.csv]
+
+The CSV has a header line with the column names. See runtime/stream.c for the format.
+"""
+import sys
+import csv
+import array
+import struct
+import argparse
+
+MAGIC = b"CALCCOL1"
+
+
+def write_header(f, names):
+    f.write(MAGIC + struct.pack("<II", len(names), 0))
+    size = 0
+    for name in names:
+        encoded = name.encode()
+        f.write(struct.pack("<I", len(encoded)) + encoded)
+        size += 4 + len(encoded)
+    f.write(b"\0" * (-size % 8))
+
+
+def write_block(f, columns):
+    f.write(struct.pack("<Q", len(columns[0])))
+    for column in columns:
+        f.write(array.array("d", column).tobytes())
+
+
+def pack(args):
+    with open(args.input, newline="") as src, open(args.output, "wb") as dst:
+        rows = csv.reader(src)
+        names = next(rows)
+        write_header(dst, names)
+        columns = [[] for _ in names]
+        for row in rows:
+            for column, value in zip(columns, row):
+                column.append(float(value))
+            if len(columns[0]) == args.block_rows:
+                write_block(dst, columns)
+                columns = [[] for _ in names]
+        if columns[0]:
+            write_block(dst, columns)
+        dst.write(struct.pack("<Q", 0))
+
+
+def unpack(args):
+    with open(args.input, "rb") as src:
+        data = src.read()
+    if data[:8] != MAGIC:
+        sys.exit(f"{args.input}: not in the columnar format")
+    num_columns, = struct.unpack_from("<I", data, 8)
+    offset = 16
+    names = []
+    for _ in range(num_columns):
+        length, = struct.unpack_from("<I", data, offset)
+        names.append(data[offset + 4:offset + 4 + length].decode())
+        offset += 4 + length
+    offset += -(offset - 16) % 8
+
+    out = open(args.output, "w", newline="") if args.output else sys.stdout
+    writer = csv.writer(out)
+    writer.writerow(names)
+    while offset + 8 <= len(data):
+        rows, = struct.unpack_from("<Q", data, offset)
+        offset += 8
+        if rows == 0:
+            break
+        columns = []
+        for _ in names:
+            column = array.array("d")
+            column.frombytes(data[offset:offset + rows * 8])
+            columns.append(column)
+            offset += rows * 8
+        writer.writerows(zip(*[[repr(v) for v in column] for column in columns]))
+    if out is not sys.stdout:
+        out.close()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    commands = parser.add_subparsers(dest="command", required=True)
+    p = commands.add_parser("pack")
+    p.add_argument("input", type=str)
+    p.add_argument("output", type=str)
+    p.add_argument("--block-rows", default=65536, type=int)
+    p.set_defaults(func=pack)
+    p = commands.add_parser("unpack")
+    p.add_argument("input", type=str)
+    p.add_argument("output", nargs="?", default=None, type=str)
+    p.set_defaults(func=unpack)
+    args = parser.parse_args()
+    args.func(args)
@@ -1,5 +1,7 @@
 import os
 import sys
+import json
+import time
 import argparse
 import tempfile
 import subprocess
@@ -8,6 +10,9 @@ from shutil import which
 
 this_file_dir = pathlib.Path(os.path.dirname(os.path.abspath(__file__)))
 runtime_c_file = this_file_dir / ".." / "runtime" / "runtime.c"
+format_c_file = this_file_dir / ".." / "runtime" / "format.c"
+stream_c_file = this_file_dir / ".." / "runtime" / "stream.c"
+aggregate_c_file = this_file_dir / ".." / "runtime" / "aggregate.c"
 external_llvm_project = this_file_dir / ".." / ".." /"external" /"llvm-project"
 
 clang_dir = str((external_llvm_project/"clang"))
@@ -19,11 +24,54 @@ calcc_path = which("calcc")
 clang_path = which("clang")
 llc_path = which("llc")
 
+
+class Steps:
+    """Runs the sub-steps of the driver, timing each of them for --time-phases and --trace."""
+
+    def __init__(self):
+        self.events = []
+        self.start = time.perf_counter()
+
+    def run(self, name, args):
+        begin = time.perf_counter()
+        subprocess.check_call(args=args)
+        end = time.perf_counter()
+        self.events.append((name, begin - self.start, end - begin))
+
+    def print_table(self, out):
+        total = sum(dur for _, _, dur in self.events)
+        out.write("   ---Wall Time---  --- Name ---\n")
+        for name, _, dur in self.events:
+            out.write(f"   {dur:.4f} ({100 * dur / total:5.1f}%)  {name}\n")
+        out.write(f"   {total:.4f} (100.0%)  Total\n")
+
+    def write_chrome_trace(self, path):
+        """Complete events in the Chrome trace event format, viewable in chrome://tracing or Perfetto."""
+        pid = os.getpid()
+        events = [{
+            "name": name,
+            "cat": "calcc_driver",
+            "ph": "X",
+            "ts": begin * 1e6,
+            "dur": dur * 1e6,
+            "pid": pid,
+            "tid": 0,
+        } for name, begin, dur in self.events]
+        with open(path, "w") as f:
+            json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, f, indent=1)
+
 if __name__ == "__main__":
     parser = argparse.ArgumentParser()
     parser.add_argument("file", type=str)
     parser.add_argument("--output", "-o", default=None, type=str, required=False)
     parser.add_argument("--verbose", action="store_true")
+    parser.add_argument("--stream", action="store_true", help="evaluate over the rows of a columnar input")
+    parser.add_argument("--scalar", action="append", default=[], metavar="NAME",
+                        help="with --stream, a variable that is the same on every row, see calcc --scalar")
+    parser.add_argument("--fast-fp", action="store_true",
+                        help="allow different rounding: Horner form polynomials and fused multiply-adds for this CPU")
+    parser.add_argument("--time-phases", action="store_true", help="print the wall time of every step to stderr")
+    parser.add_argument("--trace", default=None, type=str, required=False, help="write a Chrome trace of the steps")
     args = parser.parse_args()
 
     if args.verbose:
@@ -32,13 +80,16 @@ if __name__ == "__main__":
         sys.stderr.write(f"Use llc: {llc_path}\n")
 
     expr = open(args.file).read().strip()
+    steps = Steps()
 
     with tempfile.TemporaryDirectory(prefix="calcc") as d:
         expr_ll_file = os.path.join(d, "expr.ll")
         expr_o_file = os.path.join(d, "expr.o")
         runtime_o_file = os.path.join(d, "runtime.o")
+        format_o_file = os.path.join(d, "format.o")
+        runtime_o_files = [runtime_o_file, format_o_file]
 
-        subprocess.check_call(args=[
+        steps.run("compile runtime", [
             clang_path,
             "-w",
             "-c",
@@ -46,24 +97,65 @@ if __name__ == "__main__":
             "-o",
             runtime_o_file,
         ])
+        steps.run("compile format runtime", [
+            clang_path,
+            "-w",
+            "-O2",
+            "-c",
+            format_c_file,
+            "-o",
+            format_o_file,
+        ])
+
+        if args.stream:
+            stream_o_file = os.path.join(d, "stream.o")
+            runtime_o_files.append(stream_o_file)
+            steps.run("compile stream runtime", [
+                clang_path,
+                "-w",
+                "-O2",
+                "-c",
+                stream_c_file,
+                "-o",
+                stream_o_file,
+            ])
+            aggregate_o_file = os.path.join(d, "aggregate.o")
+            runtime_o_files.append(aggregate_o_file)
+            steps.run("compile aggregate runtime", [
+                clang_path,
+                "-w",
+                "-O2",
+                "-c",
+                aggregate_c_file,
+                "-o",
+                aggregate_o_file,
+            ])
 
-        subprocess.check_call(args=[calcc_path, expr, "-o", expr_ll_file])
-        subprocess.check_call(args=[
+        steps.run("calcc", [calcc_path, expr, "-o", expr_ll_file] + (["--stream"] if args.stream else []) +
+                  (["--fast-fp"] if args.fast_fp else []) + [f"--scalar={s}" for s in args.scalar])
+        # fused multiply-adds need a CPU that has them, the default target does not assume one
+        steps.run("llc", [
             llc_path,
             "--filetype=obj",
             expr_ll_file,
             "-o",
             expr_o_file,
-        ])
+        ] + (["-mcpu=native"] if args.fast_fp else []))
 
         out = "a.out" if args.output is None else args.output
 
-        subprocess.check_call(args=[
+        steps.run("link", [
             clang_path,
             expr_o_file,
-            runtime_o_file,
+            *runtime_o_files,
             "-lc",
             "-lm",
+            "-lpthread",
             "-o",
             out,
         ])
+
+    if args.time_phases:
+        steps.print_table(sys.stderr)
+    if args.trace is not None:
+        steps.write_chrome_trace(args.trace)
@@ -0,0 +1,38 @@
+import os
+import sys
+import time
+import argparse
+import statistics
+import subprocess
+import pathlib
+
+this_file_dir = pathlib.Path(os.path.dirname(os.path.abspath(__file__)))
+default_binaries = [str(this_file_dir / "calci"), str(this_file_dir / "calci_static")]
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Measure cold-start time and size of calci builds.")
+    parser.add_argument("binaries", nargs="*", default=default_binaries)
+    parser.add_argument("--expr", default="1+2*3-sqrt(4)", type=str)
+    parser.add_argument("--runs", "-n", default=1000, type=int)
+    args = parser.parse_args()
+
+    for binary in args.binaries:
+        if not os.path.exists(binary):
+            sys.stderr.write(f"skip {binary}: not found\n")
+            continue
+
+        # one warm-up run so that the page cache holds the binary, as it does in a pipeline
+        subprocess.run([binary, args.expr], stdout=subprocess.DEVNULL, check=True)
+
+        samples = []
+        for _ in range(args.runs):
+            begin = time.perf_counter()
+            subprocess.run([binary, args.expr], stdout=subprocess.DEVNULL, check=True)
+            samples.append((time.perf_counter() - begin) * 1e6)
+
+        samples.sort()
+        size = os.path.getsize(binary)
+        print(f"{os.path.basename(binary)}: {size / 1024:.0f} KiB, "
+              f"mean {statistics.mean(samples):.0f} us, "
+              f"p50 {samples[len(samples) // 2]:.0f} us, "
+              f"p99 {samples[len(samples) * 99 // 100]:.0f} us")
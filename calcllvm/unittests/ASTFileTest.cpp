@@ -0,0 +1,100 @@
+#include "ASTFile.h"
+#include "Parser.h"
+
+#include "ToSExpr.h"
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using llvm::dyn_cast;
+
+namespace {
+std::unique_ptr<AST> parse(const char* text) {
+    Lexer lexer(text);
+    Parser parser(lexer);
+    return std::unique_ptr<AST>(parser.parse());
+}
+
+std::unique_ptr<ASTFile> fromString(const std::string& data) {
+    return ASTFile::fromBuffer(llvm::MemoryBuffer::getMemBuffer(data, "", /*RequiresNullTerminator=*/false));
+}
+} // namespace
+
+TEST(ASTFileTest, round_trip) {
+    std::vector<const char*> texts = {"1", "x", "-x!", "a*x^2 + b*x + c", "sqrt(x*x + y*y) % 3",
+                                      "(x + 0.1) * (x + 0.1) / x", "x < 1 || y >= 2 ? -x : y != 0 && x == y"};
+
+    std::vector<std::unique_ptr<AST>> asts;
+    ASTFileWriter writer;
+    for (size_t i = 0; i < texts.size(); i++) {
+        asts.push_back(parse(texts[i]));
+        writer.add("f" + std::to_string(i), asts.back().get());
+    }
+    std::string data;
+    llvm::raw_string_ostream os(data);
+    writer.write(os);
+    os.flush();
+
+    auto file = fromString(data);
+    ASSERT_EQ(file->size(), texts.size());
+    for (size_t i = 0; i < texts.size(); i++) {
+        EXPECT_EQ(file->getName(i), "f" + std::to_string(i));
+        auto loaded = file->load(i);
+        EXPECT_EQ(ToSExprVisitor().convert(loaded.get()), ToSExprVisitor().convert(asts[i].get())) << texts[i];
+        EXPECT_EQ(loaded->getBegin(), asts[i]->getBegin());
+        EXPECT_EQ(loaded->getEnd(), asts[i]->getEnd());
+    }
+
+    // literals come back converted, and text points into the file rather than into a copy
+    auto loaded = file->load(5);
+    auto sum = dyn_cast<BinaryOp>(dyn_cast<BinaryOp>(dyn_cast<BinaryOp>(loaded.get())->getLeft())->getLeft());
+    ASSERT_NE(sum, nullptr);
+    auto n = dyn_cast<Number>(sum->getRight());
+    ASSERT_NE(n, nullptr);
+    EXPECT_EQ(n->getType(), Number::FLOAT);
+    EXPECT_EQ(n->getFloat(), 0.1);
+    EXPECT_GE(n->getText().data(), data.data());
+    EXPECT_LT(n->getText().data(), data.data() + data.size());
+}
+
+TEST(ASTFileTest, strings_are_interned) {
+    auto once = parse("x + 1");
+    auto twice = parse("x + 1 + x + 1");
+    ASTFileWriter a, b;
+    a.add("f", once.get());
+    b.add("f", twice.get());
+    std::string da, db;
+    llvm::raw_string_ostream osa(da), osb(db);
+    a.write(osa);
+    b.write(osb);
+    osa.flush();
+    osb.flush();
+    // only the four extra nodes, no extra strings or literals
+    EXPECT_EQ(db.size() - da.size(), 4u * 16);
+}
+
+TEST(ASTFileTest, rejects_corrupt_files) {
+    auto ast = parse("x + 1");
+    ASTFileWriter writer;
+    writer.add("f", ast.get());
+    std::string data;
+    llvm::raw_string_ostream os(data);
+    writer.write(os);
+    os.flush();
+
+    EXPECT_FALSE(ASTFile::isASTFile("x + 1"));
+    EXPECT_TRUE(ASTFile::isASTFile(data));
+    EXPECT_THROW(fromString("x + 1"), std::runtime_error);
+    EXPECT_THROW(fromString(data.substr(0, data.size() - 1)), std::runtime_error);
+
+    auto badVersion = data;
+    badVersion[8] = 2;
+    EXPECT_THROW(fromString(badVersion), std::runtime_error);
+
+    // a binary op node with a single operand before it
+    auto badTree = data;
+    badTree[badTree.size() - 3 * 16] = 5;
+    EXPECT_THROW(fromString(badTree)->load(0), std::runtime_error);
+}
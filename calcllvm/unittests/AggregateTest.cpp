@@ -0,0 +1,94 @@
+#include "aggregate.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+std::vector<double> aggregate(const char* spec, const std::vector<double>& values, size_t chunk = 512,
+                              int exact = 0) {
+    calc_aggregate a;
+    EXPECT_EQ(calc_aggregate_init(&a, spec, exact), 0) << spec;
+    for (size_t begin = 0; begin < values.size(); begin += chunk) {
+        calc_aggregate_add(&a, values.data() + begin, static_cast<int64_t>(std::min(chunk, values.size() - begin)));
+    }
+    std::vector<double> result(calc_aggregate_size(&a));
+    calc_aggregate_result(&a, result.data());
+    calc_aggregate_free(&a);
+    return result;
+}
+
+double aggregate1(const char* spec, const std::vector<double>& values, size_t chunk = 512, int exact = 0) {
+    return aggregate(spec, values, chunk, exact)[0];
+}
+} // namespace
+
+TEST(AggregateTest, reductions) {
+    std::vector<double> values = {3, -1.5, 8, 0.25, 2, 7, -4, 1, 5, 0.5, 6};
+    EXPECT_EQ(aggregate1("sum", values), 27.25);
+    EXPECT_EQ(aggregate1("mean", values), 27.25 / 11);
+    EXPECT_EQ(aggregate1("min", values), -4);
+    EXPECT_EQ(aggregate1("max", values), 8);
+    EXPECT_EQ(aggregate("hist:-4:8:3", values), (std::vector<double>{2, 5, 3}));
+
+    EXPECT_EQ(aggregate1("sum", {}), 0);
+    EXPECT_TRUE(std::isnan(aggregate1("mean", {})));
+    EXPECT_TRUE(std::isnan(aggregate1("min", {})));
+}
+
+TEST(AggregateTest, nans) {
+    std::vector<double> values = {1, std::nan(""), -2, 3};
+    EXPECT_TRUE(std::isnan(aggregate1("sum", values)));
+    EXPECT_TRUE(std::isnan(aggregate1("sum", values, 512, 1)));
+    EXPECT_EQ(aggregate1("min", values), -2);
+    EXPECT_EQ(aggregate1("max", values), 3);
+    EXPECT_TRUE(std::isnan(aggregate1("max", {std::nan(""), std::nan("")})));
+    EXPECT_EQ(aggregate("hist:0:4:2", values), (std::vector<double>{1, 1}));
+    EXPECT_EQ(aggregate1("sum", {INFINITY, 1, INFINITY}, 512, 1), INFINITY);
+    EXPECT_TRUE(std::isnan(aggregate1("sum", {INFINITY, -INFINITY}, 512, 1)));
+}
+
+TEST(AggregateTest, chunking_does_not_change_the_result) {
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> dist(-1e6, 1e6);
+    std::vector<double> values(10007);
+    for (auto& v : values) {
+        v = dist(rng) * std::pow(10.0, static_cast<int>(rng() % 20) - 10);
+    }
+    for (auto spec : {"sum", "mean", "min", "max"}) {
+        double whole = aggregate1(spec, values, values.size());
+        for (size_t chunk : {1, 3, 8, 100, 512}) {
+            EXPECT_EQ(aggregate1(spec, values, chunk), whole) << spec << " " << chunk;
+        }
+    }
+}
+
+TEST(AggregateTest, exact_sums_do_not_depend_on_order) {
+    // 1e100 cancels out, a plain sum loses everything else to it
+    std::vector<double> values = {1e100, 1.0, -1e100, 1e-3, 3.0};
+    EXPECT_EQ(aggregate1("sum", values, 512, 1), 4.001);
+    EXPECT_EQ(aggregate1("sum", {0.1, 0.2, 0.3}, 512, 1), 0.6);
+
+    std::mt19937_64 rng(7);
+    std::uniform_real_distribution<double> dist(-1, 1);
+    values.assign(5000, 0);
+    for (auto& v : values) {
+        v = dist(rng) * std::pow(2.0, static_cast<int>(rng() % 80) - 40);
+    }
+    double sum = aggregate1("sum", values, 512, 1);
+    for (int i = 0; i < 5; i++) {
+        std::shuffle(values.begin(), values.end(), rng);
+        EXPECT_EQ(aggregate1("sum", values, 7, 1), sum);
+    }
+}
+
+TEST(AggregateTest, invalid_specs) {
+    calc_aggregate a;
+    for (auto spec : {"", "median", "hist", "hist:0:1", "hist:1:0:4", "hist:0:1:0", "hist:0:1:4x"}) {
+        EXPECT_EQ(calc_aggregate_init(&a, spec, 0), -1) << spec;
+        calc_aggregate_free(&a);
+    }
+}
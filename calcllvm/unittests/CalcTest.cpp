@@ -0,0 +1,216 @@
+#include "Calc.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(CalcTest, compile_and_eval) {
+#define DO_TEST(text, expected)                                                                                        \
+    [&]() {                                                                                                            \
+        calc_expr* e = nullptr;                                                                                        \
+        ASSERT_EQ(calc_compile(text, nullptr, &e), CALC_OK);                                                           \
+        double r;                                                                                                      \
+        EXPECT_EQ(calc_eval(e, nullptr, &r), CALC_OK);                                                                 \
+        EXPECT_DOUBLE_EQ(r, expected);                                                                                 \
+        calc_free(e);                                                                                                  \
+    }()
+
+    DO_TEST("1+2*3", 7.0);
+    DO_TEST("7/2", 3.0);
+    DO_TEST("7/2.0", 3.5);
+    DO_TEST("2^10", 1024.0);
+    DO_TEST("2^0", 1.0);
+    DO_TEST("0^3", 0.0);
+    DO_TEST("7%3", 1.0);
+    DO_TEST("4!", 24.0);
+    DO_TEST("-(1+2)", -3.0);
+    DO_TEST("sqrt(16)", 4.0);
+    DO_TEST("cot(1.0)", 1.0 / std::tan(1.0));
+    DO_TEST("2 < 3", 1.0);
+    DO_TEST("2 >= 3.5 || 0", 0.0);
+    DO_TEST("1 == 1.0 && 2 != 3", 1.0);
+    DO_TEST("0 ? 1 : 2", 2.0);
+    DO_TEST("1 < 2 ? 1 / 2 : 2.5", 0.0);
+    DO_TEST("0.0 / 0.0 ? 1 : 2", 1.0);
+    DO_TEST("0.0 / 0.0 == 0.0 / 0.0", 0.0);
+
+#undef DO_TEST
+}
+
+TEST(CalcTest, variables) {
+    const char* names[] = {"y", "x"};
+    calc_options opts{names, 2, 0};
+    calc_expr* e = nullptr;
+    ASSERT_EQ(calc_compile("x^2 + y", &opts, &e), CALC_OK);
+    EXPECT_EQ(calc_num_vars(e), 2u);
+    EXPECT_STREQ(calc_var_name(e, 0), "y");
+    EXPECT_STREQ(calc_var_name(e, 1), "x");
+
+    double vars[] = {0.5, 3.0};
+    double r;
+    EXPECT_EQ(calc_eval(e, vars, &r), CALC_OK);
+    EXPECT_DOUBLE_EQ(r, 9.5);
+    calc_free(e);
+
+    // without names, slots follow the order of first appearance
+    ASSERT_EQ(calc_compile("b - a + b", nullptr, &e), CALC_OK);
+    EXPECT_EQ(calc_num_vars(e), 2u);
+    EXPECT_STREQ(calc_var_name(e, 0), "b");
+    EXPECT_STREQ(calc_var_name(e, 1), "a");
+    calc_free(e);
+}
+
+TEST(CalcTest, errors) {
+    calc_expr* e = nullptr;
+    EXPECT_EQ(calc_compile("1+", nullptr, &e), CALC_ERR_PARSE);
+    EXPECT_EQ(e, nullptr);
+    EXPECT_EQ(calc_compile(nullptr, nullptr, &e), CALC_ERR_INVALID_ARGUMENT);
+
+    const char* names[] = {"x"};
+    calc_options opts{names, 1, 0};
+    EXPECT_EQ(calc_compile("x + y", &opts, &e), CALC_ERR_UNKNOWN_VARIABLE);
+
+#define DO_TEST(text)                                                                                                  \
+    [&]() {                                                                                                            \
+        ASSERT_EQ(calc_compile(text, nullptr, &e), CALC_OK);                                                           \
+        double r;                                                                                                      \
+        EXPECT_EQ(calc_eval(e, nullptr, &r), CALC_ERR_DOMAIN);                                                         \
+        EXPECT_TRUE(std::isnan(r));                                                                                    \
+        calc_free(e);                                                                                                  \
+    }()
+
+    DO_TEST("1.5 % 2");
+    DO_TEST("1 % 0");
+    DO_TEST("1 / 0");
+    DO_TEST("0 ^ 0");
+    DO_TEST("2 ^ -1");
+    DO_TEST("(0-1)!");
+    DO_TEST("1.5!");
+    // int results that do not fit in an int64
+    DO_TEST("21!");
+    DO_TEST("9223372036854775807 + 1");
+    DO_TEST("0 - 9223372036854775807 - 2");
+    DO_TEST("-(0 - 9223372036854775807 - 1)");
+    DO_TEST("4294967296 * 4294967296");
+    DO_TEST("3 ^ 41");
+    // both arms are evaluated, whichever one is taken
+    DO_TEST("1 ? 2 : 1 / 0");
+    DO_TEST("0 < 1 && 1 % 0");
+
+#undef DO_TEST
+}
+
+TEST(CalcTest, batch) {
+    calc_expr* e = nullptr;
+    ASSERT_EQ(calc_compile("10 % x", nullptr, &e), CALC_OK);
+    double vars[] = {3, 0, 4};
+    double results[3];
+    EXPECT_EQ(calc_eval_batch(e, vars, 3, results), CALC_ERR_DOMAIN);
+    EXPECT_DOUBLE_EQ(results[0], 1.0);
+    EXPECT_TRUE(std::isnan(results[1]));
+    EXPECT_DOUBLE_EQ(results[2], 2.0);
+
+    // a NaN result is not a failure, the status column tells them apart
+    double dirty[] = {3, 0, 2.5, 4, 0.0 / 0.0};
+    double out[5];
+    unsigned char statuses[5];
+    EXPECT_EQ(calc_eval_batch_status(e, dirty, 5, out, statuses), CALC_ERR_DOMAIN);
+    const unsigned char expected[] = {CALC_OK, CALC_ERR_DOMAIN, CALC_ERR_DOMAIN, CALC_OK, CALC_ERR_DOMAIN};
+    for (int r = 0; r < 5; r++) {
+        EXPECT_EQ(statuses[r], expected[r]) << r;
+    }
+    EXPECT_DOUBLE_EQ(out[3], 2.0);
+    calc_free(e);
+
+    // an integral input is an int, and so is the product that overflows
+    ASSERT_EQ(calc_compile("x * x", nullptr, &e), CALC_OK);
+    double wide[] = {4e9, 4e9 + 0.5};
+    EXPECT_EQ(calc_eval_batch(e, wide, 2, results), CALC_ERR_DOMAIN);
+    EXPECT_TRUE(std::isnan(results[0]));
+    EXPECT_DOUBLE_EQ(results[1], (4e9 + 0.5) * (4e9 + 0.5));
+    calc_free(e);
+}
+
+TEST(CalcTest, fast_fp) {
+    calc_options opts{nullptr, 0, CALC_FAST_FP};
+    struct {
+        const char* text;
+        double expected;
+    } cases[] = {{"x*x - x*x", 0.0}, {"x^3 - x^3", 0.0}, {"x*x*x - x*x*x + 1", 1.0}};
+    for (auto c : cases) {
+        auto text = c.text;
+        calc_expr* e = nullptr;
+        ASSERT_EQ(calc_compile(text, &opts, &e), CALC_OK) << text;
+
+        // an int overflow is not cancelled away, a float row still is rewritten
+        double x = 4e9;
+        double result;
+        EXPECT_EQ(calc_eval(e, &x, &result), CALC_ERR_DOMAIN) << text;
+        double vars[] = {4e9, 2.5, 3};
+        double results[3];
+        unsigned char statuses[3];
+        EXPECT_EQ(calc_eval_batch_status(e, vars, 3, results, statuses), CALC_ERR_DOMAIN) << text;
+        EXPECT_EQ(statuses[0], CALC_ERR_DOMAIN) << text;
+        EXPECT_TRUE(std::isnan(results[0])) << text;
+        EXPECT_EQ(statuses[1], CALC_OK) << text;
+        EXPECT_EQ(statuses[2], CALC_OK) << text;
+        EXPECT_DOUBLE_EQ(results[2], c.expected) << text;
+
+        const uint32_t codes[] = {1, 0, 1};
+        const double values[] = {2.5, 4e9};
+        calc_dict_column dict{values, 2, codes};
+        const double* columns[] = {nullptr};
+        EXPECT_EQ(calc_eval_columns(e, columns, &dict, 3, results, nullptr), CALC_ERR_DOMAIN) << text;
+        EXPECT_TRUE(std::isnan(results[0])) << text;
+        EXPECT_FALSE(std::isnan(results[1])) << text;
+        calc_free(e);
+    }
+}
+
+TEST(CalcTest, diagnostic) {
+    calc_expr* e = nullptr;
+    calc_diagnostic diag;
+    EXPECT_EQ(calc_compile_diag("sqrt(x + 1", nullptr, &e, &diag), CALC_ERR_PARSE);
+    EXPECT_EQ(e, nullptr);
+    EXPECT_EQ(diag.offset, 10u);
+    EXPECT_STREQ(diag.message, "expected ')'");
+
+    // a message longer than the buffer is truncated
+    auto text = "x + " + std::string(200, '9');
+    EXPECT_EQ(calc_compile_diag(text.c_str(), nullptr, &e, &diag), CALC_ERR_PARSE);
+    EXPECT_EQ(diag.offset, 4u);
+    EXPECT_EQ(std::strlen(diag.message), sizeof(diag.message) - 1);
+
+    ASSERT_EQ(calc_compile_diag("x + 1", nullptr, &e, &diag), CALC_OK);
+    calc_free(e);
+}
+
+TEST(CalcTest, concurrent_eval) {
+    calc_expr* e = nullptr;
+    ASSERT_EQ(calc_compile("x * x + 1", nullptr, &e), CALC_OK);
+
+    std::vector<std::thread> threads;
+    std::vector<int> failures(4, 0);
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < 10000; i++) {
+                double x = t * 10000 + i;
+                double r;
+                if (calc_eval(e, &x, &r) != CALC_OK || r != x * x + 1) {
+                    failures[t]++;
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (auto f : failures) {
+        EXPECT_EQ(f, 0);
+    }
+    calc_free(e);
+}
@@ -0,0 +1,79 @@
+#include "Catalog.h"
+
+#include "ToSExpr.h"
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+std::unique_ptr<ASTFile> toFile(const ASTFileWriter& writer, std::string& data) {
+    llvm::raw_string_ostream os(data);
+    writer.write(os);
+    os.flush();
+    return ASTFile::fromBuffer(llvm::MemoryBuffer::getMemBuffer(data, "", /*RequiresNullTerminator=*/false));
+}
+} // namespace
+
+// Enough lines for many chunks, some that do not parse, and the same catalog whatever the number of threads.
+TEST(CatalogTest, parallel) {
+    const char* exprs[] = {"x * 2 + 1", "sin(y) ^ 2.5", "a ? b : c % 3", "(x +", "-x! / 0.125", "1 2"};
+    std::string text;
+    std::vector<size_t> badLines;
+    size_t line = 0;
+    for (size_t i = 0; i < 30000; i++) {
+        text += "f" + std::to_string(i) + " " + exprs[i % 6] + "\n";
+        line++;
+        if (i % 6 == 3 || i % 6 == 5) {
+            badLines.push_back(line);
+        }
+        if (i % 7 == 0) {
+            text += "\n";
+            line++;
+        }
+    }
+    ASSERT_GT(text.size(), 4 * 64 * 1024u);
+
+    std::string serial;
+    ASTFileWriter serialWriter;
+    auto serialErrors = parseCatalog(text, 1, serialWriter);
+    auto file = toFile(serialWriter, serial);
+    ASSERT_EQ(file->size(), 20000u);
+    ASSERT_EQ(serialErrors.size(), 10000u);
+    for (size_t i = 0; i < serialErrors.size(); i++) {
+        ASSERT_EQ(serialErrors[i].line, badLines[i]) << i;
+    }
+    EXPECT_EQ(serialErrors[0].id, "f3");
+    EXPECT_EQ(serialErrors[0].error.message, "unexpected end of input");
+    EXPECT_EQ(serialErrors[1].id, "f5");
+
+    // names, literals and trees survive the merge of the chunks
+    EXPECT_EQ(file->getName(0), "f0");
+    EXPECT_EQ(file->getName(19999), "f29998");
+    auto last = file->load(19999);
+    EXPECT_EQ(ToSExprVisitor().convert(last.get()), ToSExprVisitor().convert(file->load(3).get()));
+
+    for (unsigned threads : {2u, 4u, 7u}) {
+        std::string parallel;
+        ASTFileWriter writer;
+        auto errors = parseCatalog(text, threads, writer);
+        toFile(writer, parallel);
+        EXPECT_EQ(parallel, serial) << threads;
+        ASSERT_EQ(errors.size(), serialErrors.size());
+        for (size_t i = 0; i < errors.size(); i++) {
+            ASSERT_EQ(errors[i].line, serialErrors[i].line) << threads;
+            ASSERT_EQ(errors[i].id, serialErrors[i].id) << threads;
+            ASSERT_EQ(errors[i].error.offset, serialErrors[i].error.offset) << threads;
+        }
+    }
+}
+
+TEST(CatalogTest, empty) {
+    ASTFileWriter writer;
+    EXPECT_TRUE(parseCatalog("", 4, writer).empty());
+    EXPECT_TRUE(parseCatalog("\n  \n", 4, writer).empty());
+    auto errors = parseCatalog("\nf (", 4, writer);
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_EQ(errors[0].line, 2u);
+    EXPECT_EQ(writer.size(), 0u);
+}
@@ -0,0 +1,94 @@
+#include "format.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include <unistd.h>
+
+namespace {
+std::string formatF(double v) {
+    char buf[CALC_FORMAT_MAX];
+    return std::string(buf, calc_format_f(buf, v));
+}
+
+std::string formatI(int64_t v) {
+    char buf[CALC_FORMAT_MAX];
+    return std::string(buf, calc_format_i(buf, v));
+}
+} // namespace
+
+TEST(FormatTest, ints) {
+    EXPECT_EQ(formatI(0), "0");
+    EXPECT_EQ(formatI(7), "7");
+    EXPECT_EQ(formatI(10), "10");
+    EXPECT_EQ(formatI(-123456789), "-123456789");
+    EXPECT_EQ(formatI(std::numeric_limits<int64_t>::max()), "9223372036854775807");
+    EXPECT_EQ(formatI(std::numeric_limits<int64_t>::min()), "-9223372036854775808");
+}
+
+TEST(FormatTest, floats) {
+    EXPECT_EQ(formatF(0.0), "0.0");
+    EXPECT_EQ(formatF(-0.0), "-0.0");
+    EXPECT_EQ(formatF(3.0), "3.0");
+    EXPECT_EQ(formatF(0.1), "0.1");
+    EXPECT_EQ(formatF(0.1 + 0.2), "0.30000000000000004");
+    EXPECT_EQ(formatF(1.0 / 3), "0.3333333333333333");
+    EXPECT_EQ(formatF(-123456.789), "-123456.789");
+    EXPECT_EQ(formatF(1e16), "10000000000000000.0");
+    EXPECT_EQ(formatF(1e17), "1e+17");
+    EXPECT_EQ(formatF(1.5e300), "1.5e+300");
+    EXPECT_EQ(formatF(1e-4), "0.0001");
+    EXPECT_EQ(formatF(1e-5), "1e-05");
+    EXPECT_EQ(formatF(5e-324), "5e-324");
+    EXPECT_EQ(formatF(std::numeric_limits<double>::max()), "1.7976931348623157e+308");
+    EXPECT_EQ(formatF(std::numeric_limits<double>::infinity()), "inf");
+    EXPECT_EQ(formatF(-std::numeric_limits<double>::infinity()), "-inf");
+    EXPECT_EQ(formatF(std::numeric_limits<double>::quiet_NaN()), "nan");
+}
+
+TEST(FormatTest, round_trip) {
+    std::mt19937_64 rng(1);
+    for (int i = 0; i < 200000; i++) {
+        uint64_t bits = rng();
+        double v;
+        std::memcpy(&v, &bits, sizeof(v));
+        if (!std::isfinite(v)) {
+            continue;
+        }
+        auto text = formatF(v);
+        ASSERT_EQ(std::strtod(text.c_str(), nullptr), v) << text;
+        // never longer than the 17 significant digits that always suffice
+        char full[CALC_FORMAT_MAX];
+        std::snprintf(full, sizeof(full), "%.16e", v);
+        ASSERT_LE(text.size(), std::strlen(full) + 2) << text;
+    }
+}
+
+TEST(FormatTest, output) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    static calc_output out;
+    calc_output_init(&out, fds[1], 0);
+    calc_output_i(&out, -42);
+    calc_output_f(&out, 2.5);
+    ASSERT_EQ(calc_output_flush(&out), 0);
+    calc_output_init(&out, fds[1], 1);
+    calc_output_f(&out, 2.5);
+    ASSERT_EQ(calc_output_flush(&out), 0);
+    close(fds[1]);
+
+    char buf[64];
+    auto n = read(fds[0], buf, sizeof(buf));
+    close(fds[0]);
+    ASSERT_EQ(n, 8 + 8);
+    EXPECT_EQ(std::string(buf, 8), "-42\n2.5\n");
+    double v;
+    std::memcpy(&v, buf + 8, sizeof(v));
+    EXPECT_EQ(v, 2.5);
+}
@@ -0,0 +1,137 @@
+#include "Gradient.h"
+#include "Parser.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+namespace {
+Program compile(const char* text) {
+    Lexer lexer(text);
+    Parser parser(lexer);
+    std::unique_ptr<AST> ast(parser.parse());
+    Program p;
+    EXPECT_EQ(Program::compile(ast.get(), {}, p), Status::OK);
+    return p;
+}
+
+/// Central differences of p with respect to every variable.
+std::vector<double> finiteDifferences(const Program& p, std::vector<double> vars) {
+    std::vector<double> grad;
+    for (size_t i = 0; i < vars.size(); i++) {
+        double x = vars[i];
+        double h = 1e-6 * std::max(1.0, std::abs(x));
+        Value hi, lo;
+        vars[i] = x + h;
+        EXPECT_EQ(p.evaluate(vars.data(), hi), Status::OK);
+        vars[i] = x - h;
+        EXPECT_EQ(p.evaluate(vars.data(), lo), Status::OK);
+        vars[i] = x;
+        grad.push_back((hi.getFloat() - lo.getFloat()) / (2 * h));
+    }
+    return grad;
+}
+} // namespace
+
+TEST(GradientTest, every_op_and_builtin) {
+    // inputs are non-integral so that variables bind as floats
+    const char* exprs[] = {
+        "x + y",
+        "x - y",
+        "x * y",
+        "x / y",
+        "x ^ y",
+        "x ^ 3",
+        "2 ^ x",
+        "-x * y",
+        "abs(x - y)",
+        "exp(x)",
+        "log2(x)",
+        "lg(x)",
+        "ln(x)",
+        "sin(x)",
+        "cos(x)",
+        "tan(x)",
+        "cot(x)",
+        "arcsin(x - 1)",
+        "arccos(x - 1)",
+        "arctan(x)",
+        "arccot(x)",
+        "sqrt(x)",
+        "sin(x * y) / (1 + exp(-x)) + sqrt(x * x + y * y) - ln(x) * arctan(y)",
+        "(x > y) * x + (x <= y || y == 0) * y",
+        "x > y ? x * y : x - y",
+        "x < y ? sin(x) : exp(y) * x",
+    };
+    std::vector<double> vars = {1.25, 0.375};
+    for (auto text : exprs) {
+        auto p = compile(text);
+        auto expected = finiteDifferences(p, std::vector<double>(vars.begin(), vars.begin() + p.getNumVars()));
+        for (auto mode : {ADMode::FORWARD, ADMode::REVERSE}) {
+            std::vector<uint32_t> wrt;
+            for (uint32_t i = 0; i < p.getNumVars(); i++) {
+                wrt.push_back(i);
+            }
+            std::vector<double> grad(wrt.size());
+            Value v, plain;
+            ASSERT_EQ(evaluateGradient(p, vars.data(), wrt, mode, v, grad.data()), Status::OK) << text;
+            ASSERT_EQ(p.evaluate(vars.data(), plain), Status::OK);
+            EXPECT_DOUBLE_EQ(v.getFloat(), plain.getFloat()) << text;
+            for (size_t i = 0; i < grad.size(); i++) {
+                EXPECT_NEAR(grad[i], expected[i], 1e-6 * std::max(1.0, std::abs(expected[i]))) << text;
+            }
+        }
+    }
+}
+
+TEST(GradientTest, select_takes_one_arm) {
+    // the arm not taken has an infinite derivative here, and must not turn the gradient into a NaN
+    auto p = compile("x > 1 ? x * y : sqrt(x - 1.25)");
+    double vars[] = {1.25, 0.375};
+    std::vector<uint32_t> wrt = {0, 1};
+    for (auto mode : {ADMode::FORWARD, ADMode::REVERSE}) {
+        double grad[2];
+        Value v;
+        ASSERT_EQ(evaluateGradient(p, vars, wrt, mode, v, grad), Status::OK);
+        EXPECT_DOUBLE_EQ(v.getFloat(), 1.25 * 0.375);
+        EXPECT_DOUBLE_EQ(grad[0], 0.375);
+        EXPECT_DOUBLE_EQ(grad[1], 1.25);
+    }
+}
+
+TEST(GradientTest, integral_inputs) {
+    // bound as floats, like the code calcc --grad generates, not as ints that would make x / 2 a step function
+    auto p = compile("x / 2 + x * y");
+    double vars[] = {3, 2};
+    std::vector<uint32_t> wrt = {0, 1};
+    for (auto mode : {ADMode::FORWARD, ADMode::REVERSE}) {
+        double grad[2];
+        Value v;
+        ASSERT_EQ(evaluateGradient(p, vars, wrt, mode, v, grad), Status::OK);
+        EXPECT_FALSE(v.isInt());
+        EXPECT_DOUBLE_EQ(v.getFloat(), 7.5);
+        EXPECT_DOUBLE_EQ(grad[0], 2.5);
+        EXPECT_DOUBLE_EQ(grad[1], 3.0);
+    }
+}
+
+TEST(GradientTest, subset_of_variables) {
+    auto p = compile("a*x^2 + b*x + c");
+    // slots: a, x, b, c
+    double vars[] = {2.5, 1.5, 0.5, 7.5};
+    uint32_t wrt[] = {1, 3};
+    for (auto mode : {ADMode::FORWARD, ADMode::REVERSE, ADMode::AUTO}) {
+        double grad[2];
+        Value v;
+        ASSERT_EQ(evaluateGradient(p, vars, wrt, mode, v, grad), Status::OK);
+        EXPECT_DOUBLE_EQ(v.getFloat(), 2.5 * 2.25 + 0.75 + 7.5);
+        EXPECT_DOUBLE_EQ(grad[0], 2 * 2.5 * 1.5 + 0.5);
+        EXPECT_DOUBLE_EQ(grad[1], 1.0);
+    }
+
+    uint32_t bad[] = {4};
+    double grad[1];
+    Value v;
+    EXPECT_EQ(evaluateGradient(p, vars, bad, ADMode::AUTO, v, grad), Status::INVALID_ARGUMENT);
+}
@@ -0,0 +1,98 @@
+#include "IncrementalEvaluator.h"
+#include "Parser.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+namespace {
+std::unique_ptr<AST> parse(const char* text) {
+    Lexer lexer(text);
+    Parser parser(lexer);
+    return std::unique_ptr<AST>(parser.parse());
+}
+} // namespace
+
+TEST(IncrementalEvaluatorTest, evaluate) {
+    auto ast = parse("a*x^2 + b*x + c");
+    IncrementalEvaluator eval(ast.get());
+    EXPECT_EQ(eval.getVarNames().size(), 4u);
+
+    Value v;
+    EXPECT_EQ(eval.evaluate(v), Status::UNKNOWN_VARIABLE);
+
+    EXPECT_TRUE(eval.setBinding("a", Value(int64_t(2))));
+    EXPECT_TRUE(eval.setBinding("b", Value(int64_t(3))));
+    EXPECT_TRUE(eval.setBinding("c", Value(int64_t(4))));
+    EXPECT_TRUE(eval.setBinding("x", Value(int64_t(5))));
+    EXPECT_FALSE(eval.setBinding("y", Value(int64_t(5))));
+    ASSERT_EQ(eval.evaluate(v), Status::OK);
+    EXPECT_EQ(v.getInt(), 2 * 25 + 3 * 5 + 4);
+
+    EXPECT_TRUE(eval.setBinding("x", Value(0.5)));
+    ASSERT_EQ(eval.evaluate(v), Status::OK);
+    EXPECT_DOUBLE_EQ(v.getFloat(), 2 * 0.25 + 3 * 0.5 + 4);
+}
+
+TEST(IncrementalEvaluatorTest, recomputes_only_dirty_path) {
+    // (+ (+ (* a (^ x 2)) (* b x)) c): 11 nodes, x is loaded twice
+    auto ast = parse("a*x^2 + b*x + c");
+    IncrementalEvaluator eval(ast.get());
+    for (auto name : {"a", "b", "c", "x"}) {
+        eval.setBinding(name, Value(int64_t(1)));
+    }
+    Value v;
+    ASSERT_EQ(eval.evaluate(v), Status::OK);
+    EXPECT_EQ(eval.getNumRecomputed(), 10u); // every node but the literal 2
+    EXPECT_EQ(eval.getNumReused(), 1u);
+
+    // c only feeds the root
+    eval.resetCounters();
+    eval.setBinding("c", Value(int64_t(7)));
+    ASSERT_EQ(eval.evaluate(v), Status::OK);
+    EXPECT_EQ(v.getInt(), 9);
+    EXPECT_EQ(eval.getNumRecomputed(), 2u); // c and the root
+    EXPECT_EQ(eval.getNumReused(), 1u);     // the a*x^2 + b*x subtree
+
+    // rebinding the same value does not dirty anything
+    eval.resetCounters();
+    eval.setBinding("c", Value(int64_t(7)));
+    ASSERT_EQ(eval.evaluate(v), Status::OK);
+    EXPECT_EQ(eval.getNumRecomputed(), 0u);
+    EXPECT_EQ(eval.getNumReused(), 1u);
+
+    // b: b, b*x, the inner sum and the root; a*x^2 and c are reused
+    eval.resetCounters();
+    eval.setBinding("b", Value(int64_t(2)));
+    ASSERT_EQ(eval.evaluate(v), Status::OK);
+    EXPECT_EQ(v.getInt(), 10);
+    EXPECT_EQ(eval.getNumRecomputed(), 4u);
+    EXPECT_EQ(eval.getNumReused(), 3u); // a*x^2, x and c
+}
+
+TEST(IncrementalEvaluatorTest, errors) {
+    auto ast = parse("10 % x");
+    IncrementalEvaluator eval(ast.get());
+    Value v;
+    eval.setBinding("x", Value(int64_t(0)));
+    EXPECT_EQ(eval.evaluate(v), Status::DOMAIN_ERROR);
+    eval.setBinding("x", Value(int64_t(4)));
+    ASSERT_EQ(eval.evaluate(v), Status::OK);
+    EXPECT_EQ(v.getInt(), 2);
+}
+
+TEST(IncrementalEvaluatorTest, conditional) {
+    auto ast = parse("x > 0 ? 10 % x : y");
+    IncrementalEvaluator eval(ast.get());
+    Value v;
+    eval.setBinding("x", Value(int64_t(4)));
+    eval.setBinding("y", Value(0.5));
+    ASSERT_EQ(eval.evaluate(v), Status::OK);
+    EXPECT_DOUBLE_EQ(v.getFloat(), 2.0);
+    eval.setBinding("x", Value(int64_t(-3)));
+    ASSERT_EQ(eval.evaluate(v), Status::OK);
+    EXPECT_DOUBLE_EQ(v.getFloat(), 0.5);
+    // the arm not taken is evaluated too
+    eval.setBinding("x", Value(int64_t(0)));
+    EXPECT_EQ(eval.evaluate(v), Status::DOMAIN_ERROR);
+}
@@ -22,6 +22,16 @@ TEST(LexerTest, one_token) {
     EXPECT_EQ_3("%", TokenKind::OP_MOD, "%");
     EXPECT_EQ_3("^", TokenKind::OP_POW, "^");
     EXPECT_EQ_3("!", TokenKind::OP_FACT, "!");
+    EXPECT_EQ_3("<", TokenKind::OP_LT, "<");
+    EXPECT_EQ_3("<=", TokenKind::OP_LE, "<=");
+    EXPECT_EQ_3(">", TokenKind::OP_GT, ">");
+    EXPECT_EQ_3(">=", TokenKind::OP_GE, ">=");
+    EXPECT_EQ_3("==", TokenKind::OP_EQ, "==");
+    EXPECT_EQ_3("!=", TokenKind::OP_NE, "!=");
+    EXPECT_EQ_3("&&", TokenKind::OP_AND, "&&");
+    EXPECT_EQ_3("||", TokenKind::OP_OR, "||");
+    EXPECT_EQ_3("?", TokenKind::QUESTION, "?");
+    EXPECT_EQ_3(":", TokenKind::COLON, ":");
 
 #undef EXPECT_EQ_3
 }
@@ -42,6 +52,11 @@ TEST(LexerTest, two_tokens) {
     EXPECT_EQ_5("*/", TokenKind::OP_MUL, "*", TokenKind::OP_DIV, "/");
     EXPECT_EQ_5("%^", TokenKind::OP_MOD, "%", TokenKind::OP_POW, "^");
     EXPECT_EQ_5("!!", TokenKind::OP_FACT, "!", TokenKind::OP_FACT, "!");
+    EXPECT_EQ_5("!!=", TokenKind::OP_FACT, "!", TokenKind::OP_NE, "!=");
+    EXPECT_EQ_5("<<=", TokenKind::OP_LT, "<", TokenKind::OP_LE, "<=");
+    EXPECT_EQ_5("a==b", TokenKind::IDENT, "a", TokenKind::OP_EQ, "==");
+    EXPECT_EQ_5("&&||", TokenKind::OP_AND, "&&", TokenKind::OP_OR, "||");
+    EXPECT_EQ_5("?:", TokenKind::QUESTION, "?", TokenKind::COLON, ":");
 
 #undef EXPECT_EQ_5
 }
@@ -85,3 +100,15 @@ TEST(LexerTest, endless) {
     EXPECT_EQ(lexer.next(), Token(TokenKind::EOI));
     EXPECT_EQ(lexer.next(), Token(TokenKind::EOI));
 }
+
+TEST(LexerTest, offsets) {
+    auto lexer = Lexer("  ab+ 1.5");
+    auto t = lexer.next();
+    EXPECT_EQ(t.offset, 2u);
+    EXPECT_EQ(t.getEndOffset(), 4u);
+    EXPECT_EQ(lexer.next().offset, 4u);
+    t = lexer.next();
+    EXPECT_EQ(t.offset, 6u);
+    EXPECT_EQ(t.getEndOffset(), 9u);
+    EXPECT_EQ(lexer.next().offset, 9u);
+}
@@ -3,6 +3,10 @@
 #include "ToSExpr.h"
 #include <gtest/gtest.h>
 
+#include <cstdint>
+#include <memory>
+#include <string>
+
 using llvm::dyn_cast;
 
 TEST(ParserTest, number) {
@@ -16,7 +20,7 @@ TEST(ParserTest, number) {
         EXPECT_NE(n, nullptr);                                                                                         \
         EXPECT_EQ(n->getKind(), AST::Kind::Number);                                                                    \
         EXPECT_EQ(n->getType(), type);                                                                                 \
-        EXPECT_EQ(n->getValue(), literal);                                                                             \
+        EXPECT_EQ(n->getText(), literal);                                                                              \
     }()
 
     DO_TEST("1", Number::INT, "1");
@@ -25,6 +29,72 @@ TEST(ParserTest, number) {
 #undef DO_TEST
 }
 
+TEST(ParserTest, number_value) {
+    auto parseInt = [](const char* text) {
+        Lexer lexer(text);
+        Parser parser(lexer);
+        std::unique_ptr<AST> e(parser.parse());
+        return dyn_cast<Number>(e.get())->getInt();
+    };
+    auto parseFloat = [](const char* text) {
+        Lexer lexer(text);
+        Parser parser(lexer);
+        std::unique_ptr<AST> e(parser.parse());
+        return dyn_cast<Number>(e.get())->getFloat();
+    };
+
+    EXPECT_EQ(parseInt("0"), 0);
+    EXPECT_EQ(parseInt("007"), 7);
+    EXPECT_EQ(parseInt("9223372036854775807"), INT64_MAX);
+    EXPECT_EQ(parseFloat("0.1"), 0.1);
+    EXPECT_EQ(parseFloat("2."), 2.0);
+    EXPECT_EQ(parseFloat("000.0625"), 0.0625);
+    EXPECT_EQ(parseFloat("9007199254740993.0"), 9007199254740992.0);
+    EXPECT_EQ(parseFloat("3.14159265358979323846264338"), 3.14159265358979323846264338);
+    EXPECT_EQ(parseFloat("0.00000000000000000000000123"), 1.23e-24);
+    EXPECT_EQ(parseFloat("123456789012345678901234567890.5"), 123456789012345678901234567890.5);
+}
+
+TEST(ParserTest, number_out_of_range) {
+    auto huge = "1" + std::string(400, '0') + ".0";
+    for (std::string text : {"9223372036854775808", "99999999999999999999999", huge.c_str()}) {
+        Lexer lexer(text);
+        Parser parser(lexer);
+        EXPECT_THROW(delete parser.parse(), std::runtime_error) << text;
+    }
+}
+
+TEST(ParserTest, errors) {
+#define DO_TEST(text, at, what)                                                                                        \
+    [&]() {                                                                                                            \
+        Lexer lexer(text);                                                                                             \
+        Parser parser(lexer);                                                                                          \
+        ParseError error;                                                                                              \
+        EXPECT_EQ(parser.parse(error), nullptr) << text;                                                               \
+        EXPECT_EQ(error.offset, at) << text;                                                                           \
+        EXPECT_EQ(error.message, what) << text;                                                                        \
+    }()
+
+    DO_TEST("1 +", 3u, "unexpected end of input");
+    DO_TEST("* 2", 0u, "expected an operand");
+    DO_TEST("(x + 1", 6u, "expected ')'");
+    DO_TEST("sin x", 4u, "expected '(' after a function name");
+    DO_TEST("a ? b c", 6u, "expected ':'");
+    DO_TEST("x y", 2u, "expected an operator");
+    DO_TEST("a = b", 2u, "unexpected character");
+    DO_TEST("2 * (1 + 9223372036854775808)", 9u, "integer literal out of range: 9223372036854775808");
+
+#undef DO_TEST
+
+    // the error is cleared by a parse that succeeds
+    Lexer lexer("x + 1");
+    Parser parser(lexer);
+    ParseError error{1, "stale"};
+    std::unique_ptr<AST> ast(parser.parse(error));
+    EXPECT_NE(ast, nullptr);
+    EXPECT_TRUE(error.message.empty());
+}
+
 TEST(ParserTest, ident) {
     auto text = "x";
     Lexer lexer(text);
@@ -118,6 +188,38 @@ TEST(ParserTest, binary_op_compound) {
 #undef DO_TEST
 }
 
+TEST(ParserTest, conditional) {
+#define DO_TEST(text, sexpr)                                                                                           \
+    [&]() {                                                                                                            \
+        Lexer lexer(text);                                                                                             \
+        Parser parser(lexer);                                                                                          \
+        std::unique_ptr<AST> e(parser.parse());                                                                        \
+        EXPECT_EQ(sexpr, ToSExprVisitor().convert(e.get()));                                                           \
+    }()
+
+    DO_TEST("x < y", "(< x y)");
+    DO_TEST("x+1 >= y*2", "(>= (+ x 1) (* y 2))");
+    DO_TEST("a < b == c > d", "(== (< a b) (> c d))");
+    DO_TEST("a == b != c", "(!= (== a b) c)");
+    DO_TEST("a || b && c", "(|| a (&& b c))");
+    DO_TEST("a && b || c && d", "(|| (&& a b) (&& c d))");
+    DO_TEST("x! != 1", "(!= (! x) 1)");
+    DO_TEST("c ? a : b", "(? c a b)");
+    DO_TEST("x > 0 && y > 0 ? x * y : 0", "(? (&& (> x 0) (> y 0)) (* x y) 0)");
+    DO_TEST("a ? b : c ? d : e", "(? a b (? c d e))");
+    DO_TEST("a ? b ? c : d : e", "(? a (? b c d) e)");
+    DO_TEST("(a ? b : c) + 1", "(+ (? a b c) 1)");
+    DO_TEST("sqrt(x > 0 ? x : -x)", "(sqrt (? (> x 0) x (- x)))");
+
+#undef DO_TEST
+
+    for (auto text : {"x <", "a ? b", "a ? b c", "a : b", "a = b", "a & b"}) {
+        Lexer lexer(text);
+        Parser parser(lexer);
+        EXPECT_THROW(delete parser.parse(), std::runtime_error) << text;
+    }
+}
+
 TEST(ParserTest, func_call) {
 #define DO_TEST(text, name, sexpr)                                                                                     \
     [&]() {                                                                                                            \
@@ -185,3 +287,26 @@ TEST(ParserTest, complex) {
 
 #undef DO_TEST
 }
+
+TEST(ParserTest, source_ranges) {
+    llvm::StringRef text = " (a + 2)*sin(x)! - -b";
+    Lexer lexer(text);
+    Parser parser(lexer);
+    std::unique_ptr<AST> e(parser.parse());
+    auto span = [&](AST* node) { return text.slice(node->getBegin(), node->getEnd()); };
+
+    auto sub = dyn_cast<BinaryOp>(e.get());
+    ASSERT_NE(sub, nullptr);
+    EXPECT_EQ(span(sub), "(a + 2)*sin(x)! - -b");
+    auto mul = dyn_cast<BinaryOp>(sub->getLeft());
+    ASSERT_NE(mul, nullptr);
+    EXPECT_EQ(span(mul), "(a + 2)*sin(x)!");
+    EXPECT_EQ(span(mul->getLeft()), "(a + 2)");
+    EXPECT_EQ(span(dyn_cast<BinaryOp>(mul->getLeft())->getRight()), "2");
+    auto fact = dyn_cast<UnaryOp>(mul->getRight());
+    ASSERT_NE(fact, nullptr);
+    EXPECT_EQ(span(fact), "sin(x)!");
+    EXPECT_EQ(span(fact->getExpr()), "sin(x)");
+    EXPECT_EQ(span(dyn_cast<FuncCall>(fact->getExpr())->getParam()), "x");
+    EXPECT_EQ(span(sub->getRight()), "-b");
+}
@@ -0,0 +1,47 @@
+#include "Parser.h"
+#include "PhaseStats.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+TEST(PhaseStatsTest, count_nodes) {
+    Lexer lexer("-a + sin(2 * b)!");
+    Parser parser(lexer);
+    std::unique_ptr<AST> ast(parser.parse());
+    EXPECT_EQ(PhaseStats::countNodes(ast.get()), 8u);
+}
+
+TEST(PhaseStatsTest, json) {
+    PhaseStats stats("test", true);
+    {
+        auto timer = stats.phase("first");
+    }
+    {
+        auto timer = stats.phase("second");
+        auto p = std::make_unique<int>(1);
+    }
+    stats.setCounter("things", "Number of things", 42);
+
+    std::string out;
+    llvm::raw_string_ostream os(out);
+    stats.print(os, PhaseStats::Format::JSON, true, true);
+    os.flush();
+
+    EXPECT_EQ(out.find("{\"tool\": \"test\", \"phases\": [{\"name\": \"first\", \"wall\": "), 0u) << out;
+    EXPECT_NE(out.find("{\"name\": \"second\""), std::string::npos) << out;
+    EXPECT_NE(out.find("\"counters\": {\"things\": 42, \"peak-rss-kb\": "), std::string::npos) << out;
+    EXPECT_EQ(out.find("\"allocations\": 0,"), std::string::npos) << out;
+}
+
+TEST(PhaseStatsTest, disabled) {
+    PhaseStats stats("test", false);
+    {
+        auto timer = stats.phase("ignored");
+    }
+
+    std::string out;
+    llvm::raw_string_ostream os(out);
+    stats.print(os, PhaseStats::Format::JSON, true, false);
+    EXPECT_EQ(os.str(), "{\"tool\": \"test\", \"phases\": []}\n");
+}
@@ -0,0 +1,104 @@
+#include "Parser.h"
+#include "Polynomial.h"
+#include "Program.h"
+
+#include "ToSExpr.h"
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <memory>
+#include <string>
+
+namespace {
+std::unique_ptr<AST> parse(const char* text) {
+    Lexer lexer(text);
+    Parser parser(lexer);
+    return std::unique_ptr<AST>(parser.parse());
+}
+} // namespace
+
+TEST(PolynomialTest, horner) {
+#define DO_TEST(text, sexpr)                                                                                           \
+    [&]() {                                                                                                            \
+        auto ast = parse(text);                                                                                        \
+        PolynomialRewriter rewriter;                                                                                   \
+        auto rewritten = rewriter.rewrite(ast.get());                                                                  \
+        EXPECT_EQ(ToSExprVisitor().convert(rewritten.get()), sexpr);                                                   \
+    }()
+
+    DO_TEST("a*x^3 + b*x^2 + c*x + d", "(+ (* (+ (* (+ (* a x) b) x) c) x) d)");
+    DO_TEST("x^2 + 2*x + 1", "(+ (* (+ x 2) x) 1)");
+    DO_TEST("2*(x^2 + x)", "(* (+ (* 2 x) 2) x)");
+    DO_TEST("2*x + 3*x - 1 + 4", "(+ (* 5 x) 3)");
+    DO_TEST("x^2*y + x*y^2", "(* (+ (* y x) (* y y)) x)");
+    // not cheaper, kept as written
+    DO_TEST("x*x + 1", "(+ (* x x) 1)");
+    DO_TEST("2*x", "(* 2 x)");
+    // a cancelled term still evaluates its variables
+    DO_TEST("x^2 - x^2 + y", "(+ (* (* 0 x) x) y)");
+    // other subtrees are rewritten on their own
+    DO_TEST("sin(x^2 + 2*x + 1) + 1", "(+ (sin (+ (* (+ x 2) x) 1)) 1)");
+    DO_TEST("(x^2 + x) / y", "(/ (* (+ x 1) x) y)");
+    DO_TEST("x^2 + x > 0 ? x^3 : -1", "(? (> (* (+ x 1) x) 0) (* (* x x) x) -1)");
+    // products of sums are not expanded, a subtree is not copied into several terms
+    DO_TEST("(x+1)*(x-1)", "(* (+ x 1) (- x 1))");
+    DO_TEST("sin(x)^3 + sin(x)", "(+ (^ (sin x) 3) (sin x))");
+    DO_TEST("sin(y)*(x^2 + x)", "(* (sin y) (* (+ x 1) x))");
+    // an int overflow of the literals, or a subtree that can be an int, keeps the polynomial as written
+    DO_TEST("3037000500*3037000500 - 3037000500*3037000500 + x",
+            "(+ (- (* 3037000500 3037000500) (* 3037000500 3037000500)) x)");
+    DO_TEST("(x > 0)*x^2 + (x > 0)*x", "(+ (* (> x 0) (^ x 2)) (* (> x 0) x))");
+
+#undef DO_TEST
+
+    // a coefficient that cannot be written as a literal keeps the polynomial as written
+    auto big = "1" + std::string(200, '0') + ".0";
+    auto text = big + "*x^2 * " + big + " + x^2";
+    auto ast = parse(text.c_str());
+    PolynomialRewriter rewriter;
+    auto rewritten = rewriter.rewrite(ast.get());
+    EXPECT_EQ(ToSExprVisitor().convert(rewritten.get()), ToSExprVisitor().convert(ast.get()));
+}
+
+TEST(PolynomialTest, same_values) {
+    const char* exprs[] = {
+        "a*x^3 + b*x^2 + c*x + d",
+        "x^6 - 3*x^4 + 2*x^3 - x + 7",
+        "x^2*y + 2*x*y^2 + 3*x + y^3",
+        "-(x - 1)^2 + 2*(x^2 + y) * 3",
+        "x^2 + 0.5*x + exp(y^2 + y)",
+        "x^2 + x % (y - y)",
+        "3037000500*3037000500 - 3037000500*3037000500 + x",
+        "(x > y)*x^2 - (x > y)*x^2 + 2*x",
+    };
+    double rows[][6] = {
+        {2, 3, 5, 7, 11, -4},
+        {0.5, -1.25, 3.5, 0.25, 2.0, 1.5},
+    };
+
+    for (auto text : exprs) {
+        auto ast = parse(text);
+        Program original;
+        ASSERT_EQ(Program::compile(ast.get(), {}, original), Status::OK);
+        std::vector<std::string> names;
+        for (size_t i = 0; i < original.getNumVars(); i++) {
+            names.push_back(original.getVarName(i));
+        }
+
+        PolynomialRewriter rewriter;
+        auto rewritten = rewriter.rewrite(ast.get());
+        Program horner;
+        ASSERT_EQ(Program::compile(rewritten.get(), names, horner), Status::OK);
+        EXPECT_LE(horner.getInsts().size(), original.getInsts().size()) << text;
+
+        for (auto row : rows) {
+            Value expected;
+            Value actual;
+            auto status = original.evaluate(row, expected);
+            EXPECT_EQ(horner.evaluate(row, actual), status) << text;
+            if (status == Status::OK) {
+                EXPECT_NEAR(actual.getFloat(), expected.getFloat(), 1e-9 * std::abs(expected.getFloat())) << text;
+            }
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#include "Parser.h"
+#include "Profile.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+using llvm::dyn_cast;
+
+namespace {
+// a + sin(b): sin dominates, the addition itself is cheap
+struct Fixture {
+    llvm::StringRef text = "a + sin(b)";
+    std::unique_ptr<AST> ast;
+    Profile profile;
+
+    Fixture() {
+        Lexer lexer(text);
+        Parser parser(lexer);
+        ast.reset(parser.parse());
+        auto add = dyn_cast<BinaryOp>(ast.get());
+        auto sin = add->getRight();
+        auto b = dyn_cast<FuncCall>(sin)->getParam();
+        profile.record(add->getLeft(), 0, 0);
+        profile.record(b, 0, 0);
+        profile.record(sin, 900, 900);
+        profile.recordBuiltin("sin", 900);
+        profile.record(add, 1000, 100);
+    }
+};
+} // namespace
+
+TEST(ProfileTest, annotated) {
+    Fixture f;
+    std::string out;
+    llvm::raw_string_ostream os(out);
+    f.profile.printAnnotated(os, f.text, f.ast.get(), /*color=*/false);
+    os.flush();
+
+    EXPECT_EQ(out.substr(0, out.find("\n\n")), "a + sin(b)\n +++#### #");
+    EXPECT_NE(out.find("   90.0%   90.0%          1  sin(b)\n"), std::string::npos) << out;
+    EXPECT_NE(out.find("   10.0%  100.0%          1  a + sin(b)\n"), std::string::npos) << out;
+    EXPECT_NE(out.find("   90.0%          1       900.0  sin\n"), std::string::npos) << out;
+}
+
+TEST(ProfileTest, collapsed_stacks) {
+    Fixture f;
+    std::string out;
+    llvm::raw_string_ostream os(out);
+    f.profile.printCollapsedStacks(os, f.text, f.ast.get());
+    EXPECT_EQ(os.str(), "a+sin(b) @0 100\n"
+                        "a+sin(b) @0;sin(b) @4 900\n");
+}
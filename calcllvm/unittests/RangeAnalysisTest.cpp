@@ -0,0 +1,102 @@
+#include "Parser.h"
+#include "RangeAnalysis.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+namespace {
+std::unique_ptr<AST> parse(const char* text) {
+    Lexer lexer(text);
+    Parser parser(lexer);
+    return std::unique_ptr<AST>(parser.parse());
+}
+} // namespace
+
+TEST(RangeAnalysisTest, ranges) {
+    RangeAnalysis::Declared declared{
+        {"i", Range{Range::INT, 0, 100}},
+        {"j", Range{Range::INT, -10, 10}},
+        {"k", Range{Range::INT, 1, 8}},
+        {"x", Range{Range::FLOAT, 0, 1}},
+    };
+
+#define DO_TEST(text, kind, min, max)                                                                                  \
+    [&]() {                                                                                                            \
+        auto ast = parse(text);                                                                                        \
+        RangeAnalysis analysis(declared);                                                                              \
+        auto r = analysis.analyze(ast.get());                                                                          \
+        EXPECT_EQ(r.kind, (kind)) << text;                                                                             \
+        EXPECT_DOUBLE_EQ(r.lo, (min)) << text;                                                                         \
+        EXPECT_DOUBLE_EQ(r.hi, (max)) << text;                                                                         \
+    }()
+
+    const double inf = std::numeric_limits<double>::infinity();
+
+    DO_TEST("1 + 2 * 3", Range::INT, 7, 7);
+    DO_TEST("i + j", Range::INT, -10, 110);
+    DO_TEST("i - j", Range::INT, -10, 110);
+    DO_TEST("i * j", Range::INT, -1000, 1000);
+    DO_TEST("-j * 2", Range::INT, -20, 20);
+    DO_TEST("i / k", Range::INT, 0, 100);
+    DO_TEST("7 / k", Range::INT, 0, 7);
+    // j may be 0, which fails, every other divisor keeps |i / j| <= |i|
+    DO_TEST("i / j", Range::INT, -100, 100);
+    DO_TEST("i % k", Range::INT, 0, 7);
+    DO_TEST("j % 3", Range::INT, -2, 2);
+    DO_TEST("k ^ 2", Range::INT, 1, 64);
+    DO_TEST("j ^ 3", Range::INT, -1000, 1000);
+    DO_TEST("k!", Range::INT, 1, 40320);
+    DO_TEST("x * 2.0 + 1", Range::FLOAT, 1, 3);
+    DO_TEST("i / 2.0", Range::FLOAT, 0, 50);
+    DO_TEST("sqrt(i)", Range::FLOAT, 0, 10);
+    DO_TEST("sin(y) * i", Range::FLOAT, -100, 100);
+    DO_TEST("abs(j)", Range::FLOAT, 0, 10);
+    DO_TEST("exp(x)", Range::FLOAT, 1, std::exp(1.0));
+    DO_TEST("i < x", Range::INT, 0, 1);
+    DO_TEST("y && j", Range::INT, 0, 1);
+    // k > 0 always holds, so only the first arm counts, its int still becomes a float
+    DO_TEST("k > 0 ? i : x", Range::FLOAT, 0, 100);
+    DO_TEST("0 ? i : k", Range::INT, 1, 8);
+    DO_TEST("j ? i : k", Range::INT, 0, 100);
+
+    // undeclared variables are unbounded and may be bound to ints or floats
+    DO_TEST("y", Range::ANY, -inf, inf);
+    DO_TEST("y % k", Range::INT, -7, 7);
+    DO_TEST("1 / y", Range::ANY, -inf, inf);
+    // beyond 2^53 an int range is no longer exact
+    DO_TEST("(i + 1) ^ 10", Range::INT, -inf, inf);
+
+#undef DO_TEST
+}
+
+TEST(RangeAnalysisTest, subexpressions) {
+    auto ast = parse("(i * 1000) / (k - 9)");
+    RangeAnalysis analysis({{"i", Range{Range::INT, 0, 100}}, {"k", Range{Range::INT, 1, 8}}});
+    auto r = analysis.analyze(ast.get());
+    EXPECT_DOUBLE_EQ(r.lo, -100000);
+    EXPECT_DOUBLE_EQ(r.hi, 0);
+    EXPECT_TRUE(r.fitsInt32());
+
+    auto div = llvm::cast<BinaryOp>(ast.get());
+    auto divisor = analysis.getRange(div->getRight());
+    EXPECT_FALSE(divisor.contains(0));
+    EXPECT_DOUBLE_EQ(divisor.lo, -8);
+    EXPECT_DOUBLE_EQ(divisor.hi, -1);
+}
+
+TEST(RangeAnalysisTest, parse_range) {
+    Range r;
+    ASSERT_TRUE(RangeAnalysis::parseRange("-5..10", r));
+    EXPECT_EQ(r.kind, Range::INT);
+    EXPECT_DOUBLE_EQ(r.lo, -5);
+    EXPECT_DOUBLE_EQ(r.hi, 10);
+
+    ASSERT_TRUE(RangeAnalysis::parseRange("0.0..1", r));
+    EXPECT_EQ(r.kind, Range::FLOAT);
+    EXPECT_DOUBLE_EQ(r.hi, 1);
+
+    EXPECT_FALSE(RangeAnalysis::parseRange("10..5", r));
+    EXPECT_FALSE(RangeAnalysis::parseRange("10", r));
+    EXPECT_FALSE(RangeAnalysis::parseRange("a..b", r));
+}
@@ -0,0 +1,96 @@
+#include "Parser.h"
+#include "Specializer.h"
+
+#include "ToSExpr.h"
+#include <gtest/gtest.h>
+
+#include <memory>
+
+namespace {
+std::unique_ptr<AST> parse(const char* text) {
+    Lexer lexer(text);
+    Parser parser(lexer);
+    return std::unique_ptr<AST>(parser.parse());
+}
+} // namespace
+
+TEST(SpecializerTest, residual) {
+#define DO_TEST(text, bindings, sexpr)                                                                                 \
+    [&]() {                                                                                                            \
+        auto ast = parse(text);                                                                                        \
+        Specializer s(ast.get());                                                                                      \
+        auto residual = s.specialize(bindings);                                                                        \
+        EXPECT_EQ(ToSExprVisitor().convert(residual.get()), sexpr);                                                    \
+    }()
+
+    Specializer::Bindings none;
+    Specializer::Bindings ab{{"a", Value(int64_t(2))}, {"b", Value(0.5)}};
+
+    DO_TEST("1+2*3", none, "7");
+    DO_TEST("x+2*3", none, "(+ x 6)");
+    DO_TEST("a*x^2 + b*x", ab, "(+ (* 2 (^ x 2)) (* 0.5 x))");
+    DO_TEST("sqrt(a*8) + x", ab, "(+ 4.0 x)");
+    DO_TEST("a - b", ab, "1.5");
+    DO_TEST("-a + x", ab, "(+ -2 x)");
+    DO_TEST("a!", ab, "2");
+    DO_TEST("(a-1)*x + x/(a-1) + x^(a-1) + (a-1.0)*x", ab, "(+ (+ (+ x x) x) (* 1.0 x))");
+    // folding would fail, so the error is left for evaluation
+    DO_TEST("x + b % 2", ab, "(+ x (% 0.5 2))");
+    DO_TEST("x + 1 / (a - 2)", ab, "(+ x (/ 1 0))");
+    DO_TEST("a > 1 ? a : b", ab, "2.0");
+    DO_TEST("a > 1 && x ? x : b", ab, "(? (&& 1 x) x 0.5)");
+    // a constant condition does not drop the other arm, which still has to be evaluated
+    DO_TEST("a > 1 ? x : 1 / (a - 2)", ab, "(? 1 x (/ 1 0))");
+
+#undef DO_TEST
+}
+
+// residual nodes map back to the source, folded literals do not
+TEST(SpecializerTest, source_ranges) {
+    auto ast = parse("sin(x) + a * 2");
+    Specializer s(ast.get());
+    auto residual = s.specialize({{"a", Value(int64_t(3))}});
+    auto sum = llvm::cast<BinaryOp>(residual.get());
+    EXPECT_EQ(sum->getBegin(), 0u);
+    EXPECT_EQ(sum->getEnd(), 14u);
+    auto call = llvm::cast<FuncCall>(sum->getLeft());
+    EXPECT_EQ(call->getBegin(), 0u);
+    EXPECT_EQ(call->getEnd(), 6u);
+    EXPECT_EQ(call->getParam()->getBegin(), 4u);
+    EXPECT_EQ(sum->getRight()->getEnd(), 0u);
+}
+
+TEST(SpecializerTest, kernel_cache) {
+    auto ast = parse("a*x^2 + exp(b)*x + c*y");
+    Specializer s(ast.get());
+
+    Program full;
+    ASSERT_EQ(Program::compile(ast.get(), {}, full), Status::OK);
+
+    Status status;
+    Specializer::Bindings coeffs{{"a", Value(int64_t(1))}, {"b", Value(int64_t(0))}, {"c", Value(int64_t(3))}};
+    auto k = s.getKernel(coeffs, status);
+    ASSERT_EQ(status, Status::OK);
+    ASSERT_NE(k, nullptr);
+    EXPECT_EQ(ToSExprVisitor().convert(k->residual.get()), "(+ (+ (^ x 2) (* 1.0 x)) (* 3 y))");
+    EXPECT_LT(k->program.getInsts().size(), full.getInsts().size());
+
+    // free variables keep their order from the original expression
+    ASSERT_EQ(k->program.getNumVars(), 2u);
+    EXPECT_EQ(k->program.getVarName(0), "x");
+    EXPECT_EQ(k->program.getVarName(1), "y");
+
+    double vars[] = {2, 5};
+    Value v;
+    ASSERT_EQ(k->program.evaluate(vars, v), Status::OK);
+    EXPECT_DOUBLE_EQ(v.getFloat(), 4 + 2 + 15);
+
+    // same binding set, plus a name the expression does not use: cache hit
+    coeffs["unused"] = Value(int64_t(9));
+    EXPECT_EQ(s.getKernel(coeffs, status), k);
+    EXPECT_EQ(s.getNumCachedKernels(), 1u);
+
+    coeffs["c"] = Value(3.0);
+    EXPECT_NE(s.getKernel(coeffs, status), k);
+    EXPECT_EQ(s.getNumCachedKernels(), 2u);
+}
@@ -21,7 +21,7 @@ public:
     }
 
     void visit(Number& e) override {
-        result << e.getValue().str();
+        result << e.getText().str();
     }
 
     void visit(UnaryOp& e) override {
@@ -45,19 +45,27 @@ public:
     }
 
     void visit(BinaryOp& e) override {
-        char c;
+        const char* c = "";
         switch (e.getOp()) {
 #define CASE(v1, v2)                                                                                                   \
     case (v1):                                                                                                         \
         c = v2;                                                                                                        \
         break
 
-            CASE(BinaryOp::PLUS, '+');
-            CASE(BinaryOp::MINUS, '-');
-            CASE(BinaryOp::MUL, '*');
-            CASE(BinaryOp::DIV, '/');
-            CASE(BinaryOp::POW, '^');
-            CASE(BinaryOp::MOD, '%');
+            CASE(BinaryOp::PLUS, "+");
+            CASE(BinaryOp::MINUS, "-");
+            CASE(BinaryOp::MUL, "*");
+            CASE(BinaryOp::DIV, "/");
+            CASE(BinaryOp::POW, "^");
+            CASE(BinaryOp::MOD, "%");
+            CASE(BinaryOp::LT, "<");
+            CASE(BinaryOp::LE, "<=");
+            CASE(BinaryOp::GT, ">");
+            CASE(BinaryOp::GE, ">=");
+            CASE(BinaryOp::EQ, "==");
+            CASE(BinaryOp::NE, "!=");
+            CASE(BinaryOp::AND, "&&");
+            CASE(BinaryOp::OR, "||");
 
 #undef CASE
         }
@@ -68,6 +76,16 @@ public:
         result << ")";
     }
 
+    void visit(Conditional& e) override {
+        result << "(? ";
+        e.getCond()->accept(*this);
+        result << " ";
+        e.getLeft()->accept(*this);
+        result << " ";
+        e.getRight()->accept(*this);
+        result << ")";
+    }
+
     void visit(FuncCall& e) override {
         result << "(" << e.getName().str() << " ";
         e.getParam()->accept(*this);
@@ -0,0 +1,156 @@
+#include "Parser.h"
+#include "VectorEvaluator.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace {
+Program compile(const char* text) {
+    Lexer lexer(text);
+    Parser parser(lexer);
+    std::unique_ptr<AST> ast(parser.parse());
+    Program p;
+    EXPECT_EQ(Program::compile(ast.get(), {"x", "y"}, p), Status::OK) << text;
+    return p;
+}
+
+bool sameBits(double a, double b) {
+    return std::memcmp(&a, &b, sizeof(a)) == 0 || (std::isnan(a) && std::isnan(b));
+}
+} // namespace
+
+// Every expression over rows mixing ints, floats, zeros and negatives, against Program::evaluate row by row.
+TEST(VectorEvaluatorTest, matches_program) {
+    const double samples[] = {0, 1, -1, 2, 3, 7, -5, 20, 0.5, -2.25, 3.75, 1e6, 1e300};
+    std::vector<double> rows;
+    // more rows than a block, and not a multiple of one, with runs of all-int and all-float rows
+    for (size_t r = 0; r < 2500; r++) {
+        double x = r < 1100 ? samples[r % 8] : (r < 1600 ? samples[8 + r % 5] : samples[r % 13]);
+        double y = samples[(r * 7 + r / 13) % 13];
+        rows.push_back(x);
+        rows.push_back(y);
+    }
+    size_t numRows = rows.size() / 2;
+
+    ColumnPool pool;
+    for (auto text : {"x + y", "x - y * 2", "x / y", "x % y", "x ^ y", "y ^ 2 - x ^ 3", "-x + 1.5", "x!",
+                      "(x + 2) % 3", "sin(x) + sqrt(y)", "2 ^ 64 + x", "x / 0", "x * 0.5 % 2", "x * y / (x - y)",
+                      "abs(-x) * arccot(y) - lg(x)", "x < y", "x >= y && y != 0", "x == y || x",
+                      "x > y ? x : y * 0.5", "x ? 1 : 2.5", "x < 1 ? x : y", "x ? y % 3 : x / y",
+                      // int overflow
+                      "x * x * x * y", "x * 9223372036854775807 + y", "-(x - 9223372036854775807 - 1)",
+                      "(x - 9223372036854775807) - y"}) {
+        auto p = compile(text);
+        std::vector<double> results(numRows);
+        VectorEvaluator eval(p, pool);
+        auto s = eval.evaluate(rows.data(), 1, 2, numRows, results.data());
+
+        auto first = Status::OK;
+        for (size_t r = 0; r < numRows; r++) {
+            Value v;
+            auto rs = p.evaluate(&rows[r * 2], v);
+            double expected = rs == Status::OK ? v.getFloat() : std::nan("");
+            ASSERT_TRUE(sameBits(results[r], expected))
+                << text << " row " << r << ": " << results[r] << " != " << expected;
+            if (first == Status::OK) {
+                first = rs;
+            }
+        }
+        EXPECT_EQ(s, first) << text;
+    }
+    // no more buffers than the deepest stack needs, plus the ones converting between representations
+    EXPECT_LE(pool.size(), 8u);
+}
+
+TEST(VectorEvaluatorTest, column_major) {
+    auto p = compile("x * 10 + y");
+    std::vector<double> vars = {1, 2, 3, 0.5, 0.25, 0.125};
+    std::vector<double> results(3);
+    ColumnPool pool;
+    VectorEvaluator eval(p, pool);
+    EXPECT_EQ(eval.evaluate(vars.data(), 3, 1, 3, results.data()), Status::OK);
+    EXPECT_EQ(results, (std::vector<double>{10.5, 20.25, 30.125}));
+}
+
+TEST(VectorEvaluatorTest, column_pointers) {
+    auto p = compile("x * 10 + y");
+    std::vector<double> y(3000, 0.5);
+    std::vector<double> x(3000);
+    for (size_t r = 0; r < x.size(); r++) {
+        x[r] = static_cast<double>(r);
+    }
+    const double* columns[] = {x.data(), y.data()};
+    std::vector<double> results(x.size());
+    ColumnPool pool;
+    VectorEvaluator eval(p, pool);
+    EXPECT_EQ(eval.evaluate(columns, x.size(), results.data()), Status::OK);
+    for (size_t r = 0; r < x.size(); r++) {
+        ASSERT_EQ(results[r], r * 10 + 0.5) << r;
+    }
+}
+
+// Dictionary-encoded x, and y plain or encoded too, against Program::evaluate on the decoded rows.
+TEST(VectorEvaluatorTest, dictionary) {
+    const std::vector<std::vector<double>> dictionaries = {
+        {0, 1, 2, 3, -4}, {0.5, -2.25, 3.75}, {0, 1, 2.5, -3, 1e300}, {7}};
+    std::vector<double> y(2500);
+    for (size_t r = 0; r < y.size(); r++) {
+        y[r] = (r * 7) % 13 - 4 + (r % 3 == 0 ? 0.5 : 0);
+    }
+    std::vector<double> yValues = {1, 0, 2.5};
+    std::vector<uint32_t> yCodes(y.size());
+    for (size_t r = 0; r < y.size(); r++) {
+        yCodes[r] = static_cast<uint32_t>(r / 7 % 3);
+    }
+
+    ColumnPool pool;
+    for (auto& values : dictionaries) {
+        std::vector<uint32_t> codes(y.size());
+        for (size_t r = 0; r < codes.size(); r++) {
+            codes[r] = static_cast<uint32_t>((r / 3 + r % 5) % values.size());
+        }
+        for (bool encodedY : {false, true}) {
+            // sizes below and above the dictionary of x, which is decoded when it has more values than rows
+            for (size_t numRows : {size_t(2500), size_t(2)}) {
+                std::vector<double> rows;
+                for (size_t r = 0; r < numRows; r++) {
+                    rows.push_back(values[codes[r]]);
+                    rows.push_back(encodedY ? yValues[yCodes[r]] : y[r]);
+                }
+                const double* columns[] = {nullptr, encodedY ? nullptr : y.data()};
+                DictColumn dicts[2];
+                dicts[0] = {values.data(), values.size(), codes.data()};
+                if (encodedY) {
+                    dicts[1] = {yValues.data(), yValues.size(), yCodes.data()};
+                }
+
+                for (auto text : {"exp(x) * 2 + y", "x % 2 + y", "1 / x * y", "x * x - y", "sin(x) + cos(y)",
+                                  "x > 0 ? sqrt(x) : y", "(x + 1) * (y - 1) + x ^ 2", "x ? y : x / 2", "y", "x!"}) {
+                    auto p = compile(text);
+                    std::vector<double> results(numRows);
+                    std::vector<uint8_t> statuses(numRows);
+                    VectorEvaluator eval(p, pool);
+                    auto s = eval.evaluate(columns, dicts, numRows, results.data(), statuses.data());
+
+                    auto first = Status::OK;
+                    for (size_t r = 0; r < numRows; r++) {
+                        Value v;
+                        auto rs = p.evaluate(&rows[r * 2], v);
+                        double expected = rs == Status::OK ? v.getFloat() : std::nan("");
+                        ASSERT_TRUE(sameBits(results[r], expected))
+                            << text << " row " << r << ": " << results[r] << " != " << expected;
+                        ASSERT_EQ(statuses[r], static_cast<uint8_t>(rs)) << text << " row " << r;
+                        if (first == Status::OK) {
+                            first = rs;
+                        }
+                    }
+                    EXPECT_EQ(s, first) << text;
+                }
+            }
+        }
+    }
+}